@@ -48,6 +48,21 @@
 
 #define SET_PATH_EXEC_MAILOUT	"/usr/sbin/sendmail"
 
+#define SET_DOORBELL_NAME	"thwonk.doorbell"	// Abstract unix socket name that queue bosses listen on for
+							//  new work, queue type and doorbell number are appended
+#define SET_CLAIM_LOCK_NAME	"thwonk.claim"		// Database lock taken by sharded bosses while claiming, queue
+							//  type is appended
+
+#define SET_QUEUE_LOG_DIR	"/var/spool/thwonk/queue"	// Where the log queue backend keeps its segment files, opened
+								//  before the chroot so a path outside the jails, handed to
+								//  SET_JAIL_RUNASUSER when a daemon starts as root
+
+#define SET_ARG_BACKFILL_ARCHIVE	"--backfill-archive"	// Cmd line option for msgdelivery to archive all DONE
+								//  queue entries and exit, for upgrading existing installs
+#define SET_ARG_PROFILE_TOP		"--profile-top"		// Cmd line option for rulerunner to print the most expensive
+								//  voids and natives from rule profiles and exit, may be
+								//  followed by how many of each
+
 #define MAX_LENGTH_TEXT_STRING	10000
 #define MAX_LENGTH_DB_QUERY	100000
 #define MAX_LENGTH_MAIL_STDIN	45000
@@ -55,16 +70,96 @@
 #define MAX_LENGTH_CODE_JAVASCRIPT	100000
 #define MAX_LENGTH_FILEPATH    499
 
+#define MAX_NUM_DOORBELLS		8	// Max number of bosses that can listen for rings on one queue
+
+/* Sleep settings are the safety poll, bosses are normally woken early by a doorbell ring */
 #define MAX_NUM_OUTQUEUE_THREADS	10
-#define MAX_OUTQUEUE_SLEEP_SEC		1 //0//1 //0
-#define MAX_OUTQUEUE_SLEEP_NSEC		0 // 100000000
+#define MIN_NUM_OUTQUEUE_THREADS	2
+#define MAX_OUTQUEUE_SLEEP_SEC		5
+#define MAX_OUTQUEUE_SLEEP_NSEC		0
 
 #define MAX_NUM_RULERUNNER_THREADS	5
-#define MAX_RULERUNNER_SLEEP_SEC	0 //0//1 //0
-#define MAX_RULERUNNER_SLEEP_NSEC	100 // 100000000
+#define MIN_NUM_RULERUNNER_THREADS	1
+#define MAX_RULERUNNER_SLEEP_SEC	5
+#define MAX_RULERUNNER_SLEEP_NSEC	0
+
+/* Adaptive concurrency, bosses run between the min and max number of threads above */
+#define QUEUE_ADAPT_SEC			5	// Secs between decisions on how many threads to run
+#define QUEUE_ADAPT_MAX_LOAD		1.0	// 1 min load average per CPU above which threads are cut
+#define QUEUE_ADAPT_DB_SLOW_MSEC	250	// Claim query time above which the database is taken as overloaded
+#define QUEUE_ADAPT_LATENCY_RISE	2.0	// Times the usual per entry time at which threads are cut
+
+/* Prefork worker pools, number of jobs each pooled worker does before it's replaced. 0 = fork per message */
+#define MAX_OUTQUEUE_POOL_JOBS		0
+#define MAX_RULERUNNER_POOL_JOBS	0
+
+/* Queue tracks, weight is a track's share of worker slots when busy, reserved slots are kept for a track with work waiting */
+#define QUEUE_TRACK_SYSTEM_WEIGHT	4
+#define QUEUE_TRACK_SYSTEM_RESERVED	1
+#define QUEUE_TRACK_NORMAL_WEIGHT	2
+#define QUEUE_TRACK_NORMAL_RESERVED	1
+#define QUEUE_TRACK_BULK_WEIGHT		1
+#define QUEUE_TRACK_BULK_RESERVED	0
+
+#define QUEUE_VOID_QUANTUM		2	// Entries a void may run in a row before the next void in its track gets a turn
+
+/* Leases on queue entries a boss is holding, renewed every third of the lease while the boss lives */
+#define QUEUE_LEASE_SEC			60
+#define QUEUE_LEASE_MAX_ATTEMPTS	3	// Claims of an entry before it's set aside as POISON
+
+#define QUEUE_TIMER_HORIZON_SEC		300	// Entries due to be processed within this many secs are claimed
+						//  early and held on the boss's timer, later ones stay in the table
+
+/* Retrying outgoing mail that failed for now, the delay doubles each time from base up to max */
+#define QUEUE_RETRY_BASE_SEC		60
+#define QUEUE_RETRY_MAX_SEC		14400
+#define QUEUE_RETRY_MAX_FAILURES	8	// Failures before an entry is given up on as DEAD
+
+/* Archiving of DONE queue entries by the queue bosses, batch of 0 = don't archive */
+#define QUEUE_ARCHIVE_BATCH		500	// Max entries moved to the archive in one go
+#define QUEUE_ARCHIVE_SEC		60	// Secs between archive runs while there's little to archive
+
+/* Backpressure from the outgoing queue, pending outgoing entries a void or all voids may have before
+ *  their incoming mail is held back. 0 = no mark */
+#define QUEUE_OUT_VOID_HIGH_WATER	2000
+#define QUEUE_OUT_GLOBAL_HIGH_WATER	50000
+#define QUEUE_OUT_VOID_HARD_CAP		50000	// Pending outgoing entries a void may have before a rule is told to
+						//  try again later, only a runaway rule gets near it. 0 = no cap
+#define QUEUE_OUT_RECOUNT_SEC		10	// Secs a rule runner worker counts a void's mail itself before
+						//  asking the database again (see isQueueOutFull())
+
+/* Where queues are kept, 0 = MySQL message_queue table, 1 = local append only log (see qlog.c) */
+#define QUEUE_BACKEND			0
+
+/* Dropping repeats of incoming mail, secs a message's key is remembered per void. 0 = off */
+#define MAIL_DEDUP_SEC			86400
+#define MAIL_DEDUP_PRUNE_BATCH		100	// Max expired keys of a void removed each time a new key is added
+
+/* Sharding a queue between several daemons by void (incoming) or recipient (outgoing), 1 = on */
+#define QUEUE_SHARD_RULERUNNER		1
+#define QUEUE_SHARD_OUTQUEUE		1
 
 #define SPIDERMONKEY_ALLOC_RAM		16L * 1024L * 1024L	// How much memory to allocated to each SpiderMonkey runtime
 								//  see RES_RR_MAX_RAM
+#define SPIDERMONKEY_REUSE_RUNTIME	1	// 1 = a rule runner worker keeps one SpiderMonkey runtime for
+						//  all the rules it runs, 0 = a new runtime for every rule
+#define JS_CACHE_MAX_BYTES		4L * 1024L * 1024L	// Most compiled logic a rule runner worker holds (see jscache.c)
+#define JS_CACHE_CHECK_SEC		10	// Secs a worker runs a void's held logic before checking it's current
+#define JS_MODULE_CACHE_MAX_BYTES	1L * 1024L * 1024L	// Most compiled modules a rule runner worker holds (see jsmodule.c)
+#define JS_MAX_CPU_MSEC			400	// Most CPU millisecs a rule may use, logic can set less (see jsbudget.c)
+							//  !!! NOTE: Keep under half of RES_RR_MAX_CPU_TIME !!!
+#define JS_MAX_WALL_MSEC		2000	// Most millisecs a rule may take, logic can set less
+#define JS_MAX_HEAP_BYTES		8L * 1024L * 1024L	// Most GC heap a rule may grow by, logic can set less
+								//  !!! NOTE: Keep under SPIDERMONKEY_ALLOC_RAM !!!
+#define JS_BUDGET_TICK_MSEC		10	// How often a running rule is checked against its budget
+#define JS_PROFILE_SAMPLE		20	// 1 in this many rule runs is profiled (see jsprofile.c), 0 = off
+#define JS_PROFILE_BATCH		20	// Profiled runs a rule runner worker keeps before writing them
+#define JS_PROFILE_KEEP_DAYS		7	// Days profiles are kept, 0 = for ever
+#define JS_PROFILE_PRUNE_BATCH		1000	// Max expired profiles removed each time a batch is written
+#define JS_PROFILE_TOP			10	// Voids and natives listed by --profile-top, unless given
+#define JS_PROFILE_TOP_HOURS		24	// Hours of profiles --profile-top looks at
+#define JS_ENGINE_OPTIONS		1	// Engine options of logic that doesn't set its own, 1 = tracing JIT,
+					//  2 = method JIT, 4 = profiling, 8 = strict (see jsoptions.h)
 
 /* The max settings for rulerunner */
 #define RES_RR_MAX_RAM			67108864	// Max ram in bytes this process can consume before it is killed
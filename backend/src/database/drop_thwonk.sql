@@ -7,8 +7,13 @@
 DROP TABLE vfile_rights;
 DROP TABLE vfile;
 DROP TABLE logic_rights;
+DROP TABLE logic_profile_native;
+DROP TABLE logic_profile;
 DROP TABLE logic;
+DROP TABLE queue_node;
+DROP TABLE message_queue_archive;
 DROP TABLE message_queue;
+DROP TABLE message_dedup;
 DROP TABLE message_protocol_mail;
 DROP TABLE message;
 DROP TABLE filter_user;
@@ -170,6 +170,21 @@ CREATE TABLE message_protocol_mail (
 ) type=InnoDB;
 
 
+/*
+ * Recently seen incoming messages per void, so a message that arrives twice
+ *  (MTA retry, or sent to a list alias and a direct address) is queued once
+*/
+CREATE TABLE message_dedup (
+	voidId		BIGINT UNSIGNED NOT NULL,	# Void the message was sent to
+	dedupKey	BIGINT UNSIGNED NOT NULL,	# Hash of the Message-ID, or of the sender and body
+							#  when there's no Message-ID (see mngmail.c)
+	arrived		DATETIME NOT NULL,		# Date & Time a message with this key was last queued
+
+	PRIMARY KEY(voidId, dedupKey),
+	INDEX(voidId, arrived)
+) type=InnoDB;
+
+
 /*
  * Queue for managing messages
 */
@@ -187,6 +202,19 @@ CREATE TABLE message_queue (
 	voidId		BIGINT UNSIGNED NOT NULL,	# Void id this message is destinated for or from
 	track		INT,				# Can be used for maintaining different priority queues
 	processDate	DATETIME,			# Date & Time this queue item was last acted upon
+	claimToken	VARCHAR(100),			# Token of the boss claim that moved this entry to
+							#  processing (host.pid.claim number)
+	claimOwner	VARCHAR(100),			# Boss holding this entry while processing (host.pid)
+	leaseExpiry	DATETIME,			# When the boss's hold on this entry runs out unless
+							#  renewed, after that it's put back on the queue
+	attempts	INT UNSIGNED NOT NULL DEFAULT 0,	# Number of times this entry has been claimed
+	shardKey	SMALLINT UNSIGNED,		# Hash bucket of voidId, or of userId for EMAILOUT,
+							#  sharded bosses claim a range of buckets (see qshard.c)
+	notBefore	DATETIME NOT NULL,		# Date & Time before which this entry isn't processed,
+							#  time inserted unless scheduled for later
+	failures	INT UNSIGNED NOT NULL DEFAULT 0,	# Number of times processing failed, outgoing mail
+							#  that failed for now is retried with a backoff
+	lastError	VARCHAR(255),			# Why processing last failed, or why the entry is DEAD
 
 	FOREIGN KEY(messageId) REFERENCES message(id),
 	FOREIGN KEY(userId) REFERENCES user(id),
@@ -195,10 +223,61 @@ CREATE TABLE message_queue (
 	INDEX(voidId),
 	INDEX(queueState),
 	INDEX(messageType),
-	INDEX(track)
+	INDEX(track),
+	INDEX(claimToken),
+	INDEX(claimOwner),
+	INDEX(queueState, leaseExpiry),
+	INDEX(messageType, queueState, track, shardKey),
+	INDEX(messageType, queueState, track, notBefore),
+	INDEX(messageType, queueState, voidId)
+) type=InnoDB;
+
+
+/*
+ * Queue bosses sharing out a message queue between them, each heartbeats
+ *  here and owns a range of shard buckets by its place in the list
+*/
+CREATE TABLE queue_node (
+	id		BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,	# Order nodes joined in
+	nodeName	VARCHAR(100) NOT NULL,		# Boss of the node (host.pid)
+	messageType	INT UNSIGNED NOT NULL,		# Queue the node processes
+	heartbeat	DATETIME NOT NULL,		# Date & Time the node last checked in
+	moved		DATETIME NOT NULL,		# Date & Time the node last moved the ranges, by joining or dropping dead nodes
+
+	UNIQUE(nodeName, messageType),
+	INDEX(messageType, heartbeat)
 ) type=InnoDB;
 
 
+/*
+ * Archive of finished queue entries, moved out of message_queue so it only
+ *  holds work in flight. Partitioned by the day the entry was done, a
+ *  partition for each day is added by the queue bosses (see qarchive.c)
+*/
+CREATE TABLE message_queue_archive (
+	id		BIGINT UNSIGNED NOT NULL,	# Id the entry had in message_queue
+	messageId	BIGINT UNSIGNED NOT NULL,	# Message id for this queue entry
+	messageType	INT UNSIGNED NOT NULL,		# See message.messageType for details
+	queueState	INT UNSIGNED,			# State of the entry when archived
+	userId		BIGINT UNSIGNED,		# See message_queue.userId
+	voidId		BIGINT UNSIGNED NOT NULL,	# Void id this message was destinated for or from
+	track		INT,				# Track the entry was processed on
+	claimOwner	VARCHAR(100),			# Boss that processed the entry (host.pid)
+	attempts	INT UNSIGNED NOT NULL DEFAULT 0,	# Number of times the entry was claimed
+	failures	INT UNSIGNED NOT NULL DEFAULT 0,	# Number of times processing failed before it was done
+	doneDate	DATETIME NOT NULL,		# Date & Time the entry was done
+	archiveDate	DATETIME NOT NULL,		# Date & Time the entry was moved here
+
+	PRIMARY KEY(id, doneDate),
+
+	INDEX(messageId),
+	INDEX(voidId)
+) type=InnoDB
+PARTITION BY RANGE (TO_DAYS(doneDate)) (
+	PARTITION pfuture VALUES LESS THAN MAXVALUE
+);
+
+
 /*
  * Scripts / programs to implement rules, etc
 */
@@ -211,7 +290,65 @@ CREATE TABLE logic (
 	editDate	DATETIME,			# Date & Time this script was last edited
 	language	INT UNSIGNED,			# Language logic is written in (1 = Javascript)
 	logic		VARCHAR(100000),		# Logic (script)
-	logicCache	VARCHAR(100000)			# Compiled version of logic (if possible)
+	logicCache	MEDIUMBLOB,			# Compiled version of logic (if possible), SpiderMonkey
+							#  XDR bytecode for Javascript
+	logicCacheKey	VARCHAR(100),			# Engine and logic version logicCache was compiled from,
+							#  logicCache is stale if it doesn't match (see jsrunner.c)
+	concurrency	INT UNSIGNED NOT NULL DEFAULT 1,	# Max copies of the script run at once for a void, only
+							#  more than 1 for scripts that keep no state (e.g. vfiles)
+	batchSize	INT UNSIGNED NOT NULL DEFAULT 1,	# Max messages handed to one run of the script, only more
+							#  than 1 for scripts that use Thwonk.message.next()
+	maxCpuMsec	INT UNSIGNED NOT NULL DEFAULT 0,	# CPU millisecs a run of the script may use, 0 = server's
+							#  max (see jsbudget.c)
+	maxWallMsec	INT UNSIGNED NOT NULL DEFAULT 0,	# Millisecs a run of the script may take, 0 = server's max
+	maxHeapBytes	BIGINT UNSIGNED NOT NULL DEFAULT 0,	# GC heap a run of the script may grow by, 0 = server's max
+	peakHeapBytes	BIGINT UNSIGNED NOT NULL DEFAULT 0,	# Most GC heap a run of the script has been seen to grow by
+	engineOptions	INT UNSIGNED NOT NULL DEFAULT 0	# SpiderMonkey options the script runs with, 0 = server's,
+							#  1 = tracing JIT, 2 = method JIT, 4 = profiling, 8 = strict,
+							#  16 = no JIT (see jsoptions.h, pick with make bench)
+) type=InnoDB;
+
+
+/*
+ * Profiles of a sample of rule runs, one row per run (see jsprofile.c).
+ *  Rolled up with rulerunner --profile-top, rows older than a few days
+ *  are removed as new ones are written
+*/
+CREATE TABLE logic_profile (
+	voidId		BIGINT UNSIGNED NOT NULL,	# Void the rule ran for
+	logicId		BIGINT UNSIGNED NOT NULL,	# Logic that was run, 0 = none found
+	runDate		DATETIME NOT NULL,		# Date & Time the run finished
+	source		TINYINT UNSIGNED NOT NULL,	# Where the script came from, 0 = compiled from source,
+							#  1 = logic.logicCache, 2 = held by the worker
+	result		SMALLINT UNSIGNED NOT NULL,	# What the run returned, 0 = ok otherwise its ERRTYPE (see logerror.h)
+	setupUsec	INT UNSIGNED NOT NULL,		# Microsecs setting up the context and Thwonk object
+	lookupUsec	INT UNSIGNED NOT NULL,		# Microsecs finding the void's logic
+	compileUsec	INT UNSIGNED NOT NULL,		# Microsecs compiling, or loading bytecode
+	executeUsec	INT UNSIGNED NOT NULL,		# Microsecs running the script, natives included
+	nativeUsec	INT UNSIGNED NOT NULL,		# Microsecs of executeUsec inside Thwonk.* natives
+	nativeCalls	INT UNSIGNED NOT NULL,		# Calls of Thwonk.* natives
+	dbQueries	INT UNSIGNED NOT NULL,		# Database queries the run issued
+	fileRead	INT UNSIGNED NOT NULL,		# Bytes read through Thwonk.file
+	fileWritten	INT UNSIGNED NOT NULL,		# Bytes written through Thwonk.file
+
+	INDEX(runDate),
+	INDEX(voidId, runDate)
+) type=InnoDB;
+
+
+/*
+ * Time profiled rule runs spent in each Thwonk.* native, one row per
+ *  native a run called
+*/
+CREATE TABLE logic_profile_native (
+	voidId		BIGINT UNSIGNED NOT NULL,	# Void the rule ran for
+	runDate		DATETIME NOT NULL,		# Date & Time the run finished
+	native		TINYINT UNSIGNED NOT NULL,	# Which native, JS_PROFILE_NATIVE_* (see jsprofile.h)
+	calls		INT UNSIGNED NOT NULL,		# Times the run called it
+	usec		INT UNSIGNED NOT NULL,		# Microsecs the run spent inside it
+
+	INDEX(runDate),
+	INDEX(native, runDate)
 ) type=InnoDB;
 
 
@@ -242,9 +379,14 @@ CREATE TABLE logic_rights (
 CREATE TABLE vfile (
 	id		BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,	# Unique id for file
 	fileType	INT UNSIGNED,			# File type (reserved for now)
+	version		INT UNSIGNED NOT NULL DEFAULT 1,	# Times the file has been written
 	editDate	DATETIME,			# Date & Time the file was last edited
 	name		VARCHAR(500) NOT NULL,		# File name including full path
-	content		BLOB				# File content
+	content		BLOB,				# File content
+	moduleCache	MEDIUMBLOB,			# Content compiled as a module for Thwonk.require(),
+							#  SpiderMonkey XDR bytecode
+	moduleCacheKey	VARCHAR(100)			# Engine and file version moduleCache was compiled from,
+							#  moduleCache is stale if it doesn't match (see jsmodule.c)
 
 ) type=InnoDB;
 
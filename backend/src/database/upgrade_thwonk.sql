@@ -0,0 +1,196 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: SQL for upgrading an existing thwonk database to the current
+ *  table design in thwonk.sql. Run the sections after the version of
+ *  the database being upgraded, in order.
+*/
+
+
+/*
+ * Batch claiming of queue entries by bosses
+*/
+ALTER TABLE message_queue ADD COLUMN claimToken VARCHAR(100) AFTER processDate;
+ALTER TABLE message_queue ADD INDEX(claimToken);
+
+
+/*
+ * Leases on queue entries being processed, so entries of a boss that dies
+ *  go back on the queue
+*/
+ALTER TABLE message_queue ADD COLUMN claimOwner VARCHAR(100) AFTER claimToken;
+ALTER TABLE message_queue ADD COLUMN leaseExpiry DATETIME AFTER claimOwner;
+ALTER TABLE message_queue ADD COLUMN attempts INT UNSIGNED NOT NULL DEFAULT 0 AFTER leaseExpiry;
+ALTER TABLE message_queue ADD INDEX(claimOwner);
+ALTER TABLE message_queue ADD INDEX(queueState, leaseExpiry);
+
+
+/*
+ * Archive of finished queue entries. Once created run msgdelivery once with
+ *  --backfill-archive to move the DONE entries already in message_queue
+*/
+CREATE TABLE message_queue_archive (
+	id		BIGINT UNSIGNED NOT NULL,
+	messageId	BIGINT UNSIGNED NOT NULL,
+	messageType	INT UNSIGNED NOT NULL,
+	queueState	INT UNSIGNED,
+	userId		BIGINT UNSIGNED,
+	voidId		BIGINT UNSIGNED NOT NULL,
+	track		INT,
+	claimOwner	VARCHAR(100),
+	attempts	INT UNSIGNED NOT NULL DEFAULT 0,
+	doneDate	DATETIME NOT NULL,
+	archiveDate	DATETIME NOT NULL,
+
+	PRIMARY KEY(id, doneDate),
+
+	INDEX(messageId),
+	INDEX(voidId)
+) type=InnoDB
+PARTITION BY RANGE (TO_DAYS(doneDate)) (
+	PARTITION pfuture VALUES LESS THAN MAXVALUE
+);
+
+
+/*
+ * Sharding queues between several bosses, existing entries get their shard
+ *  key worked out the same way as getQueueShardKey() does
+*/
+ALTER TABLE message_queue ADD COLUMN shardKey SMALLINT UNSIGNED AFTER attempts;
+ALTER TABLE message_queue ADD INDEX(messageType, queueState, track, shardKey);
+UPDATE message_queue SET shardKey = ((IF(messageType = 4, userId, voidId) * 2654435761) % 4294967296) DIV 4194304;
+
+CREATE TABLE queue_node (
+	id		BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,
+	nodeName	VARCHAR(100) NOT NULL,
+	messageType	INT UNSIGNED NOT NULL,
+	heartbeat	DATETIME NOT NULL,
+	moved		DATETIME NOT NULL,
+
+	UNIQUE(nodeName, messageType),
+	INDEX(messageType, heartbeat)
+) type=InnoDB;
+
+
+/*
+ * Scheduled queue entries, existing entries are due from when they were
+ *  last acted upon
+*/
+ALTER TABLE message_queue ADD COLUMN notBefore DATETIME NOT NULL AFTER shardKey;
+UPDATE message_queue SET notBefore = IFNULL(processDate, now());
+ALTER TABLE message_queue ADD INDEX(messageType, queueState, track, notBefore);
+
+
+/*
+ * Retrying outgoing mail that failed for now, entries that fail for good
+ *  are left DEAD (queueState 5) with the reason in lastError
+*/
+ALTER TABLE message_queue ADD COLUMN failures INT UNSIGNED NOT NULL DEFAULT 0 AFTER notBefore;
+ALTER TABLE message_queue ADD COLUMN lastError VARCHAR(255) AFTER failures;
+ALTER TABLE message_queue_archive ADD COLUMN failures INT UNSIGNED NOT NULL DEFAULT 0 AFTER attempts;
+
+
+/*
+ * Backpressure from the outgoing queue, counting pending outgoing entries
+ *  per void
+*/
+ALTER TABLE message_queue ADD INDEX(messageType, queueState, voidId);
+
+
+/*
+ * Logic that keeps no state between runs can be run several at once for
+ *  a void, existing logic stays one at a time
+*/
+ALTER TABLE logic ADD COLUMN concurrency INT UNSIGNED NOT NULL DEFAULT 1 AFTER logicCache;
+
+
+/*
+ * Dropping repeats of incoming messages by Message-ID
+*/
+CREATE TABLE message_dedup (
+	voidId		BIGINT UNSIGNED NOT NULL,	# Void the message was sent to
+	dedupKey	BIGINT UNSIGNED NOT NULL,	# Hash of the Message-ID, or of the sender and body
+	arrived		DATETIME NOT NULL,		# Date & Time a message with this key was last queued
+
+	PRIMARY KEY(voidId, dedupKey),
+	INDEX(voidId, arrived)
+) type=InnoDB;
+
+
+/*
+ * Compiled logic cached as bytecode, existing caches were never filled
+*/
+ALTER TABLE logic MODIFY COLUMN logicCache MEDIUMBLOB;
+ALTER TABLE logic ADD COLUMN logicCacheKey VARCHAR(100) AFTER logicCache;
+
+
+/*
+ * Per logic budgets of CPU and run time, existing logic gets the server's max
+*/
+ALTER TABLE logic ADD COLUMN maxCpuMsec INT UNSIGNED NOT NULL DEFAULT 0 AFTER concurrency;
+ALTER TABLE logic ADD COLUMN maxWallMsec INT UNSIGNED NOT NULL DEFAULT 0 AFTER maxCpuMsec;
+
+
+/*
+ * Per logic heap budget, and the most heap the logic has been seen to use
+*/
+ALTER TABLE logic ADD COLUMN maxHeapBytes BIGINT UNSIGNED NOT NULL DEFAULT 0 AFTER maxWallMsec;
+ALTER TABLE logic ADD COLUMN peakHeapBytes BIGINT UNSIGNED NOT NULL DEFAULT 0 AFTER maxHeapBytes;
+
+
+/*
+ * Logic that goes through every message of its run can be handed a batch
+ *  of a void's messages at once, existing logic gets one at a time
+*/
+ALTER TABLE logic ADD COLUMN batchSize INT UNSIGNED NOT NULL DEFAULT 1 AFTER concurrency;
+
+
+/*
+ * Per logic SpiderMonkey engine options, existing logic gets the server's
+*/
+ALTER TABLE logic ADD COLUMN engineOptions INT UNSIGNED NOT NULL DEFAULT 0 AFTER peakHeapBytes;
+
+
+/*
+ * Profiles of a sample of rule runs, and the natives they called
+*/
+CREATE TABLE logic_profile (
+	voidId		BIGINT UNSIGNED NOT NULL,	# Void the rule ran for
+	logicId		BIGINT UNSIGNED NOT NULL,	# Logic that was run, 0 = none found
+	runDate		DATETIME NOT NULL,		# Date & Time the run finished
+	source		TINYINT UNSIGNED NOT NULL,	# Where the script came from, 0 = compiled from source,
+							#  1 = logic.logicCache, 2 = held by the worker
+	result		SMALLINT UNSIGNED NOT NULL,	# What the run returned, 0 = ok otherwise its ERRTYPE (see logerror.h)
+	setupUsec	INT UNSIGNED NOT NULL,		# Microsecs setting up the context and Thwonk object
+	lookupUsec	INT UNSIGNED NOT NULL,		# Microsecs finding the void's logic
+	compileUsec	INT UNSIGNED NOT NULL,		# Microsecs compiling, or loading bytecode
+	executeUsec	INT UNSIGNED NOT NULL,		# Microsecs running the script, natives included
+	nativeUsec	INT UNSIGNED NOT NULL,		# Microsecs of executeUsec inside Thwonk.* natives
+	nativeCalls	INT UNSIGNED NOT NULL,		# Calls of Thwonk.* natives
+	dbQueries	INT UNSIGNED NOT NULL,		# Database queries the run issued
+	fileRead	INT UNSIGNED NOT NULL,		# Bytes read through Thwonk.file
+	fileWritten	INT UNSIGNED NOT NULL,		# Bytes written through Thwonk.file
+
+	INDEX(runDate),
+	INDEX(voidId, runDate)
+) type=InnoDB;
+
+CREATE TABLE logic_profile_native (
+	voidId		BIGINT UNSIGNED NOT NULL,	# Void the rule ran for
+	runDate		DATETIME NOT NULL,		# Date & Time the run finished
+	native		TINYINT UNSIGNED NOT NULL,	# Which native, JS_PROFILE_NATIVE_* (see jsprofile.h)
+	calls		INT UNSIGNED NOT NULL,		# Times the run called it
+	usec		INT UNSIGNED NOT NULL,		# Microsecs the run spent inside it
+
+	INDEX(runDate),
+	INDEX(native, runDate)
+) type=InnoDB;
+
+
+/*
+ * Files loaded as modules by Thwonk.require(), keeping the compiled module
+ *  with the file and a version to tell when it's stale
+*/
+ALTER TABLE vfile ADD COLUMN version INT UNSIGNED NOT NULL DEFAULT 1 AFTER fileType;
+ALTER TABLE vfile ADD COLUMN moduleCache MEDIUMBLOB AFTER content;
+ALTER TABLE vfile ADD COLUMN moduleCacheKey VARCHAR(100) AFTER moduleCache;
@@ -15,6 +15,9 @@
 #include "logerror.h"
 #include "dbchatter.h"
 
+/* Queries performed through this process's connections, see dbQueryCount() */
+static long _dbQueries = 0;
+
 
 /*
  * Purpose: Opens a database connection
@@ -80,6 +83,28 @@ void dbDisconnect() {
 }
 
 
+/*
+ * Purpose: Check a database connection is still alive, e.g. before a long
+ * 	lived worker uses a connection that may have been idle a while
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	True  - Connection is usable
+ * 	False - Connection has gone away and _errno set to ERR_DB_OPEN
+*/
+bool dbPing() {
+
+	if(_myconn == NULL || mysql_ping(_myconn) != 0) {
+		setErrType(ERR_DB_OPEN);
+		return false;
+	}
+
+	return true;
+}
+
+
 /*
  * Purpose: Escape a string so it can be inserted into a database
  *
@@ -175,6 +200,8 @@ DBRESULT *dbQuery(const char *fmt, ...) {
 		return NULL;
 	}
 
+	_dbQueries++;
+
 	if(mysql_real_query(_myconn, query, safe_length) != 0) {
 		setErrType(ERR_DB_QUERY);
 		free(query);
@@ -241,6 +268,26 @@ DBROW dbQueryGetRow(DBRESULT *result) {
 }
 
 
+/*
+ * Purpose: Returns the lengths of the fields in the row last got by
+ * 	dbQueryGetRow(), needed for binary fields which may hold \0's
+ *
+ * Entry:
+ * 	1st - Result set generated by query
+ *
+ * Exit:
+ * 	NULL if no row has been got or an array of field lengths in the
+ * 	same order as the row
+*/
+unsigned long *dbQueryGetLengths(DBRESULT *result) {
+
+	if(result == NULL)
+		return NULL;
+
+	return mysql_fetch_lengths(result);
+}
+
+
 /*
  * Purpose: Free the memory that may be allocated by a call to dbQuery()
  *
@@ -272,3 +319,19 @@ long dbQueryLastInsertId() {
 
 	return mysql_insert_id(_myconn);
 }
+
+
+/*
+ * Purpose: Count the queries this process has performed, for working out
+ * 	how many a piece of work needed
+ *
+ * On Entry:
+ * 	NONE
+ *
+ * On Exit:
+ * 	Queries sent to the database so far, whether they worked or not
+*/
+long dbQueryCount() {
+
+	return _dbQueries;
+}
@@ -49,8 +49,12 @@
 #define DBVAL_message_queue_queueState_JUSTIN		1
 #define DBVAL_message_queue_queueState_PROCESSING	2
 #define DBVAL_message_queue_queueState_DONE		3
+#define DBVAL_message_queue_queueState_POISON		4	// Claimed too many times without finishing, left alone
+#define DBVAL_message_queue_queueState_DEAD		5	// Failed for good or out of retries, see lastError
 
+#define DBVAL_message_queue_track_SYSTEM		100	// Mail from Thwonk itself, e.g. signups and admin
 #define DBVAL_message_queue_track_NORMAL		1000
+#define DBVAL_message_queue_track_BULK			2000	// Mail sent by void logic, e.g. sendMember() to a whole list
 
 #define DBVAL_void_membership_privilege_CREATOR		1
 #define DBVAL_void_membership_privilege_ADMIN		100
@@ -99,6 +103,7 @@ MYSQL *_myconn;
 
 bool dbConnect();			// Open a connection to a database
 void dbDisconnect();			// Close a connection to a database
+bool dbPing();				// Check a connection to a database is still alive
 char *dbEscapeString(char *, size_t);	// Escape a string for safe insertion in an SQL database
 
 DBRESULT *dbQuery(const char *, ...);	// Perform a query on the database
@@ -106,7 +111,9 @@ void dbQueryFreeResult(DBRESULT *);	// Free the memory used by a result allocate
 
 int dbQueryCountRows(DBRESULT *);	// Return a count of the number of rows returned or affected by a query
 DBROW dbQueryGetRow(DBRESULT *);	// Process the results of a query
+unsigned long *dbQueryGetLengths(DBRESULT *);	// Lengths of the fields of the row last got
 
 long dbQueryLastInsertId();		// Get the last insert id generated by an auto_increment
+long dbQueryCount();			// Number of queries performed so far
 
 #endif
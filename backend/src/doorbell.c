@@ -0,0 +1,181 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Doorbell for waking queue bosses when new work is added
+ *  to a message queue, rather than having them poll the database
+ *
+ * Note: Doorbells are datagram sockets in the Linux abstract unix socket
+ *  namespace. They don't live in the file system so they can be reached
+ *  from inside the mailinject and rulerunner chroots. Each boss on a
+ *  queue binds the first free of MAX_NUM_DOORBELLS addresses and a ring
+ *  is sent to all of them. A ring is only a hint, it carries no data and
+ *  losing one just means the boss picks up the work on its next poll.
+*/
+
+#include<stdio.h>
+#include<string.h>
+#include<stddef.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/types.h>
+#include "doorbell.h"
+#include "logerror.h"
+
+
+static int ringerSocket = DOORBELL_UNSET;	// Socket used for sending rings, opened on first ring
+
+
+/*
+ * Purpose: Fill in the address of a doorbell
+ *
+ * Entry:
+ * 	1st - Address struct to fill in
+ * 	2nd - Queue type, i.e. DBVAL_message_queue_messageType_EMAILIN
+ * 	3rd - Which of the doorbells on this queue
+ *
+ * Exit:
+ * 	Length of the address
+*/
+socklen_t setDoorbellAddress(struct sockaddr_un *addr, int queueType, int slot) {
+	int length;
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
+
+	addr->sun_family = AF_UNIX;
+
+	// Leading \0 in sun_path puts the address in the abstract namespace
+	length = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "%s.%d.%d", SET_DOORBELL_NAME, queueType, slot);
+
+	return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+
+/*
+ * Purpose: Start listening for rings on the doorbell of a queue
+ *
+ * Entry:
+ * 	1st - Queue type to listen for, i.e. DBVAL_message_queue_messageType_EMAILIN
+ *
+ * Exit:
+ * 	SUCCESS = Non blocking file descriptor to wait on
+ * 	FAILURE = DOORBELL_UNSET and err type set
+*/
+int openDoorbell(int queueType) {
+	struct sockaddr_un addr;
+	socklen_t length;
+	int fd, slot;
+
+	if((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1) {
+		setErrType(ERR_DOORBELL_OPEN);
+		return DOORBELL_UNSET;
+	}
+
+	if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+		close(fd);
+		setErrType(ERR_DOORBELL_OPEN);
+		return DOORBELL_UNSET;
+	}
+
+	// Another boss on the same queue may already have a doorbell, so take the next free one
+	for(slot = 0; slot < MAX_NUM_DOORBELLS; slot++) {
+		length = setDoorbellAddress(&addr, queueType, slot);
+
+		if(bind(fd, (struct sockaddr *)&addr, length) == 0)
+			return fd;
+	}
+
+	close(fd);
+	setErrType(ERR_DOORBELL_OPEN);
+
+	return DOORBELL_UNSET;
+}
+
+
+/*
+ * Purpose: Stop listening on a doorbell
+ *
+ * Entry:
+ * 	1st - Doorbell returned by openDoorbell()
+ *
+ * Exit:
+ * 	NONE
+*/
+void closeDoorbell(int fd) {
+
+	if(fd != DOORBELL_UNSET)
+		close(fd);
+}
+
+
+/*
+ * Purpose: Ring the doorbells of all bosses listening on a queue
+ *
+ * Entry:
+ * 	1st - Queue type that has new work, i.e. DBVAL_message_queue_messageType_EMAILIN
+ *
+ * Exit:
+ * 	NONE (failures are ignored as the boss falls back to polling)
+*/
+void ringDoorbell(int queueType) {
+	struct sockaddr_un addr;
+	socklen_t length;
+	int slot;
+	char ring = 0;
+
+	if(ringerSocket == DOORBELL_UNSET) {
+		if((ringerSocket = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1) {
+			ringerSocket = DOORBELL_UNSET;
+			return;
+		}
+
+		fcntl(ringerSocket, F_SETFD, FD_CLOEXEC);
+	}
+
+	for(slot = 0; slot < MAX_NUM_DOORBELLS; slot++) {
+		length = setDoorbellAddress(&addr, queueType, slot);
+
+		// Unbound slots fail straight away with ECONNREFUSED, full ones with EAGAIN
+		sendto(ringerSocket, &ring, sizeof(ring), MSG_DONTWAIT, (struct sockaddr *)&addr, length);
+	}
+}
+
+
+/*
+ * Purpose: Close the socket used for sending rings
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Forked workers call this, FD_CLOEXEC only helps across exec and
+ * 	sandboxed workers are short of descriptors. A worker that rings
+ * 	opens its own on its first ring.
+*/
+void closeDoorbellRinger() {
+
+	if(ringerSocket != DOORBELL_UNSET) {
+		close(ringerSocket);
+		ringerSocket = DOORBELL_UNSET;
+	}
+}
+
+
+/*
+ * Purpose: Clear all pending rings so the next wait blocks
+ *
+ * Entry:
+ * 	1st - Doorbell returned by openDoorbell()
+ *
+ * Exit:
+ * 	NONE
+*/
+void drainDoorbell(int fd) {
+	char ring[64];
+
+	if(fd == DOORBELL_UNSET)
+		return;
+
+	while(recv(fd, ring, sizeof(ring), MSG_DONTWAIT) > 0);
+}
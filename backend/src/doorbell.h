@@ -0,0 +1,25 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Doorbell for waking queue bosses when new work is added
+ *  to a message queue, rather than having them poll the database
+*/
+
+#ifndef __DOORBELL_H__
+#define __DOORBELL_H__
+
+#include<sys/socket.h>
+#include<sys/un.h>
+#include "codewide.h"
+
+#define DOORBELL_UNSET		-1
+
+/* Function prototypes */
+int openDoorbell(int);		// Start listening for rings on a queue's doorbell
+void closeDoorbell(int);	// Stop listening on a doorbell
+void ringDoorbell(int);		// Let any bosses listening on a queue know there is work
+void closeDoorbellRinger();	// Close the socket rings are sent from, in a forked worker
+void drainDoorbell(int);	// Clear all pending rings from a doorbell
+socklen_t setDoorbellAddress(struct sockaddr_un *, int, int);	// Address of a doorbell on a queue
+
+#endif
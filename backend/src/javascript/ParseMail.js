@@ -6,6 +6,8 @@
  * Methods:
  *	- ParseMail.getHeaderEntry(entry, mail)
  *	- ParseMail.getBody(mail)
+ *
+ * Load with: var ParseMail = Thwonk.require("/bumplist/code/ParseMail.js").ParseMail;
 */
 function InternalParseMail() {
 
@@ -36,3 +38,7 @@ function InternalParseMail() {
 }
 
 var ParseMail = new InternalParseMail();
+
+/* Exported when loaded by Thwonk.require() */
+if(typeof exports != "undefined")
+	exports.ParseMail = ParseMail;
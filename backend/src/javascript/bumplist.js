@@ -6,9 +6,10 @@ UPDATE logic SET logic = '
 */
 
 /*
- * C like include of ParseMail object for parsing Mail headers
+ * ParseMail object for parsing Mail headers, loaded as a module so it's
+ *  only compiled once rather than every run
 */
-eval(Thwonk.file.read("/bumplist/code/ParseMail.js"));
+var ParseMail = Thwonk.require("/bumplist/code/ParseMail.js").ParseMail;
 
 /*
  * Variables and paths for user messages
@@ -0,0 +1,397 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Benchmark scripts under each set of engine options, for picking
+ *  the engine options of logic (see logic.engineOptions)
+ *
+ * Usage: jsbench script.js [script.js ...]
+ *
+ * Note: Each script is compiled and run JS_BENCH_RUNS times under each set
+ *  of options in _benchOptions, in a new runtime every time so runs don't
+ *  share a heap or JIT code. The fastest compile and run, and the most GC
+ *  heap a run grew by, are reported. "make bench" runs the scripts in
+ *  javascript/ that compile on their own (see BENCH_SCRIPTS in Makefile.am).
+ *
+ * Note 2: Scripts get a global with the standard classes only, there's no
+ *  Thwonk object, so a script that uses it shows up with an error after
+ *  however much of it ran.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<sys/time.h>
+#include "jsbench.h"
+
+
+JSClass js_bench_global_class = {
+	"global",
+	JSCLASS_GLOBAL_FLAGS,
+	JS_PropertyStub,
+	JS_PropertyStub,
+	JS_PropertyStub,
+	JS_StrictPropertyStub,
+	JS_EnumerateStub,
+	JS_ResolveStub,
+	JS_ConvertStub,
+	JS_FinalizeStub,
+	JSCLASS_NO_OPTIONAL_MEMBERS
+};
+
+/* Sets of engine options each script is run under */
+static int _benchOptions[] = {
+	JS_ENGINE_INTERP,
+	JS_ENGINE_TRACEJIT,
+	JS_ENGINE_METHODJIT,
+	JS_ENGINE_TRACEJIT | JS_ENGINE_METHODJIT,
+	JS_ENGINE_TRACEJIT | JS_ENGINE_METHODJIT | JS_ENGINE_PROFILING,
+	JS_ENGINE_METHODJIT | JS_ENGINE_STRICT
+};
+
+/* Run in progress, the timer's signal handler and SpiderMonkey's callbacks need to find it */
+static JSContext *_benchContext = NULL;
+static JS_Bench_Result *_benchResult = NULL;
+static long _benchHeapStarted = 0;
+static volatile sig_atomic_t _benchTimedOut = 0;
+
+
+/*
+ * Purpose: Entry point for benchmarking scripts
+ *
+ * Entry:
+ * 	1st - count of arguments
+ * 	2nd - string array of arguments, script files
+ *
+ * Exit:
+ * 	SUCCESS = every script ran
+ * 	FAILURE = a script couldn't be read
+*/
+int main(int argc, char **argv) {
+	JS_Bench_Result result;
+	char *script;
+	char name[JS_ENGINE_LENGTH_NAME + 1];
+	size_t length;
+	long fastest;
+	int fastestOptions = JS_ENGINE_DEFAULT;
+	int ret = SUCCESS;
+	int i, j, k;
+
+	if(argc < 2) {
+		fprintf(stderr, "Usage: %s script.js [script.js ...]\n", argv[0]);
+		return FAILURE;
+	}
+
+	signal(SIGALRM, handler_jsbench_SIGALRM);
+
+	printf("%-28s %-30s %10s %10s %10s  %s\n", "script", "options (engineOptions)", "compile us", "run us", "peak KB", "result");
+
+	for(i = 1; i < argc; i++) {
+
+		if((script = readJSBenchScript(argv[i], &length)) == NULL) {
+			fprintf(stderr, "Couldn't read %s\n", argv[i]);
+			ret = FAILURE;
+			continue;
+		}
+
+		fastest = -1;
+
+		for(j = 0; j < sizeof(_benchOptions) / sizeof(_benchOptions[0]); j++) {
+
+			memset(&result, 0, sizeof(result));
+			result.engineOptions = _benchOptions[j];
+
+			for(k = 0; k < JS_BENCH_RUNS; k++) {
+				if(runJSBenchScript(script, length, argv[i], &result) == false)
+					break;
+			}
+
+			printJSBenchResult(argv[i], &result);
+
+			if(result.runs == JS_BENCH_RUNS && (fastest == -1 || result.compileUsec + result.runUsec < fastest)) {
+				fastest = result.compileUsec + result.runUsec;
+				fastestOptions = result.engineOptions;
+			}
+		}
+
+		if(fastest != -1) {
+			getJSEngineOptionsName(fastestOptions, name, sizeof(name));
+			printf("%-28s fastest: %s (engineOptions = %d)\n\n", argv[i], name, fastestOptions);
+		} else
+			printf("%-28s fastest: none, every set of options failed\n\n", argv[i]);
+
+		free(script);
+	}
+
+	JS_ShutDown();
+
+	return ret;
+}
+
+
+/*
+ * Purpose: Read a whole script file
+ *
+ * Entry:
+ * 	1st - Path of the file
+ * 	2nd - Set to the length of the script
+ *
+ * Exit:
+ * 	SUCCESS = Script, \0 terminated, free once finished with
+ * 	FAILURE = NULL
+*/
+char *readJSBenchScript(char *path, size_t *length) {
+	FILE *fp;
+	char *script;
+	long size;
+
+	if((fp = fopen(path, "r")) == NULL)
+		return NULL;
+
+	if(fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		fclose(fp);
+		return NULL;
+	}
+
+	if((script = (char *)malloc(size + 1)) == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+
+	*length = fread(script, 1, size, fp);
+	script[*length] = '\0';
+
+	fclose(fp);
+
+	return script;
+}
+
+
+/*
+ * Purpose: Compile and run a script once, in its own runtime, and add how
+ * 	it did to its result
+ *
+ * Entry:
+ * 	1st - Script
+ * 	2nd - Length of script
+ * 	3rd - File the script came from, for errors
+ * 	4th - Result, its engineOptions are what the script is run with
+ *
+ * Exit:
+ * 	true = Script compiled and ran
+ * 	false = Script failed, went over JS_BENCH_MAX_MSEC or SpiderMonkey
+ * 		couldn't be setup
+*/
+bool runJSBenchScript(char *script, size_t length, char *filename, JS_Bench_Result *result) {
+	struct itimerval timer;
+	JSRuntime *rt;
+	JSContext *cx;
+	JSObject *global, *compiled;
+	JSBool ret = JS_FALSE;
+	jsval rval;
+	long started, compileUsec, runUsec;
+
+	if((rt = JS_NewRuntime(SPIDERMONKEY_ALLOC_RAM)) == NULL)
+		return false;
+
+	if((cx = JS_NewContext(rt, 8192)) == NULL) {
+		JS_DestroyRuntime(rt);
+		return false;
+	}
+
+	JS_SetOptions(cx, getJSEngineOptions(result->engineOptions));
+	JS_SetVersion(cx, JSVERSION_LATEST);
+	JS_SetErrorReporter(cx, jsBenchErrorHandler);
+
+	_benchContext = cx;
+	_benchResult = result;
+	_benchTimedOut = 0;
+
+	if((global = JS_NewCompartmentAndGlobalObject(cx, &js_bench_global_class, NULL)) == NULL
+		|| JS_InitStandardClasses(cx, global) == JS_FALSE) {
+		_benchContext = NULL;
+		_benchResult = NULL;
+		JS_DestroyContext(cx);
+		JS_DestroyRuntime(rt);
+		return false;
+	}
+
+	_benchHeapStarted = (long)JS_GetGCParameter(rt, JSGC_BYTES);
+
+	JS_SetGCCallback(cx, jsBenchGCCallback);
+	JS_SetOperationCallback(cx, jsBenchCallback);
+
+	started = getJSBenchUsec();
+	compiled = JS_CompileScript(cx, global, script, length, filename, 1);
+	compileUsec = getJSBenchUsec() - started;
+
+	if(compiled != NULL) {
+		memset(&timer, 0, sizeof(timer));
+		timer.it_value.tv_sec = JS_BENCH_MAX_MSEC / 1000;
+		timer.it_value.tv_usec = (JS_BENCH_MAX_MSEC % 1000) * 1000;
+
+		setitimer(ITIMER_REAL, &timer, NULL);
+
+		started = getJSBenchUsec();
+		ret = JS_ExecuteScript(cx, global, compiled, &rval);
+		runUsec = getJSBenchUsec() - started;
+
+		memset(&timer, 0, sizeof(timer));
+		setitimer(ITIMER_REAL, &timer, NULL);
+
+		// Heap at the end of the run is as much a peak as any seen when collecting
+		jsBenchGCCallback(cx, JSGC_BEGIN);
+
+		if(ret == JS_TRUE) {
+			if(result->runs == 0 || compileUsec < result->compileUsec)
+				result->compileUsec = compileUsec;
+
+			if(result->runs == 0 || runUsec < result->runUsec)
+				result->runUsec = runUsec;
+
+			result->runs++;
+		}
+	}
+
+	if(_benchTimedOut != 0)
+		result->timedOut = 1;
+
+	_benchContext = NULL;
+
+	JS_DestroyContext(cx);
+	JS_DestroyRuntime(rt);
+
+	_benchResult = NULL;
+
+	return (ret == JS_TRUE);
+}
+
+
+/*
+ * Purpose: Print how a script did under one set of engine options
+ *
+ * Entry:
+ * 	1st - File the script came from
+ * 	2nd - Result of its runs
+ *
+ * Exit:
+ * 	NONE
+*/
+void printJSBenchResult(char *filename, JS_Bench_Result *result) {
+	char name[JS_ENGINE_LENGTH_NAME + 1];
+	char options[JS_ENGINE_LENGTH_NAME + 16];
+
+	getJSEngineOptionsName(result->engineOptions, name, sizeof(name));
+	snprintf(options, sizeof(options), "%s (%d)", name, result->engineOptions);
+
+	if(result->runs == 0) {
+		printf("%-28s %-30s %10s %10s %10ld  %s\n", filename, options, "-", "-", result->heapPeak / 1024,
+			(result->timedOut != 0) ? "timed out" : "error");
+	} else {
+		printf("%-28s %-30s %10ld %10ld %10ld  %s\n", filename, options, result->compileUsec, result->runUsec,
+			result->heapPeak / 1024, (result->runs == JS_BENCH_RUNS) ? "ok" : ((result->timedOut != 0) ? "timed out" : "error"));
+	}
+
+	if(result->error[0] != '\0')
+		printf("%-28s   %s\n", "", result->error);
+}
+
+
+/*
+ * Purpose: Get the time of a clock that only goes forward
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	Microsecs
+*/
+long getJSBenchUsec() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000000L) + (now.tv_nsec / 1000L);
+}
+
+
+/*
+ * Purpose: Called by SpiderMonkey when asked to by handler_jsbench_SIGALRM(),
+ * 	stops the run
+ *
+ * Entry:
+ * 	1st - Context of the run
+ *
+ * Exit:
+ * 	JS_TRUE = Carry on running the script
+ * 	JS_FALSE = Stop the script
+*/
+JSBool jsBenchCallback(JSContext *cx) {
+	return (_benchTimedOut != 0) ? JS_FALSE : JS_TRUE;
+}
+
+
+/*
+ * Purpose: Called by SpiderMonkey at the start and end of each garbage
+ * 	collection, keeps track of the peak heap of the run
+ *
+ * Entry:
+ * 	1st - Context of the run
+ * 	2nd - Stage of the collection
+ *
+ * Exit:
+ * 	JS_TRUE = Carry on with the collection
+*/
+JSBool jsBenchGCCallback(JSContext *cx, JSGCStatus status) {
+	long grown;
+
+	if(status != JSGC_BEGIN || _benchResult == NULL)
+		return JS_TRUE;
+
+	grown = (long)JS_GetGCParameter(JS_GetRuntime(cx), JSGC_BYTES) - _benchHeapStarted;
+
+	if(grown > _benchResult->heapPeak)
+		_benchResult->heapPeak = grown;
+
+	return JS_TRUE;
+}
+
+
+/*
+ * Purpose: Gets called when an error occurs, keeps the first error of a
+ * 	script's runs rather than printing the same error every run
+ *
+ * Entry:
+ * 	1st - Context of the run
+ * 	2nd - Error message
+ * 	3rd - Struct containing more details about the error
+ *
+ * Exit:
+ * 	NONE
+*/
+void jsBenchErrorHandler(JSContext *cx, const char *msg, JSErrorReport *err) {
+
+	if(_benchResult == NULL || _benchResult->error[0] != '\0')
+		return;
+
+	snprintf(_benchResult->error, sizeof(_benchResult->error), "line %u: %s", err->lineno, msg);
+}
+
+
+/*
+ * Purpose: Signal handler called once a run has taken JS_BENCH_MAX_MSEC,
+ * 	asks SpiderMonkey to call jsBenchCallback() as soon as it safely can
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	NONE
+*/
+void handler_jsbench_SIGALRM(int ignore) {
+
+	_benchTimedOut = 1;
+
+	if(_benchContext != NULL)
+		JS_TriggerOperationCallback(_benchContext);
+}
@@ -0,0 +1,43 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Benchmark scripts under each set of engine options, for picking
+ *  the engine options of logic
+*/
+
+#ifndef __JSBENCH_H__
+#define __JSBENCH_H__
+
+#include<signal.h>
+#include<jsapi.h>
+#include "codewide.h"
+#include "jsoptions.h"
+
+#define JS_BENCH_RUNS		5	// Times each script is run under each set of options
+#define JS_BENCH_MAX_MSEC	2000	// Millisecs a run may take before it's stopped
+#define JS_BENCH_LENGTH_ERROR	200	// Max length of an error kept from a run
+
+/* What a script did under one set of engine options, over all its runs */
+typedef struct {
+	int engineOptions;		// JS_ENGINE_* bits
+
+	long compileUsec;		// Fastest compile, microsecs
+	long runUsec;			// Fastest run, microsecs
+	long heapPeak;			// Most GC heap a run grew by
+
+	int runs;			// Runs done, stops at the first that fails
+	int timedOut;			// 1 = a run went over JS_BENCH_MAX_MSEC
+	char error[JS_BENCH_LENGTH_ERROR + 1];	// First error reported, "" = none
+} JS_Bench_Result;
+
+/* Function prototypes */
+char *readJSBenchScript(char *, size_t *);	// Read a script file
+bool runJSBenchScript(char *, size_t, char *, JS_Bench_Result *);	// Compile and run a script once
+void printJSBenchResult(char *, JS_Bench_Result *);	// Print how a script did under one set of options
+long getJSBenchUsec();				// Microsecs of a clock that only goes forward
+JSBool jsBenchCallback(JSContext *);		// SpiderMonkey's operation callback, stops a run
+JSBool jsBenchGCCallback(JSContext *, JSGCStatus);	// SpiderMonkey's GC callback, tracks the heap
+void jsBenchErrorHandler(JSContext *, const char *, JSErrorReport *);	// Keep the first error of a run
+void handler_jsbench_SIGALRM(int);		// Run has taken too long
+
+#endif
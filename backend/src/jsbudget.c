@@ -0,0 +1,288 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Budgets of CPU, run time and heap for a rule, checked from
+ *  inside SpiderMonkey while the rule's script runs
+ *
+ * Note: While a rule runs a timer goes off every JS_BUDGET_TICK_MSEC and
+ *  asks SpiderMonkey to call jsBudgetCallback(), which stops the script
+ *  once it's over budget. Only the script is stopped, the worker carries
+ *  on and tells its boss with ERR_JS_BUDGET, rather than the whole
+ *  process being killed by RLIMIT_CPU (see setupLimits()), which is left
+ *  as a backstop.
+ *
+ * Note 2: A signal is used rather than a watchdog thread as the sandbox
+ *  allows a rule runner no more processes or threads (RES_RR_MAX_PROCESS).
+ *
+ * Note 3: Time spent in a native function (e.g. a database query made by
+ *  the Thwonk object) is only noticed once the script carries on.
+ *
+ * Note 4: The heap budget is enforced by lowering the runtime's
+ *  JSGC_MAX_BYTES for the run, so SpiderMonkey fails the allocation that
+ *  would go over with an out of memory error the script can't catch. The
+ *  worker carries on and tells its boss with ERR_JS_HEAP, rather than
+ *  the whole process being killed at RLIMIT_AS (RES_RR_MAX_RAM). Memory
+ *  SpiderMonkey mallocs outside the GC heap (e.g. string chars) isn't
+ *  counted.
+ *
+ * Note 5: The GC heap only shrinks when garbage is collected, so its
+ *  peak is seen at the start of each collection and at the end of the
+ *  run (see jsBudgetGCCallback()).
+*/
+
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include<sys/time.h>
+#include "jsbudget.h"
+#include "setupthang.h"
+#include "qadapt.h"
+
+/* Budget of the rule being run, the timer's signal handler needs to find it */
+static JS_Budget _jsBudget = { NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+
+/*
+ * Purpose: Start the budget of a rule that's about to run
+ *
+ * Entry:
+ * 	1st - Context the rule runs in
+ * 	2nd - Rule's logic, with its maxCpuMsec, maxWallMsec and
+ * 		maxHeapBytes (0 = server's max)
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Logic can only make its budget tighter than the server's max
+ * 	(js_max_cpu_msec, js_max_wall_msec and js_max_heap_bytes of SCONFIG).
+ * 	A max of 0 is no budget, when there's no CPU or run time budget the
+ * 	timer isn't started.
+*/
+void startJSBudget(JSContext *cx, Logic_Entry *lentry) {
+	struct itimerval timer;
+	JSRuntime *rt;
+
+	_jsBudget.cpuMsec = _config->js_max_cpu_msec;
+	_jsBudget.wallMsec = _config->js_max_wall_msec;
+	_jsBudget.heapBytes = _config->js_max_heap_bytes;
+
+	if(lentry->maxCpuMsec > 0 && (_jsBudget.cpuMsec == 0 || lentry->maxCpuMsec < _jsBudget.cpuMsec))
+		_jsBudget.cpuMsec = lentry->maxCpuMsec;
+
+	if(lentry->maxWallMsec > 0 && (_jsBudget.wallMsec == 0 || lentry->maxWallMsec < _jsBudget.wallMsec))
+		_jsBudget.wallMsec = lentry->maxWallMsec;
+
+	if(lentry->maxHeapBytes > 0 && (_jsBudget.heapBytes == 0 || lentry->maxHeapBytes < _jsBudget.heapBytes))
+		_jsBudget.heapBytes = lentry->maxHeapBytes;
+
+	_jsBudget.exceeded = 0;
+	_jsBudget.heapFull = 0;
+	_jsBudget.heapPeak = 0;
+
+	rt = JS_GetRuntime(cx);
+
+	_jsBudget.heapStarted = getJSBudgetHeapBytes(cx);
+
+	// Runtime's own max (see getJSRunnerContext()) still applies
+	if(_jsBudget.heapBytes > 0 && _jsBudget.heapStarted + _jsBudget.heapBytes < SPIDERMONKEY_ALLOC_RAM)
+		JS_SetGCParameter(rt, JSGC_MAX_BYTES, (uint32)(_jsBudget.heapStarted + _jsBudget.heapBytes));
+
+	JS_SetGCCallback(cx, jsBudgetGCCallback);
+	_jsBudget.cx = cx;
+
+	if(_jsBudget.cpuMsec == 0 && _jsBudget.wallMsec == 0)
+		return;
+
+	_jsBudget.cpuStarted = getJSBudgetCpuMsec();
+	_jsBudget.wallStarted = getQueueAdaptMsec();
+
+	JS_SetOperationCallback(cx, jsBudgetCallback);
+
+	signal(SIGALRM, handler_SIGALRM);
+
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = JS_BUDGET_TICK_MSEC * 1000;
+	timer.it_value = timer.it_interval;
+
+	setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+
+/*
+ * Purpose: Rule has finished running, stop checking its budget
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	NONE
+*/
+void stopJSBudget() {
+	struct itimerval timer;
+
+	if(_jsBudget.cx == NULL)
+		return;
+
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_REAL, &timer, NULL);
+
+	jsBudgetGCCallback(_jsBudget.cx, JSGC_BEGIN);
+
+	JS_SetGCParameter(JS_GetRuntime(_jsBudget.cx), JSGC_MAX_BYTES, (uint32)SPIDERMONKEY_ALLOC_RAM);
+
+	JS_SetOperationCallback(_jsBudget.cx, NULL);
+	JS_SetGCCallback(_jsBudget.cx, NULL);
+	_jsBudget.cx = NULL;
+}
+
+
+/*
+ * Purpose: Did the last rule run go over its budget
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	true = Went over, its script was stopped
+ * 	false = Within budget
+*/
+bool isJSBudgetExceeded() {
+	return (_jsBudget.exceeded != 0);
+}
+
+
+/*
+ * Purpose: Did the last rule run go over its heap budget
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	true = Heap was still at its budget after garbage was collected, a
+ * 		script that then failed ran out of memory
+ * 	false = Within budget
+*/
+bool isJSBudgetHeapExceeded() {
+	return (_jsBudget.heapFull != 0);
+}
+
+
+/*
+ * Purpose: Get the most GC heap the last rule run grew by
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	Bytes
+*/
+long getJSBudgetHeapPeak() {
+	return _jsBudget.heapPeak;
+}
+
+
+/*
+ * Purpose: Get the GC heap a context's runtime has
+ *
+ * Entry:
+ * 	1st - Context
+ *
+ * Exit:
+ * 	Bytes
+*/
+long getJSBudgetHeapBytes(JSContext *cx) {
+	return (long)JS_GetGCParameter(JS_GetRuntime(cx), JSGC_BYTES);
+}
+
+
+/*
+ * Purpose: Get how much CPU this worker has used
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	CPU millisecs
+*/
+long getJSBudgetCpuMsec() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+
+	return (now.tv_sec * 1000L) + (now.tv_nsec / 1000000L);
+}
+
+
+/*
+ * Purpose: Called by SpiderMonkey when asked to by handler_SIGALRM(), stop
+ * 	the script if it's over budget
+ *
+ * Entry:
+ * 	1st - Context the rule runs in
+ *
+ * Exit:
+ * 	JS_TRUE = Carry on running the script
+ * 	JS_FALSE = Stop the script, the script can't catch this
+*/
+JSBool jsBudgetCallback(JSContext *cx) {
+
+	if(_jsBudget.cpuMsec > 0 && getJSBudgetCpuMsec() - _jsBudget.cpuStarted >= _jsBudget.cpuMsec)
+		_jsBudget.exceeded = 1;
+
+	if(_jsBudget.wallMsec > 0 && getQueueAdaptMsec() - _jsBudget.wallStarted >= _jsBudget.wallMsec)
+		_jsBudget.exceeded = 1;
+
+	return (_jsBudget.exceeded != 0) ? JS_FALSE : JS_TRUE;
+}
+
+
+/*
+ * Purpose: Called by SpiderMonkey at the start and end of each garbage
+ * 	collection, keeps track of the peak heap and whether it's full
+ *
+ * Entry:
+ * 	1st - Context the rule runs in
+ * 	2nd - Stage of the collection
+ *
+ * Exit:
+ * 	JS_TRUE = Carry on with the collection
+ *
+ * Note: A collection that leaves the heap at its budget is followed by the
+ * 	script running out of memory, unless it's done allocating.
+*/
+JSBool jsBudgetGCCallback(JSContext *cx, JSGCStatus status) {
+	long grown;
+
+	if(status != JSGC_BEGIN && status != JSGC_END)
+		return JS_TRUE;
+
+	grown = getJSBudgetHeapBytes(cx) - _jsBudget.heapStarted;
+
+	if(status == JSGC_BEGIN && grown > _jsBudget.heapPeak)
+		_jsBudget.heapPeak = grown;
+
+	if(status == JSGC_END)
+		_jsBudget.heapFull = (_jsBudget.heapBytes > 0 && grown + JS_BUDGET_HEAP_SLACK >= _jsBudget.heapBytes);
+
+	return JS_TRUE;
+}
+
+
+/*
+ * Purpose: Signal handler called by the budget's timer, asks SpiderMonkey
+ * 	to call jsBudgetCallback() as soon as it safely can
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: JS_TriggerOperationCallback() only sets a flag the running script
+ * 	checks, so it's safe to call from a signal handler.
+*/
+void handler_SIGALRM(int ignore) {
+
+	if(_jsBudget.cx != NULL && (_jsBudget.cpuMsec > 0 || _jsBudget.wallMsec > 0))
+		JS_TriggerOperationCallback(_jsBudget.cx);
+}
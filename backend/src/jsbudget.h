@@ -0,0 +1,49 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Budgets of CPU, run time and heap for a rule, checked from
+ *  inside SpiderMonkey while the rule's script runs
+*/
+
+#ifndef __JSBUDGET_H__
+#define __JSBUDGET_H__
+
+#include<signal.h>
+#include<jsapi.h>
+#include "codewide.h"
+#include "mnglogic.h"
+
+#define JS_BUDGET_HEAP_SLACK	16384	// Heap within this many bytes of its budget counts as full, the
+					//  GC heap grows by 4K arenas
+
+/* Budget of the rule being run */
+typedef struct {
+	JSContext *cx;			// Context the rule runs in, NULL = no rule running
+
+	long cpuMsec;			// CPU millisecs the rule may use
+	long wallMsec;			// Millisecs the rule may take
+
+	long heapBytes;			// GC heap the rule may grow by, 0 = no budget
+
+	long cpuStarted;		// CPU millisecs the worker had used when the rule started
+	long wallStarted;		// When the rule started (see getQueueAdaptMsec())
+	long heapStarted;		// GC heap of the runtime when the rule started
+	long heapPeak;			// Most GC heap the rule has grown by
+
+	volatile sig_atomic_t exceeded;	// Set once the rule goes over its CPU or run time budget
+	int heapFull;			// Set while the GC heap is at its budget
+} JS_Budget;
+
+/* Function prototypes */
+void startJSBudget(JSContext *, Logic_Entry *);	// Start the budget of a rule about to run
+void stopJSBudget();				// Rule has finished running
+bool isJSBudgetExceeded();			// Did the last rule go over its CPU or run time budget
+bool isJSBudgetHeapExceeded();			// Did the last rule go over its heap budget
+long getJSBudgetHeapPeak();			// Most GC heap the last rule grew by
+long getJSBudgetHeapBytes(JSContext *);		// GC heap of a context's runtime
+long getJSBudgetCpuMsec();			// CPU millisecs the worker has used
+JSBool jsBudgetCallback(JSContext *);		// SpiderMonkey's operation callback, checks the budget
+JSBool jsBudgetGCCallback(JSContext *, JSGCStatus);	// SpiderMonkey's GC callback, tracks the heap
+void handler_SIGALRM(int);			// Asks SpiderMonkey to call jsBudgetCallback()
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Least recently used cache a rule runner worker keeps of each
+ *  void's compiled logic, so a void's rules can start without asking
+ *  the database for its logic
+ *
+ * Note: Bytecode is held rather than compiled script objects, a script
+ *  object belongs to the compartment of the rule it was loaded for and
+ *  every rule gets a new compartment (see jsrunner.c). Loading bytecode
+ *  costs a fraction of compiling source. The cache holds at most
+ *  maxBytes of bytecode, dropping the least recently used void's first.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "jscache.h"
+#include "logerror.h"
+
+
+/*
+ * Purpose: Creates an empty cache
+ *
+ * Entry:
+ * 	1st - Most bytecode to hold
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated JS_Cache
+ * 	FAILURE = NULL, and err type set
+*/
+JS_Cache *createJSCache(size_t maxBytes) {
+	JS_Cache *cache;
+	int i;
+
+	if((cache = (JS_Cache *)malloc(sizeof(JS_Cache))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	for(i = 0; i < JS_CACHE_HASH_SIZE; i++)
+		cache->buckets[i] = NULL;
+
+	cache->head = NULL;
+	cache->tail = NULL;
+
+	cache->bytes = 0;
+	cache->maxBytes = maxBytes;
+
+	return cache;
+}
+
+
+/*
+ * Purpose: Free up a cache and everything in it
+ *
+ * Entry:
+ * 	1st - JS_Cache to free
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeJSCache(JS_Cache *cache) {
+
+	if(cache == NULL)
+		return;
+
+	while(cache->head != NULL)
+		dropJSCacheEntry(cache, cache->head);
+
+	free(cache);
+}
+
+
+/*
+ * Purpose: Find the compiled logic held for a void, and mark it as the
+ * 	most recently used
+ *
+ * Entry:
+ * 	1st - JS_Cache
+ * 	2nd - Void id
+ *
+ * Exit:
+ * 	SUCCESS = pointer to the void's entry
+ * 	FAILURE = NULL if nothing held for the void
+*/
+JS_Cache_Entry *getJSCacheEntry(JS_Cache *cache, long voidId) {
+	JS_Cache_Entry *entry;
+
+	for(entry = cache->buckets[voidId & (JS_CACHE_HASH_SIZE - 1)]; entry != NULL; entry = entry->hashNext) {
+		if(entry->voidId == voidId)
+			break;
+	}
+
+	if(entry == NULL || entry == cache->head)
+		return entry;
+
+	// Move to the front
+	entry->prev->next = entry->next;
+
+	if(entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+	cache->head->prev = entry;
+	cache->head = entry;
+
+	return entry;
+}
+
+
+/*
+ * Purpose: Forget the compiled logic held for a void
+ *
+ * Entry:
+ * 	1st - JS_Cache
+ * 	2nd - Entry to drop, it's freed
+ *
+ * Exit:
+ * 	NONE
+*/
+void dropJSCacheEntry(JS_Cache *cache, JS_Cache_Entry *entry) {
+	JS_Cache_Entry **link;
+
+	for(link = &cache->buckets[entry->voidId & (JS_CACHE_HASH_SIZE - 1)]; *link != NULL; link = &(*link)->hashNext) {
+		if(*link == entry) {
+			*link = entry->hashNext;
+			break;
+		}
+	}
+
+	if(entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if(entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	cache->bytes -= entry->length;
+
+	free(entry->bytecode);
+	free(entry);
+}
+
+
+/*
+ * Purpose: Hold the compiled logic of a void, replacing anything held for
+ * 	it before
+ *
+ * Entry:
+ * 	1st - JS_Cache
+ * 	2nd - Void id
+ * 	3rd - Void's logic, its id, budgets, peak heap and engine options
+ * 		are kept
+ * 	4th - What the bytecode was compiled from
+ * 	5th - Bytecode, copied
+ * 	6th - Length of bytecode
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false, too big to hold or err type set
+*/
+bool putJSCacheEntry(JS_Cache *cache, long voidId, Logic_Entry *lentry, char *key, char *bytecode, size_t length) {
+	JS_Cache_Entry *entry;
+	int bucket;
+
+	if((entry = getJSCacheEntry(cache, voidId)) != NULL)
+		dropJSCacheEntry(cache, entry);
+
+	if(length > cache->maxBytes)
+		return false;
+
+	// Make room
+	while(cache->tail != NULL && cache->bytes + length > cache->maxBytes)
+		dropJSCacheEntry(cache, cache->tail);
+
+	if((entry = (JS_Cache_Entry *)malloc(sizeof(JS_Cache_Entry))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	if((entry->bytecode = (char *)malloc(length)) == NULL) {
+		free(entry);
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	memcpy(entry->bytecode, bytecode, length);
+	entry->length = length;
+
+	entry->voidId = voidId;
+	entry->logicId = lentry->id;
+	entry->maxCpuMsec = lentry->maxCpuMsec;
+	entry->maxWallMsec = lentry->maxWallMsec;
+	entry->maxHeapBytes = lentry->maxHeapBytes;
+	entry->peakHeapBytes = lentry->peakHeapBytes;
+	entry->engineOptions = lentry->engineOptions;
+
+	strncpy(entry->key, key, LOGIC_LENGTH_CACHE_KEY);
+	entry->key[LOGIC_LENGTH_CACHE_KEY] = '\0';
+
+	entry->checked = time(NULL);
+
+	bucket = voidId & (JS_CACHE_HASH_SIZE - 1);
+	entry->hashNext = cache->buckets[bucket];
+	cache->buckets[bucket] = entry;
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	if(cache->head != NULL)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+
+	cache->head = entry;
+	cache->bytes += length;
+
+	return true;
+}
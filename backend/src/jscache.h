@@ -0,0 +1,57 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Least recently used cache a rule runner worker keeps of each
+ *  void's compiled logic, so a void's rules can start without asking
+ *  the database for its logic
+*/
+
+#ifndef __JSCACHE_H__
+#define __JSCACHE_H__
+
+#include<time.h>
+#include "codewide.h"
+#include "mnglogic.h"
+
+#define JS_CACHE_HASH_SIZE	256	// Number of buckets in the void lookup table (power of 2)
+
+/* Compiled logic of a void */
+typedef struct JS_Cache_Entry {
+	long voidId;
+	long logicId;
+
+	char key[LOGIC_LENGTH_CACHE_KEY + 1];	// What the bytecode was compiled from (see getJSRunnerCacheKey())
+	char *bytecode;			// SpiderMonkey XDR bytecode, may hold \0's
+	size_t length;
+
+	time_t checked;			// When the logic was last checked to still be this version
+
+	int maxCpuMsec;			// Budgets of the logic (see jsbudget.c)
+	int maxWallMsec;
+	long maxHeapBytes;
+	long peakHeapBytes;		// Most heap a run of the logic is known to have used
+
+	int engineOptions;		// Engine options of the logic (see jsoptions.h)
+
+	struct JS_Cache_Entry *hashNext;
+	struct JS_Cache_Entry *prev, *next;	// Most recently used first
+} JS_Cache_Entry;
+
+/* Cache of a worker */
+typedef struct {
+	JS_Cache_Entry *buckets[JS_CACHE_HASH_SIZE];
+
+	JS_Cache_Entry *head, *tail;
+
+	size_t bytes;			// Bytecode held
+	size_t maxBytes;		// Most bytecode to hold before least recently used is dropped
+} JS_Cache;
+
+/* Function prototypes */
+JS_Cache *createJSCache(size_t);		// Allocate mem and setup a JS_Cache
+void freeJSCache(JS_Cache *);			// Release mem associated with a JS_Cache, and its entries
+JS_Cache_Entry *getJSCacheEntry(JS_Cache *, long);	// Find a void's compiled logic, marking it used
+void dropJSCacheEntry(JS_Cache *, JS_Cache_Entry *);	// Forget a void's compiled logic
+bool putJSCacheEntry(JS_Cache *, long, Logic_Entry *, char *, char *, size_t);	// Hold a void's compiled logic
+
+#endif
@@ -0,0 +1,413 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Load vfiles as modules for Thwonk.require(), keeping the
+ *  compiled modules a rule runner worker has loaded
+ *
+ * Note: A module is its vfile's source wrapped in a function, which is
+ *  handed the module's exports object. Like logic (see jscache.c) it's
+ *  bytecode that's kept, in the worker and with the vfile for other
+ *  workers, since every rule gets a new compartment. A rule that
+ *  requires a library gets it without the library's source being
+ *  fetched or compiled, the module is only run once in each rule.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "jsmodule.h"
+#include "jsrunner.h"
+#include "dbchatter.h"
+#include "logerror.h"
+#include "misc.h"
+
+
+/* Compiled modules held by this worker, see getJSModuleScript() */
+static JS_Module_Cache *_jsModuleCache = NULL;
+
+
+/*
+ * Purpose: Creates an empty module cache
+ *
+ * Entry:
+ * 	1st - Most bytecode to hold
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated JS_Module_Cache
+ * 	FAILURE = NULL, and err type set
+*/
+JS_Module_Cache *createJSModuleCache(size_t maxBytes) {
+	JS_Module_Cache *cache;
+
+	if((cache = (JS_Module_Cache *)malloc(sizeof(JS_Module_Cache))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	cache->head = NULL;
+	cache->tail = NULL;
+
+	cache->bytes = 0;
+	cache->maxBytes = maxBytes;
+
+	return cache;
+}
+
+
+/*
+ * Purpose: Free up a module cache and everything in it
+ *
+ * Entry:
+ * 	1st - JS_Module_Cache to free
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeJSModuleCache(JS_Module_Cache *cache) {
+
+	if(cache == NULL)
+		return;
+
+	while(cache->head != NULL)
+		dropJSModuleEntry(cache, cache->head);
+
+	free(cache);
+}
+
+
+/*
+ * Purpose: Find the compiled module held for a vfile, and mark it as the
+ * 	most recently used
+ *
+ * Entry:
+ * 	1st - JS_Module_Cache
+ * 	2nd - Path of the vfile
+ *
+ * Exit:
+ * 	SUCCESS = pointer to the vfile's entry
+ * 	FAILURE = NULL if nothing held for the vfile
+ *
+ * Note: Entries are searched in order, a rule's libraries are few and
+ * 	the ones it uses are at the front.
+*/
+JS_Module_Entry *getJSModuleEntry(JS_Module_Cache *cache, char *path) {
+	JS_Module_Entry *entry;
+
+	for(entry = cache->head; entry != NULL; entry = entry->next) {
+		if(strcmp(entry->path, path) == 0)
+			break;
+	}
+
+	if(entry == NULL || entry == cache->head)
+		return entry;
+
+	// Move to the front
+	entry->prev->next = entry->next;
+
+	if(entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+	cache->head->prev = entry;
+	cache->head = entry;
+
+	return entry;
+}
+
+
+/*
+ * Purpose: Forget the compiled module held for a vfile
+ *
+ * Entry:
+ * 	1st - JS_Module_Cache
+ * 	2nd - Entry to drop, it's freed
+ *
+ * Exit:
+ * 	NONE
+*/
+void dropJSModuleEntry(JS_Module_Cache *cache, JS_Module_Entry *entry) {
+
+	if(entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if(entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	cache->bytes -= entry->length;
+
+	free(entry->path);
+	free(entry->bytecode);
+	free(entry);
+}
+
+
+/*
+ * Purpose: Hold the compiled module of a vfile, replacing anything held
+ * 	for it before
+ *
+ * Entry:
+ * 	1st - JS_Module_Cache
+ * 	2nd - Path of the vfile
+ * 	3rd - Id of the vfile
+ * 	4th - What the bytecode was compiled from
+ * 	5th - Bytecode, copied
+ * 	6th - Length of bytecode
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false, too big to hold or err type set
+*/
+bool putJSModuleEntry(JS_Module_Cache *cache, char *path, long vfileId, char *key, char *bytecode, size_t length) {
+	JS_Module_Entry *entry;
+
+	if((entry = getJSModuleEntry(cache, path)) != NULL)
+		dropJSModuleEntry(cache, entry);
+
+	if(length > cache->maxBytes)
+		return false;
+
+	// Make room
+	while(cache->tail != NULL && cache->bytes + length > cache->maxBytes)
+		dropJSModuleEntry(cache, cache->tail);
+
+	if((entry = (JS_Module_Entry *)malloc(sizeof(JS_Module_Entry))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	if((entry->path = mStrndup(path, MAX_LENGTH_FILEPATH)) == NULL) {
+		free(entry);
+		return false;
+	}
+
+	if((entry->bytecode = (char *)malloc(length)) == NULL) {
+		free(entry->path);
+		free(entry);
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	memcpy(entry->bytecode, bytecode, length);
+	entry->length = length;
+
+	entry->vfileId = vfileId;
+
+	strncpy(entry->key, key, VFILE_LENGTH_MODULE_KEY);
+	entry->key[VFILE_LENGTH_MODULE_KEY] = '\0';
+
+	entry->checked = time(NULL);
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	if(cache->head != NULL)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+
+	cache->head = entry;
+	cache->bytes += length;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Work out the key a compiled module is cached under, anything
+ * 	that would make the bytecode differ is part of it
+ *
+ * Entry:
+ * 	1st - Vfile
+ * 	2nd - String to fill, at least VFILE_LENGTH_MODULE_KEY + 1 long
+ *
+ * Exit:
+ * 	NONE
+*/
+void getJSModuleCacheKey(VFile_Entry *ventry, char *key) {
+
+	snprintf(key, VFILE_LENGTH_MODULE_KEY + 1, "%lx:%d:%s:%lu:%s", (unsigned long)JSXDR_BYTECODE_VERSION,
+		ventry->version, (ventry->editDate == NULL) ? "" : ventry->editDate, (unsigned long)ventry->contentLength,
+		(ventry->contentHash == NULL) ? "" : ventry->contentHash);
+}
+
+
+/*
+ * Purpose: Get the script of a vfile's module ready to run, from what
+ * 	this worker holds, the bytecode stored with the vfile, or by
+ * 	compiling the vfile
+ *
+ * Entry:
+ * 	1st - Context, in the rule's compartment
+ * 	2nd - Global object of the rule
+ * 	3rd - Path of the vfile
+ *
+ * Exit:
+ * 	SUCCESS = Script object, running it gives the module's function
+ * 	FAILURE = NULL, no such vfile or it doesn't compile
+ *
+ * Note: A module held for longer than JS_CACHE_CHECK_SEC is checked
+ * 	against the version of the vfile in the database, which doesn't
+ * 	fetch the vfile itself. Until then a rule may get the old version
+ * 	of an edited library, the same as with logic.
+ *
+ * Note 2: Compiled without JSOPTION_COMPILE_N_GO, see getJSRunnerScript().
+*/
+JSObject *getJSModuleScript(JSContext *cx, JSObject *global, char *path) {
+	JS_Module_Entry *entry;
+	VFile_Entry *ventry;
+	JSObject *script = NULL;
+	JSXDRState *xdr;
+	uint32 options, length;
+	void *data;
+	char *name, *source;
+	char key[VFILE_LENGTH_MODULE_KEY + 1];
+	time_t now;
+
+	if(_jsModuleCache == NULL && (_jsModuleCache = createJSModuleCache(JS_MODULE_CACHE_MAX_BYTES)) == NULL)
+		return NULL;
+
+	if((name = dbEscapeString(path, strlen(path))) == NULL)
+		return NULL;
+
+	// Module this worker already holds
+	if((entry = getJSModuleEntry(_jsModuleCache, path)) != NULL
+		&& (now = time(NULL)) - entry->checked >= JS_CACHE_CHECK_SEC) {
+
+		if((ventry = getVFileVersionByName(name)) != NULL)
+			getJSModuleCacheKey(ventry, key);
+
+		if(ventry == NULL || ventry->id != entry->vfileId || strcmp(key, entry->key) != 0) {
+			dropJSModuleEntry(_jsModuleCache, entry);
+			entry = NULL;
+		} else {
+			entry->checked = now;
+		}
+
+		freeVFileEntry(ventry);
+	}
+
+	if(entry != NULL) {
+
+		if((script = loadJSRunnerBytecode(cx, entry->bytecode, entry->length)) != NULL) {
+			free(name);
+			return script;
+		}
+
+		dropJSModuleEntry(_jsModuleCache, entry);
+	}
+
+	ventry = getVFileModuleByName(name);
+
+	free(name);
+
+	if(ventry == NULL)
+		return NULL;
+
+	getJSModuleCacheKey(ventry, key);
+
+	// Load what another worker compiled
+	if(ventry->moduleCacheKey != NULL && strcmp(ventry->moduleCacheKey, key) == 0
+		&& (script = loadJSRunnerBytecode(cx, ventry->moduleCache, ventry->moduleCacheLength)) != NULL) {
+
+		putJSModuleEntry(_jsModuleCache, path, ventry->id, key, ventry->moduleCache, ventry->moduleCacheLength);
+		freeVFileEntry(ventry);
+
+		return script;
+	}
+
+	if(ventry->content == NULL || (source = (char *)malloc(strlen(JS_MODULE_HEAD) + ventry->contentLength + strlen(JS_MODULE_TAIL) + 1)) == NULL) {
+		freeVFileEntry(ventry);
+		return NULL;
+	}
+
+	strcpy(source, JS_MODULE_HEAD);
+	strcat(source, ventry->content);
+	strcat(source, JS_MODULE_TAIL);
+
+	options = JS_SetOptions(cx, JS_GetOptions(cx) & ~JSOPTION_COMPILE_N_GO);
+
+	script = JS_CompileScript(cx, global, source, strlen(source), path, 0);
+
+	JS_SetOptions(cx, options);
+
+	free(source);
+
+	if(script == NULL) {
+		freeVFileEntry(ventry);
+		return NULL;
+	}
+
+	// Keep it, here and with the vfile
+	if((xdr = JS_XDRNewMem(cx, JSXDR_ENCODE)) != NULL) {
+
+		if(JS_XDRScriptObject(xdr, &script) == JS_TRUE && (data = JS_XDRMemGetData(xdr, &length)) != NULL) {
+			putJSModuleEntry(_jsModuleCache, path, ventry->id, key, (char *)data, length);
+
+			if(updateVFileModuleCache(ventry->id, key, (char *)data, length) == false)
+				printf("Couldn't cache compiled module %s: %s\n", path, getErrTypeMsg());
+		} else {
+			JS_ClearPendingException(cx);
+		}
+
+		JS_XDRDestroy(xdr);
+	}
+
+	freeVFileEntry(ventry);
+
+	return script;
+}
+
+
+/*
+ * Purpose: Run a module's script, handing it a new exports object
+ *
+ * Entry:
+ * 	1st - Context, in the rule's compartment
+ * 	2nd - Global object of the rule
+ * 	3rd - Modules the rule has required, by path
+ * 	4th - Path of the module
+ * 	5th - Module's script (see getJSModuleScript())
+ * 	6th - Filled with the module's exports
+ *
+ * Exit:
+ * 	SUCCESS = JS_TRUE
+ * 	FAILURE = JS_FALSE, the module threw or was stopped (see jsbudget.c)
+ *
+ * Note: The exports are recorded before the module runs, so modules
+ * 	that require each other get what the other has exported so far
+ * 	rather than going round for ever. A module that fails is forgotten,
+ * 	requiring it again runs it again.
+*/
+JSBool runJSModule(JSContext *cx, JSObject *global, JSObject *modules, char *path, JSObject *script, jsval *exports) {
+	JSObject *exportsObj, *moduleObj;
+	jsval fval, rval, argv[2];
+
+	if((exportsObj = JS_NewObject(cx, NULL, NULL, NULL)) == NULL || (moduleObj = JS_NewObject(cx, NULL, NULL, NULL)) == NULL)
+		return JS_FALSE;
+
+	argv[0] = OBJECT_TO_JSVAL(exportsObj);
+	argv[1] = OBJECT_TO_JSVAL(moduleObj);
+
+	if(JS_SetProperty(cx, moduleObj, "exports", &argv[0]) == JS_FALSE || JS_SetProperty(cx, modules, path, &argv[0]) == JS_FALSE)
+		return JS_FALSE;
+
+	if(JS_ExecuteScript(cx, global, script, &fval) == JS_FALSE
+		|| JS_CallFunctionValue(cx, global, fval, 2, argv, &rval) == JS_FALSE
+		|| JS_GetProperty(cx, moduleObj, "exports", exports) == JS_FALSE) {
+
+		rval = JSVAL_VOID;
+		JS_SetProperty(cx, modules, path, &rval);
+
+		return JS_FALSE;
+	}
+
+	// The module may have replaced its exports
+	return JS_SetProperty(cx, modules, path, exports);
+}
@@ -0,0 +1,51 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Load vfiles as modules for Thwonk.require(), keeping the
+ *  compiled modules a rule runner worker has loaded
+*/
+
+#ifndef __JSMODULE_H__
+#define __JSMODULE_H__
+
+#include<time.h>
+#include<jsapi.h>
+#include "codewide.h"
+#include "mngvfile.h"
+
+#define JS_MODULE_HEAD		"(function (exports, module) {"	// Wrapped round a module's source, so its
+#define JS_MODULE_TAIL		"\n})"				//  variables stay out of the rule's global
+
+/* Compiled module of a vfile */
+typedef struct JS_Module_Entry {
+	char *path;			// Vfile the module was compiled from
+	long vfileId;
+
+	char key[VFILE_LENGTH_MODULE_KEY + 1];	// What the bytecode was compiled from (see getJSModuleCacheKey())
+	char *bytecode;			// SpiderMonkey XDR bytecode, may hold \0's
+	size_t length;
+
+	time_t checked;			// When the vfile was last checked to still be this version
+
+	struct JS_Module_Entry *prev, *next;	// Most recently used first
+} JS_Module_Entry;
+
+/* Modules of a worker */
+typedef struct {
+	JS_Module_Entry *head, *tail;
+
+	size_t bytes;			// Bytecode held
+	size_t maxBytes;		// Most bytecode to hold before least recently used is dropped
+} JS_Module_Cache;
+
+/* Function prototypes */
+JS_Module_Cache *createJSModuleCache(size_t);	// Allocate mem and setup a JS_Module_Cache
+void freeJSModuleCache(JS_Module_Cache *);	// Release mem associated with a JS_Module_Cache, and its entries
+JS_Module_Entry *getJSModuleEntry(JS_Module_Cache *, char *);	// Find a compiled module, marking it used
+void dropJSModuleEntry(JS_Module_Cache *, JS_Module_Entry *);	// Forget a compiled module
+bool putJSModuleEntry(JS_Module_Cache *, char *, long, char *, char *, size_t);	// Hold a compiled module
+void getJSModuleCacheKey(VFile_Entry *, char *);	// Key a compiled module is cached under
+JSObject *getJSModuleScript(JSContext *, JSObject *, char *);	// Get a module's script, held, cached or compiled
+JSBool runJSModule(JSContext *, JSObject *, JSObject *, char *, JSObject *, jsval *);	// Run a module's script, getting its exports
+
+#endif
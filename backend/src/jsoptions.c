@@ -0,0 +1,71 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: SpiderMonkey engine options a rule's script is run with, as
+ *  set per logic (see logic.engineOptions)
+ *
+ * Note: Which options suit a script is best found by running it under
+ *  each of them with jsbench (make bench). Short scripts finish before
+ *  a JIT pays for itself, loop heavy ones gain most from the method JIT.
+*/
+
+#include<stdio.h>
+#include<string.h>
+#include "jsoptions.h"
+
+
+/*
+ * Purpose: Work out the SpiderMonkey options for engine options
+ *
+ * Entry:
+ * 	1st - Engine options, JS_ENGINE_* bits
+ *
+ * Exit:
+ * 	JSOPTION_* bits, to hand to JS_SetOptions()
+ *
+ * Note: JSOPTION_VAROBJFIX and JSOPTION_COMPILE_N_GO are always on, they're
+ * 	what every rule has been run with.
+*/
+uint32 getJSEngineOptions(int engineOptions) {
+	uint32 options = JSOPTION_VAROBJFIX | JSOPTION_COMPILE_N_GO;
+
+	if(engineOptions & JS_ENGINE_TRACEJIT)
+		options |= JSOPTION_JIT;
+
+	if(engineOptions & JS_ENGINE_METHODJIT)
+		options |= JSOPTION_METHODJIT;
+
+	if((engineOptions & JS_ENGINE_PROFILING) && (engineOptions & JS_ENGINE_TRACEJIT) && (engineOptions & JS_ENGINE_METHODJIT))
+		options |= JSOPTION_PROFILING;
+
+	if(engineOptions & JS_ENGINE_STRICT)
+		options |= JSOPTION_STRICT;
+
+	return options;
+}
+
+
+/*
+ * Purpose: Get a readable name for engine options, e.g. "tracejit+strict"
+ *
+ * Entry:
+ * 	1st - Engine options, JS_ENGINE_* bits
+ * 	2nd - String to fill
+ * 	3rd - Size of string, JS_ENGINE_LENGTH_NAME + 1 holds any name
+ *
+ * Exit:
+ * 	NONE
+*/
+void getJSEngineOptionsName(int engineOptions, char *name, size_t size) {
+
+	snprintf(name, size, "%s%s%s%s",
+		(engineOptions & JS_ENGINE_TRACEJIT) ? "+tracejit" : "",
+		(engineOptions & JS_ENGINE_METHODJIT) ? "+methodjit" : "",
+		((engineOptions & JS_ENGINE_PROFILING) && (engineOptions & JS_ENGINE_TRACEJIT) && (engineOptions & JS_ENGINE_METHODJIT)) ? "+profiling" : "",
+		(engineOptions & JS_ENGINE_STRICT) ? "+strict" : "");
+
+	if(name[0] == '\0')
+		snprintf(name, size, "interp");
+	else
+		memmove(name, name + 1, strlen(name));
+}
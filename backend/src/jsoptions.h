@@ -0,0 +1,30 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: SpiderMonkey engine options a rule's script is run with, as
+ *  set per logic (see logic.engineOptions)
+*/
+
+#ifndef __JSOPTIONS_H__
+#define __JSOPTIONS_H__
+
+#include<stddef.h>
+#include<jsapi.h>
+
+/* Bits of logic.engineOptions */
+#define JS_ENGINE_DEFAULT	0	// Use the server's options (js_engine_options of SCONFIG)
+#define JS_ENGINE_TRACEJIT	1	// Tracing JIT, JSOPTION_JIT
+#define JS_ENGINE_METHODJIT	2	// Method JIT, JSOPTION_METHODJIT
+#define JS_ENGINE_PROFILING	4	// With both JITs on, let SpiderMonkey pick per loop, JSOPTION_PROFILING
+#define JS_ENGINE_STRICT	8	// Extra warnings, JSOPTION_STRICT
+#define JS_ENGINE_INTERP	16	// Interpreter only, only needed so no JIT isn't 0 (= server's options)
+
+#define JS_ENGINE_ALL		31	// All the bits above
+
+#define JS_ENGINE_LENGTH_NAME	48	// Max length of a name from getJSEngineOptionsName()
+
+/* Function prototypes */
+uint32 getJSEngineOptions(int);			// SpiderMonkey JSOPTION_* for engine options
+void getJSEngineOptionsName(int, char *, size_t);	// Readable name of engine options
+
+#endif
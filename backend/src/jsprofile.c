@@ -0,0 +1,416 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Profile a sample of rule runs, where each run's time goes and
+ *  what it asks of the database, so expensive voids can be found
+ *
+ * Note: One run in js_profile_sample (see SCONFIG) is profiled, picked at
+ *  random so one shot workers are sampled as evenly as pooled ones. A
+ *  run not sampled costs a few compares. Profiled runs are kept by the
+ *  worker and written JS_PROFILE_BATCH at a time, the rest are written
+ *  when the worker retires (see flushJSProfile()).
+ *
+ * Note 2: Each run is a row in logic_profile, with a row in
+ *  logic_profile_native for each Thwonk.* native it called. Rows older
+ *  than js_profile_keep_days are removed a few at a time as new ones are
+ *  written. "rulerunner --profile-top" rolls them up.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "jsprofile.h"
+#include "setupthang.h"
+#include "dbchatter.h"
+
+/* Profiler of this worker */
+static JS_Profile _jsProfile;
+
+/* Random sampling is seeded once per worker */
+static int _jsProfileSeeded = 0;
+
+/* Names of the natives, indexed by JS_PROFILE_NATIVE_* */
+static const char *_jsProfileNatives[JS_PROFILE_NATIVES] = {
+	"Thwonk.print",
+	"Thwonk.version",
+	"Thwonk.message.getCurrent",
+	"Thwonk.message.sendAll",
+	"Thwonk.message.sendMember",
+	"Thwonk.message.count",
+	"Thwonk.message.next",
+	"Thwonk.file.read",
+	"Thwonk.file.write",
+	"Thwonk.member.test",
+	"Thwonk.require"
+};
+
+
+/*
+ * Purpose: Start a rule run, it's profiled if it's picked for the sample
+ *
+ * Entry:
+ * 	1st - Void the rule is for
+ *
+ * Exit:
+ * 	NONE
+*/
+void startJSProfile(long voidId) {
+
+	_jsProfile.active = 0;
+	_jsProfile.native = JS_PROFILE_NATIVE_NONE;
+
+	if(_config->js_profile_sample <= 0)
+		return;
+
+	if(_jsProfileSeeded == 0) {
+		srandom((unsigned int)(getpid() ^ getJSProfileUsec()));
+		_jsProfileSeeded = 1;
+	}
+
+	if(random() % _config->js_profile_sample != 0)
+		return;
+
+	memset(&_jsProfile.run, 0, sizeof(_jsProfile.run));
+
+	_jsProfile.run.voidId = voidId;
+	_jsProfile.run.source = JS_PROFILE_SOURCE_COMPILED;
+
+	_jsProfile.dbStarted = dbQueryCount();
+	_jsProfile.marked = getJSProfileUsec();
+	_jsProfile.active = 1;
+}
+
+
+/*
+ * Purpose: A phase of the run in progress has ended, the time since the
+ * 	last phase ended is added to it
+ *
+ * Entry:
+ * 	1st - Phase, JS_PROFILE_*
+ *
+ * Exit:
+ * 	NONE
+*/
+void markJSProfile(int phase) {
+	long now;
+
+	if(_jsProfile.active == 0)
+		return;
+
+	now = getJSProfileUsec();
+
+	_jsProfile.run.usec[phase] += now - _jsProfile.marked;
+	_jsProfile.marked = now;
+}
+
+
+/*
+ * Purpose: Note the logic the run in progress got
+ *
+ * Entry:
+ * 	1st - Logic id
+ *
+ * Exit:
+ * 	NONE
+*/
+void setJSProfileLogic(long logicId) {
+
+	if(_jsProfile.active == 1)
+		_jsProfile.run.logicId = logicId;
+}
+
+
+/*
+ * Purpose: Note where the script of the run in progress came from
+ *
+ * Entry:
+ * 	1st - JS_PROFILE_SOURCE_*
+ *
+ * Exit:
+ * 	NONE
+*/
+void setJSProfileSource(int source) {
+
+	if(_jsProfile.active == 1)
+		_jsProfile.run.source = source;
+}
+
+
+/*
+ * Purpose: A Thwonk.* native has been called by the run in progress
+ *
+ * Entry:
+ * 	1st - Native, JS_PROFILE_NATIVE_*
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Natives don't call back into the script, so only one runs at once.
+ * 	Thwonk.require() stops its timing before it runs the module.
+*/
+void startJSProfileNative(int native) {
+
+	if(_jsProfile.active == 0)
+		return;
+
+	_jsProfile.native = native;
+	_jsProfile.nativeStarted = getJSProfileUsec();
+}
+
+
+/*
+ * Purpose: The native called last is returning
+ *
+ * Entry:
+ * 	1st - What the native returns
+ *
+ * Exit:
+ * 	1st, so a native can return stopJSProfileNative(JS_TRUE)
+*/
+JSBool stopJSProfileNative(JSBool ret) {
+
+	if(_jsProfile.active == 0 || _jsProfile.native == JS_PROFILE_NATIVE_NONE)
+		return ret;
+
+	_jsProfile.run.nativeCalls[_jsProfile.native]++;
+	_jsProfile.run.nativeUsec[_jsProfile.native] += getJSProfileUsec() - _jsProfile.nativeStarted;
+	_jsProfile.native = JS_PROFILE_NATIVE_NONE;
+
+	return ret;
+}
+
+
+/*
+ * Purpose: Count bytes the run in progress read and wrote through
+ * 	Thwonk.file
+ *
+ * Entry:
+ * 	1st - Bytes read
+ * 	2nd - Bytes written
+ *
+ * Exit:
+ * 	NONE
+*/
+void addJSProfileFileBytes(long bytesRead, long bytesWritten) {
+
+	if(_jsProfile.active == 0)
+		return;
+
+	_jsProfile.run.fileRead += bytesRead;
+	_jsProfile.run.fileWritten += bytesWritten;
+}
+
+
+/*
+ * Purpose: The run in progress has finished, keep its profile to be
+ * 	written with the rest of the batch
+ *
+ * Entry:
+ * 	1st - What the run returned
+ *
+ * Exit:
+ * 	NONE
+*/
+void stopJSProfile(ERRTYPE result) {
+
+	if(_jsProfile.active == 0)
+		return;
+
+	_jsProfile.active = 0;
+
+	_jsProfile.run.result = (result == ERR_NONE) ? 0 : result;	// Stored as 0 = ok
+	_jsProfile.run.runDate = time(NULL);
+	_jsProfile.run.dbQueries = dbQueryCount() - _jsProfile.dbStarted;
+
+	_jsProfile.batch[_jsProfile.batched++] = _jsProfile.run;
+
+	if(_jsProfile.batched >= JS_PROFILE_BATCH)
+		flushJSProfile();
+}
+
+
+/*
+ * Purpose: Write the profiled runs kept by this worker to the database
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Called when the batch is full and when the worker retires, before
+ * 	it lets go of the database. Profiles that can't be written are
+ * 	dropped, they aren't worth holding up rules for.
+*/
+void flushJSProfile() {
+	DBRESULT *result;
+	JS_Profile_Run *run;
+	char *runs, *natives;
+	size_t runsLength, nativesLength, runsUsed = 0, nativesUsed = 0;
+	long nativeUsec, nativeCalls;
+	int i, j;
+
+	if(_jsProfile.batched == 0)
+		return;
+
+	runsLength = (_jsProfile.batched * JS_PROFILE_LENGTH_ROW) + 1;
+	nativesLength = (_jsProfile.batched * JS_PROFILE_NATIVES * JS_PROFILE_LENGTH_ROW) + 1;
+
+	runs = (char *)malloc(runsLength);
+	natives = (char *)malloc(nativesLength);
+
+	if(runs == NULL || natives == NULL) {
+		free(runs);
+		free(natives);
+		_jsProfile.batched = 0;
+		return;
+	}
+
+	natives[0] = '\0';
+
+	for(i = 0; i < _jsProfile.batched; i++) {
+		run = &_jsProfile.batch[i];
+
+		for(j = 0, nativeUsec = 0, nativeCalls = 0; j < JS_PROFILE_NATIVES; j++) {
+			if(run->nativeCalls[j] == 0)
+				continue;
+
+			nativeUsec += run->nativeUsec[j];
+			nativeCalls += run->nativeCalls[j];
+
+			nativesUsed += snprintf(natives + nativesUsed, nativesLength - nativesUsed, "%s(%ld, FROM_UNIXTIME(%ld), %d, %ld, %ld)",
+				(nativesUsed == 0) ? "" : ",", run->voidId, (long)run->runDate, j, run->nativeCalls[j], run->nativeUsec[j]);
+		}
+
+		runsUsed += snprintf(runs + runsUsed, runsLength - runsUsed, "%s(%ld, %ld, FROM_UNIXTIME(%ld), %d, %d, %ld, %ld, %ld, %ld, %ld, %ld, %ld, %ld, %ld)",
+			(i == 0) ? "" : ",", run->voidId, run->logicId, (long)run->runDate, run->source, run->result,
+			run->usec[JS_PROFILE_SETUP], run->usec[JS_PROFILE_LOOKUP], run->usec[JS_PROFILE_COMPILE], run->usec[JS_PROFILE_EXECUTE],
+			nativeUsec, nativeCalls, run->dbQueries, run->fileRead, run->fileWritten);
+	}
+
+	_jsProfile.batched = 0;
+
+	result = dbQuery("INSERT INTO logic_profile (voidId, logicId, runDate, source, result, setupUsec, lookupUsec, compileUsec, executeUsec, nativeUsec, nativeCalls, dbQueries, fileRead, fileWritten) VALUES %s", runs);
+	dbQueryFreeResult(result);
+
+	if(getErrType() == ERR_NONE && nativesUsed > 0) {
+		result = dbQuery("INSERT INTO logic_profile_native (voidId, runDate, native, calls, usec) VALUES %s", natives);
+		dbQueryFreeResult(result);
+	}
+
+	if(getErrType() != ERR_NONE)
+		printf("Couldn't write rule profiles: %s\n", getErrTypeMsg());
+
+	free(runs);
+	free(natives);
+
+	if(_config->js_profile_keep_days <= 0)
+		return;
+
+	// Keep the tables from growing for ever
+	result = dbQuery("DELETE FROM logic_profile WHERE runDate < NOW() - INTERVAL %ld DAY LIMIT %d", _config->js_profile_keep_days, JS_PROFILE_PRUNE_BATCH);
+	dbQueryFreeResult(result);
+
+	result = dbQuery("DELETE FROM logic_profile_native WHERE runDate < NOW() - INTERVAL %ld DAY LIMIT %d", _config->js_profile_keep_days, JS_PROFILE_PRUNE_BATCH);
+	dbQueryFreeResult(result);
+}
+
+
+/*
+ * Purpose: Print the voids whose rules cost the most, and the natives
+ * 	rules spend the most time in
+ *
+ * Entry:
+ * 	1st - How many of each to print
+ * 	2nd - Hours of profiles to look at
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false, and err type set
+ *
+ * Note: Only sampled runs are in the profile, counts and totals are of
+ * 	about 1 in js_profile_sample of the runs.
+*/
+bool printJSProfileTop(int top, int hours) {
+	DBRESULT *result;
+	DBROW row;
+	long calls, usec;
+
+	result = dbQuery("SELECT voidId, COUNT(*), SUM(setupUsec + lookupUsec + compileUsec + executeUsec) AS total, AVG(lookupUsec), AVG(compileUsec), AVG(executeUsec), AVG(nativeUsec), AVG(dbQueries), SUM(fileRead + fileWritten), SUM(result != 0) FROM logic_profile WHERE runDate >= NOW() - INTERVAL %d HOUR GROUP BY voidId ORDER BY total DESC LIMIT %d", hours, top);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	printf("Rule runs profiled in the last %d hours, about 1 in %ld runs is sampled\n\n", hours, _config->js_profile_sample);
+
+	printf("Most expensive voids, times are averages per run\n");
+	printf("%12s %8s %10s %10s %10s %10s %10s %8s %12s %7s\n", "void", "runs", "total ms", "lookup us", "compile us", "execute us", "native us", "queries", "file bytes", "failed");
+
+	while((row = dbQueryGetRow(result)) != NULL) {
+		printf("%12ld %8ld %10ld %10ld %10ld %10ld %10ld %8.1f %12ld %7ld\n", atol(row[0]), atol(row[1]), atol(row[2]) / 1000,
+			atol(row[3]), atol(row[4]), atol(row[5]), atol(row[6]), atof(row[7]), (row[8] != NULL) ? atol(row[8]) : 0, atol(row[9]));
+	}
+
+	dbQueryFreeResult(result);
+
+	result = dbQuery("SELECT native, SUM(calls), SUM(usec) AS total, COUNT(DISTINCT voidId) FROM logic_profile_native WHERE runDate >= NOW() - INTERVAL %d HOUR GROUP BY native ORDER BY total DESC LIMIT %d", hours, top);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	printf("\nMost expensive natives\n");
+	printf("%-28s %10s %10s %10s %8s\n", "native", "calls", "total ms", "us a call", "voids");
+
+	while((row = dbQueryGetRow(result)) != NULL) {
+		calls = atol(row[1]);
+		usec = atol(row[2]);
+
+		printf("%-28s %10ld %10ld %10ld %8ld\n", getJSProfileNativeName(atoi(row[0])), calls, usec / 1000,
+			(calls > 0) ? usec / calls : 0, atol(row[3]));
+	}
+
+	dbQueryFreeResult(result);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Get the name of a native
+ *
+ * Entry:
+ * 	1st - JS_PROFILE_NATIVE_*
+ *
+ * Exit:
+ * 	Name, e.g. "Thwonk.file.read"
+*/
+const char *getJSProfileNativeName(int native) {
+
+	if(native < 0 || native >= JS_PROFILE_NATIVES)
+		return "unknown";
+
+	return _jsProfileNatives[native];
+}
+
+
+/*
+ * Purpose: Get the time of a clock that only goes forward
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	Microsecs
+*/
+long getJSProfileUsec() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000000L) + (now.tv_nsec / 1000L);
+}
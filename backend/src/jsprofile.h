@@ -0,0 +1,93 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Profile a sample of rule runs, where each run's time goes and
+ *  what it asks of the database, so expensive voids can be found
+*/
+
+#ifndef __JSPROFILE_H__
+#define __JSPROFILE_H__
+
+#include<time.h>
+#include<jsapi.h>
+#include "codewide.h"
+#include "logerror.h"
+
+#define JS_PROFILE_LENGTH_ROW	400	// Most SQL a profiled run or one of its natives adds to an INSERT
+
+/* Phases of a run, see markJSProfile() */
+#define JS_PROFILE_SETUP	0	// Context, global and Thwonk object
+#define JS_PROFILE_LOOKUP	1	// Finding the void's logic
+#define JS_PROFILE_COMPILE	2	// Compiling, or loading bytecode
+#define JS_PROFILE_EXECUTE	3	// Running the script, natives included
+#define JS_PROFILE_PHASES	4
+
+/* Where a run's script came from, logic_profile.source */
+#define JS_PROFILE_SOURCE_COMPILED	0	// Compiled from source
+#define JS_PROFILE_SOURCE_CACHE		1	// Bytecode in logic.logicCache
+#define JS_PROFILE_SOURCE_HELD		2	// Bytecode the worker held (see jscache.c)
+
+/* Thwonk.* natives, logic_profile_native.native, keep in step with _jsProfileNatives */
+#define JS_PROFILE_NATIVE_PRINT			0
+#define JS_PROFILE_NATIVE_VERSION		1
+#define JS_PROFILE_NATIVE_MESSAGE_GETCURRENT	2
+#define JS_PROFILE_NATIVE_MESSAGE_SENDALL	3
+#define JS_PROFILE_NATIVE_MESSAGE_SENDMEMBER	4
+#define JS_PROFILE_NATIVE_MESSAGE_COUNT		5
+#define JS_PROFILE_NATIVE_MESSAGE_NEXT		6
+#define JS_PROFILE_NATIVE_FILE_READ		7
+#define JS_PROFILE_NATIVE_FILE_WRITE		8
+#define JS_PROFILE_NATIVE_MEMBER_TEST		9
+#define JS_PROFILE_NATIVE_REQUIRE		10
+#define JS_PROFILE_NATIVES			11
+#define JS_PROFILE_NATIVE_NONE			-1	// No native running
+
+/* One profiled run */
+typedef struct {
+	long voidId;
+	long logicId;			// 0 = no logic found
+	time_t runDate;			// When the run finished
+
+	int source;			// JS_PROFILE_SOURCE_*
+	ERRTYPE result;			// What the run returned, 0 for ERR_NONE
+
+	long usec[JS_PROFILE_PHASES];	// Microsecs spent in each phase
+
+	long nativeCalls[JS_PROFILE_NATIVES];	// Calls of each native
+	long nativeUsec[JS_PROFILE_NATIVES];	// Microsecs inside each native, part of JS_PROFILE_EXECUTE
+
+	long dbQueries;			// Queries the run issued (see dbQueryCount())
+	long fileRead;			// Bytes read through Thwonk.file
+	long fileWritten;		// Bytes written through Thwonk.file
+} JS_Profile_Run;
+
+/* Profiler of a rule runner worker */
+typedef struct {
+	int active;			// 1 = the run in progress is being profiled
+	JS_Profile_Run run;		// Run in progress
+
+	long marked;			// When the last phase ended (see getJSProfileUsec())
+	long dbStarted;			// dbQueryCount() when the run started
+
+	int native;			// Native running, JS_PROFILE_NATIVE_NONE = none
+	long nativeStarted;		// When it was called
+
+	JS_Profile_Run batch[JS_PROFILE_BATCH];	// Finished runs not yet written to the database
+	int batched;
+} JS_Profile;
+
+/* Function prototypes */
+void startJSProfile(long);			// Start a run, profiled if it's sampled
+void markJSProfile(int);			// A phase of the run has ended
+void setJSProfileLogic(long);			// Logic the run got
+void setJSProfileSource(int);			// Where the run's script came from
+void startJSProfileNative(int);			// A native has been called
+JSBool stopJSProfileNative(JSBool);		// The native is returning
+void addJSProfileFileBytes(long, long);		// Bytes read and written through Thwonk.file
+void stopJSProfile(ERRTYPE);			// The run has finished
+void flushJSProfile();				// Write the finished runs to the database
+bool printJSProfileTop(int, int);		// Print the most expensive voids and natives
+const char *getJSProfileNativeName(int);	// Name of a native
+long getJSProfileUsec();			// Microsecs of a clock that only goes forward
+
+#endif
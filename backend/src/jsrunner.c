@@ -6,9 +6,13 @@
 
 #include<stdlib.h>
 #include<string.h>
+#include "setupthang.h"
 #include "jsrunner.h"
 #include "jsthwonk.h"
 #include "mnglogic.h"
+#include "jsbudget.h"
+#include "jsoptions.h"
+#include "jsprofile.h"
 
 
 JSClass js_global_object_class = {
@@ -26,6 +30,13 @@ JSClass js_global_object_class = {
 };
 
 
+/* SpiderMonkey context (and its runtime) kept by this worker between rules, see getJSRunnerContext() */
+static JSContext *_jsContext = NULL;
+
+/* Compiled logic held by this worker, see getJSRunnerHeldScript() */
+static JS_Cache *_jsCache = NULL;
+
+
 /*
  * Purpose: Carry out rule running in this spun off thread
  *
@@ -35,80 +46,149 @@ JSClass js_global_object_class = {
  * Exit:
  *	SUCCESS = ERR_NONE
  * 	FAILURE = ERR_* (type of error)
+ *
+ * Note: A sample of runs are profiled (see jsprofile.c).
 */
 ERRTYPE spawnRuleRunner(Queue_Entry *qentry) {
+	ERRTYPE ret;
+
+	startJSProfile(qentry->voidId);
+
+	ret = runJSRunnerRule(qentry);
+
+	stopJSProfile(ret);
+
+	return ret;
+}
+
+
+/*
+ * Purpose: Run the void's logic on a queue entry
+ *
+ * Entry:
+ * 	1st - Queue entry
+ *
+ * Exit:
+ *	SUCCESS = ERR_NONE
+ * 	FAILURE = ERR_* (type of error)
+ *
+ * Note: Every rule gets its own compartment and global object with fresh
+ * 	standard classes and Thwonk object, even when the runtime is reused,
+ * 	so nothing one rule does can be seen by the next.
+ *
+ * Note 2: The script is loaded from bytecode this worker holds for the
+ * 	void (see getJSRunnerHeldScript()), or else from the bytecode cached
+ * 	with the logic when there is any for this version of it (see
+ * 	getJSRunnerScript()).
+ *
+ * Note 3: The script is stopped if it goes over the CPU, run time or
+ * 	heap budget of its logic (see jsbudget.c). The most heap a run of
+ * 	the logic uses is recorded with the logic.
+ *
+ * Note 4: A reused context keeps the last rule's engine options, so they're
+ * 	set for every rule from its logic (see setJSRunnerOptions()).
+*/
+ERRTYPE runJSRunnerRule(Queue_Entry *qentry) {
 	JSObject *script = NULL;
-	JSRuntime *rt = NULL;
 	JSContext *cx = NULL;
 	JSBool ret;
 	JSObject *global;
 	jsval rval;
 	Logic_Entry *lentry;
 
-	if((lentry = getLogicEntryForVoid(qentry->voidId)) == NULL) {
-		printf("logic 2\r\n");
-		return ERR_NONE;
-	}
-
-	rt = JS_NewRuntime(SPIDERMONKEY_ALLOC_RAM);
-
-	if(rt == NULL) {
-		return ERR_UNKNOWN;
-	}
-
-	/*
-	 * 8192 = size of each stack chunk (not stack size)
-	 *
-	 * Apparently this is an internal variable in spidermonkey
-	 * that shouldn't be tweaked without knowing a lot about
-	 * spidermonkey's garbage collection.
-	*/
-	cx = JS_NewContext(rt, 8192);
-
-	if(cx == NULL) {
-		JS_DestroyRuntime(rt);
+	if((cx = getJSRunnerContext()) == NULL) {
 		return ERR_UNKNOWN;
 	}
 
-	JS_SetOptions(cx, JSOPTION_VAROBJFIX | JSOPTION_JIT | JSOPTION_COMPILE_N_GO); // JSOPTION_METHODJIT
-	JS_SetVersion(cx, JSVERSION_LATEST);
-
-	JS_SetErrorReporter(cx, jsErrorHandler);
-
 	// Create the global object in a new compartment. See http://developer.mozilla.org/En/SpiderMonkey/JSAPI_User_Guide#Native_functions
 	global = JS_NewCompartmentAndGlobalObject(cx, &js_global_object_class, NULL);
 
     	if (global == NULL) {
-		JS_DestroyContext(cx);
-		JS_DestroyRuntime(rt);
+		releaseJSRunnerContext(cx);
 		return ERR_UNKNOWN;
 	}
 
+	// The context runs in its global's compartment, a reused context would otherwise still
+	//  be in the last rule's
+	JS_SetGlobalObject(cx, global);
+
 	if(JS_InitStandardClasses(cx, global) == false) {
-		JS_DestroyContext(cx);
-		JS_DestroyRuntime(rt);
+		releaseJSRunnerContext(cx);
 		return ERR_UNKNOWN;
 	}
 
 	createJSObjectThwonk(cx, global, qentry);
 
-	script = JS_CompileScript(cx, global, lentry->logic, strlen(lentry->logic), "<inline>", 0);
+	if((lentry = createLogicEntry()) == NULL) {
+		releaseJSRunnerContext(cx);
+		return ERR_MEM_ALLOC;
+	}
+
+	markJSProfile(JS_PROFILE_SETUP);
+
+	// Logic this worker already holds for the void, otherwise get it from the database
+	if((script = getJSRunnerHeldScript(cx, qentry->voidId, lentry)) == NULL) {
+
+		freeLogicEntry(lentry);
+
+		if((lentry = getLogicEntryForVoid(qentry->voidId)) == NULL) {
+			printf("logic 2\r\n");
+			releaseJSRunnerContext(cx);
+			return ERR_NONE;
+		}
+
+		markJSProfile(JS_PROFILE_LOOKUP);
+		setJSProfileLogic(lentry->id);
+
+		setJSRunnerOptions(cx, lentry);
+
+		script = getJSRunnerScript(cx, global, lentry, qentry->voidId);
+	} else {
+		setJSProfileLogic(lentry->id);
+		setJSProfileSource(JS_PROFILE_SOURCE_HELD);
+
+		setJSRunnerOptions(cx, lentry);
+	}
+
+	markJSProfile(JS_PROFILE_COMPILE);
 
 	if(script == NULL) {
 		// TODO: Log error to database for script writer to see
 		printf("Couldn't compiled the script\n");
-		JS_DestroyContext(cx);
-		JS_DestroyRuntime(rt);
+		freeLogicEntry(lentry);
+		releaseJSRunnerContext(cx);
 		return ERR_UNKNOWN;
 	}
 
+	startJSBudget(cx, lentry);
+
 	ret = JS_ExecuteScript(cx, global, script, &rval);
- 
+
+	stopJSBudget();
+
+	markJSProfile(JS_PROFILE_EXECUTE);
+
+	recordJSRunnerHeapPeak(lentry, qentry->voidId, getJSBudgetHeapPeak());
+	freeLogicEntry(lentry);
+
+	if(ret == JS_FALSE && isJSBudgetExceeded() == true) {
+		// TODO: Log error to database for script writer to see
+		printf("Script for void %ld went over its budget.\n", qentry->voidId);
+		releaseJSRunnerContext(cx);
+		return ERR_JS_BUDGET;
+	}
+
+	if(ret == JS_FALSE && isJSBudgetHeapExceeded() == true) {
+		// TODO: Log error to database for script writer to see
+		printf("Script for void %ld went over its heap budget.\n", qentry->voidId);
+		releaseJSRunnerContext(cx);
+		return ERR_JS_HEAP;
+	}
+
 	if(ret == JS_FALSE) {
 		// TODO: Log error to database for script writer to see
 		printf("Failed to run compiled script.\n");
-		JS_DestroyContext(cx);
-		JS_DestroyRuntime(rt);
+		releaseJSRunnerContext(cx);
 		return ERR_UNKNOWN;
 	}
 
@@ -116,14 +196,356 @@ ERRTYPE spawnRuleRunner(Queue_Entry *qentry) {
 
 //	printf("script result: %s\n", JS_GetStringBytes(str));
 
-	JS_DestroyContext(cx);
-	JS_DestroyRuntime(rt);
-	JS_ShutDown();		// Is this needed since thread is ending on return from this function?
+	releaseJSRunnerContext(cx);
 
 	return ERR_NONE;
 }
 
 
+/*
+ * Purpose: Work out the key compiled logic is cached under, anything that
+ * 	would make the bytecode differ is part of it
+ *
+ * Entry:
+ * 	1st - Logic
+ * 	2nd - String to fill, at least LOGIC_LENGTH_CACHE_KEY + 1 long
+ *
+ * Exit:
+ * 	NONE
+*/
+void getJSRunnerCacheKey(Logic_Entry *lentry, char *key) {
+
+	snprintf(key, LOGIC_LENGTH_CACHE_KEY + 1, "%lx:%d:%s:%lu:%s", (unsigned long)JSXDR_BYTECODE_VERSION,
+		lentry->version, (lentry->editDate == NULL) ? "" : lentry->editDate, (unsigned long)lentry->logicLength,
+		(lentry->logicHash == NULL) ? "" : lentry->logicHash);
+}
+
+
+/*
+ * Purpose: Get a rule's script ready to run, from the bytecode cached with
+ * 	its logic if that's up to date, otherwise by compiling its source
+ *
+ * Entry:
+ * 	1st - Context, in the rule's compartment
+ * 	2nd - Global object of the rule
+ * 	3rd - Logic of the rule
+ * 	4th - Void the rule is for, the worker holds on to the bytecode for it
+ *
+ * Exit:
+ * 	SUCCESS = Script object
+ * 	FAILURE = NULL, script doesn't compile
+ *
+ * Note: The cache is stale when the SpiderMonkey bytecode version, the
+ * 	logic's version or edit date, or the length or MD5 of its source
+ * 	change. The MD5 catches logic updated in place without bumping its
+ * 	version or edit date (e.g. javascript/bumplist.js).
+ * 	A stale cache or bytecode that won't load is replaced by compiling
+ * 	the source and storing the result, failing to store it only costs
+ * 	the next rule a compile.
+ *
+ * Note 2: Scripts are compiled without JSOPTION_COMPILE_N_GO, bytecode
+ * 	compiled that way is bound to the global it was compiled against and
+ * 	can't be loaded into another.
+*/
+JSObject *getJSRunnerScript(JSContext *cx, JSObject *global, Logic_Entry *lentry, long voidId) {
+	JSObject *script = NULL;
+	JSXDRState *xdr;
+	uint32 options, length;
+	void *data;
+	char key[LOGIC_LENGTH_CACHE_KEY + 1];
+
+	getJSRunnerCacheKey(lentry, key);
+
+	// Load from the cache
+	if(lentry->logicCacheKey != NULL && strcmp(lentry->logicCacheKey, key) == 0
+		&& (script = loadJSRunnerBytecode(cx, lentry->logicCache, lentry->logicCacheLength)) != NULL) {
+
+		if(_jsCache != NULL)
+			putJSCacheEntry(_jsCache, voidId, lentry, key, lentry->logicCache, lentry->logicCacheLength);
+
+		setJSProfileSource(JS_PROFILE_SOURCE_CACHE);
+
+		return script;
+	}
+
+	options = JS_SetOptions(cx, JS_GetOptions(cx) & ~JSOPTION_COMPILE_N_GO);
+
+	script = JS_CompileScript(cx, global, lentry->logic, strlen(lentry->logic), "<inline>", 0);
+
+	JS_SetOptions(cx, options);
+
+	if(script == NULL)
+		return NULL;
+
+	// Refresh the cache
+	if((xdr = JS_XDRNewMem(cx, JSXDR_ENCODE)) != NULL) {
+
+		if(JS_XDRScriptObject(xdr, &script) == JS_TRUE && (data = JS_XDRMemGetData(xdr, &length)) != NULL) {
+			if(_jsCache != NULL)
+				putJSCacheEntry(_jsCache, voidId, lentry, key, (char *)data, length);
+
+			if(updateLogicCache(lentry->id, key, (char *)data, length) == false)
+				printf("Couldn't cache compiled logic %ld: %s\n", lentry->id, getErrTypeMsg());
+		} else {
+			JS_ClearPendingException(cx);
+		}
+
+		JS_XDRDestroy(xdr);
+	}
+
+	return script;
+}
+
+
+/*
+ * Purpose: Load a script from its bytecode
+ *
+ * Entry:
+ * 	1st - Context, in the rule's compartment
+ * 	2nd - Bytecode, not changed or freed
+ * 	3rd - Length of bytecode
+ *
+ * Exit:
+ * 	SUCCESS = Script object
+ * 	FAILURE = NULL, bytecode won't load (e.g. from another SpiderMonkey)
+*/
+JSObject *loadJSRunnerBytecode(JSContext *cx, char *bytecode, size_t length) {
+	JSObject *script = NULL;
+	JSXDRState *xdr;
+
+	if((xdr = JS_XDRNewMem(cx, JSXDR_DECODE)) == NULL)
+		return NULL;
+
+	JS_XDRMemSetData(xdr, bytecode, (uint32)length);
+
+	if(JS_XDRScriptObject(xdr, &script) == JS_FALSE) {
+		JS_ClearPendingException(cx);
+		script = NULL;
+	}
+
+	// Bytecode belongs to the caller, not the XDR state
+	JS_XDRMemSetData(xdr, NULL, 0);
+	JS_XDRDestroy(xdr);
+
+	return script;
+}
+
+
+/*
+ * Purpose: Get a rule's script from the logic this worker holds for its
+ * 	void, without asking the database for the logic
+ *
+ * Entry:
+ * 	1st - Context, in the rule's compartment
+ * 	2nd - Void the rule is for
+ * 	3rd - Logic_Entry to fill with the id, budgets, peak heap and engine
+ * 		options of the held logic
+ *
+ * Exit:
+ * 	SUCCESS = Script object
+ * 	FAILURE = NULL, nothing held or it's out of date
+ *
+ * Note: Logic held for longer than JS_CACHE_CHECK_SEC is checked against
+ * 	the version of the void's logic in the database, which doesn't fetch
+ * 	the logic itself. Until then a void's rules start with no database
+ * 	work at all, a rule may run the old version of edited logic for up
+ * 	to that long.
+*/
+JSObject *getJSRunnerHeldScript(JSContext *cx, long voidId, Logic_Entry *held) {
+	JS_Cache_Entry *entry;
+	Logic_Entry *lentry;
+	JSObject *script;
+	char key[LOGIC_LENGTH_CACHE_KEY + 1];
+	time_t now;
+
+	if(_jsCache == NULL && (_jsCache = createJSCache(JS_CACHE_MAX_BYTES)) == NULL)
+		return NULL;
+
+	if((entry = getJSCacheEntry(_jsCache, voidId)) == NULL)
+		return NULL;
+
+	if((now = time(NULL)) - entry->checked >= JS_CACHE_CHECK_SEC) {
+
+		if((lentry = getLogicVersionForVoid(voidId)) != NULL)
+			getJSRunnerCacheKey(lentry, key);
+
+		if(lentry == NULL || lentry->id != entry->logicId || strcmp(key, entry->key) != 0) {
+			freeLogicEntry(lentry);
+			dropJSCacheEntry(_jsCache, entry);
+			return NULL;
+		}
+
+		entry->maxCpuMsec = lentry->maxCpuMsec;
+		entry->maxWallMsec = lentry->maxWallMsec;
+		entry->maxHeapBytes = lentry->maxHeapBytes;
+		entry->engineOptions = lentry->engineOptions;
+
+		if(lentry->peakHeapBytes > entry->peakHeapBytes)
+			entry->peakHeapBytes = lentry->peakHeapBytes;
+
+		freeLogicEntry(lentry);
+		entry->checked = now;
+	}
+
+	held->id = entry->logicId;
+	held->maxCpuMsec = entry->maxCpuMsec;
+	held->maxWallMsec = entry->maxWallMsec;
+	held->maxHeapBytes = entry->maxHeapBytes;
+	held->peakHeapBytes = entry->peakHeapBytes;
+	held->engineOptions = entry->engineOptions;
+
+	markJSProfile(JS_PROFILE_LOOKUP);
+
+	if((script = loadJSRunnerBytecode(cx, entry->bytecode, entry->length)) == NULL)
+		dropJSCacheEntry(_jsCache, entry);
+
+	return script;
+}
+
+
+/*
+ * Purpose: Record the heap a run of logic grew by, when it's more than
+ * 	the logic has been seen to use before
+ *
+ * Entry:
+ * 	1st - Logic that was run, its peakHeapBytes is updated
+ * 	2nd - Void the rule was for
+ * 	3rd - Bytes of GC heap the run grew by
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Runs of logic mostly use about the same heap, so the database is
+ * 	rarely written to once the logic has been run a few times.
+*/
+void recordJSRunnerHeapPeak(Logic_Entry *lentry, long voidId, long peakHeapBytes) {
+	JS_Cache_Entry *entry;
+
+	if(peakHeapBytes <= lentry->peakHeapBytes)
+		return;
+
+	lentry->peakHeapBytes = peakHeapBytes;
+
+	if(_jsCache != NULL && (entry = getJSCacheEntry(_jsCache, voidId)) != NULL && entry->logicId == lentry->id)
+		entry->peakHeapBytes = peakHeapBytes;
+
+	if(updateLogicPeakHeap(lentry->id, peakHeapBytes) == false)
+		printf("Couldn't record peak heap of logic %ld: %s\n", lentry->id, getErrTypeMsg());
+}
+
+
+/*
+ * Purpose: Set the engine options a rule's script runs with
+ *
+ * Entry:
+ * 	1st - Context the rule runs in
+ * 	2nd - Logic of the rule, an engineOptions of 0 uses the server's
+ * 		(js_engine_options of SCONFIG)
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Options that make no difference to bytecode (JITs and strict
+ * 	warnings) are all that logic can set, so bytecode cached with the
+ * 	logic stays good when they change.
+*/
+void setJSRunnerOptions(JSContext *cx, Logic_Entry *lentry) {
+	int engineOptions = lentry->engineOptions & JS_ENGINE_ALL;
+
+	if(engineOptions == JS_ENGINE_DEFAULT)
+		engineOptions = _config->js_engine_options;
+
+	JS_SetOptions(cx, getJSEngineOptions(engineOptions));
+}
+
+
+/*
+ * Purpose: Get a SpiderMonkey context to run a rule in, with its own
+ * 	runtime
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	SUCCESS = Context, hand back with releaseJSRunnerContext()
+ * 	FAILURE = NULL
+ *
+ * Note: With reuse_js_runtime set (see SCONFIG) the runtime and context are
+ * 	made the first time and kept for the life of the worker, a pooled
+ * 	worker then only pays for them once rather than for every rule.
+*/
+JSContext *getJSRunnerContext() {
+	JSRuntime *rt;
+	JSContext *cx;
+
+	if(_jsContext != NULL)
+		return _jsContext;
+
+	if((rt = JS_NewRuntime(SPIDERMONKEY_ALLOC_RAM)) == NULL)
+		return NULL;
+
+	/*
+	 * 8192 = size of each stack chunk (not stack size)
+	 *
+	 * Apparently this is an internal variable in spidermonkey
+	 * that shouldn't be tweaked without knowing a lot about
+	 * spidermonkey's garbage collection.
+	*/
+	if((cx = JS_NewContext(rt, 8192)) == NULL) {
+		JS_DestroyRuntime(rt);
+		return NULL;
+	}
+
+	JS_SetOptions(cx, getJSEngineOptions(_config->js_engine_options));
+	JS_SetVersion(cx, JSVERSION_LATEST);
+
+	JS_SetErrorReporter(cx, jsErrorHandler);
+
+	if(_config->reuse_js_runtime == 1)
+		_jsContext = cx;
+
+	return cx;
+}
+
+
+/*
+ * Purpose: Finished running a rule in a context got from
+ * 	getJSRunnerContext()
+ *
+ * Entry:
+ * 	1st - Context
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: A kept context lets go of the rule's global and garbage collects,
+ * 	which frees the rule's whole compartment. Anything else is destroyed
+ * 	along with its runtime.
+ *
+ * Note 2: No JS_ShutDown() here, a pooled worker runs many scripts and
+ * 	JS_ShutDown() should only be called once when the process is finished
+ * 	with Spidermonkey.
+*/
+void releaseJSRunnerContext(JSContext *cx) {
+	JSRuntime *rt;
+
+	if(cx == NULL)
+		return;
+
+	if(cx == _jsContext) {
+		JS_ClearPendingException(cx);
+		JS_SetGlobalObject(cx, NULL);
+		JS_GC(cx);
+		return;
+	}
+
+	rt = JS_GetRuntime(cx);
+
+	JS_DestroyContext(cx);
+	JS_DestroyRuntime(rt);
+}
+
+
 /*
  * Purpose: Gets called when an error occurs, print out error message.
  *
@@ -10,8 +10,19 @@
 #include<jsapi.h>
 #include "logerror.h"
 #include "msgqueue.h"
+#include "mnglogic.h"
+#include "jscache.h"
 
 ERRTYPE spawnRuleRunner(Queue_Entry *);		// Spin off a thread to run a rule
+ERRTYPE runJSRunnerRule(Queue_Entry *);		// Run the void's logic on a queue entry
+void getJSRunnerCacheKey(Logic_Entry *, char *);	// Key compiled logic is cached under
+JSObject *getJSRunnerScript(JSContext *, JSObject *, Logic_Entry *, long);	// Get a rule's script from cache or source
+JSObject *loadJSRunnerBytecode(JSContext *, char *, size_t);	// Load a script from its bytecode
+JSObject *getJSRunnerHeldScript(JSContext *, long, Logic_Entry *);	// Get a rule's script from logic the worker holds
+void recordJSRunnerHeapPeak(Logic_Entry *, long, long);	// Keep a new peak heap of a run of logic
+void setJSRunnerOptions(JSContext *, Logic_Entry *);	// Set the engine options a rule runs with
+JSContext *getJSRunnerContext();		// Get a context to run a rule in
+void releaseJSRunnerContext(JSContext *);	// Finished running a rule in a context
 void jsErrorHandler(JSContext *, const char *, JSErrorReport *);
 
 #endif
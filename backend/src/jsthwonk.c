@@ -15,6 +15,8 @@
 #include "mngvfile.h"
 #include "dbchatter.h"
 #include "misc.h"
+#include "jsprofile.h"
+#include "jsmodule.h"
 
 
 /*
@@ -40,13 +42,20 @@ JSObject *createJSObjectThwonk(JSContext *cx, JSObject *obj, Queue_Entry *qentry
 
 	JS_DefineFunctions(cx, jsThwonk, jsThwonk_methods);
 
+	// Modules required by this rule, see Thwonk.require()
+	if((jsObject = JS_NewObject(cx, NULL, NULL, NULL)) == NULL
+		|| JS_SetReservedSlot(cx, jsThwonk, TJS_SLOT_MODULES, OBJECT_TO_JSVAL(jsObject)) == JS_FALSE) {
+		printf("Couldn't create Thwonk modules\n");
+		return NULL;
+	}
+
 	// Create Javascript Thwonk.message object
 	if((jsObject = JS_DefineObject(cx, jsThwonk, "message", &jsThwonk_message_class, NULL, JSPROP_PERMANENT | JSPROP_READONLY | JSPROP_ENUMERATE)) == NULL) {
 		printf("Couldn't create Thwonk.message object\n");
 		return NULL;
 	}
 
-	// Setup Queue_Entry shared among all message functions
+	// Setup Queue_Entry shared among all message functions, moves along a batch with next()
 	JS_SetPrivate(cx, jsObject, qentry);
 	JS_DefineFunctions(cx, jsObject, jsThwonk_message_methods);
 
@@ -93,9 +102,11 @@ JSBool jsObjectThwonk_print(JSContext *cx, uintN argc, jsval *vp) {
 	size_t amount = 0;
 	jsval *argv;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_PRINT);
+
 	if(argc < 1) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(0));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	argv = JS_ARGV(cx, vp);
@@ -114,7 +125,7 @@ JSBool jsObjectThwonk_print(JSContext *cx, uintN argc, jsval *vp) {
 
 	printf("\n");
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
 }
 
 
@@ -136,16 +147,105 @@ JSBool jsObjectThwonk_print(JSContext *cx, uintN argc, jsval *vp) {
 JSBool jsObjectThwonk_version(JSContext *cx, uintN argc, jsval *vp) {
 	JSString *jstr;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_VERSION);
+
 	if(argc != 0) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	jstr = JS_NewStringCopyZ(cx, PACKAGE_VERSION);
 
 	JS_SET_RVAL(cx, vp, STRING_TO_JSVAL(jstr));
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
+}
+
+
+/*
+ * Purpose: Native code for Thwonk.require(), it loads a file as a module
+ * 	and returns what the module exports
+ *
+ * Entry:
+ * 	1st - Context this methods was called from
+ * 	2nd - Number of arguments passed to this method call
+ * 		-- 1
+ * 	3rd - Array of arguments
+ * 		-- 1st = Virtual path to the file, from /
+ *
+ * Exit:
+ * 	SUCCESS - rval = Module's exports
+ * 	FAILURE - rval = TJS_FAILURE, or exception if the module threw
+ *
+ * Note: A module is run once per rule, requiring it again gives the same
+ * 	exports. The module sees exports and module, and exports what it
+ * 	sets on exports or puts in module.exports (see jsmodule.c).
+*/
+JSBool jsObjectThwonk_require(JSContext *cx, uintN argc, jsval *vp) {
+	JSObject *obj, *modules, *script, *global;
+	char *path;
+	jsval *argv;
+	jsval val;
+	JSBool ret;
+
+	startJSProfileNative(JS_PROFILE_NATIVE_REQUIRE);
+
+	if(argc != 1) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	argv = JS_ARGV(cx, vp);
+
+	// Modules this rule has already required
+	obj = JS_THIS_OBJECT(cx, vp);
+
+	if(obj == NULL || JS_InstanceOf(cx, obj, &jsThwonk_class, NULL) == JS_FALSE
+		|| JS_GetReservedSlot(cx, obj, TJS_SLOT_MODULES, &val) == JS_FALSE || JSVAL_IS_PRIMITIVE(val)) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	modules = JSVAL_TO_OBJECT(val);
+
+	path = JS_EncodeString(cx, JS_ValueToString(cx, argv[0]));
+
+	if(path == NULL || path[0] != '/' || strlen(path) > MAX_LENGTH_FILEPATH) {
+
+		if(path != NULL)
+			free(path);
+
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	if(JS_GetProperty(cx, modules, path, &val) == JS_TRUE && JSVAL_IS_VOID(val) == JS_FALSE) {
+		free(path);
+		JS_SET_RVAL(cx, vp, val);
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	global = JS_GetGlobalObject(cx);
+
+	script = getJSModuleScript(cx, global, path);
+
+	// Module's own code is part of the script's run, not this native's
+	stopJSProfileNative(JS_TRUE);
+
+	if(script == NULL) {
+		free(path);
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return JS_TRUE;
+	}
+
+	ret = runJSModule(cx, global, modules, path, script, &val);
+
+	free(path);
+
+	if(ret == JS_TRUE)
+		JS_SET_RVAL(cx, vp, val);
+
+	return ret;
 }
 
 
@@ -170,28 +270,30 @@ JSBool jsObjectThwonk_message_getCurrent(JSContext *cx, uintN argc, jsval *vp) {
 	JSString *jstr;
 	JSObject *obj;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_MESSAGE_GETCURRENT);
+
 	if(argc != 0) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	obj = JS_THIS_OBJECT(cx, vp);
 
 	if(obj == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	qentry = (Queue_Entry *)JS_GetPrivate(cx, obj);
 
 	if(qentry == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	if((mentry = getMessageEntryById(qentry->messageId)) == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	jstr = JS_NewStringCopyZ(cx, mentry->rawContent);
@@ -200,7 +302,7 @@ JSBool jsObjectThwonk_message_getCurrent(JSContext *cx, uintN argc, jsval *vp) {
 
 	freeMessageEntry(mentry);
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
 }
 
 
@@ -225,23 +327,25 @@ JSBool jsObjectThwonk_message_sendAll(JSContext *cx, uintN argc, jsval *vp) {
 	Queue_Entry *qentry;
 	JSObject *obj;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_MESSAGE_SENDALL);
+
 	obj = JS_THIS_OBJECT(cx, vp);
 
 	if(obj == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	qentry = (Queue_Entry *)JS_GetPrivate(cx, obj);
 
 	if(qentry == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	addMailToOutQueue(AM_MAIL_OUTALL_SUB, qentry, "thwonk", "Subject of mail", "This is the mail");
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
 }
 
 
@@ -262,7 +366,8 @@ JSBool jsObjectThwonk_message_sendAll(JSContext *cx, uintN argc, jsval *vp) {
  *
  * Exit:
  * 	SUCCESS - rval = TJS_SUCCESS
- * 	FAILURE - rval = TJS_FAILURE
+ * 	FAILURE - rval = TJS_FAILURE, or TJS_ERR_RETRY_LATER when the void
+ * 		has a runaway amount of mail waiting to go out
 */
 JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 	Queue_Entry *qentry;
@@ -272,9 +377,11 @@ JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 	JSObject *obj;
 	jsval *argv;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_MESSAGE_SENDMEMBER);
+
 	if(argc != 4) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	argv = JS_ARGV(cx, vp);
@@ -312,7 +419,7 @@ JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 
 		default:
 			JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-			return JS_TRUE;
+			return stopJSProfileNative(JS_TRUE);
 	}
 
 	// Lets get the fields for sending the mail
@@ -324,7 +431,7 @@ JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 
 	if(userUnsafe == NULL || subjectUnsafe == NULL || bodyUnsafe == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	user = dbEscapeString(userUnsafe, strlen(userUnsafe));
@@ -339,7 +446,7 @@ JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 	// Now check was escaping of unsafe strings successful
 	if(user == NULL || subject == NULL || bodyUnsafe == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	// Make sure the user ain't trying anything naughty by trying
@@ -347,7 +454,7 @@ JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 	// newlines are allowed in the subject
 	if(doesStringHaveNewline(subject) == true) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_ERR_UNSAFE_SUBJECT));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	// Right, now that everything is setup try and add the mail to the outgoing message queue
@@ -355,25 +462,32 @@ JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 
 	if(obj == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	qentry = (Queue_Entry *)JS_GetPrivate(cx, obj);
 
 	if(qentry == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	// Bumplist: Using bodyUnsafe because of double escape in insertMessage() and when creating
 	// body - need nicer way for thwonk (dbEscapeString())
 //	if(addMailToOutQueue(i, qentry, user, subject, body) == SUCCESS)
 
-	if(addMailToOutQueue(outType, qentry, user, subject, bodyUnsafe) == SUCCESS) {
-		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_SUCCESS));
-	} else {
-		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-    	}
+	switch(addMailToOutQueue(outType, qentry, user, subject, bodyUnsafe)) {
+		case SUCCESS:
+			JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_SUCCESS));
+		break;
+
+		case AM_MAIL_RETRY_LATER:
+			JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_ERR_RETRY_LATER));
+		break;
+
+		default:
+			JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+	}
 
 	if(user != NULL)
 		free(user);
@@ -384,7 +498,111 @@ JSBool jsObjectThwonk_message_sendMember(JSContext *cx, uintN argc, jsval *vp) {
 	if(body != NULL)
 		free(body);
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
+}
+
+
+/*
+ * Purpose: Native code for Thwonk.message.count() which gets how many
+ * 	messages this run of javascript has left, including the current one
+ *
+ * Entry:
+ * 	1st - Context this methods was called from
+ * 	2nd - Number of arguments passed to this method call
+ * 		-- 0
+ * 	3rd - Array of arguments
+ * 		-- None
+ *
+ * Exit:
+ * 	SUCCESS - rval = Number of messages, 1 unless the logic takes batches
+ * 	FAILURE - rval = TJS_FAILURE
+*/
+JSBool jsObjectThwonk_message_count(JSContext *cx, uintN argc, jsval *vp) {
+	Queue_Entry *qentry;
+	JSObject *obj;
+
+	startJSProfileNative(JS_PROFILE_NATIVE_MESSAGE_COUNT);
+
+	if(argc != 0) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	obj = JS_THIS_OBJECT(cx, vp);
+
+	if(obj == NULL) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	qentry = (Queue_Entry *)JS_GetPrivate(cx, obj);
+
+	if(qentry == NULL) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	JS_SET_RVAL(cx, vp, INT_TO_JSVAL(countQueueEntryBatch(qentry)));
+
+	return stopJSProfileNative(JS_TRUE);
+}
+
+
+/*
+ * Purpose: Native code for Thwonk.message.next() which moves on to the next
+ * 	message of this run of javascript, getCurrent() and the send methods
+ * 	then work with that message
+ *
+ * Entry:
+ * 	1st - Context this methods was called from
+ * 	2nd - Number of arguments passed to this method call
+ * 		-- 0
+ * 	3rd - Array of arguments
+ * 		-- None
+ *
+ * Exit:
+ * 	SUCCESS - rval = TJS_SUCCESS
+ * 	FAILURE - rval = TJS_FAILURE, no more messages
+ *
+ * Note: Logic that takes batches (see logic.batchSize) is run once for up
+ * 	to that many messages of its void, so state read from files is read
+ * 	once for all of them, e.g.
+ *
+ * 	do {
+ * 		msg = Thwonk.message.getCurrent();
+ * 		...
+ * 	} while(Thwonk.message.next() == 0);	// TJS_SUCCESS
+*/
+JSBool jsObjectThwonk_message_next(JSContext *cx, uintN argc, jsval *vp) {
+	Queue_Entry *qentry;
+	JSObject *obj;
+
+	startJSProfileNative(JS_PROFILE_NATIVE_MESSAGE_NEXT);
+
+	if(argc != 0) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	obj = JS_THIS_OBJECT(cx, vp);
+
+	if(obj == NULL) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	qentry = (Queue_Entry *)JS_GetPrivate(cx, obj);
+
+	if(qentry == NULL || qentry->batchNext == NULL) {
+		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
+		return stopJSProfileNative(JS_TRUE);
+	}
+
+	JS_SetPrivate(cx, obj, qentry->batchNext);
+
+	JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_SUCCESS));
+
+	return stopJSProfileNative(JS_TRUE);
 }
 
 
@@ -409,9 +627,11 @@ JSBool jsObjectThwonk_file_read(JSContext *cx, uintN argc, jsval *vp) {
 	jsval *argv;
 	JSString *jstr;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_FILE_READ);
+
 	if(argc != 1) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	argv = JS_ARGV(cx, vp);
@@ -420,7 +640,7 @@ JSBool jsObjectThwonk_file_read(JSContext *cx, uintN argc, jsval *vp) {
 
 	if(nameUnsafe == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	name = dbEscapeString(nameUnsafe, strlen(nameUnsafe));
@@ -429,7 +649,7 @@ JSBool jsObjectThwonk_file_read(JSContext *cx, uintN argc, jsval *vp) {
 
 	if(name == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	if((vfile = getVFileEntryByName(name)) == NULL) {
@@ -438,7 +658,7 @@ JSBool jsObjectThwonk_file_read(JSContext *cx, uintN argc, jsval *vp) {
 			free(name);
 
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	if(name != NULL)
@@ -446,11 +666,13 @@ JSBool jsObjectThwonk_file_read(JSContext *cx, uintN argc, jsval *vp) {
 
 	jstr = JS_NewStringCopyZ(cx, vfile->content);
 
+	addJSProfileFileBytes((vfile->content != NULL) ? strlen(vfile->content) : 0, 0);
+
 	freeVFileEntry(vfile);
 
 	JS_SET_RVAL(cx, vp, STRING_TO_JSVAL(jstr));
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
 }
 
 
@@ -473,12 +695,15 @@ JSBool jsObjectThwonk_file_write(JSContext *cx, uintN argc, jsval *vp) {
 	Queue_Entry *qentry;
 	char *nameUnsafe, *contentUnsafe;
 	char *name, *content;
+	size_t contentLength;
 	JSObject *obj;
 	jsval *argv;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_FILE_WRITE);
+
 	if(argc != 2) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	argv = JS_ARGV(cx, vp);
@@ -488,18 +713,19 @@ JSBool jsObjectThwonk_file_write(JSContext *cx, uintN argc, jsval *vp) {
 
 	if(nameUnsafe == NULL || contentUnsafe == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	name = dbEscapeString(nameUnsafe, strlen(nameUnsafe));
-	content = dbEscapeString(contentUnsafe, strlen(contentUnsafe));
+	contentLength = strlen(contentUnsafe);
+	content = dbEscapeString(contentUnsafe, contentLength);
 
 	free(nameUnsafe);
 	free(contentUnsafe);
 
 	if(name == NULL || content == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
     // Get Queue_Entry for setting up vfile_rights correctly
@@ -507,20 +733,22 @@ JSBool jsObjectThwonk_file_write(JSContext *cx, uintN argc, jsval *vp) {
 
 	if(obj == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
 	qentry = (Queue_Entry *)JS_GetPrivate(cx, obj);
 
 	if(qentry == NULL) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-		return JS_TRUE;
+		return stopJSProfileNative(JS_TRUE);
 	}
 
-	if(insertVFileEntryByName(name, content, qentry) == false)
+	if(insertVFileEntryByName(name, content, qentry) == false) {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_FAILURE));
-	else
+	} else {
 		JS_SET_RVAL(cx, vp, INT_TO_JSVAL(TJS_SUCCESS));
+		addJSProfileFileBytes(0, contentLength);
+	}
 
 	if(name != NULL)
 		free(name);
@@ -528,7 +756,7 @@ JSBool jsObjectThwonk_file_write(JSContext *cx, uintN argc, jsval *vp) {
 	if(content != NULL)
 		free(content);
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
 }
 
 
@@ -544,11 +772,13 @@ JSBool jsObjectThwonk_file_write(JSContext *cx, uintN argc, jsval *vp) {
 JSBool jsObjectThwonk_dummy(JSContext *cx, uintN argc, jsval *vp) {
 	JSString *jstr;
 
+	startJSProfileNative(JS_PROFILE_NATIVE_MEMBER_TEST);
+
 	printf("jsObjectThwonk_dummy() called\r\n");
 
 	jstr = JS_NewStringCopyZ(cx, "moo");
 
 	JS_SET_RVAL(cx, vp, STRING_TO_JSVAL(jstr));
 
-	return JS_TRUE;
+	return stopJSProfileNative(JS_TRUE);
 }
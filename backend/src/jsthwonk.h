@@ -18,11 +18,14 @@ JSObject *createJSObjectThwonk(JSContext *, JSObject *, Queue_Entry *);
 JSBool jsObjectThwonk_dummy(JSContext *, uintN, jsval *);
 JSBool jsObjectThwonk_print(JSContext *, uintN, jsval *);	// Print a string to STDOUT
 JSBool jsObjectThwonk_version(JSContext *, uintN, jsval *);	// Return what is the current version of thwonk
+JSBool jsObjectThwonk_require(JSContext *, uintN, jsval *);	// Load a file as a module, returning its exports
 
 /* Thwonk.message.* */
 JSBool jsObjectThwonk_message_getCurrent(JSContext *, uintN, jsval *);	// Get current message associated with this javascript run
 JSBool jsObjectThwonk_message_sendAll(JSContext *, uintN, jsval *);	// Send a message to all members of the current Thwonk
 JSBool jsObjectThwonk_message_sendMember(JSContext *, uintN, jsval *);	// Send a message to a particular member of a Thwonk
+JSBool jsObjectThwonk_message_count(JSContext *, uintN, jsval *);	// Number of messages left in this javascript run
+JSBool jsObjectThwonk_message_next(JSContext *, uintN, jsval *);	// Move on to the next message of this javascript run
 
 /* Thwonk.file.* */
 JSBool jsObjectThwonk_file_read(JSContext *, uintN, jsval *);	// Read in file contents
@@ -26,6 +26,9 @@
 
 #define TJS_ERR_NOUSER		-2
 #define TJS_ERR_UNSAFE_SUBJECT	-3
+#define TJS_ERR_RETRY_LATER	-4	// Too much mail waiting to go out, try again later
+
+#define TJS_SLOT_MODULES	0	// Thwonk object's slot for the modules a rule has required
 
 
 /*
@@ -33,7 +36,7 @@
 */
 JSClass jsThwonk_class = {
 	"thwonk",
-	0,
+	JSCLASS_HAS_RESERVED_SLOTS(1),
 	JS_PropertyStub,
 	JS_PropertyStub,
 	JS_PropertyStub,
@@ -48,6 +51,7 @@ JSClass jsThwonk_class = {
 static JSFunctionSpec jsThwonk_methods[] = {
 	JS_FS("print", jsObjectThwonk_print, 0, 0),
 	JS_FS("version", jsObjectThwonk_version, 0, 0),
+	JS_FS("require", jsObjectThwonk_require, 1, 0),
 	JS_FS_END
 };
 
@@ -73,6 +77,8 @@ JSFunctionSpec jsThwonk_message_methods[] = {
 	JS_FS("getCurrent", jsObjectThwonk_message_getCurrent, 0, 0),
 	JS_FS("sendAll", jsObjectThwonk_message_sendAll, 3, 0),
 	JS_FS("sendMember", jsObjectThwonk_message_sendMember, 4, 0),
+	JS_FS("count", jsObjectThwonk_message_count, 0, 0),
+	JS_FS("next", jsObjectThwonk_message_next, 0, 0),
 	JS_FS_END
 };
 
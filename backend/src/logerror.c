@@ -43,7 +43,15 @@ struct ErrorMsg {
 	{ERR_MISC_STRNJOIN,	"* ERROR: mStrnjoin() input strings were bigger than max lenght allowed"},
 	{ERR_UNKNOWN,		"* ERROR: An unknown error has occurred"},
 	{ERR_NONE,		"- What ya doin 'ere? No error occurred"},
-	{_ERR_END,		NULL}		// Keep ERR_NONE in the last position because used by
+	{ERR_JS_BUDGET,		"* ERROR: Script went over its CPU or run time budget"},
+	{ERR_JS_HEAP,		"* ERROR: Script went over its heap budget"},
+	{ERR_DOORBELL_OPEN,	"* ERROR: Couldn't open a doorbell for listening to a queue"},
+	{ERR_QUEUE_EVENTS,	"* ERROR: Couldn't setup the event loop of a queue boss"},
+	{ERR_QUEUE_LOG,		"* ERROR: Couldn't open, read or append to a queue log"},
+	{ERR_QUEUE_OUT_FULL,	"* ERROR: Outgoing queue is over its hard cap for the void"},
+	{ERR_MAILOUT_TEMPFAIL,	"* ERROR: Outgoing mail couldn't be delivered for now"},
+	{ERR_MAILOUT_PERMFAIL,	"* ERROR: Outgoing mail was refused by sendmail"},
+	{_ERR_END,		NULL}		// Keep _ERR_END in the last position because used by
 						// getErrType() as end of array marker
 };
 
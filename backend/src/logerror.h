@@ -17,6 +17,9 @@
  * NOTE: ANYTIME A NEW ERROR IS ADDED MAKE SURE AND UPDATE
  *       ErrorMsgs[] IN logerror.c 
  * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+ *
+ * Note: Add new errors at the end, just before _ERR_END, values are kept
+ *  in the database (see logic_profile.result) so mustn't be renumbered
 */
 typedef enum {
 	ERR_LOG_OPEN = 100,	// Couldn't open log file
@@ -50,6 +53,14 @@ typedef enum {
 	ERR_MISC_STRNJOIN,	// Input strings were longer than the max output string allowed
 	ERR_UNKNOWN,		// Unknown error
 	ERR_NONE,		// No Error
+	ERR_JS_BUDGET,		// Script used more CPU or time than its logic's budget allows
+	ERR_JS_HEAP,		// Script grew its heap by more than its logic's budget allows
+	ERR_DOORBELL_OPEN,	// Couldn't open a doorbell for listening to a queue
+	ERR_QUEUE_EVENTS,	// Couldn't setup the event loop of a queue boss
+	ERR_QUEUE_LOG,		// Couldn't open, read or append to a queue log
+	ERR_QUEUE_OUT_FULL,	// Outgoing queue is over its hard cap for the void, try again later
+	ERR_MAILOUT_TEMPFAIL,	// sendmail couldn't deliver an outgoing mail for now, may work later
+	ERR_MAILOUT_PERMFAIL,	// sendmail refused an outgoing mail, won't work later either
 	_ERR_END		// DONT USE - MARKS END OF ARRAY
 } ERRTYPE;
 
@@ -17,6 +17,7 @@
 #include "parsemail.h"
 #include "mngmail.h"
 #include "void.h"
+#include "qlog.h"
 
 
 /*
@@ -40,6 +41,13 @@ bool setup(int argc, char **argv) {
 #endif
 	dbConnect();
 
+	// Log queue backend reaches its segments through this from inside the jail, so
+	//  every daemon shares the one log rather than each its own copy in the jail
+	if(openQueueLogDir() == false) {
+		printf("mailinject: FAILED TO OPEN QUEUE LOG DIR\n");
+		exit(FAILURE);
+	}
+
 	// Security wise it might make more sense to have this happening first and
 	// put the config file along with database socket in the chroot folder
 #ifndef DEBUG
@@ -64,6 +72,9 @@ bool setup(int argc, char **argv) {
 */
 bool tidy() {
 
+	// Mail queued by this run must be on disk before the MTA is told it was delivered
+	syncQueueEntries();
+
 	dbDisconnect();
 
 #ifdef DEBUG
@@ -105,7 +116,7 @@ void failureExit(ERRTYPE err) {
  * 	Returns 0
 */
  int main(int argc, char **argv) {
-	char *input, *tmp;
+	char *input, *tmp, *msgIdHdr;
 	size_t length;
 	long mId;
 	MSG_MAIL *msg;
@@ -190,8 +201,14 @@ void failureExit(ERRTYPE err) {
 			failureExit(getErrType());
 		}
 
-		mId = addMailToInQueue(sender, tmp, input, length, AM_MAIL_NOTINDB);
+		// Repeats of a mail are spotted by its Message-ID
+		msgIdHdr = getMailHeaderField(msg_hdr, MU_HEADER_MESSAGE_ID);
+
+		mId = addMailToInQueue(sender, tmp, input, length, msgIdHdr, AM_MAIL_NOTINDB);
 		free(tmp);
+
+		if(msgIdHdr != NULL)
+			free(msgIdHdr);
 //		failureExit(getErrType());
 	}
 
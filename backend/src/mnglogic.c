@@ -5,6 +5,7 @@
 */
 
 #include<stdlib.h>
+#include<string.h>
 #include "setupthang.h"
 #include "logerror.h"
 #include "dbchatter.h"
@@ -37,7 +38,18 @@ Logic_Entry *createLogicEntry() {
 	lentry->editDate = NULL;
 	lentry->language = UNSET;
 	lentry->logic = NULL;
+	lentry->logicLength = 0;
+	lentry->logicHash = NULL;
 	lentry->logicCache = NULL;
+	lentry->logicCacheLength = 0;
+	lentry->logicCacheKey = NULL;
+	lentry->concurrency = 1;
+	lentry->batchSize = 1;
+	lentry->maxCpuMsec = 0;
+	lentry->maxWallMsec = 0;
+	lentry->maxHeapBytes = 0;
+	lentry->peakHeapBytes = 0;
+	lentry->engineOptions = 0;
 
 	return lentry;
 }
@@ -57,6 +69,27 @@ void freeLogicEntry(Logic_Entry *lentry) {
 	if(lentry == NULL)
 		return;
 
+	if(lentry->name != NULL)
+		free(lentry->name);
+
+	if(lentry->blurb != NULL)
+		free(lentry->blurb);
+
+	if(lentry->editDate != NULL)
+		free(lentry->editDate);
+
+	if(lentry->logic != NULL)
+		free(lentry->logic);
+
+	if(lentry->logicHash != NULL)
+		free(lentry->logicHash);
+
+	if(lentry->logicCache != NULL)
+		free(lentry->logicCache);
+
+	if(lentry->logicCacheKey != NULL)
+		free(lentry->logicCacheKey);
+
 	free(lentry);
 
 	lentry = NULL;
@@ -78,8 +111,9 @@ Logic_Entry *getLogicEntryForVoid(long voidId) {
 	Logic_Entry *lentry;
 	DBRESULT *result;
 	DBROW row;
+	unsigned long *lengths;
 
-	result = dbQuery("SELECT logic.id, logic.logic FROM logic, logic_rights WHERE logic_rights.voidId = %ld and logic_rights.rightType = %d AND logic_rights.useRight = %d AND logic.language = %d AND logic.id = logic_rights.logicId", voidId, DBVAL_logic_rights_rightType_VOID, DBVAL_logic_rights_ANYRIGHT_ALLOWED, DBVAL_logic_language_JAVASCRIPT);
+	result = dbQuery("SELECT logic.id, logic.logic, logic.concurrency, logic.version, logic.editDate, logic.logicCache, logic.logicCacheKey, logic.maxCpuMsec, logic.maxWallMsec, logic.maxHeapBytes, logic.peakHeapBytes, logic.engineOptions, MD5(logic.logic) FROM logic, logic_rights WHERE logic_rights.voidId = %ld and logic_rights.rightType = %d AND logic_rights.useRight = %d AND logic.language = %d AND logic.id = logic_rights.logicId", voidId, DBVAL_logic_rights_rightType_VOID, DBVAL_logic_rights_ANYRIGHT_ALLOWED, DBVAL_logic_language_JAVASCRIPT);
 
 	if(getErrType() != ERR_NONE) {
 		return NULL;
@@ -102,9 +136,191 @@ Logic_Entry *getLogicEntryForVoid(long voidId) {
 
 	lentry->id = atol(row[0]);
 	lentry->logic = mStrndup(row[1], MAX_LENGTH_CODE_JAVASCRIPT);
+	lentry->logicLength = (lentry->logic != NULL) ? strlen(lentry->logic) : 0;
+	lentry->concurrency = atoi(row[2]);
+	lentry->version = (row[3] != NULL) ? atoi(row[3]) : UNSET;
+	lentry->editDate = (row[4] != NULL) ? mStrdup(row[4]) : NULL;
+	lentry->maxCpuMsec = atoi(row[7]);
+	lentry->maxWallMsec = atoi(row[8]);
+	lentry->maxHeapBytes = atol(row[9]);
+	lentry->peakHeapBytes = atol(row[10]);
+	lentry->engineOptions = atoi(row[11]);
+	lentry->logicHash = (row[12] != NULL) ? mStrdup(row[12]) : NULL;
+
+	// Compiled version, if there is one, is binary
+	if(row[5] != NULL && row[6] != NULL && (lengths = dbQueryGetLengths(result)) != NULL && lengths[5] > 0) {
+
+		if((lentry->logicCache = (char *)malloc(lengths[5])) != NULL) {
+			memcpy(lentry->logicCache, row[5], lengths[5]);
+			lentry->logicCacheLength = lengths[5];
+			lentry->logicCacheKey = mStrndup(row[6], LOGIC_LENGTH_CACHE_KEY);
+		}
+	}
 
 	dbQueryFreeResult(result);
 
 	return lentry;
 }
 
+
+/*
+ * Purpose: Get which version of logic is associated with a void, its
+ * 	budgets and engine options, without the logic itself or its compiled version
+ *
+ * Entry:
+ * 	1st - Id of void to get logic for
+ *
+ * Exit:
+ * 	SUCCESS = Pointer to Logic_Entry with id, version, editDate,
+ * 		logicLength, logicHash, budgets and engine options filled in,
+ * 		or NULL if not found
+ * 	FAILURE = NULL and err type set
+ *
+ * Note: For checking logic held by a worker is current, the length and
+ * 	hash are what getLogicEntryForVoid() would give.
+*/
+Logic_Entry *getLogicVersionForVoid(long voidId) {
+	Logic_Entry *lentry;
+	DBRESULT *result;
+	DBROW row;
+
+	result = dbQuery("SELECT logic.id, logic.version, logic.editDate, LENGTH(logic.logic), logic.maxCpuMsec, logic.maxWallMsec, logic.maxHeapBytes, logic.peakHeapBytes, logic.engineOptions, MD5(logic.logic) FROM logic, logic_rights WHERE logic_rights.voidId = %ld and logic_rights.rightType = %d AND logic_rights.useRight = %d AND logic.language = %d AND logic.id = logic_rights.logicId", voidId, DBVAL_logic_rights_rightType_VOID, DBVAL_logic_rights_ANYRIGHT_ALLOWED, DBVAL_logic_language_JAVASCRIPT);
+
+	if(getErrType() != ERR_NONE) {
+		return NULL;
+	}
+
+	if(dbQueryCountRows(result) != 1 || (row = dbQueryGetRow(result)) == NULL) {
+		dbQueryFreeResult(result);
+		return NULL;
+	}
+
+	if((lentry = createLogicEntry()) == NULL) {
+		dbQueryFreeResult(result);
+		return NULL;
+	}
+
+	lentry->id = atol(row[0]);
+	lentry->version = (row[1] != NULL) ? atoi(row[1]) : UNSET;
+	lentry->editDate = (row[2] != NULL) ? mStrdup(row[2]) : NULL;
+	lentry->logicLength = (row[3] != NULL) ? (size_t)atol(row[3]) : 0;
+	lentry->maxCpuMsec = atoi(row[4]);
+	lentry->maxWallMsec = atoi(row[5]);
+	lentry->maxHeapBytes = atol(row[6]);
+	lentry->peakHeapBytes = atol(row[7]);
+	lentry->engineOptions = atoi(row[8]);
+	lentry->logicHash = (row[9] != NULL) ? mStrdup(row[9]) : NULL;
+
+	dbQueryFreeResult(result);
+
+	return lentry;
+}
+
+
+/*
+ * Purpose: Get how many copies of a void's logic may run at once, and how
+ * 	many messages one run may be given, as set on the logic
+ *
+ * Entry:
+ * 	1st - Id of void
+ * 	2nd - Filled with the max messages per run, at least 1
+ *
+ * Exit:
+ * 	SUCCESS = Max rules to run at once for the void, at least 1
+ * 	FAILURE = FAILURE if the void has no logic, or err type set
+ *
+ * Note: Only logic that keeps no state between runs (e.g. a filter or a
+ * 	relay) should be set higher than 1, copies running at once would
+ * 	otherwise race over the void's vfiles.
+ *
+ * Note 2: Only logic that goes through every message of its run (see
+ * 	Thwonk.message.next()) should have a batch size over 1, the rest of
+ * 	the batch is otherwise marked done without being looked at.
+*/
+int getLogicLimitsForVoid(long voidId, int *batchSize) {
+	DBRESULT *result;
+	DBROW row;
+	int concurrency;
+
+	result = dbQuery("SELECT logic.concurrency, logic.batchSize FROM logic, logic_rights WHERE logic_rights.voidId = %ld and logic_rights.rightType = %d AND logic_rights.useRight = %d AND logic.language = %d AND logic.id = logic_rights.logicId", voidId, DBVAL_logic_rights_rightType_VOID, DBVAL_logic_rights_ANYRIGHT_ALLOWED, DBVAL_logic_language_JAVASCRIPT);
+
+	if(getErrType() != ERR_NONE) {
+		return FAILURE;
+	}
+
+	if(dbQueryCountRows(result) != 1 || (row = dbQueryGetRow(result)) == NULL) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	concurrency = atoi(row[0]);
+	*batchSize = (atoi(row[1]) < 1) ? 1 : atoi(row[1]);
+
+	dbQueryFreeResult(result);
+
+	return (concurrency < 1) ? 1 : concurrency;
+}
+
+
+/*
+ * Purpose: Store the compiled version of logic so it needn't be compiled
+ * 	again
+ *
+ * Entry:
+ * 	1st - Id of logic
+ * 	2nd - What it was compiled from, see Logic_Entry.logicCacheKey
+ * 	3rd - Compiled version, may hold \0's
+ * 	4th - Length of compiled version
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set, ERR_DB_QUERY if too big to store
+*/
+bool updateLogicCache(long logicId, char *key, char *cache, size_t length) {
+	DBRESULT *result;
+	char *escaped;
+
+	if((escaped = dbEscapeString(cache, length)) == NULL)
+		return false;
+
+	result = dbQuery("UPDATE logic SET logicCache = '%s', logicCacheKey = '%s' WHERE id = %ld", escaped, key, logicId);
+
+	free(escaped);
+	dbQueryFreeResult(result);
+
+	if(getErrType() != ERR_NONE) {
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Record the most heap a run of logic has been seen to use, for
+ * 	right sizing its heap budget
+ *
+ * Entry:
+ * 	1st - Id of logic
+ * 	2nd - Bytes of GC heap a run grew by
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+ *
+ * Note: Only ever raises the recorded peak, so workers racing each other
+ * 	can't lower it
+*/
+bool updateLogicPeakHeap(long logicId, long peakHeapBytes) {
+	DBRESULT *result;
+
+	result = dbQuery("UPDATE logic SET peakHeapBytes = %ld WHERE id = %ld AND peakHeapBytes < %ld", peakHeapBytes, logicId, peakHeapBytes);
+
+	dbQueryFreeResult(result);
+
+	if(getErrType() != ERR_NONE) {
+		return false;
+	}
+
+	return true;
+}
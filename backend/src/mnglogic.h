@@ -9,6 +9,8 @@
 
 #include "codewide.h"
 
+#define LOGIC_LENGTH_CACHE_KEY	100	// Max length of logic.logicCacheKey
+
 /* Structure for holding details on about logic script */
 typedef struct {
 	long id;                // Id of logic item
@@ -23,8 +25,22 @@ typedef struct {
 	int language;           // Language this script was written in (1 = Javascript)
 
 	char *logic;            // Logic in scripting language
+	size_t logicLength;     // Length of logic, set even when only its version is got
+	char *logicHash;        // MD5 of logic in hex, set even when only its version is got
+
+	char *logicCache;       // Chache containing compiled version of script, may hold \0's
+	size_t logicCacheLength;	// Length of logicCache
+	char *logicCacheKey;    // What logicCache was compiled from, NULL = nothing cached
+
+	int concurrency;        // Max copies of the script run at once for a void
+	int batchSize;          // Max messages handed to one run of the script
+
+	int maxCpuMsec;         // CPU millisecs a rule may use, 0 = server's max (see jsbudget.c)
+	int maxWallMsec;        // Millisecs a rule may take, 0 = server's max
+	long maxHeapBytes;      // GC heap a rule may grow by, 0 = server's max
+	long peakHeapBytes;     // Most GC heap a rule has been seen to grow by
 
-	char *logicCache;       // Chache containing compiled version of script (not yet used)
+	int engineOptions;      // SpiderMonkey options the script runs with, 0 = server's (see jsoptions.h)
 
 	// Note: There is a date field in the database table but not going to use for now
 } Logic_Entry;
@@ -33,5 +49,9 @@ typedef struct {
 Logic_Entry *createLogicEntry();	// Allocate mem and setup a Logic_Entry
 void freeLogicEntry(Logic_Entry *);	// Release mem associated with a Logic_Entry
 Logic_Entry *getLogicEntryForVoid(long);	// Get the logic associated with a void
+Logic_Entry *getLogicVersionForVoid(long);	// Get which version of logic a void has, without the logic
+int getLogicLimitsForVoid(long, int *);	// How many rules a void may run at once, and messages per rule
+bool updateLogicCache(long, char *, char *, size_t);	// Store the compiled version of logic
+bool updateLogicPeakHeap(long, long);	// Record the most heap a run of logic has used
 
 #endif
@@ -8,6 +8,7 @@
 
 #include<stdlib.h>
 #include<string.h>
+#include<ctype.h>
 #include "setupthang.h"
 #include "mngmail.h"
 #include "message.h"
@@ -18,6 +19,7 @@
 #include "void.h"
 #include "user.h"
 #include "misc.h"
+#include "qpressure.h"
 
 
 /*
@@ -30,22 +32,29 @@
  * 		each email must be separated by a comma
  * 	3rd - Contents of mail (not yet made safe)
  * 	4th - Length of mail
- * 	5th - If AM_MAIL_NOTINDB then mail not yet inserted in database otherwise
+ * 	5th - Message-ID header of the mail, NULL if it has none
+ * 	6th - If AM_MAIL_NOTINDB then mail not yet inserted in database otherwise
  * 		should be positive
  *
  * Exit:
  * 	SUCCESS, > 0 for ID of mail in database
  * 	FAILURE, TODO reject email
  *
+ * Note: A mail a void already had queued within the last mail_dedup_sec
+ * 	(see SCONFIG) isn't queued for it again, see isMailDuplicate(). It's
+ * 	only remembered once it's on the queue, so mailinject dying part way
+ * 	through doesn't turn the MTA's retry into a dropped repeat.
+ *
  * TODO: Fix FOR loop, was originally going to walk through a text list of email
  * 	addresses
 */
-long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t length, long mId) {
+long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t length, char *msgIdHdr, long mId) {
 	Address_Mail *dest;
 	Void_Filter *voidFilter;
 	User_Filter *userFilter;
 	Queue_Entry *queueEntry;
 	User_Entry *userEntry;
+	unsigned long long dedupKey = 0;
 	size_t i, n;
 	bool didMsg;
 
@@ -56,6 +65,9 @@ long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t leng
 
 	queueEntry = createQueueEntry();
 
+	if(_config->mail_dedup_sec > 0)
+		dedupKey = getMailDedupKey(msgIdHdr, sender, mail);
+
 	// Lets walk through all the target void email addresses sent
 	for(i = 0, didMsg = false, n = getMailAddressCount(voids); i < n; i++) {
 
@@ -73,6 +85,16 @@ long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t leng
 			if(voidFilter->status == DBVAL_filter_void_status_ACTIVE &&
 				checkVoidAllowSubmit(voidFilter, sender) == true) {
 
+				// Drop a repeat of a mail already queued for this void, i.e. the MTA
+				//  retried or it was sent to the void by two addresses
+				if(isMailDuplicate(voidFilter->voidId, dedupKey) == true) {
+#ifdef DEBUG
+					write2Log("addMailToInQueue(): Dropped repeat of a mail");
+#endif
+					freeVoidFilter(voidFilter);
+					continue;
+				}
+
 				// Try and get user id to associate with this message, if one is available
 				if(userEntry == NULL) {
 
@@ -102,8 +124,9 @@ long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t leng
 
 				// Make sure mail was inserted in the database, may have happened on previous
 				//  iteration of for loop
-				if(queueEntry->messageId == AM_MAIL_NOTINDB)
+				if(queueEntry->messageId == AM_MAIL_NOTINDB) {
 					break;
+				}
 
 				queueEntry->userId = userEntry->id;
 				queueEntry->voidId = voidFilter->voidId;
@@ -114,14 +137,18 @@ long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t leng
 
 				// Add queue item and if that fails remove last inserted message (if message
 				//  isn't referred to by another queue entry)
-				if(insertQueueEntry(queueEntry) == false && didMsg == false) {
-					deleteMessage(queueEntry->messageId);
-					mId = AM_MAIL_NOTINDB;
+				if(insertQueueEntry(queueEntry) == false) {
+					if(didMsg == false) {
+						deleteMessage(queueEntry->messageId);
+						mId = AM_MAIL_NOTINDB;
+					}
 				} else {
 					// Queue insertion was success so on next iteration of this loop
 					//  we shouldn't try and delete the message (db table constrains should
 					//  prohit a deletion anyway - but lets play safe)
 					didMsg = true;
+
+					rememberMailDedup(voidFilter->voidId, dedupKey);
 				}
 
 			} else {
@@ -146,6 +173,141 @@ long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t leng
 }
 
 
+/*
+ * Purpose: Work out the key a mail is known by when checking for repeats
+ *
+ * Entry:
+ * 	1st - Message-ID header of the mail, NULL if it has none
+ * 	2nd - Sender of the mail
+ * 	3rd - Contents of mail, nul terminated
+ *
+ * Exit:
+ * 	Key for the mail, never 0
+ *
+ * Note: 64 bit FNV-1a hash of the Message-ID without its angle brackets.
+ * 	Without a Message-ID the sender and body are hashed instead, the
+ * 	headers aren't as Received: etc. differ between deliveries of the
+ * 	same mail.
+*/
+unsigned long long getMailDedupKey(char *msgIdHdr, Address_Mail *sender, char *mail) {
+	unsigned long long key = AM_MAIL_DEDUP_FNV_BASIS;
+	char *start, *end, *c;
+
+	start = end = NULL;
+
+	// Message-ID without surrounding space or <>
+	if(msgIdHdr != NULL) {
+		for(start = msgIdHdr; *start == '<' || isspace((unsigned char)*start); start++);
+
+		for(end = start + strlen(start); end > start && (end[-1] == '>' || isspace((unsigned char)end[-1])); end--);
+	}
+
+	if(start != NULL && end > start) {
+		key = (key ^ 'M') * AM_MAIL_DEDUP_FNV_PRIME;
+
+		for(c = start; c < end; c++)
+			key = (key ^ (unsigned char)*c) * AM_MAIL_DEDUP_FNV_PRIME;
+	} else {
+		key = (key ^ 'B') * AM_MAIL_DEDUP_FNV_PRIME;
+
+		for(c = sender->full; *c != '\0'; c++)
+			key = (key ^ (unsigned char)tolower((unsigned char)*c)) * AM_MAIL_DEDUP_FNV_PRIME;
+
+		// Body starts after the first blank line
+		if((start = strstr(mail, "\r\n\r\n")) != NULL)
+			start += 4;
+		else if((start = strstr(mail, "\n\n")) != NULL)
+			start += 2;
+		else
+			start = mail;
+
+		for(c = start; *c != '\0'; c++)
+			key = (key ^ (unsigned char)*c) * AM_MAIL_DEDUP_FNV_PRIME;
+	}
+
+	return (key == 0) ? 1 : key;
+}
+
+
+/*
+ * Purpose: Check whether a void has already had a mail queued within the
+ * 	last mail_dedup_sec (see SCONFIG)
+ *
+ * Entry:
+ * 	1st - Void the mail is for
+ * 	2nd - Key of the mail from getMailDedupKey(), 0 = not checking
+ *
+ * Exit:
+ * 	true = Repeat of a mail already queued for the void
+ * 	false = Not seen before, or couldn't tell
+ *
+ * Note: Only checks, the mail is remembered by rememberMailDedup() once
+ * 	it's been queued. Two copies arriving at once can both be queued.
+ *
+ * Note 2: If the database can't say the mail is let through, a mail
+ * 	queued twice is better than one lost.
+*/
+bool isMailDuplicate(long voidId, unsigned long long key) {
+	DBRESULT *result;
+	int n;
+
+	if(key == 0)
+		return false;
+
+	result = dbQuery("SELECT 1 FROM message_dedup WHERE voidId = %ld AND dedupKey = %llu AND arrived >= now() - INTERVAL %ld SECOND", voidId, key, _config->mail_dedup_sec);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	n = dbQueryCountRows(result);
+
+	dbQueryFreeResult(result);
+
+	return (n > 0);
+}
+
+
+/*
+ * Purpose: Remember a void has had a mail queued, so repeats of it within
+ * 	mail_dedup_sec (see SCONFIG) are dropped by isMailDuplicate()
+ *
+ * Entry:
+ * 	1st - Void the mail was queued for
+ * 	2nd - Key of the mail from getMailDedupKey(), 0 = not checking
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set, a repeat may be queued again
+ *
+ * Note: The primary key keeps one row per void and key whichever copy of
+ * 	a mail gets here first. A key seen longer ago than the window has its
+ * 	time updated. Each new key also clears out a few of the void's
+ * 	expired keys so a void holds about a window's worth.
+*/
+bool rememberMailDedup(long voidId, unsigned long long key) {
+	DBRESULT *result;
+
+	if(key == 0)
+		return true;
+
+	result = dbQuery("INSERT INTO message_dedup (voidId, dedupKey, arrived) VALUES (%ld, %llu, now()) ON DUPLICATE KEY UPDATE arrived = IF(arrived < now() - INTERVAL %ld SECOND, now(), arrived)", voidId, key, _config->mail_dedup_sec);
+
+	dbQueryFreeResult(result);
+
+	if(getErrType() != ERR_NONE) {
+		return false;
+	}
+
+	result = dbQuery("DELETE FROM message_dedup WHERE voidId = %ld AND arrived < now() - INTERVAL %ld SECOND LIMIT %d", voidId, _config->mail_dedup_sec, MAIL_DEDUP_PRUNE_BATCH);
+
+	dbQueryFreeResult(result);
+
+	return true;
+}
+
+
 /*
  * Purpose: Checks whether a mail item should be added to the msg queue and if
  * 	so adds it for each destination void (may be more than one)
@@ -161,9 +323,15 @@ long addMailToInQueue(Address_Mail *sender, char *voids, char *mail, size_t leng
  * Exit:
  * 	SUCCESS
  * 	FAILURE
+ * 	AM_MAIL_RETRY_LATER - void is at its hard cap of pending outgoing
+ * 		mail (see qpressure.c), nothing was added
 */
 long addMailToOutQueue(int outType, Queue_Entry *qentry, char *dest, char *subject, char *body) {
 
+	// Don't let a rule flood the outgoing queue, it can try again later
+	if(isQueueOutFull(qentry->voidId) == true)
+		return AM_MAIL_RETRY_LATER;
+
 	if(outType == AM_MAIL_OUTALL_SUB) {
 
 		printf("addMailToOutQueue(): AM_MAIL_OUTALL_SUB\r\n");
@@ -591,7 +759,12 @@ long insertMessageOutMail(int outType, char *msg, User_Filter *destUser, Queue_E
 		qentryMsg->messageId = msgId;
 		qentryMsg->messageType = DBVAL_message_queue_messageType_EMAILOUT;
 		qentryMsg->queueState = DBVAL_message_queue_queueState_JUSTIN;
-		qentryMsg->track = DBVAL_message_queue_track_NORMAL;
+
+		// Mail from Thwonk itself shouldn't wait behind mail sent out by void logic
+		if(outType == AM_MAIL_FROM_THWONK_TO_ANYTHWONK_MEMBER)
+			qentryMsg->track = DBVAL_message_queue_track_SYSTEM;
+		else
+			qentryMsg->track = DBVAL_message_queue_track_BULK;
 
 		qentryMsg->userId = destUser->userId;
 		qentryMsg->voidId = qentryParent->voidId;
@@ -34,7 +34,10 @@ typedef struct {
 
 
 /* Function prototypes */
-long addMailToInQueue(Address_Mail *, char *, char *, size_t, long);
+long addMailToInQueue(Address_Mail *, char *, char *, size_t, char *, long);
+unsigned long long getMailDedupKey(char *, Address_Mail *, char *);	// Key a mail is known by when checking for repeats
+bool isMailDuplicate(long, unsigned long long);	// Has a void already queued this mail?
+bool rememberMailDedup(long, unsigned long long);	// Remember a void queued a mail
 long addMailToOutQueue(int, Queue_Entry *, char *, char *, char *);
 long addMailToOutQueueForUser(int, Queue_Entry *, char *, char *, char *);
 char *constructMailPreOut(char *, char *);
@@ -54,6 +57,11 @@ bool deleteMProtocolMail(long);
 #define RM_INVALID_HEADER	2		// Email header was invalid
 
 #define AM_MAIL_NOTINDB		FAILURE
+#define AM_MAIL_RETRY_LATER	-2		// Outgoing queue is too full for this void, try again later
+
+/* Used by getMailDedupKey(), 64 bit FNV-1a */
+#define AM_MAIL_DEDUP_FNV_BASIS	14695981039346656037ULL
+#define AM_MAIL_DEDUP_FNV_PRIME	1099511628211ULL
 
 /* Used by addMailToOutQueue() to decide what kind of mail are we been asked to deliver */
 #define AM_MAIL_OUTALL_SUB	1		// Send mail to all members of a void, where subject is provided
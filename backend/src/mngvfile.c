@@ -34,9 +34,15 @@ VFile_Entry *createVFileEntry() {
 
 	ventry->id = UNSET;
 	ventry->fileType = UNSET;
+	ventry->version = UNSET;
 	ventry->editDate = NULL;
 	ventry->name = NULL;
 	ventry->content = NULL;
+	ventry->contentLength = 0;
+	ventry->contentHash = NULL;
+	ventry->moduleCache = NULL;
+	ventry->moduleCacheLength = 0;
+	ventry->moduleCacheKey = NULL;
 
 	return ventry;
 }
@@ -65,6 +71,15 @@ void freeVFileEntry(VFile_Entry *ventry) {
 	if(ventry->content != NULL)
 		free(ventry->content);
 
+	if(ventry->contentHash != NULL)
+		free(ventry->contentHash);
+
+	if(ventry->moduleCache != NULL)
+		free(ventry->moduleCache);
+
+	if(ventry->moduleCacheKey != NULL)
+		free(ventry->moduleCacheKey);
+
 	free(ventry);
 
 	ventry = NULL;
@@ -289,7 +304,7 @@ bool insertVFileEntryByName(char *name, char *content, Queue_Entry *qentry) {
 
         // * TODO: Convert to always dealing with absolute paths
 		// File DOES exist, so update the contents
-		result = dbQuery("UPDATE vfile SET content = '%s', editDate = now() WHERE name = '%s'", content, safe_name);
+		result = dbQuery("UPDATE vfile SET content = '%s', version = version + 1, editDate = now() WHERE name = '%s'", content, safe_name);
 
 		if(getErrType() != ERR_NONE) {
 			dbQueryFreeResult(result);
@@ -309,6 +324,153 @@ bool insertVFileEntryByName(char *name, char *content, Queue_Entry *qentry) {
 }
 
 
+/*
+ * Purpose: Get vfile entry by name (path), along with the module compiled
+ * 	from its content if one has been stored
+ *
+ * Entry:
+ * 	1st - Path to the file
+ *
+ * Exit:
+ * 	SUCCESS = Pointer to VFile_Entry filled with details
+ * 		or NULL if not found
+ * 	FAILURE = NULL and err type set
+*/
+VFile_Entry *getVFileModuleByName(char *name) {
+	VFile_Entry *ventry;
+	DBRESULT *result;
+	DBROW row;
+	unsigned long *lengths;
+
+	result = dbQuery("SELECT id, fileType, version, editDate, name, content, moduleCache, moduleCacheKey, MD5(content) FROM vfile WHERE name = \"%s\"", name);
+
+	if(getErrType() != ERR_NONE) {
+		return NULL;
+	}
+
+	if(dbQueryCountRows(result) != 1) {
+		dbQueryFreeResult(result);
+		return NULL;
+	}
+
+	if((row = dbQueryGetRow(result)) == NULL) {
+		dbQueryFreeResult(result);
+		return NULL;
+	}
+
+	if((ventry = createVFileEntry()) == NULL) {
+		dbQueryFreeResult(result);
+		return NULL;
+	}
+
+	ventry->id = atol(row[0]);
+	ventry->fileType = (row[1] != NULL) ? atoi(row[1]) : UNSET;
+	ventry->version = atoi(row[2]);
+	ventry->editDate = (row[3] != NULL) ? mStrdup(row[3]) : NULL;
+	ventry->name = mStrdup(row[4]);
+	ventry->content = (row[5] != NULL) ? mStrndup(row[5], MAX_LENGTH_CODE_JAVASCRIPT) : NULL;
+	ventry->contentLength = (ventry->content != NULL) ? strlen(ventry->content) : 0;
+	ventry->contentHash = (row[8] != NULL) ? mStrdup(row[8]) : NULL;
+
+	// Compiled module, if there is one, is binary
+	if(row[6] != NULL && row[7] != NULL && (lengths = dbQueryGetLengths(result)) != NULL && lengths[6] > 0) {
+
+		if((ventry->moduleCache = (char *)malloc(lengths[6])) != NULL) {
+			memcpy(ventry->moduleCache, row[6], lengths[6]);
+			ventry->moduleCacheLength = lengths[6];
+			ventry->moduleCacheKey = mStrndup(row[7], VFILE_LENGTH_MODULE_KEY);
+		}
+	}
+
+	dbQueryFreeResult(result);
+
+	return ventry;
+}
+
+
+/*
+ * Purpose: Get which version of a vfile is stored, without its content
+ * 	or the module compiled from it
+ *
+ * Entry:
+ * 	1st - Path to the file
+ *
+ * Exit:
+ * 	SUCCESS = Pointer to VFile_Entry with its id, version, edit date,
+ * 		content length and hash filled in, or NULL if not found
+ * 	FAILURE = NULL and err type set
+*/
+VFile_Entry *getVFileVersionByName(char *name) {
+	VFile_Entry *ventry;
+	DBRESULT *result;
+	DBROW row;
+
+	result = dbQuery("SELECT id, version, editDate, LENGTH(content), MD5(content) FROM vfile WHERE name = \"%s\"", name);
+
+	if(getErrType() != ERR_NONE) {
+		return NULL;
+	}
+
+	if(dbQueryCountRows(result) != 1 || (row = dbQueryGetRow(result)) == NULL) {
+		dbQueryFreeResult(result);
+		return NULL;
+	}
+
+	if((ventry = createVFileEntry()) == NULL) {
+		dbQueryFreeResult(result);
+		return NULL;
+	}
+
+	ventry->id = atol(row[0]);
+	ventry->version = atoi(row[1]);
+	ventry->editDate = (row[2] != NULL) ? mStrdup(row[2]) : NULL;
+	ventry->contentLength = (row[3] != NULL) ? (size_t)atol(row[3]) : 0;
+	ventry->contentHash = (row[4] != NULL) ? mStrdup(row[4]) : NULL;
+
+	dbQueryFreeResult(result);
+
+	return ventry;
+}
+
+
+/*
+ * Purpose: Store the module compiled from a vfile, so other rule runners
+ * 	don't have to compile it
+ *
+ * Entry:
+ * 	1st - Id of vfile
+ * 	2nd - What it was compiled from, see VFile_Entry.moduleCacheKey
+ * 	3rd - Bytecode, may hold \0's
+ * 	4th - Length of bytecode
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+ *
+ * Note: The compiled module is stored alongside the content rather than
+ * 	cleared when the file is written, it's stale once its key no longer
+ * 	matches the file.
+*/
+bool updateVFileModuleCache(long id, char *key, char *cache, size_t length) {
+	DBRESULT *result;
+	char *escaped;
+
+	if((escaped = dbEscapeString(cache, length)) == NULL)
+		return false;
+
+	result = dbQuery("UPDATE vfile SET moduleCache = '%s', moduleCacheKey = '%s' WHERE id = %ld", escaped, key, id);
+
+	free(escaped);
+	dbQueryFreeResult(result);
+
+	if(getErrType() != ERR_NONE) {
+		return false;
+	}
+
+	return true;
+}
+
+
 /*
  * Purpose: Create a vfile rights struct. Default mode is
  *  rights aren't allowed
@@ -10,16 +10,25 @@
 #include "codewide.h"
 #include "msgqueue.h"
 
+#define VFILE_LENGTH_MODULE_KEY	100	// Max length of vfile.moduleCacheKey
+
 /* Structure for holding details on about vfile */
 typedef struct {
 	long id;                // Id of vfile item
 
 	int fileType;		// File type (reserved)
 
+	int version;		// Times the file has been written
 	char *editDate;		// Date this file was last edited
 
 	char *name;             // Name of vfile
 	char *content;		// File content
+	size_t contentLength;	// Length of content
+	char *contentHash;	// MD5 of content in hex, set even when only its version is got
+
+	char *moduleCache;	// Content compiled as a module (see jsmodule.c), may hold \0's
+	size_t moduleCacheLength;	// Length of moduleCache
+	char *moduleCacheKey;	// What moduleCache was compiled from, NULL = nothing cached
 } VFile_Entry;
 
 
@@ -46,6 +55,9 @@ void freeVFileEntry(VFile_Entry *);	// Release mem associated with a VFile_Entry
 VFile_Entry *getVFileEntryById(long);	// Get a VFile_Entry by id
 VFile_Entry *getVFileEntryByName(char *);	// Get a VFile_Entry by name
 bool insertVFileEntryByName(char *, char *, Queue_Entry *);	// Insert or update the contents of a virtual file
+VFile_Entry *getVFileModuleByName(char *);	// Get a VFile_Entry by name, with the module compiled from it
+VFile_Entry *getVFileVersionByName(char *);	// Get which version of a file is stored, without its content
+bool updateVFileModuleCache(long, char *, char *, size_t);	// Store the module compiled from a file
 
 VFile_Rights *createVFileRights();	// Allocate mem and setup a VFile_Rights
 void freeVFileRights(VFile_Rights *);	// Release mem associated with a VFile_Rights
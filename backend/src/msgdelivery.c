@@ -14,6 +14,7 @@
 #include<time.h>
 #include<sys/types.h>
 #include<sys/wait.h>
+#include<sysexits.h>
 #include "setupthang.h"
 #include "logerror.h"
 #include "dbchatter.h"
@@ -21,6 +22,8 @@
 #include "jsrunner.h"
 #include "sandbox.h"
 #include "msgqueue.h"
+#include "qlog.h"
+#include "qarchive.h"
 
 
 /*
@@ -44,6 +47,13 @@ bool setup(int argc, char **argv) {
 	if(dbConnect() == false)
 		return false;
 
+	// Log queue backend reaches its segments through this from inside the jail, so
+	//  every daemon shares the one log rather than each its own copy in the jail
+	if(openQueueLogDir() == false) {
+		printf("msgdelivery: FAILED TO OPEN QUEUE LOG DIR\n");
+		exit(FAILURE);
+	}
+
 	// Security wise it might make more sense to have this happening first and
 	// put the config file along with database socket in the chroot folder
 #ifndef DEBUG
@@ -118,11 +128,23 @@ int main(int argc, char **argv) {
 		failureExit(getErrType());
 	}
 
+	// One shot archiving of queue entries left DONE before archiving existed
+	if(_config->archive_backfill == 1) {
+		if(backfillQueueArchive(_config->archive_batch) == FAILURE) {
+			printf("ERROR archiving queue entries\n");
+			failureExit(getErrType());
+		}
+
+		tidy();
+
+		return SUCCESS;
+	}
+
 	// Process outgoing message queue with spawnQueue() doing the work in each child
 	runQueueThreads(&spawnProcessOutQueue, _config->maxnum_outqueue_threads,
-		DBVAL_message_queue_messageType_EMAILOUT, DBVAL_message_queue_track_NORMAL, 
+		DBVAL_message_queue_messageType_EMAILOUT,
 		MAX_OUTQUEUE_SLEEP_SEC, MAX_OUTQUEUE_SLEEP_NSEC,
-		&failureExit, SANDBOX_MSGDELIVERY);
+		&failureExit, SANDBOX_MSGDELIVERY, NULL, NULL);
 
 	tidy();
 
@@ -200,9 +222,57 @@ ERRTYPE spawnProcessOutQueue(Queue_Entry *qentry) {
 	free(outMsg);
 	close(pipeNode[1]);
 
-	// Tidy up zombies
-	if(waitpid(pid, NULL, 0) < 0) 
+	// Tidy up zombies, and find out whether sendmail took the message
+	if(waitpid(pid, &status, 0) < 0) 
 		return ERR_PROC_FORK;
 
-	return ERR_NONE;
+	return getMailOutExitErr(status);
+}
+
+
+/*
+ * Purpose: Turn how sendmail exited into an error type, telling apart
+ * 	failures that may go away from ones that won't
+ *
+ * Entry:
+ * 	1st - Status returned by waitpid() for sendmail
+ *
+ * Exit:
+ * 	ERR_NONE = mail accepted
+ * 	ERR_MAILOUT_TEMPFAIL = try again later
+ * 	ERR_MAILOUT_PERMFAIL = mail refused, e.g. bad address
+ * 	Other ERR_* = the child failed before sendmail ran
+ *
+ * Note: sendmail exits with the sysexits.h codes
+*/
+ERRTYPE getMailOutExitErr(int status) {
+	int code;
+
+	if(WIFEXITED(status) == false)
+		return ERR_MAILOUT_TEMPFAIL;
+
+	code = WEXITSTATUS(status);
+
+	// Our own child failing to exec or setup stdin
+	if(code == ERR_EXEC_MAILOUT || code == ERR_PROC_PIPE_CREATE)
+		return (ERRTYPE)code;
+
+	switch(code) {
+
+		case EX_OK:
+			return ERR_NONE;
+
+		case EX_TEMPFAIL:
+		case EX_UNAVAILABLE:
+		case EX_SOFTWARE:
+		case EX_OSERR:
+		case EX_OSFILE:
+		case EX_CANTCREAT:
+		case EX_IOERR:
+		case EX_CONFIG:
+			return ERR_MAILOUT_TEMPFAIL;
+
+		default:
+			return ERR_MAILOUT_PERMFAIL;
+	}
 }
@@ -18,5 +18,6 @@ bool tidy();			// Disconnect from db, etc
 void failureExit(ERRTYPE);	// If there is a failure, tidy up and exit
 
 ERRTYPE spawnProcessOutQueue(Queue_Entry *);	// Deliver an outgoing message
+ERRTYPE getMailOutExitErr(int);			// Turn how sendmail exited into an error type
 
 #endif
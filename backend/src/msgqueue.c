@@ -6,16 +6,46 @@
 
 #include<stdlib.h>
 #include<string.h>
+#include<stddef.h>
 #include<unistd.h>
 #include<time.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<signal.h>
 #include<sys/types.h>
 #include<sys/wait.h>
+#include<sys/socket.h>
+#include<sys/time.h>
+#include<sys/resource.h>
 #include "setupthang.h"
 #include "msgqueue.h"
 #include "logerror.h"
 #include "dbchatter.h"
 #include "mngmail.h"
 #include "sandbox.h"
+#include "doorbell.h"
+#include "qsched.h"
+#include "qarchive.h"
+#include "qshard.h"
+#include "qevents.h"
+#include "qtimer.h"
+#include "qadapt.h"
+#include "qpressure.h"
+#include "qlog.h"
+
+
+/* Where queues can be kept, picked by the queue_backend setting (see SCONFIG) */
+static Queue_Backend queueBackends[] = {
+	{QUEUE_BACKEND_DB, true, insertQueueEntryDb, getQueueEntryOldestDb, getQueueEntryJustinNotRunningDb,
+		setQueueEntryStateDb, setQueueEntriesStateDb, claimQueueEntriesDb, releaseQueueEntryDb, renewQueueLeasesDb,
+		sweepQueueLeasesDb, failQueueEntryDb, archiveQueueEntries, countQueueOutPendingDb,
+		getQueueOutFullVoidsDb, NULL},
+
+	{QUEUE_BACKEND_LOG, false, insertQueueEntryLog, getQueueEntryOldestLog, getQueueEntryJustinNotRunningLog,
+		setQueueEntryStateLog, setQueueEntriesStateLog, claimQueueEntriesLog, releaseQueueEntryLog, renewQueueLeasesLog,
+		sweepQueueLeasesLog, failQueueEntryLog, compactQueueLog, countQueueOutPendingLog,
+		getQueueOutFullVoidsLog, syncQueueEntriesLog}
+};
 
 
 /*
@@ -43,6 +73,9 @@ Queue_Entry *createQueueEntry() {
 	qentry->userId = UNSET;
 	qentry->voidId = UNSET;
 	qentry->track = UNSET;
+	qentry->notBefore = UNSET;
+	qentry->failures = 0;
+	qentry->batchNext = NULL;
 
 	return qentry;
 }
@@ -68,20 +101,301 @@ void freeQueueEntry(Queue_Entry *qentry) {
 }
 
 
+/*
+ * Purpose: Frees mem used by a queue entry and the rest of its batch
+ *
+ * Entry:
+ * 	1st - Pointer to the first Queue_Entry of a batch
+ *
+ * Exit:
+ * 	NONE
+ */
+void freeQueueEntryBatch(Queue_Entry *qentry) {
+	Queue_Entry *next;
+
+	for(; qentry != NULL; qentry = next) {
+		next = qentry->batchNext;
+		freeQueueEntry(qentry);
+	}
+}
+
+
+/*
+ * Purpose: Count the entries in a batch
+ *
+ * Entry:
+ * 	1st - Pointer to the first Queue_Entry of a batch
+ *
+ * Exit:
+ * 	Number of entries, 1 for an entry on its own
+ */
+int countQueueEntryBatch(Queue_Entry *qentry) {
+	int n;
+
+	for(n = 0; qentry != NULL; qentry = qentry->batchNext)
+		n++;
+
+	return n;
+}
+
+
+/*
+ * Purpose: Get where queues are kept, the database unless the queue_backend
+ * 	setting says otherwise
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	Queue_Backend to call through
+ *
+ * Note: Every program of an install must use the same backend, mailinject
+ * 	adds the entries the rule runner claims.
+*/
+Queue_Backend *getQueueBackend() {
+
+	if(_config != NULL && _config->queue_backend == QUEUE_BACKEND_LOG)
+		return &queueBackends[QUEUE_BACKEND_LOG];
+
+	return &queueBackends[QUEUE_BACKEND_DB];
+}
+
+
 /*
  * Purpose: Add an item to the message queue
  *
  * Entry:
- * 	1st - Queue_Entry with struct values filled in
+ * 	1st - Queue_Entry with struct values filled in, notBefore set if the
+ * 		entry shouldn't be processed straight away
  *
  * Exit:
  * 	SUCCESS = true
  * 	FAILURE = false
 */
 bool insertQueueEntry(Queue_Entry *qentry) {
+
+	if(getQueueBackend()->insertEntry(qentry) == false)
+		return false;
+
+	// Wake up the bosses processing this queue
+	ringDoorbell(qentry->messageType);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Gets the oldest item in the message queue in a specific
+ * 	state, of a specific message type and on a specific queue track
+ *
+ * Entry:
+ * 	1st - Queue item state to get
+ * 	2nd - Queue track to get item on
+ * 	3rd - Type of message queue entry to get, e.g. email
+ *
+ * Exit:
+ * 	SUCCESS = Pointer to Queue_Entry struck with details
+ * 		or NULL if not found
+ * 	FAILURE = NULL and err type set
+*/
+Queue_Entry *getQueueEntryOldest(int queueState, int track, int messageType) {
+
+	return getQueueBackend()->getEntryOldest(queueState, track, messageType);
+}
+
+
+/*
+ * Purpose: Gets the oldest item in the message queue in a specific
+ * 	state and on a specific queue track BUT only get items where
+ * 	a rule isn't currently getting run for a void
+ *
+ * Entry:
+ * 	1st - Queue track to get item on
+ * 	2nd - Type of message queue entry to get, e.g. email
+ *
+ * Exit:
+ * 	SUCCESS = Pointer to Queue_Entry struck with details
+ * 		or NULL if not found
+ * 	FAILURE = NULL and err type set
+*/
+Queue_Entry *getQueueEntryJustinNotRunning(int track, int messageType) {
+
+	return getQueueBackend()->getEntryJustinNotRunning(track, messageType);
+}
+
+
+/*
+ * Purpose: Set the queueState of queue entry
+ *
+ * Entry:
+ * 	1st - Queue_Entry to set state of
+ * 	2nd - Queue state to set it to
+ *
+ * Exit:
+ * 	SUCCESS = true, and qentry queueState updated with the new state
+ * 	FAILURE = false
+*/
+bool setQueueEntryState(Queue_Entry *qentry, int state) {
+
+	if(getQueueBackend()->setEntryState(qentry, state) == false)
+		return false;
+
+	qentry->queueState = state;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Set the queue state of every entry of a batch together
+ *
+ * Entry:
+ * 	1st - First Queue_Entry of the batch, all in the same state
+ * 	2nd - Queue state to set them to
+ *
+ * Exit:
+ * 	SUCCESS = true, and every entry's queueState updated with the new state
+ * 	FAILURE = false
+*/
+bool setQueueEntriesState(Queue_Entry *qentry, int state) {
+	int n;
+
+	if(qentry->batchNext == NULL)
+		return setQueueEntryState(qentry, state);
+
+	n = countQueueEntryBatch(qentry);
+
+	if(getQueueBackend()->setEntriesState(qentry, n, state) == false)
+		return false;
+
+	for(; qentry != NULL; qentry = qentry->batchNext)
+		qentry->queueState = state;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Atomically claim a batch of JUSTIN queue entries for a boss,
+ * 	moving them to PROCESSING
+ *
+ * Entry:
+ * 	1st - Array to fill with the claimed Queue_Entry's
+ * 	2nd - Max number of entries to claim (size of the array)
+ * 	3rd - Queue track to claim items on
+ * 	4th - Type of message queue entry to claim, e.g. email
+ * 	5th - Claim token, must be unique to this boss and this claim
+ * 	6th - Id of the boss claiming, the entries are leased to it
+ * 	7th - Comma separated list of void ids not to claim entries for,
+ * 		NULL = claim for any void
+ * 	8th - Comma separated list of void ids being held back by backpressure
+ * 		(see qpressure.c), NULL = none
+ * 	9th - Shard of the boss, NULL = not sharding
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries claimed (0 if nothing to do)
+ * 	FAILURE = FAILURE and err type set
+*/
+int claimQueueEntries(Queue_Entry **qentries, int max, int track, int messageType, char *claimToken, char *owner, char *skipVoids, char *heldVoids, Queue_Shard *shard) {
+
+	return getQueueBackend()->claimEntries(qentries, max, track, messageType, claimToken, owner, skipVoids, heldVoids, shard);
+}
+
+
+/*
+ * Purpose: Put a claimed queue entry that was never started back on the
+ * 	queue, without it counting as an attempt
+ *
+ * Entry:
+ * 	1st - Queue_Entry to put back
+ *
+ * Exit:
+ * 	SUCCESS = true, and qentry queueState set to JUSTIN
+ * 	FAILURE = false
+*/
+bool releaseQueueEntry(Queue_Entry *qentry) {
+
+	return getQueueBackend()->releaseEntry(qentry);
+}
+
+
+/*
+ * Purpose: Heartbeat from a boss, pushes back the lease expiry of every
+ * 	entry it's holding
+ *
+ * Entry:
+ * 	1st - Id of the boss, as passed to claimQueueEntries()
+ * 	2nd - Type of message queue the boss processes
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool renewQueueLeases(char *owner, int messageType) {
+
+	return getQueueBackend()->renewLeases(owner, messageType);
+}
+
+
+/*
+ * Purpose: Put entries whose lease has run out back on the queue, their
+ * 	boss has died or lost touch with the queue
+ *
+ * Entry:
+ * 	1st - Type of message queue to sweep
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries put back or set aside
+ * 	FAILURE = FAILURE and err type set
+*/
+int sweepQueueLeases(int messageType) {
+
+	return getQueueBackend()->sweepLeases(messageType);
+}
+
+
+/*
+ * Purpose: Make sure changes to the queue so far survive the host going
+ * 	down, for backends that don't do so as they go
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool syncQueueEntries() {
+	Queue_Backend *backend;
+
+	backend = getQueueBackend();
+
+	if(backend->syncEntries == NULL)
+		return true;
+
+	return backend->syncEntries();
+}
+
+
+/*
+ * Purpose: Add an item to the message_queue table
+ *
+ * Entry:
+ * 	1st - Queue_Entry with struct values filled in, notBefore set if the
+ * 		entry shouldn't be processed straight away
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false
+*/
+bool insertQueueEntryDb(Queue_Entry *qentry) {
 	DBRESULT *result;
 
-	result = dbQuery("INSERT INTO message_queue (messageId, messageType, queueState, userId, voidId, track, processDate) VALUES (%ld, %d, %d, %ld, %ld, %d, now())", qentry->messageId, qentry->messageType, qentry->queueState, qentry->userId, qentry->voidId, qentry->track);
+	if(qentry->notBefore > time(NULL)) {
+		result = dbQuery("INSERT INTO message_queue (messageId, messageType, queueState, userId, voidId, track, shardKey, notBefore, processDate) VALUES (%ld, %d, %d, %ld, %ld, %d, %d, FROM_UNIXTIME(%ld), now())", qentry->messageId, qentry->messageType, qentry->queueState, qentry->userId, qentry->voidId, qentry->track, getQueueShardKey(qentry->messageType, qentry->voidId, qentry->userId), (long)qentry->notBefore);
+	} else {
+		result = dbQuery("INSERT INTO message_queue (messageId, messageType, queueState, userId, voidId, track, shardKey, notBefore, processDate) VALUES (%ld, %d, %d, %ld, %ld, %d, %d, now(), now())", qentry->messageId, qentry->messageType, qentry->queueState, qentry->userId, qentry->voidId, qentry->track, getQueueShardKey(qentry->messageType, qentry->voidId, qentry->userId));
+	}
 
 	dbQueryFreeResult(result);
 
@@ -107,7 +421,7 @@ bool insertQueueEntry(Queue_Entry *qentry) {
  * 		or NULL if not found
  * 	FAILURE = NULL and err type set
 */
-Queue_Entry *getQueueEntryOldest(int queueState, int track, int messageType) {
+Queue_Entry *getQueueEntryOldestDb(int queueState, int track, int messageType) {
 	Queue_Entry *qentry;
 	DBRESULT *result;
 	DBROW row;
@@ -166,7 +480,7 @@ Queue_Entry *getQueueEntryOldest(int queueState, int track, int messageType) {
  * Todo: This function could probably be speeded up by
  * 	returning an array of items in the message queue
 */
-Queue_Entry *getQueueEntryJustinNotRunning(int track, int messageType) {
+Queue_Entry *getQueueEntryJustinNotRunningDb(int track, int messageType) {
 	Queue_Entry *qentry;
 	DBRESULT *result = NULL;
 	DBROW row;
@@ -219,163 +533,1280 @@ Queue_Entry *getQueueEntryJustinNotRunning(int track, int messageType) {
 
 
 /*
- * Purpose: In the database set the queueState of queue entry
+ * Purpose: Atomically claim a batch of JUSTIN queue entries for a boss,
+ * 	moving them to PROCESSING and stamping them with a claim token
  *
  * Entry:
- * 	1st - Queue_Entry to set state of
- * 	2nd - Queue state to set it to
+ * 	1st - Array to fill with the claimed Queue_Entry's
+ * 	2nd - Max number of entries to claim (size of the array)
+ * 	3rd - Queue track to claim items on
+ * 	4th - Type of message queue entry to claim, e.g. email
+ * 	5th - Claim token, must be unique to this boss and this claim
+ * 	6th - Id of the boss claiming, the entries are leased to it
+ * 	7th - Comma separated list of void ids not to claim entries for,
+ * 		NULL = claim for any void
+ * 	8th - Comma separated list of void ids being held back, NULL = none
+ * 	9th - Shard of the boss, NULL = not sharding
  *
  * Exit:
- * 	SUCCESS = true, and qentry queueState updated with the new state
- * 	FAILURE = false
+ * 	SUCCESS = Number of entries claimed (0 if nothing to do)
+ * 	FAILURE = FAILURE and err type set
+ *
+ * Note: Entries are claimed oldest first whatever void they're for, it's
+ * 	up to the boss (see qsched.c) to make sure a void doesn't have two
+ * 	rules running at once. When two bosses race for the same rows the
+ * 	queueState check in the UPDATE means each row goes to exactly one of
+ * 	them. MySQL has no UPDATE ... RETURNING so the claimed rows are read
+ * 	back by token, but only when something was claimed, an empty queue
+ * 	costs a single query.
+ *
+ * Note 2: The boss holds a lease of QUEUE_LEASE_SEC on what it claims,
+ * 	see renewQueueLeases() and sweepQueueLeases().
+ *
+ * Note 3: Entries due within QUEUE_TIMER_HORIZON_SEC are claimed too, soonest
+ * 	due first, and their notBefore says when they can run. Their lease
+ * 	runs from their notBefore so they cost nothing while the boss waits.
+ *
+ * Note 4: If the claimed rows can't be read back they're all put back on
+ * 	the queue, otherwise the boss would keep renewing leases on entries
+ * 	it doesn't know it has.
 */
-bool setQueueEntryState(Queue_Entry *qentry, int state) {
-	DBRESULT *result;
+int claimQueueEntriesDb(Queue_Entry **qentries, int max, int track, int messageType, char *claimToken, char *owner, char *skipVoids, char *heldVoids, Queue_Shard *shard) {
+	DBRESULT *result = NULL;
+	DBROW row;
+	ERRTYPE err;
+	char *filter;
+	int n;
 
-	result = dbQuery("UPDATE message_queue SET queueState = %d, processDate = now() WHERE id = %ld AND queueState = %d", state, qentry->id, qentry->queueState);
+	if(max <= 0)
+		return 0;
+
+	if((filter = createQueueClaimFilter(skipVoids, heldVoids, shard)) == NULL)
+		return FAILURE;
+
+	result = dbQuery("UPDATE message_queue SET queueState = %d, claimToken = '%s', claimOwner = '%s', leaseExpiry = GREATEST(now(), notBefore) + INTERVAL %d SECOND, attempts = attempts + 1, processDate = now() WHERE queueState = %d AND messageType = %d AND track = %d AND notBefore <= now() + INTERVAL %d SECOND%s ORDER BY notBefore ASC, id ASC LIMIT %d", DBVAL_message_queue_queueState_PROCESSING, claimToken, owner, QUEUE_LEASE_SEC, DBVAL_message_queue_queueState_JUSTIN, messageType, track, QUEUE_TIMER_HORIZON_SEC, filter, max);
+
+	free(filter);
 
 	if(getErrType() != ERR_NONE) {
 		dbQueryFreeResult(result);
-		return false;
+		return FAILURE;
 	}
 
-	// Make sure a single row was updated, otherwise update definitely didn't work
-	if(dbQueryCountRows(result) != 1) {
+	n = dbQueryCountRows(result);
+
+	dbQueryFreeResult(result);
+
+	if(n <= 0)
+		return 0;
+
+	// Read back what was claimed
+	result = dbQuery("SELECT id, messageId, userId, voidId, UNIX_TIMESTAMP(notBefore), failures FROM message_queue WHERE claimToken = '%s' AND queueState = %d ORDER BY notBefore ASC, id ASC LIMIT %d", claimToken, DBVAL_message_queue_queueState_PROCESSING, max);
+
+	if(getErrType() != ERR_NONE) {
+		err = getErrType();
 		dbQueryFreeResult(result);
-		return false;
+		releaseQueueClaimDb(claimToken);
+		setErrType(err);
+		return FAILURE;
 	}
 
-	dbQueryFreeResult(result);
+	for(n = 0; n < max && (row = dbQueryGetRow(result)) != NULL; n++) {
 
-	qentry->queueState = state;
+		if((qentries[n] = createQueueEntry()) == NULL) {
+			err = getErrType();
 
-	return true;
+			while(n-- > 0)
+				freeQueueEntry(qentries[n]);
+
+			dbQueryFreeResult(result);
+			releaseQueueClaimDb(claimToken);
+			setErrType(err);
+			return FAILURE;
+		}
+
+		qentries[n]->id = atol(row[0]);
+		qentries[n]->messageId = atol(row[1]);
+		qentries[n]->messageType = messageType;
+
+		qentries[n]->queueState = DBVAL_message_queue_queueState_PROCESSING;
+
+		qentries[n]->userId = atol(row[2]);
+		qentries[n]->voidId = atol(row[3]);
+		qentries[n]->track = track;
+
+		qentries[n]->notBefore = (row[4] != NULL) ? (time_t)atol(row[4]) : UNSET;
+		qentries[n]->failures = atoi(row[5]);
+	}
+
+	dbQueryFreeResult(result);
+
+	return n;
 }
 
 
 /*
- * Purpose: Thread worker spawner (Boss/Worker design pattern)
+ * Purpose: Put everything claimed under a claim token back on the database
+ * 	queue, without it counting as an attempt
  *
  * Entry:
- * 	1st - Function pointer to function to do the work in child threads
- * 	2nd - Max number of threads to run at once
- * 	3rd - What message queue to process
- * 	4th - What priority on the message queue to process
- * 	5th - Number of secs to sleep between spawning worker threads
- * 	6th - Number of nanosecs to sleep (+ secs) between spawning worker
- * 		threads
- * 	7th - Function to call when a serious error occurs that should
- * 		stop the thread runner
- * 	8th - What kind of sandbox should child processes be put into
+ * 	1st - Claim token the entries were claimed with
  *
  * Exit:
- * 	SUCCESS = No return from this method UNLESS there is a FAILURE
- * 	FAILURE = Err set to error type
- *
- * Note: This function normally calls the failureExit function pointer upon
- * 	a serious error. When this function is called it should exit the program
- * 	and NOT return back to continue running this function where it left off.
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
 */
-bool runQueueThreads(ERRTYPE (*worker)(Queue_Entry *), int numThreads, int queueType, int track, long int sleepSec, long int sleepNsec, void (*failureExit)(ERRTYPE), SANDBOXTYPE stype) {
+bool releaseQueueClaimDb(char *claimToken) {
+	DBRESULT *result;
 
-	Queuerunner_Thread **threads;
-	int i, n = 0, status /*, msgId */;
-	struct timespec delay;
+	result = dbQuery("UPDATE message_queue SET queueState = %d, claimToken = NULL, claimOwner = NULL, leaseExpiry = NULL, attempts = IF(attempts > 0, attempts - 1, 0), processDate = now() WHERE claimToken = '%s' AND queueState = %d", DBVAL_message_queue_queueState_JUSTIN, claimToken, DBVAL_message_queue_queueState_PROCESSING);
 
-	// Everything was setup properly so now get on with main code
-	if((threads = (Queuerunner_Thread **)malloc(sizeof(Queuerunner_Thread *) * (numThreads + 1))) == NULL) {
-		failureExit(ERR_MEM_ALLOC);
-	}
+	dbQueryFreeResult(result);
 
-	// Time to sleep between checking whether there's work to do
-	delay.tv_sec = sleepSec;
-	delay.tv_nsec = sleepNsec; 
+	if(getErrType() != ERR_NONE) {
+		return false;
+	}
 
-	// Initialise with no threads running
-	for(i = 0; i < numThreads; i++) {
+	return true;
+}
 
-		if((threads[i] = (Queuerunner_Thread *)malloc(sizeof(Queuerunner_Thread))) == NULL) {
-			failureExit(ERR_MEM_ALLOC);
-		}
 
-		threads[i]->id = QUEUE_THREAD_SLOT_EMPTY;
-		threads[i]->qentry = NULL;
+/*
+ * Purpose: Build the extra conditions a boss puts on a claim
+ *
+ * Entry:
+ * 	1st - Comma separated list of void ids not to claim entries for,
+ * 		NULL = claim for any void
+ * 	2nd - Comma separated list of void ids being held back by backpressure
+ * 		(see qpressure.c), NULL = none
+ * 	3rd - Shard of the boss, NULL = not sharding
+ *
+ * Exit:
+ * 	SUCCESS = SQL conditions each starting with AND (may be empty),
+ * 		caller must free()
+ * 	FAILURE = NULL and err type set
+*/
+char *createQueueClaimFilter(char *skipVoids, char *heldVoids, Queue_Shard *shard) {
+	char *filter;
+	size_t length, used = 0;
+
+	length = ((skipVoids == NULL) ? 0 : strlen(skipVoids)) + ((heldVoids == NULL) ? 0 : strlen(heldVoids)) + QUEUE_LENGTH_CLAIM_FILTER;
+
+	if((filter = (char *)malloc(length)) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	filter[0] = '\0';
+
+	if(skipVoids != NULL)
+		used += snprintf(filter + used, length - used, " AND voidId NOT IN (%s)", skipVoids);
+
+	if(heldVoids != NULL)
+		used += snprintf(filter + used, length - used, " AND voidId NOT IN (%s)", heldVoids);
+
+	if(shard != NULL) {
+		used += snprintf(filter + used, length - used, " AND shardKey >= %d AND shardKey < %d", shard->low, shard->high);
+
+		// While shard ranges move another node may still be running a void that's now ours
+		if(isQueueShardMoving(shard) == true)
+			used += snprintf(filter + used, length - used, " AND voidId NOT IN (SELECT voidId FROM (SELECT DISTINCT voidId FROM message_queue WHERE queueState = %d AND messageType = %d AND claimOwner != '%s') AS busy)", DBVAL_message_queue_queueState_PROCESSING, shard->messageType, shard->nodeName);
+
+		// Claiming without the lock, claim nothing if a node moved the ranges since that was checked
+		else if(shard->exclusive == true)
+			used += snprintf(filter + used, length - used, " AND (SELECT MAX(moved) FROM queue_node WHERE messageType = %d) <= now() - INTERVAL %d SECOND", shard->messageType, QUEUE_LEASE_SEC);
+	}
+
+	return filter;
+}
+
+
+/*
+ * Purpose: In the database set the queueState of queue entry
+ *
+ * Entry:
+ * 	1st - Queue_Entry to set state of
+ * 	2nd - Queue state to set it to
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false
+*/
+bool setQueueEntryStateDb(Queue_Entry *qentry, int state) {
+	DBRESULT *result;
+
+	result = dbQuery("UPDATE message_queue SET queueState = %d, processDate = now() WHERE id = %ld AND queueState = %d", state, qentry->id, qentry->queueState);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	// Make sure a single row was updated, otherwise update definitely didn't work
+	if(dbQueryCountRows(result) != 1) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	dbQueryFreeResult(result);
+
+	return true;
+}
+
+/*
+ * Purpose: In the database set the queueState of every entry of a batch
+ * 	with one query
+ *
+ * Entry:
+ * 	1st - First Queue_Entry of the batch, all in the same state
+ * 	2nd - Number of entries in the batch
+ * 	3rd - Queue state to set them to
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false, and err type set if not every entry was updated
+*/
+bool setQueueEntriesStateDb(Queue_Entry *qentry, int numEntries, int state) {
+	DBRESULT *result;
+	Queue_Entry *q;
+	char *ids;
+	size_t length, used;
+
+	length = (numEntries * 21) + 1;		// Max digits in a long plus a comma
+
+	if((ids = (char *)malloc(length)) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	for(q = qentry, used = 0; q != NULL; q = q->batchNext)
+		used += snprintf(ids + used, length - used, (q == qentry) ? "%ld" : ",%ld", q->id);
+
+	result = dbQuery("UPDATE message_queue SET queueState = %d, processDate = now() WHERE id IN (%s) AND queueState = %d", state, ids, qentry->queueState);
+
+	free(ids);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	if(dbQueryCountRows(result) != numEntries) {
+		dbQueryFreeResult(result);
+		setErrType(ERR_DB_QUERY);
+		return false;
+	}
+
+	dbQueryFreeResult(result);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Put a claimed queue entry that was never started back on the
+ * 	database queue, without it counting as an attempt
+ *
+ * Entry:
+ * 	1st - Queue_Entry to put back
+ *
+ * Exit:
+ * 	SUCCESS = true, and qentry queueState set to JUSTIN
+ * 	FAILURE = false
+*/
+bool releaseQueueEntryDb(Queue_Entry *qentry) {
+	DBRESULT *result;
+
+	result = dbQuery("UPDATE message_queue SET queueState = %d, claimToken = NULL, claimOwner = NULL, leaseExpiry = NULL, attempts = IF(attempts > 0, attempts - 1, 0), processDate = now() WHERE id = %ld AND queueState = %d", DBVAL_message_queue_queueState_JUSTIN, qentry->id, qentry->queueState);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	if(dbQueryCountRows(result) != 1) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	dbQueryFreeResult(result);
+
+	qentry->queueState = DBVAL_message_queue_queueState_JUSTIN;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Heartbeat from a boss, pushes back the lease expiry of every
+ * 	entry it's holding
+ *
+ * Entry:
+ * 	1st - Id of the boss, as passed to claimQueueEntries()
+ * 	2nd - Type of message queue the boss processes
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+ *
+ * Note: Entries waiting on the boss's timer already have a lease running
+ * 	past their notBefore, which is left as it is
+*/
+bool renewQueueLeasesDb(char *owner, int messageType) {
+	DBRESULT *result;
+
+	result = dbQuery("UPDATE message_queue SET leaseExpiry = GREATEST(leaseExpiry, now() + INTERVAL %d SECOND) WHERE claimOwner = '%s' AND queueState = %d AND messageType = %d", QUEUE_LEASE_SEC, owner, DBVAL_message_queue_queueState_PROCESSING, messageType);
+
+	dbQueryFreeResult(result);
+
+	return (getErrType() == ERR_NONE);
+}
+
+
+/*
+ * Purpose: Put entries whose lease has run out back on the queue, their
+ * 	boss has died or lost touch with the database
+ *
+ * Entry:
+ * 	1st - Type of message queue to sweep
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries put back or set aside
+ * 	FAILURE = FAILURE and err type set
+ *
+ * Note: An entry already claimed QUEUE_LEASE_MAX_ATTEMPTS times is set to
+ * 	POISON instead, as it's likely what keeps killing its boss. Entries
+ * 	left PROCESSING from before leases existed have no expiry and are
+ * 	swept too.
+*/
+int sweepQueueLeasesDb(int messageType) {
+	DBRESULT *result;
+	int n;
+
+	result = dbQuery("UPDATE message_queue SET queueState = IF(attempts >= %d, %d, %d), claimToken = NULL, claimOwner = NULL, leaseExpiry = NULL, processDate = now() WHERE queueState = %d AND messageType = %d AND (leaseExpiry < now() OR leaseExpiry IS NULL)", QUEUE_LEASE_MAX_ATTEMPTS, DBVAL_message_queue_queueState_POISON, DBVAL_message_queue_queueState_JUSTIN, DBVAL_message_queue_queueState_PROCESSING, messageType);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	n = dbQueryCountRows(result);
+
+	dbQueryFreeResult(result);
+
+	return n;
+}
+
+
+/*
+ * Purpose: Whether a failure processing a queue entry might not happen if
+ * 	the entry is tried again later
+ *
+ * Entry:
+ * 	1st - How processing the entry failed
+ *
+ * Exit:
+ * 	true = temporary, e.g. the database or sendmail was unavailable
+ * 	false = permanent, trying again would fail the same way
+*/
+bool isQueueErrTemporary(ERRTYPE err) {
+
+	switch(err) {
+
+		case ERR_DB_OPEN:
+		case ERR_DB_QUERY:
+		case ERR_PROC_FORK:
+		case ERR_PROC_PIPE_CREATE:
+		case ERR_PROC_PIPE_WRITE:
+		case ERR_PROC_CPU_OVERUSE:
+		case ERR_PROC_KILLED:
+		case ERR_SANDBOX_SETUP:
+		case ERR_EXEC_MAILOUT:
+		case ERR_MAILOUT_TEMPFAIL:
+		case ERR_MEM_ALLOC:
+		case ERR_UNKNOWN:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+
+/*
+ * Purpose: Work out how long to wait before retrying a failed entry
+ *
+ * Entry:
+ * 	1st - Number of times the entry has already failed
+ *
+ * Exit:
+ * 	Secs to wait, QUEUE_RETRY_BASE_SEC doubled for each earlier failure up
+ * 	to QUEUE_RETRY_MAX_SEC
+ *
+ * Note: The wait is picked at random from the second half of the backoff,
+ * 	so a batch that failed together (e.g. the MTA was down) comes back
+ * 	spread out rather than all at once.
+*/
+int getQueueRetryDelay(int failures) {
+	long delay;
+
+	for(delay = QUEUE_RETRY_BASE_SEC; failures > 0 && delay < QUEUE_RETRY_MAX_SEC; failures--)
+		delay *= 2;
+
+	if(delay > QUEUE_RETRY_MAX_SEC)
+		delay = QUEUE_RETRY_MAX_SEC;
+
+	return (int)((delay / 2) + (random() % ((delay / 2) + 1)));
+}
+
+
+/*
+ * Purpose: Deal with a queue entry whose processing failed, temporary
+ * 	failures are put back on the queue to try again later, anything else
+ * 	or one too many failures leaves the entry DEAD
+ *
+ * Entry:
+ * 	1st - Queue_Entry that failed, must be PROCESSING
+ * 	2nd - How it failed
+ *
+ * Exit:
+ * 	SUCCESS = true, and qentry queueState set to JUSTIN or DEAD
+ * 	FAILURE = false and err type set, entry left PROCESSING for the
+ * 		lease sweep to put back
+ *
+ * Note: A retry is an entry waiting on its notBefore (see qtimer.c), so it
+ * 	doesn't hold a worker thread slot while it waits. Its attempts are
+ * 	reset as it didn't kill its boss.
+*/
+bool failQueueEntry(Queue_Entry *qentry, ERRTYPE err) {
+	char *reason;
+	int state, delay = 0;
+
+	setErrType(err);
+
+	if((reason = getErrTypeMsg()) == NULL)
+		reason = "Unknown error";
+
+	if(isQueueErrTemporary(err) == true && qentry->failures + 1 < QUEUE_RETRY_MAX_FAILURES) {
+		state = DBVAL_message_queue_queueState_JUSTIN;
+		delay = getQueueRetryDelay(qentry->failures);
+	} else {
+		state = DBVAL_message_queue_queueState_DEAD;
+	}
+
+	if(getQueueBackend()->failEntry(qentry, state, delay, reason) == false)
+		return false;
+
+	qentry->queueState = state;
+	qentry->failures++;
+
+	// Leave how it failed for the caller to report
+	setErrType(err);
+
+	return true;
+}
+
+
+/*
+ * Purpose: In the database put a failed entry back on the queue to retry
+ * 	later or set it DEAD, noting why it failed
+ *
+ * Entry:
+ * 	1st - Queue_Entry that failed, must be PROCESSING
+ * 	2nd - State to set, JUSTIN or DEAD
+ * 	3rd - Secs before a JUSTIN entry can be retried
+ * 	4th - Why it failed
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool failQueueEntryDb(Queue_Entry *qentry, int state, int delay, char *reason) {
+	DBRESULT *result;
+	char *escaped;
+
+	if((escaped = dbEscapeString(reason, strlen(reason))) == NULL)
+		return false;
+
+	if(state == DBVAL_message_queue_queueState_JUSTIN)
+		result = dbQuery("UPDATE message_queue SET queueState = %d, claimToken = NULL, claimOwner = NULL, leaseExpiry = NULL, attempts = 0, failures = failures + 1, lastError = '%s', notBefore = now() + INTERVAL %d SECOND, processDate = now() WHERE id = %ld AND queueState = %d", DBVAL_message_queue_queueState_JUSTIN, escaped, delay, qentry->id, DBVAL_message_queue_queueState_PROCESSING);
+	else
+		result = dbQuery("UPDATE message_queue SET queueState = %d, claimToken = NULL, leaseExpiry = NULL, failures = failures + 1, lastError = '%s', processDate = now() WHERE id = %ld AND queueState = %d", DBVAL_message_queue_queueState_DEAD, escaped, qentry->id, DBVAL_message_queue_queueState_PROCESSING);
+
+	free(escaped);
+	dbQueryFreeResult(result);
+
+	if(getErrType() != ERR_NONE) {
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Tidy up what the boss had open before a worker thread starts
+ * 	its work, the worker doesn't need the boss's doorbell and ringer,
+ * 	event loop or the sockets to other pooled workers
+ *
+ * Entry:
+ * 	1st - Event loop of the boss
+ * 	2nd - Worker thread slots of the boss
+ * 	3rd - Number of worker thread slots
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Only closes its copies, taking anything out of the epoll instance
+ * 	here would take it out for the boss too
+*/
+void detachFromBoss(Queue_Events *events, Queuerunner_Thread **threads, int numThreads) {
+	int i;
+
+	closeDoorbell(events->doorbell);
+	closeDoorbellRinger();
+
+	for(i = 0; i < numThreads; i++) {
+		if(threads[i]->pipe != QUEUE_THREAD_PIPE_UNSET)
+			close(threads[i]->pipe);
+	}
+
+	// Also unblocks SIGCHLD, workers may have children of their own (e.g. sendmail)
+	freeQueueEvents(events);
+}
+
+
+/*
+ * Purpose: Turn how a worker thread ended into an error type
+ *
+ * Entry:
+ * 	1st - Status returned by waitpid()
+ *
+ * Exit:
+ * 	ERRTYPE for how the thread ended
+ *
+ * Note: Worker threads exit with the ERRTYPE their work returned, or the
+ * 	sandbox's signal handlers exit with the ERRTYPE of the signal (see
+ * 	sandbox.c). Exit statuses are only 8 bits, all ERRTYPEs fit.
+*/
+ERRTYPE getQueueThreadExitErr(int status) {
+	int code;
+
+	if(WIFEXITED(status)) {
+		code = WEXITSTATUS(status);
+
+		if(code == 0)
+			return ERR_NONE;
+
+		if(code >= ERR_LOG_OPEN && code < _ERR_END)
+			return (ERRTYPE)code;
+
+		return ERR_UNKNOWN;
+	}
+
+	// Signals the sandbox didn't get to handle, i.e. SIGKILL at the hard CPU limit
+	if(WIFSIGNALED(status)) {
+		switch(WTERMSIG(status)) {
+
+			case SIGXCPU:
+				return ERR_PROC_CPU_OVERUSE;
+
+			case SIGSEGV:
+				return ERR_PROC_MEM_EXCEED;
+
+			case SIGXFSZ:
+				return ERR_PROC_FILESIZE;
+
+			case SIGFPE:
+				return ERR_PROC_FLOATINGPOINT;
+
+			case SIGILL:
+				return ERR_PROC_ILLEGAL;
+
+			case SIGBUS:
+				return ERR_PROC_BUS;
+
+			default:
+				return ERR_PROC_KILLED;
+		}
+	}
+
+	return ERR_UNKNOWN;
+}
+
+
+/*
+ * Purpose: Record that the queue entry a worker thread was processing is
+ * 	done and free up the slot's entry
+ *
+ * Entry:
+ * 	1st - Worker thread slot
+ * 	2nd - How processing of the entry went
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: Failed outgoing mail is retried or set DEAD (see failQueueEntry()),
+ * 	other queues don't retry as running a rule again could repeat what
+ * 	it already did before failing
+ *
+ * Note 2: Every entry of a batch went through the one run, so they're all
+ * 	DONE together however it went
+*/
+void finishQueueThread(Queuerunner_Thread *thread, ERRTYPE err) {
+
+	if(thread->qentry == NULL)
+		return;
+
+	// Check whether there was a threading error, and if need be
+	//  record this to the database
+	// TODO: Log error if one occurred in the database
+	setErrType(err);
+//	printf("%d  --  %s\r\n", _errno, getErrTypeMsg());
+
+	if(err != ERR_NONE && thread->qentry->messageType == DBVAL_message_queue_messageType_EMAILOUT) {
+		if(failQueueEntry(thread->qentry, err) == true && thread->qentry->queueState == DBVAL_message_queue_queueState_DEAD)
+			printf("Gave up on queue entry %ld after %d failures: %s\n", thread->qentry->id, thread->qentry->failures, getErrTypeMsg());
+	} else {
+		setQueueEntriesState(thread->qentry, DBVAL_message_queue_queueState_DONE);
+	}
+
+	thread->doneMsec += getQueueAdaptMsec() - thread->started;
+	thread->doneJobs++;
+
+	freeQueueEntryBatch(thread->qentry);
+	thread->qentry = NULL;
+}
+
+
+/*
+ * Purpose: Main loop of a pooled worker, takes Queue_Entry's from the boss
+ * 	over a socket and passes back how each one went
+ *
+ * Entry:
+ * 	1st - Function pointer to function to do the work
+ * 	2nd - Socket connected to the boss
+ * 	3rd - Max number of jobs before the worker retires
+ * 	4th - Max CPU secs the sandbox allows (see setupLimits())
+ * 	5th - Function to call before the worker lets go of the database and
+ * 		exits, NULL = none
+ *
+ * Exit:
+ * 	Never returns, process exits when the boss closes the socket or
+ * 	the worker retires
+ *
+ * Note: RLIMIT_CPU counts all the CPU the worker has used, not just the
+ * 	current job, so the worker retires after using half its allowance
+ * 	rather than let a later job get killed part way through by SIGXCPU
+ *
+ * Note 2: A job may be a batch of entries, the worker function gets the
+ * 	first with the rest chained on through batchNext
+*/
+void runPooledWorker(ERRTYPE (*worker)(Queue_Entry *), int fd, long maxJobs, long maxCpuSec, void (*retire)()) {
+	Queuerunner_Batch batch;
+	Queuerunner_Reply reply;
+	struct rusage usage;
+	long jobs, cpuMsec;
+	ssize_t got;
+	int i;
+
+	for(jobs = 0; ; ) {
+
+		got = recv(fd, &batch, sizeof(batch), 0);
+
+		if(got < (ssize_t)offsetof(Queuerunner_Batch, entries) || batch.numEntries < 1 || batch.numEntries > QUEUE_BATCH_MAX
+			|| got != (ssize_t)(offsetof(Queuerunner_Batch, entries) + (batch.numEntries * sizeof(Queue_Entry))))
+			break;
+
+		// Pointers don't survive the trip, chain the batch up again
+		for(i = 0; i < batch.numEntries; i++)
+			batch.entries[i].batchNext = (i + 1 < batch.numEntries) ? &batch.entries[i + 1] : NULL;
+
+		// Connection may have timed out while the worker sat idle
+		if(dbPing() == false) {
+			dbDisconnect();
+			_myconn = NULL;
+			dbConnect();
+		}
+
+		reply.status = worker(&batch.entries[0]);
+		fflush(stdout);
+
+		jobs++;
+
+		getrusage(RUSAGE_SELF, &usage);
+
+		cpuMsec = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+			+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+
+		reply.retiring = (jobs >= maxJobs || cpuMsec * 2 >= maxCpuSec * 1000);
+
+		if(send(fd, &reply, sizeof(reply), 0) != sizeof(reply) || reply.retiring == true)
+			break;
+	}
+
+	if(retire != NULL)
+		retire();
+
+	dbDisconnect();
+
+	exit(ERR_NONE);
+}
+
+
+/*
+ * Purpose: Fork a worker thread, either to process one queue entry or
+ * 	as a pooled worker that processes many
+ *
+ * Entry:
+ * 	1st - Function pointer to function to do the work in the child
+ * 	2nd - Worker thread slots
+ * 	3rd - Number of worker thread slots
+ * 	4th - Slot to start the worker thread in, for a single entry the
+ * 		slot's qentry should be set
+ * 	5th - Max jobs for a pooled worker, 0 = run the slot's qentry only
+ * 	6th - Event loop of the boss
+ * 	7th - What kind of sandbox should the child process be put into
+ * 	8th - Function the child calls before it lets go of the database and
+ * 		exits, NULL = none
+ *
+ * Exit:
+ * 	SUCCESS = true, slot's id (and pipe if pooled) set
+ * 	FAILURE = false and err type set, if the thread was forked the slot's
+ * 		id is still set and the slot is freed once it's reaped
+*/
+bool spawnQueueThread(ERRTYPE (*worker)(Queue_Entry *), Queuerunner_Thread **threads, int numThreads, int slot, long poolJobs, Queue_Events *events, SANDBOXTYPE stype, void (*retire)()) {
+	int sv[2], status;
+	long maxCpuSec;
+
+	if(poolJobs > 0 && socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+		setErrType(ERR_PROC_PIPE_CREATE);
+		return false;
+	}
+
+	if((threads[slot]->id = fork()) == -1) {
+		threads[slot]->id = QUEUE_THREAD_SLOT_EMPTY;
+
+		if(poolJobs > 0) {
+			close(sv[0]);
+			close(sv[1]);
+		}
+
+		setErrType(ERR_PROC_FORK);
+		return false;
+	}
+
+	// Are we the child process?
+	if(threads[slot]->id == 0) {
+
+		detachFromBoss(events, threads, numThreads);
+
+		_myconn = NULL;
+
+		if(dbConnect() == false) {
+			printf("ERROR connecting to database\r\n");
+			exit(ERR_SANDBOX_SETUP);
+		}
+
+		// queue_log_dir is outside the jail, the worker mustn't keep it
+		if(holdQueueLogSegments() == false || putInSandbox(stype) != true) {
+			printf("ERROR setting up sandbox\r\n");
+			dbDisconnect();
+			exit(ERR_SANDBOX_SETUP);
+		}
+
+		if(poolJobs > 0) {
+			close(sv[0]);
+
+			maxCpuSec = (stype == SANDBOX_MSGDELIVERY) ? RES_MD_MAX_CPU_TIME : RES_RR_MAX_CPU_TIME;
+
+			runPooledWorker(worker, sv[1], poolJobs, maxCpuSec, retire);
+		}
+
+		status = worker(threads[slot]->qentry);
+		fflush(stdout);
+
+		if(retire != NULL)
+			retire();
+
+		// Exit returning status so manager thread can check whether all ended well
+		dbDisconnect();
+
+		exit(status);
+	}
+
+	// We're the boss
+	if(poolJobs > 0) {
+		close(sv[1]);
+		fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+		// Without being watched the boss would never hear back, closing makes the worker exit
+		if(watchQueueEvent(events, sv[0], QUEUE_EVENT_SLOT + slot) == false) {
+			close(sv[0]);
+			return false;
+		}
+
+		threads[slot]->pipe = sv[0];
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Hand a queue entry, or a batch of them, to an idle pooled worker
+ *
+ * Entry:
+ * 	1st - Worker thread slot, with an idle pooled worker
+ * 	2nd - Queue entry to process, with the rest of its batch chained on
+ *
+ * Exit:
+ * 	SUCCESS = true, slot's qentry set
+ * 	FAILURE = false and err type set, worker is no longer usable and its
+ * 		pipe should be closed with closeQueueThreadPipe()
+*/
+bool dispatchQueueThread(Queuerunner_Thread *thread, Queue_Entry *qentry) {
+	Queuerunner_Batch batch;
+	Queue_Entry *q;
+	size_t length;
+
+	for(q = qentry, batch.numEntries = 0; q != NULL && batch.numEntries < QUEUE_BATCH_MAX; q = q->batchNext)
+		batch.entries[batch.numEntries++] = *q;
+
+	length = offsetof(Queuerunner_Batch, entries) + (batch.numEntries * sizeof(Queue_Entry));
+
+	// MSG_NOSIGNAL so a worker that just died doesn't take the boss with it via SIGPIPE
+	if(send(thread->pipe, &batch, length, MSG_NOSIGNAL) != (ssize_t)length) {
+		setErrType(ERR_PROC_PIPE_WRITE);
+		return false;
+	}
+
+	thread->qentry = qentry;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Thread worker spawner (Boss/Worker design pattern)
+ *
+ * Entry:
+ * 	1st - Function pointer to function to do the work in child threads
+ * 	2nd - Max number of threads to run at once (see Note 10)
+ * 	3rd - What message queue to process
+ * 	4th - Max number of secs to wait for a doorbell ring or a worker
+ * 		thread to end before checking the queue anyway (safety poll)
+ * 	5th - Number of nanosecs to wait (+ secs) for the safety poll
+ * 	6th - Function to call when a serious error occurs that should
+ * 		stop the thread runner
+ * 	7th - What kind of sandbox should child processes be put into
+ * 	8th - Function to look up how many entries of a void may run at once
+ * 		and how many go to a worker together (see qsched.c), NULL =
+ * 		incoming one at a time, outgoing any, none batched
+ * 	9th - Function a worker thread calls before it exits, while it still
+ * 		has the database, NULL = none
+ *
+ * Exit:
+ * 	SUCCESS = No return from this method UNLESS there is a FAILURE
+ * 	FAILURE = Err set to error type
+ *
+ * Note: This function normally calls the failureExit function pointer upon
+ * 	a serious error. When this function is called it should exit the program
+ * 	and NOT return back to continue running this function where it left off.
+ *
+ * Note 2: The boss sleeps until insertQueueEntry() rings the queue's doorbell,
+ * 	a worker thread ends (SIGCHLD) or replies, housekeeping is due or the
+ * 	safety poll delay runs out, all through one event loop (see qevents.c).
+ * 	If the doorbell can't be opened the boss falls back to only the safety
+ * 	poll.
+ *
+ * Note 3: When the daemon's pool jobs setting (see SCONFIG) is more than 0 the
+ * 	worker threads are a prefork pool. Each is forked, connected to the
+ * 	database and sandboxed once, then processes queue entries sent to it
+ * 	over a socket until it has done that many jobs. A pooled worker that
+ * 	dies part way through a job (e.g. a resource limit signal) has that
+ * 	entry marked DONE and is replaced when its slot is next needed.
+ *
+ * Note 4: Claimed entries are held by the boss in a Queue_Sched (see qsched.c)
+ * 	and stay PROCESSING in the database until they're done. For incoming
+ * 	messages the scheduler only lets one entry per void run at a time,
+ * 	or as many as the void's logic allows, so without sharding this must
+ * 	be the only boss processing a queue.
+ *
+ * Note 5: Every track of the queue is processed, each is claimed from
+ * 	separately and gets its own backlog so a busy track can't keep the
+ * 	entries of another out of the boss. How slots are shared between the
+ * 	tracks is up to the scheduler.
+ *
+ * Note 6: Claimed entries are leased to the boss, which renews the lease of
+ * 	everything it holds every third of QUEUE_LEASE_SEC. Each boss also
+ * 	sweeps expired leases back onto the queue, so the entries of a boss
+ * 	that died are picked up again within about a lease.
+ *
+ * Note 7: The boss also moves DONE entries of its queue to the archive (see
+ * 	qarchive.c), one batch every archive_sec or every time round the loop
+ * 	while full batches keep coming.
+ *
+ * Note 8: With sharding on for the daemon (see SCONFIG) the boss registers as
+ * 	a node of the queue and only claims entries in its range of shard
+ * 	buckets (see qshard.c), so several daemons can process one queue.
+ *
+ * Note 9: Entries with a notBefore within QUEUE_TIMER_HORIZON_SEC are claimed
+ * 	early and held on a timing wheel (see qtimer.c) until they're due,
+ * 	then scheduled like any other. Entries further off stay in the table
+ * 	untouched until a claim comes within reach of them.
+ *
+ * Note 10: numThreads is the most threads the boss runs, how many it runs at
+ * 	any one time is adapted between that and the daemon's min threads
+ * 	setting (see qadapt.c). Only the first that many slots get new work.
+ *
+ * Note 11: A rule runner boss holds back incoming mail for voids with too
+ * 	much outgoing mail pending, or for every void when the whole outgoing
+ * 	queue is too full (see qpressure.c). Who is held back is checked with
+ * 	the other housekeeping, entries already claimed still run.
+ *
+ * Note 12: Queues are kept wherever the queue_backend setting says (see
+ * 	getQueueBackend()). A backend that can't be shared between hosts
+ * 	ignores the shard settings, compacts rather than archives, and has
+ * 	what was changed since it last woke synced to disk before the boss
+ * 	sleeps again.
+ *
+ * Note 13: A void whose logic takes batches (see takeQueueSchedBatch()) has
+ * 	up to that many of its waiting entries handed to a worker in one go,
+ * 	they're all finished together once it's done.
+*/
+bool runQueueThreads(ERRTYPE (*worker)(Queue_Entry *), int numThreads, int queueType, long int sleepSec, long int sleepNsec, void (*failureExit)(ERRTYPE), SANDBOXTYPE stype, int (*voidLimit)(long, int *), void (*retire)()) {
+
+	Queuerunner_Thread **threads;
+	Queue_Events *events;
+	Queue_Sched *sched;
+	Queue_Timer *timer;
+	Queue_Adapt *adapt;
+	Queue_Entry **claimed;
+	Queue_Entry *qentry;
+	Queue_Backend *backend;
+	int i, c, t, n = 0 /*, msgId */;
+	int doorbell, backlog, numFree, numWanted, numClaimed, woke, delay, timeout, active;
+	long timerWait, dbStart;
+	bool checkQueue[QUEUE_SCHED_NUM_TRACKS], claimMore, tick = true, timerShort;
+	struct timeval tv;
+	long poolJobs;
+	unsigned long claimNum = 0;
+	time_t now, lastArchive = 0;
+	bool archiveMore = false;
+	char *skipVoids;
+	Queue_Shard *shard = NULL;
+	Queue_Pressure *pressure = NULL;
+	char host[QUEUE_LENGTH_CLAIM_TOKEN / 2];
+	char bossId[QUEUE_LENGTH_CLAIM_TOKEN], claimToken[QUEUE_LENGTH_CLAIM_TOKEN];
+
+	// Max number of claimed entries held by the boss per track
+	backlog = numThreads * QUEUE_BACKLOG_PER_THREAD;
+
+	// Everything was setup properly so now get on with main code
+	if((threads = (Queuerunner_Thread **)malloc(sizeof(Queuerunner_Thread *) * (numThreads + 1))) == NULL) {
+		failureExit(ERR_MEM_ALLOC);
+	}
+
+	if((claimed = (Queue_Entry **)malloc(sizeof(Queue_Entry *) * (backlog + 1))) == NULL) {
+		failureExit(ERR_MEM_ALLOC);
+	}
+
+	// Incoming messages for a void are processed one at a time unless its logic allows more,
+	//  outgoing can go at once
+	if((sched = createQueueSched((queueType == DBVAL_message_queue_messageType_EMAILIN) ? 1 : QUEUE_SCHED_NO_LIMIT, voidLimit)) == NULL) {
+		failureExit(ERR_MEM_ALLOC);
+	}
+
+	// Entries claimed before their notBefore wait here
+	if((timer = createQueueTimer(time(NULL))) == NULL) {
+		failureExit(ERR_MEM_ALLOC);
+	}
+
+	// Run between the min threads and numThreads, depending on how things are going
+	if((adapt = createQueueAdapt((stype == SANDBOX_MSGDELIVERY) ? _config->minnum_outqueue_threads : _config->minnum_rulerunner_threads, numThreads)) == NULL) {
+		failureExit(ERR_MEM_ALLOC);
+	}
+
+	// Prefork pool or fork per queue entry?
+	poolJobs = (stype == SANDBOX_MSGDELIVERY) ? _config->pooljobs_outqueue : _config->pooljobs_rulerunner;
+
+	// Spreads out retries of failed entries (see getQueueRetryDelay())
+	srandom((unsigned int)(time(NULL) ^ getpid()));
+
+	// Claims made by this boss are stamped with host and pid, plus a count per claim
+	if(gethostname(host, sizeof(host)) != 0)
+		strcpy(host, "unknown");
+
+	host[sizeof(host) - 1] = '\0';
+	snprintf(bossId, sizeof(bossId), "%s.%d", host, (int)getpid());
+
+	backend = getQueueBackend();
+
+	// Share the queue with bosses of other daemons by void or recipient?
+	if(backend->shared == true && ((stype == SANDBOX_MSGDELIVERY) ? _config->shard_outqueue : _config->shard_rulerunner) == 1) {
+
+		if((shard = createQueueShard(bossId, queueType, (queueType == DBVAL_message_queue_messageType_EMAILIN))) == NULL) {
+			failureExit(getErrType());
+		}
+
+		if(updateQueueShard(shard) == FAILURE) {
+			printf("Couldn't join queue shards, claiming from all buckets\n");
+		}
+	}
+
+	// Rules shouldn't run faster than the mail they send can go out
+	if(queueType == DBVAL_message_queue_messageType_EMAILIN
+		&& (_config->outqueue_void_high_water > 0 || _config->outqueue_global_high_water > 0)) {
+
+		if((pressure = createQueuePressure(_config->outqueue_void_high_water, _config->outqueue_global_high_water)) == NULL) {
+			failureExit(getErrType());
+		}
+	}
+
+	// Max millisecs to wait between checking whether there's work to do
+	delay = (sleepSec * 1000) + (sleepNsec / 1000000);
+
+	for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++)
+		checkQueue[t] = true;
+
+	// Get woken when new work is queued, worker threads end or it's time for housekeeping
+	if((doorbell = openDoorbell(queueType)) == DOORBELL_UNSET) {
+		printf("Couldn't open doorbell, only polling queue every %ld secs\n", sleepSec);
+	}
+
+	if((events = createQueueEvents(doorbell, QUEUE_LEASE_SEC / 3)) == NULL) {
+		failureExit(getErrType());
+	}
+
+	// Initialise with no threads running
+	for(i = 0; i < numThreads; i++) {
+
+		if((threads[i] = (Queuerunner_Thread *)malloc(sizeof(Queuerunner_Thread))) == NULL) {
+			failureExit(ERR_MEM_ALLOC);
+		}
+
+		threads[i]->id = QUEUE_THREAD_SLOT_EMPTY;
+		threads[i]->qentry = NULL;
+		threads[i]->pipe = QUEUE_THREAD_PIPE_UNSET;
+
+		threads[i]->started = 0;
+		threads[i]->doneMsec = 0;
+		threads[i]->doneJobs = 0;
 	}
 
 	while(true) {
 
-		// Do we need to get rid of a thread that has finished?
-		for(i = 0; i < numThreads; i++) {
-
-			// Check whether a thread is dead
-			if(threads[i]->id != QUEUE_THREAD_SLOT_EMPTY && waitpid(threads[i]->id, &status, WNOHANG) != 0) {
-				setErrType(ERR_NONE);
-
-				// How did the thread die? Via a kill signal (an unknown kill)?
-				if(WIFEXITED(status) != true && WIFSIGNALED(status) == true) {
-					setErrType(ERR_PROC_KILLED);
-				} else {
-// TODO:  Rewrite so properly reports an error status, at the moment setErrType takes in
-//  enums so won't behave properly with int returned by WEXITSTATUS
-//					setErrType(WEXITSTATUS(status));
-					setErrType(ERR_UNKNOWN);
+		// Keep hold of what this boss has claimed and put back what dead bosses had
+		if(tick == true) {
+
+			if(sched->pending + sched->running > 0)
+				renewQueueLeases(bossId, queueType);
+
+			// Other nodes may have joined or left
+			if(shard != NULL && updateQueueShard(shard) == QUEUE_SHARD_CHANGED) {
+				printf("Shard now buckets %d to %d of %d across %d nodes\n", shard->low, shard->high - 1, QUEUE_SHARD_BUCKETS, shard->nodes);
+
+				for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++)
+					checkQueue[t] = true;
+			}
+
+			// Voids may have gone over or back under their outgoing mark
+			if(pressure != NULL && updateQueuePressure(pressure) == QUEUE_PRESSURE_CHANGED) {
+				printf("Holding back %d voids over the outgoing mark%s\n", pressure->numFullVoids,
+					(pressure->globalFull == true) ? ", and all voids as the outgoing queue is full" : "");
+
+				for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++)
+					checkQueue[t] = true;
+			}
+
+			if(sweepQueueLeases(queueType) > 0) {
+				for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++)
+					checkQueue[t] = true;
+
+				ringDoorbell(queueType);
+			}
+		}
+
+		now = time(NULL);
+
+		// Move finished entries out of the live queue, a batch at a time so dispatching isn't held up
+		if(_config->archive_batch > 0 && (archiveMore == true || now - lastArchive >= _config->archive_sec)) {
+			lastArchive = now;
+
+			archiveMore = (backend->archiveEntries(queueType, _config->archive_batch) == _config->archive_batch);
+		}
+
+		// Top up each track's backlog, but only when there may be something new on the queue.
+		//  Voids that already have plenty waiting are skipped so they can't crowd out the rest
+		for(t = 0, claimMore = false; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+
+			// Entries held on the timer are part of the backlog, or a claim of nothing but
+			//  future entries would pull in everything due within QUEUE_TIMER_HORIZON_SEC
+			if(checkQueue[t] == false || sched->tracks[t].pending + sched->tracks[t].timed >= backlog)
+				continue;
+
+			// Nothing more is claimed till the outgoing queue drains, checkQueue stays set for then
+			if(pressure != NULL && pressure->globalFull == true)
+				continue;
+
+			numWanted = backlog - sched->tracks[t].pending - sched->tracks[t].timed;
+			skipVoids = getQueueSchedFullVoids(sched, t, QUEUE_BACKLOG_PER_VOID, backlog);
+
+			snprintf(claimToken, sizeof(claimToken), "%s.%lu", bossId, claimNum++);
+
+			numClaimed = 0;
+
+			if(lockQueueClaims(shard) == true) {
+				dbStart = getQueueAdaptMsec();
+
+				if((numClaimed = claimQueueEntries(claimed, numWanted, sched->tracks[t].track, queueType, claimToken, bossId, skipVoids, (pressure == NULL) ? NULL : pressure->fullVoids, shard)) == FAILURE) {
+					numClaimed = 0;
 				}
 
-				// Check whether there was a threading error, and if need be
-				//  record this to the database
-				// TODO: Log error if one occurred in the database
-//				printf("%d  --  %s\r\n", _errno, getErrTypeMsg());
+				noteQueueAdaptDb(adapt, getQueueAdaptMsec() - dbStart);
+
+				unlockQueueClaims(shard);
+			}
+
+			free(skipVoids);
+
+			for(c = 0; c < numClaimed; c++) {
+
+				// Not due yet, hold it on the timer
+				if(claimed[c]->notBefore > now) {
+					if(addQueueTimerEntry(timer, claimed[c]) == true) {
+						sched->tracks[t].timed++;
+						continue;
+					}
+
+				} else if(addQueueSchedEntry(sched, claimed[c]) == true) {
+					continue;
+				}
+
+				releaseQueueEntry(claimed[c]);
+				freeQueueEntry(claimed[c]);
+			}
+
+			// A full claim means there's likely more waiting
+			checkQueue[t] = (numClaimed == numWanted);
 
-				setQueueEntryState(threads[i]->qentry, DBVAL_message_queue_queueState_DONE);
-				threads[i]->id = QUEUE_THREAD_SLOT_EMPTY;
+			if(checkQueue[t] == true && sched->tracks[t].pending + sched->tracks[t].timed < backlog)
+				claimMore = true;
+		}
+
+		// Entries on the timer whose time has come join the rest
+		advanceQueueTimer(timer, now);
 
-				freeQueueEntry(threads[i]->qentry);
-				threads[i]->qentry = NULL;
+		while((qentry = popQueueTimerEntry(timer)) != NULL) {
+			sched->tracks[getQueueSchedTrack(sched, qentry->track)].timed--;
+
+			if(addQueueSchedEntry(sched, qentry) == false) {
+				releaseQueueEntry(qentry);
+				freeQueueEntry(qentry);
 			}
 		}
 
-		// Do we have a slot to run a new thread?
-		for(i = 0; i < numThreads; i++) {
+		// How many threads to run, idle pooled workers above that are let go and exit
+		//  once their socket closes
+		active = updateQueueAdapt(adapt, threads, numThreads, sched->pending);
+
+		for(i = active; i < numThreads; i++) {
+			if(threads[i]->pipe != QUEUE_THREAD_PIPE_UNSET && threads[i]->qentry == NULL)
+				closeQueueThreadPipe(events, threads[i]);
+		}
 
-			// Don't want to replace existing threads
+		// How many slots are free to run a new thread? A slot is free when it has no
+		//  thread or has an idle pooled worker
+		for(i = 0, numFree = 0; i < active; i++) {
 			if(threads[i]->id == QUEUE_THREAD_SLOT_EMPTY
-				&& (threads[i]->qentry = getQueueEntryJustinNotRunning(track, queueType)) != NULL) {
-
-//				printf("********** Got item: %ld\r\n", threads[i]->qentry->id);
-
-				if(setQueueEntryState(threads[i]->qentry, DBVAL_message_queue_queueState_PROCESSING) == true) {
-					// TODO: Add check in case fork() fails
-					if((threads[i]->id = fork()) == 0) {
-
-						_myconn = NULL;
-
-						if(dbConnect() == false) {
-							printf("ERROR connecting to database\r\n");
-							status = ERR_SANDBOX_SETUP;
-						} else if(putInSandbox(stype) == true) {
-							status = worker(threads[i]->qentry);
-							fflush(stdout);
-						} else {
-							printf("ERROR setting up sandbox\r\n");
-							status = ERR_SANDBOX_SETUP;
-						}
-
-						// Exit returning status so manager thread can check whether all ended well
-						dbDisconnect();
-
-						exit(status);
-					} else {
-						n++;
-						printf("Created New Thread * Thread Slot: %d  --  Thread Id: %d  --  Total Threads: %d  --  DB id: %ld\n", i, threads[i]->id, n, threads[i]->qentry->id);
+				|| (threads[i]->pipe != QUEUE_THREAD_PIPE_UNSET && threads[i]->qentry == NULL))
+				numFree++;
+		}
+
+		// Hand out entries from the backlog to the free slots
+		for(i = 0; i < active && numFree > 0; i++) {
+
+			// Don't want to replace existing threads, but idle pooled workers can take more work
+			if(threads[i]->id != QUEUE_THREAD_SLOT_EMPTY
+				&& (threads[i]->pipe == QUEUE_THREAD_PIPE_UNSET || threads[i]->qentry != NULL))
+				continue;
+
+			if((qentry = nextQueueSchedEntry(sched, numFree)) == NULL)
+				break;
+
+			// Void's logic may take several of its entries in one run
+			takeQueueSchedBatch(sched, qentry);
+
+			numFree--;
+
+//			printf("********** Got item: %ld\r\n", qentry->id);
+
+			threads[i]->started = getQueueAdaptMsec();
+
+			if(poolJobs <= 0) {
+				threads[i]->qentry = qentry;
+
+				if(spawnQueueThread(worker, threads, numThreads, i, 0, events, stype, retire) == false) {
+					threads[i]->qentry = NULL;
+					returnQueueSchedEntry(sched, qentry);
+					break;
+				}
+
+				n++;
+				printf("Created New Thread * Thread Slot: %d  --  Thread Id: %d  --  Total Threads: %d  --  DB id: %ld\n", i, threads[i]->id, n, qentry->id);
+
+			} else {
+				if(threads[i]->id == QUEUE_THREAD_SLOT_EMPTY) {
+
+					if(spawnQueueThread(worker, threads, numThreads, i, poolJobs, events, stype, retire) == false) {
+						returnQueueSchedEntry(sched, qentry);
+						break;
 					}
+
+					n++;
+					printf("Created New Pooled Worker * Thread Slot: %d  --  Thread Id: %d  --  Total Threads: %d\n", i, threads[i]->id, n);
 				}
 
-//				freeQueueEntry(threads[i]->qentry);
+				if(dispatchQueueThread(threads[i], qentry) == false) {
+					closeQueueThreadPipe(events, threads[i]);
+					returnQueueSchedEntry(sched, qentry);
+					continue;
+				}
 			}
 		}
 
-		// Sleep and let child threads run
-		nanosleep(&delay, NULL);
+		// Sleep till there is something to do and let child threads run, don't sleep
+		//  if the last claim left more on the queue and there's room for it. Slots of
+		//  threads that ended are free again by the time this returns
+		timeout = (claimMore == true) ? 0 : delay;
+		timerShort = false;
+
+		// Wake at the start of the sec the timer's next entry is due
+		if((timerWait = getQueueTimerWait(timer)) != QUEUE_TIMER_IDLE) {
+			gettimeofday(&tv, NULL);
+
+			timerWait = ((timer->now + timerWait - tv.tv_sec) * 1000) - (tv.tv_usec / 1000);
+
+			if(timerWait < timeout) {
+				timeout = (timerWait > 0) ? (int)timerWait : 0;
+				timerShort = true;
+			}
+		}
+
+		// Whatever this boss changed on the queue should survive a crash while it sleeps
+		if(syncQueueEntries() == false)
+			printf("Couldn't sync queue: %s\n", getErrTypeMsg());
+
+		woke = waitQueueEvents(events, timeout, sched, threads, numThreads);
+
+		// Only the timer waking the boss says nothing about the queue
+		if((woke & QUEUE_WOKE_WORK) || ((woke & QUEUE_WOKE_TIMEOUT) && timerShort == false)) {
+			for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++)
+				checkQueue[t] = true;
+		}
+
+		tick = ((woke & QUEUE_WOKE_TICK) != 0);
 	}
 
 	return SUCCESS;
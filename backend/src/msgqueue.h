@@ -7,15 +7,30 @@
 #ifndef __MSGQUEUE_H__
 #define __MSGQUEUE_H__
 
+#include<time.h>
+#include<signal.h>
+#include<sys/types.h>
 #include "codewide.h"
 #include "message.h"
 #include "logerror.h"
 #include "sandbox.h"
+#include "qshard.h"
 
 #define QUEUE_THREAD_SLOT_EMPTY		-1
+#define QUEUE_THREAD_PIPE_UNSET		-1
+
+#define QUEUE_LENGTH_CLAIM_TOKEN	100	// Max length of a claim token (see message_queue.claimToken)
+#define QUEUE_LENGTH_CLAIM_FILTER	500	// Room for claim conditions besides the void list
+#define QUEUE_BACKLOG_PER_THREAD	8	// Entries a boss holds claimed per worker thread slot
+#define QUEUE_BACKLOG_PER_VOID		8	// Entries of one void a boss holds before claiming skips it
+#define QUEUE_BATCH_MAX			32	// Most entries of one void handed to a worker at once
+
+/* Where queues are kept (see Queue_Backend) */
+#define QUEUE_BACKEND_DB		0	// message_queue table in the database
+#define QUEUE_BACKEND_LOG		1	// Local append only log, single node only (see qlog.c)
 
 /* Structure for holding details on mail address access rights to a void */
-typedef struct {
+typedef struct Queue_Entry {
     long id;                // Id of queue item
 
 	long messageId;         // Id in message table
@@ -28,6 +43,12 @@ typedef struct {
 
 	int track;              // Can be used for maintaining different priority queues
 
+	time_t notBefore;	// Don't process before this time, 0 = straight away
+	int failures;		// Number of times processing has failed and been retried
+
+	struct Queue_Entry *batchNext;	// Next entry handed to a worker along with this one, NULL = none
+				//  (see takeQueueSchedBatch())
+
 	// Note: There is a date field in the database table but not going to use for now
 } Queue_Entry;
 
@@ -36,18 +57,104 @@ typedef struct {
 typedef struct {
 	pid_t id;		// Id of thread
 	Queue_Entry *qentry;	// Queue_Entry in database associated with this thread
+	int pipe;		// Socket to a pooled worker thread (QUEUE_THREAD_PIPE_UNSET if not pooled)
+
+	long started;		// When the current entry was handed over (see getQueueAdaptMsec())
+	long doneMsec;		// Total millisecs spent on entries finished in this slot
+	long doneJobs;		// Number of entries finished in this slot
 } Queuerunner_Thread;
 
 
+// Sent to a pooled worker thread with the entries it's to process in one go
+typedef struct {
+	int numEntries;
+	Queue_Entry entries[QUEUE_BATCH_MAX];	// Only numEntries of these are sent
+} Queuerunner_Batch;
+
+
+// Sent back by a pooled worker thread after each Queue_Entry it processes
+typedef struct {
+	int status;		// ERRTYPE returned by the worker function
+	bool retiring;		// Worker is about to exit, don't send it any more work
+} Queuerunner_Reply;
+
+
+// What a boss waits on for something to do (see qevents.c)
+typedef struct {
+	int epoll;		// epoll instance everything below is watched through
+	int signals;		// signalfd SIGCHLD is read from when worker threads end
+	int timer;		// timerfd ticking for housekeeping (leases, shards)
+	int doorbell;		// Doorbell of the boss (may be DOORBELL_UNSET)
+	sigset_t oldMask;	// Signal mask from before SIGCHLD was blocked, restored in workers
+} Queue_Events;
+
+
+// Where a queue's entries are kept, the queue functions below call through this
+typedef struct {
+	int type;		// QUEUE_BACKEND_*
+	bool shared;		// Can bosses on several nodes share a queue (see qshard.c)
+
+	bool (*insertEntry)(Queue_Entry *);
+	Queue_Entry *(*getEntryOldest)(int, int, int);
+	Queue_Entry *(*getEntryJustinNotRunning)(int, int);
+	bool (*setEntryState)(Queue_Entry *, int);
+	bool (*setEntriesState)(Queue_Entry *, int, int);
+	int (*claimEntries)(Queue_Entry **, int, int, int, char *, char *, char *, char *, Queue_Shard *);
+	bool (*releaseEntry)(Queue_Entry *);
+	bool (*renewLeases)(char *, int);
+	int (*sweepLeases)(int);
+	bool (*failEntry)(Queue_Entry *, int, int, char *);
+	int (*archiveEntries)(int, int);
+	long (*countOutPending)(long, long);
+	int (*getOutFullVoids)(long, char *, size_t);
+	bool (*syncEntries)();	// NULL = nothing to do
+} Queue_Backend;
+
+
 // Function prototypes
+Queue_Backend *getQueueBackend();	// Where queues are kept
 Queue_Entry *createQueueEntry();	// Allocate mem and setup a Queue_Entry
 void freeQueueEntry(Queue_Entry *);	// Release mem associated with a Queue_Entry
-bool insertQueueEntry(Queue_Entry *);	// Add a queue entry in the database
+bool insertQueueEntry(Queue_Entry *);	// Add a queue entry
 Queue_Entry *getQueueEntryOldest(int, int, int);	// Get oldest queue entry
 Queue_Entry *getQueueEntryJustinNotRunning(int, int);	// Get oldest queue entry to each void
-bool setQueueEntryState(Queue_Entry *, int);		// In the database set the queue state of a Queue Entry
+bool setQueueEntryState(Queue_Entry *, int);		// Set the queue state of a Queue Entry
+bool setQueueEntriesState(Queue_Entry *, int);		// Set the queue state of a batch of Queue Entries
+int countQueueEntryBatch(Queue_Entry *);		// Number of entries in a batch
+void freeQueueEntryBatch(Queue_Entry *);		// Release mem of a Queue_Entry and the rest of its batch
+int claimQueueEntries(Queue_Entry **, int, int, int, char *, char *, char *, char *, Queue_Shard *);
+					// Claim a batch of queue entries for a boss
+bool releaseQueueEntry(Queue_Entry *);	// Put a claimed entry back on the queue
+bool renewQueueLeases(char *, int);	// Push back the lease expiry of entries a boss holds
+int sweepQueueLeases(int);		// Put entries with an expired lease back on the queue
+bool isQueueErrTemporary(ERRTYPE);	// Whether trying an entry again later may work
+int getQueueRetryDelay(int);		// Secs to wait before retrying an entry
+bool failQueueEntry(Queue_Entry *, ERRTYPE);	// Retry a failed entry later or set it DEAD
+bool syncQueueEntries();		// Make sure queue changes so far survive the host going down
+
+bool insertQueueEntryDb(Queue_Entry *);	// Add a queue entry in the database
+Queue_Entry *getQueueEntryOldestDb(int, int, int);	// Get oldest queue entry in the database
+Queue_Entry *getQueueEntryJustinNotRunningDb(int, int);	// Get oldest queue entry in the database to each void
+bool setQueueEntryStateDb(Queue_Entry *, int);	// In the database set the queue state of a Queue Entry
+bool setQueueEntriesStateDb(Queue_Entry *, int, int);	// In the database set the queue state of a batch
+int claimQueueEntriesDb(Queue_Entry **, int, int, int, char *, char *, char *, char *, Queue_Shard *);
+					// Claim a batch of database queue entries for a boss
+bool releaseQueueClaimDb(char *);	// Put a whole claim back on the database queue
+char *createQueueClaimFilter(char *, char *, Queue_Shard *);	// Extra conditions on what a boss claims
+bool releaseQueueEntryDb(Queue_Entry *);	// Put a claimed entry back on the database queue
+bool renewQueueLeasesDb(char *, int);	// Push back the lease expiry of database entries a boss holds
+int sweepQueueLeasesDb(int);		// Put database entries with an expired lease back on the queue
+bool failQueueEntryDb(Queue_Entry *, int, int, char *);	// Record a failed entry in the database
+
+void detachFromBoss(Queue_Events *, Queuerunner_Thread **, int);	// Close what a worker thread inherited from the boss
+ERRTYPE getQueueThreadExitErr(int);	// Turn waitpid() status into an error type
+void finishQueueThread(Queuerunner_Thread *, ERRTYPE);		// Mark a worker thread's queue entry done
+void runPooledWorker(ERRTYPE (*)(Queue_Entry *), int, long, long, void (*)());	// Main loop of a pooled worker thread
+bool spawnQueueThread(ERRTYPE (*)(Queue_Entry *), Queuerunner_Thread **, int, int, long, Queue_Events *, SANDBOXTYPE, void (*)());
+					// Fork a worker thread
+bool dispatchQueueThread(Queuerunner_Thread *, Queue_Entry *);	// Send work to a pooled worker thread
 
-bool runQueueThreads(ERRTYPE (*)(Queue_Entry *), int, int, int, long int, long int, void (*)(ERRTYPE), SANDBOXTYPE);
+bool runQueueThreads(ERRTYPE (*)(Queue_Entry *), int, int, long int, long int, void (*)(ERRTYPE), SANDBOXTYPE, int (*)(long, int *), void (*)());
 					// Run worker threads for processing message queues
 
 #endif
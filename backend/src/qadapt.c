@@ -0,0 +1,218 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Decide how many worker threads a boss runs at once, between
+ *  its configured min and max, from how the queue and host are doing
+ *
+ * Note: Every QUEUE_ADAPT_SEC the boss looks at how many claimed entries
+ *  are waiting for a slot, how long entries have been taking compared to
+ *  usual, the host's load average and how long its claim queries took.
+ *  Threads are cut by a quarter when the host, the database or the entries
+ *  themselves show strain, added by a quarter when all running threads are
+ *  busy and there's a backlog, and cut one at a time when mostly idle.
+ *  Each change is printed with the figures behind it for tuning.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include "qadapt.h"
+#include "logerror.h"
+
+
+/*
+ * Purpose: Creates a concurrency controller, starting at the min threads
+ *
+ * Entry:
+ * 	1st - Fewest threads to run
+ * 	2nd - Most threads to run
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated Queue_Adapt
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Adapt *createQueueAdapt(int min, int max) {
+	Queue_Adapt *adapt;
+
+	if((adapt = (Queue_Adapt *)malloc(sizeof(Queue_Adapt))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	if(max < 1)
+		max = 1;
+
+	if(min < 1 || min > max)
+		min = (min < 1) ? 1 : max;
+
+	adapt->min = min;
+	adapt->max = max;
+	adapt->active = min;
+
+	if((adapt->cpus = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		adapt->cpus = 1;
+
+	adapt->doneMsec = 0;
+	adapt->doneJobs = 0;
+
+	adapt->latency = QUEUE_ADAPT_UNMEASURED;
+	adapt->usualLatency = QUEUE_ADAPT_UNMEASURED;
+	adapt->dbMsec = QUEUE_ADAPT_UNMEASURED;
+
+	adapt->lastDecision = time(NULL);
+
+	return adapt;
+}
+
+
+/*
+ * Purpose: Free up a concurrency controller
+ *
+ * Entry:
+ * 	1st - Queue_Adapt to free
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeQueueAdapt(Queue_Adapt *adapt) {
+
+	if(adapt == NULL)
+		return;
+
+	free(adapt);
+}
+
+
+/*
+ * Purpose: Get the time for measuring how long things take
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	Millisecs on the monotonic clock
+*/
+long getQueueAdaptMsec() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000L) + (now.tv_nsec / 1000000L);
+}
+
+
+/*
+ * Purpose: Record how long a claim query took, as a measure of how busy
+ * 	the database is
+ *
+ * Entry:
+ * 	1st - Queue_Adapt
+ * 	2nd - Millisecs the query took
+ *
+ * Exit:
+ * 	NONE
+*/
+void noteQueueAdaptDb(Queue_Adapt *adapt, long msec) {
+
+	if(adapt->dbMsec == QUEUE_ADAPT_UNMEASURED)
+		adapt->dbMsec = msec;
+	else
+		adapt->dbMsec = (adapt->dbMsec * 0.7) + (msec * 0.3);
+}
+
+
+/*
+ * Purpose: Decide whether the boss should run more or fewer threads, at
+ * 	most once every QUEUE_ADAPT_SEC
+ *
+ * Entry:
+ * 	1st - Queue_Adapt
+ * 	2nd - Worker thread slots
+ * 	3rd - Number of worker thread slots
+ * 	4th - Number of claimed entries waiting for a slot
+ *
+ * Exit:
+ * 	Number of threads the boss may now run
+*/
+int updateQueueAdapt(Queue_Adapt *adapt, Queuerunner_Thread **threads, int numThreads, int waiting) {
+	double load, recent;
+	long doneMsec, doneJobs;
+	int i, busy, step, active;
+	char *reason = NULL;
+	time_t now;
+
+	if((now = time(NULL)) - adapt->lastDecision < QUEUE_ADAPT_SEC)
+		return adapt->active;
+
+	adapt->lastDecision = now;
+
+	for(i = 0, busy = 0, doneMsec = 0, doneJobs = 0; i < numThreads; i++) {
+		if(threads[i]->qentry != NULL)
+			busy++;
+
+		doneMsec += threads[i]->doneMsec;
+		doneJobs += threads[i]->doneJobs;
+	}
+
+	// How long did entries finished since last time take?
+	if(doneJobs > adapt->doneJobs) {
+		recent = (double)(doneMsec - adapt->doneMsec) / (doneJobs - adapt->doneJobs);
+
+		if(adapt->latency == QUEUE_ADAPT_UNMEASURED) {
+			adapt->latency = recent;
+			adapt->usualLatency = recent;
+		} else {
+			adapt->latency = (adapt->latency * 0.5) + (recent * 0.5);
+			adapt->usualLatency = (adapt->usualLatency * 0.95) + (recent * 0.05);
+		}
+	}
+
+	adapt->doneMsec = doneMsec;
+	adapt->doneJobs = doneJobs;
+
+	if(getloadavg(&load, 1) != 1)
+		load = 0;
+
+	load /= adapt->cpus;
+
+	active = adapt->active;
+	step = (active / 4 > 1) ? active / 4 : 1;
+
+	if(active > adapt->min && load > QUEUE_ADAPT_MAX_LOAD) {
+		active -= step;
+		reason = "host loaded";
+
+	} else if(active > adapt->min && adapt->dbMsec > QUEUE_ADAPT_DB_SLOW_MSEC) {
+		active -= step;
+		reason = "database slow";
+
+	} else if(active > adapt->min && adapt->usualLatency != QUEUE_ADAPT_UNMEASURED
+			&& adapt->latency > adapt->usualLatency * QUEUE_ADAPT_LATENCY_RISE) {
+		active -= step;
+		reason = "entries slowing";
+
+	} else if(active < adapt->max && waiting > 0 && busy >= active) {
+		active += step;
+		reason = "backlog";
+
+	} else if(active > adapt->min && waiting == 0 && busy < active / 2) {
+		active--;
+		reason = "idle";
+	}
+
+	if(active < adapt->min)
+		active = adapt->min;
+
+	if(active > adapt->max)
+		active = adapt->max;
+
+	if(reason != NULL && active != adapt->active) {
+		printf("Concurrency %d -> %d (%s): waiting %d, busy %d, load/cpu %.2f, entry %.0fms (usual %.0fms), db %.0fms\n",
+			adapt->active, active, reason, waiting, busy, load,
+			adapt->latency, adapt->usualLatency, adapt->dbMsec);
+
+		adapt->active = active;
+	}
+
+	return adapt->active;
+}
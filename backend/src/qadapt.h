@@ -0,0 +1,41 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Decide how many worker threads a boss runs at once, between
+ *  its configured min and max, from how the queue and host are doing
+*/
+
+#ifndef __QADAPT_H__
+#define __QADAPT_H__
+
+#include<time.h>
+#include "codewide.h"
+#include "msgqueue.h"
+
+#define QUEUE_ADAPT_UNMEASURED	-1.0	// No measurement yet
+
+/* State of a boss's concurrency controller */
+typedef struct {
+	int min;		// Fewest threads to run
+	int max;		// Most threads to run (number of slots)
+	int active;		// Threads the boss may run right now
+	int cpus;		// CPUs on the host
+
+	long doneMsec;		// Totals over all slots at the last decision
+	long doneJobs;
+
+	double latency;		// Recent millisecs per entry
+	double usualLatency;	// Long run millisecs per entry
+	double dbMsec;		// Recent millisecs per claim query
+
+	time_t lastDecision;
+} Queue_Adapt;
+
+/* Function prototypes */
+Queue_Adapt *createQueueAdapt(int, int);	// Allocate mem and setup a Queue_Adapt
+void freeQueueAdapt(Queue_Adapt *);		// Release mem associated with a Queue_Adapt
+long getQueueAdaptMsec();			// Millisecs on a clock that doesn't jump
+void noteQueueAdaptDb(Queue_Adapt *, long);	// Record how long a claim query took
+int updateQueueAdapt(Queue_Adapt *, Queuerunner_Thread **, int, int);	// Raise or lower the number of threads
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Move DONE message queue entries out of message_queue into the
+ *  day partitioned message_queue_archive table
+ *
+ * Note: message_queue should only hold work in flight, otherwise every
+ *  index on it grows forever and the claim queries scan more each day.
+ *  Entries are moved in bounded batches, each batch in one transaction,
+ *  so bosses can archive between dispatching without stalling. Day
+ *  partitions are named pYYYYMMDD and hold the entries done on that day,
+ *  old days can be dropped with ALTER TABLE ... DROP PARTITION.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "qarchive.h"
+#include "logerror.h"
+#include "dbchatter.h"
+
+
+static time_t nextPartitionCheck = 0;	// When archiveQueueEntries() next checks partitions
+
+
+/*
+ * Purpose: Find where the newest day partition of the archive ends
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	SUCCESS = TO_DAYS() value of the day after the newest day partition,
+ * 		0 if there are no day partitions yet
+ * 	FAILURE = FAILURE and err type set
+*/
+long getQueueArchiveLastDay() {
+	DBRESULT *result;
+	DBROW row;
+	long day = 0;
+
+	result = dbQuery("SELECT MAX(CAST(PARTITION_DESCRIPTION AS UNSIGNED)) FROM information_schema.PARTITIONS WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'message_queue_archive' AND PARTITION_DESCRIPTION != 'MAXVALUE'");
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	if((row = dbQueryGetRow(result)) != NULL && row[0] != NULL)
+		day = atol(row[0]);
+
+	dbQueryFreeResult(result);
+
+	return day;
+}
+
+
+/*
+ * Purpose: Add a partition to the archive for each day in a range, split
+ * 	off the front of the catch all pfuture partition
+ *
+ * Entry:
+ * 	1st - TO_DAYS() value of first day
+ * 	2nd - TO_DAYS() value of last day
+ *
+ * Exit:
+ * 	SUCCESS = true, days that already have a partition are skipped
+ * 	FAILURE = false and err type set
+ *
+ * Note: Partitions can only be split off the end of the table, so days
+ * 	older than the newest existing partition are left in it.
+*/
+bool addQueueArchivePartitions(long fromDay, long toDay) {
+	DBRESULT *result;
+	char *parts;
+	char name[16];
+	size_t length, used;
+	time_t secs;
+	long lastDay, day;
+
+	if((lastDay = getQueueArchiveLastDay()) == FAILURE)
+		return false;
+
+	if(fromDay < lastDay)
+		fromDay = lastDay;
+
+	if(toDay - fromDay >= QUEUE_ARCHIVE_MAX_NEW_DAYS)
+		fromDay = toDay - QUEUE_ARCHIVE_MAX_NEW_DAYS + 1;
+
+	if(fromDay > toDay)
+		return true;
+
+	length = ((toDay - fromDay + 2) * 64) + 1;
+
+	if((parts = (char *)malloc(length)) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	for(day = fromDay, used = 0; day <= toDay; day++) {
+		secs = (time_t)(day - QUEUE_ARCHIVE_EPOCH_DAYS) * 86400;
+		strftime(name, sizeof(name), "p%Y%m%d", gmtime(&secs));
+
+		used += snprintf(parts + used, length - used, "PARTITION %s VALUES LESS THAN (%ld), ", name, day + 1);
+	}
+
+	snprintf(parts + used, length - used, "PARTITION pfuture VALUES LESS THAN MAXVALUE");
+
+	result = dbQuery("ALTER TABLE message_queue_archive REORGANIZE PARTITION pfuture INTO (%s)", parts);
+
+	free(parts);
+	dbQueryFreeResult(result);
+
+	return (getErrType() == ERR_NONE);
+}
+
+
+/*
+ * Purpose: Make sure the archive has partitions for today and tomorrow,
+ * 	so entries done either side of midnight have somewhere to go
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool updateQueueArchivePartitions() {
+	DBRESULT *result;
+	DBROW row;
+	long today;
+
+	result = dbQuery("SELECT TO_DAYS(now())");
+
+	if(getErrType() != ERR_NONE || (row = dbQueryGetRow(result)) == NULL || row[0] == NULL) {
+		dbQueryFreeResult(result);
+		setErrType(ERR_DB_QUERY);
+		return false;
+	}
+
+	today = atol(row[0]);
+
+	dbQueryFreeResult(result);
+
+	return addQueueArchivePartitions(today, today + 1);
+}
+
+
+/*
+ * Purpose: Copy a batch of DONE queue entries to the archive and remove
+ * 	them from message_queue, must be called within a transaction
+ *
+ * Entry:
+ * 	1st - Type of message queue entries to archive,
+ * 		DBVAL_message_queue_messageType_EVERYTHING for all
+ * 	2nd - Max number of entries to move
+ * 	3rd - Buffer for the list of ids moved
+ * 	4th - Length of the buffer, at least 21 chars per entry
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries moved (0 if nothing to do)
+ * 	FAILURE = FAILURE and err type set
+ *
+ * Note: The DONE rows are locked with SELECT ... FOR UPDATE so two bosses
+ * 	archiving at once take different batches rather than the same one.
+*/
+int moveQueueEntriesToArchive(int messageType, int max, char *ids, size_t length) {
+	DBRESULT *result;
+	DBROW row;
+	size_t used;
+	int n;
+
+	if(messageType == DBVAL_message_queue_messageType_EVERYTHING) {
+		result = dbQuery("SELECT id FROM message_queue WHERE queueState = %d ORDER BY id ASC LIMIT %d FOR UPDATE", DBVAL_message_queue_queueState_DONE, max);
+	} else {
+		result = dbQuery("SELECT id FROM message_queue WHERE queueState = %d AND messageType = %d ORDER BY id ASC LIMIT %d FOR UPDATE", DBVAL_message_queue_queueState_DONE, messageType, max);
+	}
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	for(n = 0, used = 0; (row = dbQueryGetRow(result)) != NULL; n++)
+		used += snprintf(ids + used, length - used, (n == 0) ? "%s" : ",%s", row[0]);
+
+	dbQueryFreeResult(result);
+
+	if(n == 0)
+		return 0;
+
+	dbQueryFreeResult(dbQuery("INSERT INTO message_queue_archive (id, messageId, messageType, queueState, userId, voidId, track, claimOwner, attempts, failures, doneDate, archiveDate) SELECT id, messageId, messageType, queueState, userId, voidId, track, claimOwner, attempts, failures, IFNULL(processDate, now()), now() FROM message_queue WHERE id IN (%s)", ids));
+
+	if(getErrType() != ERR_NONE)
+		return FAILURE;
+
+	dbQueryFreeResult(dbQuery("DELETE FROM message_queue WHERE id IN (%s)", ids));
+
+	if(getErrType() != ERR_NONE)
+		return FAILURE;
+
+	return n;
+}
+
+
+/*
+ * Purpose: Move a batch of DONE queue entries to the archive in one
+ * 	transaction
+ *
+ * Entry:
+ * 	1st - Type of message queue entries to archive,
+ * 		DBVAL_message_queue_messageType_EVERYTHING for all
+ * 	2nd - Max number of entries to move
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries archived (0 if nothing to do)
+ * 	FAILURE = FAILURE and err type set
+*/
+int archiveQueueEntries(int messageType, int max) {
+	ERRTYPE err;
+	char *ids;
+	size_t length;
+	time_t now;
+	int n;
+
+	if(max <= 0)
+		return 0;
+
+	if(max > QUEUE_ARCHIVE_MAX_BATCH)
+		max = QUEUE_ARCHIVE_MAX_BATCH;
+
+	// Every so often make sure today has a partition
+	if((now = time(NULL)) >= nextPartitionCheck) {
+		if(updateQueueArchivePartitions() == false)
+			return FAILURE;
+
+		nextPartitionCheck = now + QUEUE_ARCHIVE_PARTITION_SEC;
+	}
+
+	length = (max * 21) + 1;		// Max digits in a long plus a comma
+
+	if((ids = (char *)malloc(length)) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return FAILURE;
+	}
+
+	dbQueryFreeResult(dbQuery("START TRANSACTION"));
+
+	if(getErrType() != ERR_NONE) {
+		free(ids);
+		return FAILURE;
+	}
+
+	n = moveQueueEntriesToArchive(messageType, max, ids, length);
+
+	free(ids);
+
+	if(n > 0) {
+		dbQueryFreeResult(dbQuery("COMMIT"));
+
+		return (getErrType() == ERR_NONE) ? n : FAILURE;
+	}
+
+	// Keep the error that caused the rollback rather than the rollback's
+	err = getErrType();
+
+	dbQueryFreeResult(dbQuery("ROLLBACK"));
+
+	setErrType(err);
+
+	return n;
+}
+
+
+/*
+ * Purpose: Move every DONE queue entry to the archive, for installs that
+ * 	had entries piling up before archiving existed
+ *
+ * Entry:
+ * 	1st - Number of entries to move per batch
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries archived
+ * 	FAILURE = FAILURE and err type set
+*/
+long backfillQueueArchive(int batch) {
+	DBRESULT *result;
+	DBROW row;
+	long fromDay, toDay, total;
+	int n;
+
+	if(batch <= 0)
+		batch = QUEUE_ARCHIVE_BATCH;
+
+	// A partition for every day since the oldest DONE entry
+	result = dbQuery("SELECT TO_DAYS(MIN(processDate)), TO_DAYS(now()) FROM message_queue WHERE queueState = %d", DBVAL_message_queue_queueState_DONE);
+
+	if(getErrType() != ERR_NONE || (row = dbQueryGetRow(result)) == NULL || row[1] == NULL) {
+		dbQueryFreeResult(result);
+		setErrType(ERR_DB_QUERY);
+		return FAILURE;
+	}
+
+	toDay = atol(row[1]);
+	fromDay = (row[0] != NULL) ? atol(row[0]) : toDay;
+
+	dbQueryFreeResult(result);
+
+	if(addQueueArchivePartitions(fromDay, toDay + 1) == false)
+		return FAILURE;
+
+	nextPartitionCheck = time(NULL) + QUEUE_ARCHIVE_PARTITION_SEC;
+
+	for(total = 0; ; total += n) {
+		if((n = archiveQueueEntries(DBVAL_message_queue_messageType_EVERYTHING, batch)) == FAILURE)
+			return FAILURE;
+
+		if(n == 0)
+			break;
+
+		printf("Archived %ld queue entries\n", total + n);
+	}
+
+	return total;
+}
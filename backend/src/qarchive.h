@@ -0,0 +1,28 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Move DONE message queue entries out of message_queue into the
+ *  day partitioned message_queue_archive table
+*/
+
+#ifndef __QARCHIVE_H__
+#define __QARCHIVE_H__
+
+#include<time.h>
+#include "codewide.h"
+
+#define QUEUE_ARCHIVE_MAX_BATCH		2000	// Upper bound on entries moved in one go, keeps id list
+						//  within MAX_LENGTH_DB_QUERY
+#define QUEUE_ARCHIVE_MAX_NEW_DAYS	366	// Max day partitions added at once, older days share the first
+#define QUEUE_ARCHIVE_PARTITION_SEC	3600	// Secs between checks that today's partition exists
+#define QUEUE_ARCHIVE_EPOCH_DAYS	719528L	// MySQL TO_DAYS('1970-01-01')
+
+/* Function prototypes */
+long getQueueArchiveLastDay();			// Day after the newest day partition of the archive
+bool addQueueArchivePartitions(long, long);	// Add day partitions to the archive
+bool updateQueueArchivePartitions();		// Make sure today's and tomorrow's partitions exist
+int moveQueueEntriesToArchive(int, int, char *, size_t);	// Move DONE entries to the archive within a transaction
+int archiveQueueEntries(int, int);		// Move a batch of DONE entries to the archive
+long backfillQueueArchive(int);			// Move all DONE entries to the archive
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Event loop of a queue boss, one epoll instance watching worker
+ *  threads ending, pooled workers replying, doorbell rings and timers
+ *
+ * Note: SIGCHLD is blocked in the boss and read from a signalfd, so a
+ *  worker ending wakes the boss straight away without a signal handler
+ *  interrupting it part way through a database query. Only threads that
+ *  have ended are reaped, rather than calling waitpid() on every slot each
+ *  time round, and their slot can be reused as soon as the boss wakes.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<sys/types.h>
+#include<sys/wait.h>
+#include<sys/socket.h>
+#include<sys/epoll.h>
+#include<sys/signalfd.h>
+#include<sys/timerfd.h>
+#include "qevents.h"
+#include "logerror.h"
+#include "doorbell.h"
+
+
+/*
+ * Purpose: Setup the event loop of a boss
+ *
+ * Entry:
+ * 	1st - Doorbell the boss listens on (may be DOORBELL_UNSET)
+ * 	2nd - Secs between housekeeping ticks
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated Queue_Events
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Events *createQueueEvents(int doorbell, long tickSec) {
+	Queue_Events *events;
+	struct itimerspec tick;
+	sigset_t mask;
+
+	if((events = (Queue_Events *)malloc(sizeof(Queue_Events))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	events->epoll = events->signals = events->timer = QUEUE_EVENTS_UNSET;
+	events->doorbell = doorbell;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+
+	// SIGCHLD has to be blocked for the signalfd to get it
+	if(sigprocmask(SIG_BLOCK, &mask, &events->oldMask) == -1) {
+		free(events);
+		setErrType(ERR_QUEUE_EVENTS);
+		return NULL;
+	}
+
+	events->epoll = epoll_create1(EPOLL_CLOEXEC);
+	events->signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	events->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if(events->epoll == -1 || events->signals == -1 || events->timer == -1) {
+		freeQueueEvents(events);
+		setErrType(ERR_QUEUE_EVENTS);
+		return NULL;
+	}
+
+	memset(&tick, 0, sizeof(tick));
+	tick.it_value.tv_sec = tickSec;
+	tick.it_interval.tv_sec = tickSec;
+
+	if(timerfd_settime(events->timer, 0, &tick, NULL) == -1
+		|| watchQueueEvent(events, events->signals, QUEUE_EVENT_CHILD) == false
+		|| watchQueueEvent(events, events->timer, QUEUE_EVENT_TICK) == false
+		|| (doorbell != DOORBELL_UNSET && watchQueueEvent(events, doorbell, QUEUE_EVENT_DOORBELL) == false)) {
+
+		freeQueueEvents(events);
+		setErrType(ERR_QUEUE_EVENTS);
+		return NULL;
+	}
+
+	return events;
+}
+
+
+/*
+ * Purpose: Close the event loop of a boss and unblock SIGCHLD again
+ *
+ * Entry:
+ * 	1st - Queue_Events to free
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: The doorbell belongs to the boss and is left open
+*/
+void freeQueueEvents(Queue_Events *events) {
+
+	if(events == NULL)
+		return;
+
+	if(events->epoll != QUEUE_EVENTS_UNSET)
+		close(events->epoll);
+
+	if(events->signals != QUEUE_EVENTS_UNSET)
+		close(events->signals);
+
+	if(events->timer != QUEUE_EVENTS_UNSET)
+		close(events->timer);
+
+	sigprocmask(SIG_SETMASK, &events->oldMask, NULL);
+
+	free(events);
+}
+
+
+/*
+ * Purpose: Have the boss woken when a file descriptor is readable
+ *
+ * Entry:
+ * 	1st - Event loop of the boss
+ * 	2nd - File descriptor to watch
+ * 	3rd - What the descriptor is for, i.e. QUEUE_EVENT_DOORBELL
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool watchQueueEvent(Queue_Events *events, int fd, unsigned int tag) {
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u32 = tag;
+
+	if(epoll_ctl(events->epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+		setErrType(ERR_QUEUE_EVENTS);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Stop watching and close the socket to a pooled worker
+ *
+ * Entry:
+ * 	1st - Event loop of the boss
+ * 	2nd - Worker thread slot
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: The socket is taken out of epoll before it's closed, a worker
+ * 	forked since may still hold a copy of it which would keep it in.
+ * 	Workers must not call this, the epoll instance is shared with the
+ * 	boss (see detachFromBoss()).
+*/
+void closeQueueThreadPipe(Queue_Events *events, Queuerunner_Thread *thread) {
+
+	if(thread->pipe == QUEUE_THREAD_PIPE_UNSET)
+		return;
+
+	epoll_ctl(events->epoll, EPOLL_CTL_DEL, thread->pipe, NULL);
+	close(thread->pipe);
+
+	thread->pipe = QUEUE_THREAD_PIPE_UNSET;
+}
+
+
+/*
+ * Purpose: Read the reply of a pooled worker and finish its queue entry
+ *
+ * Entry:
+ * 	1st - Event loop of the boss
+ * 	2nd - Scheduler holding the boss's queue entries
+ * 	3rd - Worker thread slot
+ *
+ * Exit:
+ * 	true = reply read, slot's qentry is done
+ * 	false = nothing to read yet, or the worker has gone in which case its
+ * 		socket is closed and the entry is finished once it's reaped
+*/
+bool readQueueThreadReply(Queue_Events *events, Queue_Sched *sched, Queuerunner_Thread *thread) {
+	Queuerunner_Reply reply;
+	ssize_t got;
+
+	got = recv(thread->pipe, &reply, sizeof(reply), MSG_DONTWAIT);
+
+	if(got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return false;
+
+	if(got != sizeof(reply)) {
+		closeQueueThreadPipe(events, thread);
+		return false;
+	}
+
+	if(thread->qentry != NULL) {
+		doneQueueSchedEntry(sched, thread->qentry);
+		finishQueueThread(thread, reply.status);
+	}
+
+	// Retiring workers exit by themselves, slot is freed once they've been reaped
+	if(reply.retiring == true)
+		closeQueueThreadPipe(events, thread);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Reap worker threads that have ended and free up their slots
+ *
+ * Entry:
+ * 	1st - Event loop of the boss
+ * 	2nd - Scheduler holding the boss's queue entries
+ * 	3rd - Worker thread slots
+ * 	4th - Number of worker thread slots
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: SIGCHLD's of threads ending close together merge into one, so
+ * 	this reaps until there's nobody left to reap rather than once per
+ * 	signal read.
+*/
+void reapQueueThreads(Queue_Events *events, Queue_Sched *sched, Queuerunner_Thread **threads, int numThreads) {
+	struct signalfd_siginfo info;
+	pid_t pid;
+	int i, status;
+
+	while(read(events->signals, &info, sizeof(info)) == sizeof(info));
+
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+
+		for(i = 0; i < numThreads && threads[i]->id != pid; i++);
+
+		if(i == numThreads)
+			continue;
+
+		// A pooled worker may have replied just before it exited
+		if(threads[i]->qentry != NULL && threads[i]->pipe != QUEUE_THREAD_PIPE_UNSET)
+			readQueueThreadReply(events, sched, threads[i]);
+
+		// Otherwise the entry is done with however the thread ended
+		if(threads[i]->qentry != NULL) {
+			doneQueueSchedEntry(sched, threads[i]->qentry);
+			finishQueueThread(threads[i], getQueueThreadExitErr(status));
+		}
+
+		closeQueueThreadPipe(events, threads[i]);
+
+		threads[i]->id = QUEUE_THREAD_SLOT_EMPTY;
+	}
+}
+
+
+/*
+ * Purpose: Block until there's something for the boss to do, and handle
+ * 	worker threads that replied or ended while it slept
+ *
+ * Entry:
+ * 	1st - Event loop of the boss
+ * 	2nd - Max millisecs to wait
+ * 	3rd - Scheduler holding the boss's queue entries
+ * 	4th - Worker thread slots
+ * 	5th - Number of worker thread slots
+ *
+ * Exit:
+ * 	QUEUE_WOKE_ flags for what needs doing, QUEUE_WOKE_WORK if the doorbell
+ * 	rang, QUEUE_WOKE_TICK if housekeeping is due, QUEUE_WOKE_TIMEOUT if the
+ * 	max wait ran out, QUEUE_WOKE_NONE if only woken by worker threads
+ * 	(slots may have freed up)
+*/
+int waitQueueEvents(Queue_Events *events, int timeout, Queue_Sched *sched, Queuerunner_Thread **threads, int numThreads) {
+	struct epoll_event ready[QUEUE_EVENTS_MAX];
+	uint64_t ticks;
+	unsigned int slot;
+	int i, n, woke = QUEUE_WOKE_NONE;
+	bool childEnded = false;
+
+	if((n = epoll_wait(events->epoll, ready, QUEUE_EVENTS_MAX, timeout)) == 0)
+		return QUEUE_WOKE_TIMEOUT;
+
+	for(i = 0; i < n; i++) {
+
+		switch(ready[i].data.u32) {
+
+			case QUEUE_EVENT_CHILD:
+				childEnded = true;
+				break;
+
+			case QUEUE_EVENT_DOORBELL:
+				drainDoorbell(events->doorbell);
+				woke |= QUEUE_WOKE_WORK;
+				break;
+
+			case QUEUE_EVENT_TICK:
+				while(read(events->timer, &ticks, sizeof(ticks)) == sizeof(ticks));
+				woke |= QUEUE_WOKE_TICK;
+				break;
+
+			default:
+				slot = ready[i].data.u32 - QUEUE_EVENT_SLOT;
+
+				if(slot < (unsigned int)numThreads && threads[slot]->pipe != QUEUE_THREAD_PIPE_UNSET)
+					readQueueThreadReply(events, sched, threads[slot]);
+				break;
+		}
+	}
+
+	// Replies are read first so a worker that retired isn't taken as having died mid job
+	if(childEnded == true)
+		reapQueueThreads(events, sched, threads, numThreads);
+
+	return woke;
+}
@@ -0,0 +1,39 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Event loop of a queue boss, one epoll instance watching worker
+ *  threads ending, pooled workers replying, doorbell rings and timers
+*/
+
+#ifndef __QEVENTS_H__
+#define __QEVENTS_H__
+
+#include "codewide.h"
+#include "msgqueue.h"
+#include "qsched.h"
+
+#define QUEUE_EVENTS_UNSET	-1
+#define QUEUE_EVENTS_MAX	64	// Max events handled per wake up of a boss
+
+/* What an epoll event is for, pooled worker sockets are QUEUE_EVENT_SLOT + their slot */
+#define QUEUE_EVENT_CHILD	0
+#define QUEUE_EVENT_DOORBELL	1
+#define QUEUE_EVENT_TICK	2
+#define QUEUE_EVENT_SLOT	3
+
+/* What woke the boss, returned by waitQueueEvents() */
+#define QUEUE_WOKE_NONE		0
+#define QUEUE_WOKE_WORK		1	// The queue may have new work
+#define QUEUE_WOKE_TICK		2	// Time for housekeeping
+#define QUEUE_WOKE_TIMEOUT	4	// Max time to wait ran out
+
+/* Function prototypes */
+Queue_Events *createQueueEvents(int, long);	// Setup the event loop of a boss
+void freeQueueEvents(Queue_Events *);		// Close the event loop of a boss
+bool watchQueueEvent(Queue_Events *, int, unsigned int);	// Wake the boss when a fd is readable
+void closeQueueThreadPipe(Queue_Events *, Queuerunner_Thread *);	// Stop watching and close a pooled worker's socket
+bool readQueueThreadReply(Queue_Events *, Queue_Sched *, Queuerunner_Thread *);	// Finish a pooled worker's job
+void reapQueueThreads(Queue_Events *, Queue_Sched *, Queuerunner_Thread **, int);	// Free the slots of ended threads
+int waitQueueEvents(Queue_Events *, int, Queue_Sched *, Queuerunner_Thread **, int);	// Sleep till there's something to do
+
+#endif
@@ -0,0 +1,1970 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Queue backend keeping a queue in a local append only log of
+ *  memory mapped segment files, for single node installs
+ *
+ * Note: Each message type has its own log in a directory under the
+ *  queue_log_dir setting (see SCONFIG), a meta file shared by every
+ *  process using the log plus numbered segment files of fixed size
+ *  records. Nothing is ever changed in place, adding an entry or changing
+ *  its state appends a record holding all of the entry. Appending is done
+ *  under a process shared lock in the meta file, the record is written
+ *  then the log's position moved past it, so readers never see half a
+ *  record.
+ *
+ * Note 2: Every process keeps its own index of the live (JUSTIN or
+ *  PROCESSING) entries of a log, brought up to date by reading what's been
+ *  appended since it last looked (see readQueueLog()). Changes that depend
+ *  on an entry's current state, e.g. claiming it, read up to the end of
+ *  the log while holding the lock so two bosses can't both claim an entry.
+ *  Workers forked by a boss start with a copy of its index.
+ *
+ * Note 3: Records land in the page cache as soon as they're appended, so
+ *  they survive any process dying. Getting them on disk is batched, the
+ *  queue bosses sync the log once every time they wake up (see
+ *  syncQueueEntries()) and mailinject syncs before telling the MTA a mail
+ *  was taken. Every record has a checksum, and the first process to open
+ *  a log after the host has rebooted cuts it back to the last whole
+ *  record (see recoverQueueLog()).
+ *
+ * Note 4: Segments older than the oldest live entry are removed when the
+ *  bosses tidy up (see compactQueueLog()), instead of archiving. Finished
+ *  entries are gone once their segment is, there's no message_queue_archive
+ *  for them.
+ *
+ * Note 5: Only one node can use a log, so sharding is off and claims are
+ *  never filtered by shard. Queue entries still refer to messages in the
+ *  database, only the queue itself is local.
+ *
+ * Note 6: mailinject, rulerunner and msgdelivery each run in their own
+ *  chroot, so queue_log_dir is opened by their setup() before the chroot
+ *  (see openQueueLogDir()) and everything in it is reached relative to
+ *  that, giving them all the same logs. Rule runner workers are under
+ *  RLIMIT_FSIZE 0 so can't grow a segment, they append into the spares
+ *  already grown by the bosses and mailinject (see appendQueueLog()).
+ *
+ * Note 7: A descriptor of a directory outside the jail is a way out of it,
+ *  so forked workers don't keep it. Before going into the sandbox they open
+ *  the logs and the segments they can need, then close it (see
+ *  holdQueueLogSegments()). Everything is in the group of the user the
+ *  jailed daemons run as, so msgdelivery running as root and the rest
+ *  running as that user can open each other's files.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<sys/file.h>
+#include<sys/resource.h>
+#include<pwd.h>
+#include "setupthang.h"
+#include "qlog.h"
+#include "logerror.h"
+#include "dbchatter.h"
+
+
+static Queue_Log *_queueLogs[QUEUE_LOG_MAX_TYPES];	// Logs this process has open, by message type
+static int _queueLogDir = QUEUE_LOG_DIR_UNSET;		// queue_log_dir, opened before the chroot
+static char _queueLogBootId[QUEUE_LOG_LENGTH_BOOT_ID];	// Boot of the host, read before the chroot hides /proc
+
+
+/*
+ * Purpose: Open the directory logs are kept in, so they can still be
+ * 	reached once the process is in its chroot
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	SUCCESS = true, also when queues aren't kept in logs
+ * 	FAILURE = false and err type set
+ *
+ * Note: Must be called before putInChroot(), queue_log_dir is a path
+ * 	outside every jail and /proc isn't in them either. The descriptor is
+ * 	inherited by forked workers, who let go of it before the sandbox
+ * 	(see holdQueueLogSegments()).
+ *
+ * Note 2: Run as root the directory is handed to SET_JAIL_RUNASUSER and
+ * 	its group, so every daemon can use it whoever it runs as.
+*/
+bool openQueueLogDir() {
+	struct passwd *user;
+
+	if(_config->queue_backend != QUEUE_BACKEND_LOG || _queueLogDir != QUEUE_LOG_DIR_UNSET)
+		return true;
+
+	getQueueLogBootId(_queueLogBootId);
+
+	mkdir(_config->queue_log_dir, QUEUE_LOG_DIR_MODE);
+
+	if((_queueLogDir = open(_config->queue_log_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		_queueLogDir = QUEUE_LOG_DIR_UNSET;
+		setErrType(ERR_QUEUE_LOG);
+		return false;
+	}
+
+	if(geteuid() == 0) {
+		if((user = getpwnam(SET_JAIL_RUNASUSER)) == NULL
+			|| fchown(_queueLogDir, user->pw_uid, user->pw_gid) != 0
+			|| fchmod(_queueLogDir, QUEUE_LOG_DIR_MODE) != 0) {
+
+			close(_queueLogDir);
+			_queueLogDir = QUEUE_LOG_DIR_UNSET;
+			setErrType(ERR_QUEUE_LOG);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Get what a forked worker needs of the logs before it goes into
+ * 	the sandbox, then close queue_log_dir so it can't be used to get out
+ * 	of the jail
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	SUCCESS = true, also when queues aren't kept in logs
+ * 	FAILURE = false and err type set
+ *
+ * Note: Every log that exists is opened and read up to its end, and the
+ * 	segment being appended to plus QUEUE_LOG_SPARE_SEGMENTS after it are
+ * 	grown and held open. A worker that outlives them, or wants a log
+ * 	that didn't exist yet, gets ERR_QUEUE_LOG and its entry goes back on
+ * 	the queue when the lease runs out.
+*/
+bool holdQueueLogSegments() {
+	Queue_Log *log;
+	char path[MAX_LENGTH_FILEPATH + 1];
+	long segment;
+	int t, i;
+
+	if(_queueLogDir == QUEUE_LOG_DIR_UNSET)
+		return true;
+
+	for(t = 0; t < QUEUE_LOG_MAX_TYPES; t++) {
+		snprintf(path, sizeof(path), "%d/meta", t);
+
+		if(_queueLogs[t] == NULL && faccessat(_queueLogDir, path, F_OK, 0) != 0)
+			continue;
+
+		if((log = openQueueLog(t)) == NULL || readQueueLog(log) == false)
+			return false;
+
+		segment = __atomic_load_n(&log->meta->position, __ATOMIC_ACQUIRE) / QUEUE_LOG_SEGMENT_RECORDS;
+
+		for(i = 0; i <= QUEUE_LOG_SPARE_SEGMENTS; i++) {
+			if(createQueueLogSegment(log, segment + i) == false
+				|| (log->held[i] = openQueueLogSegment(log, segment + i, O_RDWR)) == -1) {
+
+				setErrType(ERR_QUEUE_LOG);
+				return false;
+			}
+		}
+
+		log->heldSegment = segment;
+	}
+
+	close(_queueLogDir);
+	_queueLogDir = QUEUE_LOG_DIR_UNSET;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Open the log of a message type, creating it if it doesn't exist
+ *
+ * Entry:
+ * 	1st - Type of message queue, e.g. email
+ *
+ * Exit:
+ * 	SUCCESS = Queue_Log, the same one for the rest of the process
+ * 	FAILURE = NULL and err type set
+ *
+ * Note: The meta file is only held open while it's checked, everything
+ * 	after that goes through its memory map, sandboxed workers have few
+ * 	file descriptors to spare.
+ *
+ * Note 2: Fails if openQueueLogDir() wasn't called, looking for
+ * 	queue_log_dir from inside a chroot would find a log of its own.
+ * 	Also fails in a sandboxed worker for a log it didn't hold open
+ * 	(see holdQueueLogSegments()).
+*/
+Queue_Log *openQueueLog(int messageType) {
+	Queue_Log *log;
+	Queue_Log_Meta *meta;
+	struct stat st;
+	char path[MAX_LENGTH_FILEPATH + 1];
+	bool ok = true;
+	int fd;
+
+	if(messageType < 0 || messageType >= QUEUE_LOG_MAX_TYPES) {
+		setErrType(ERR_QUEUE_LOG);
+		return NULL;
+	}
+
+	if(_queueLogs[messageType] != NULL)
+		return _queueLogs[messageType];
+
+	if(_queueLogDir == QUEUE_LOG_DIR_UNSET) {
+		setErrType(ERR_QUEUE_LOG);
+		return NULL;
+	}
+
+	if((log = createQueueLog(messageType)) == NULL)
+		return NULL;
+
+	// umask may have taken the group's write, whoever creates them puts it back
+	if(mkdirat(_queueLogDir, log->dir, QUEUE_LOG_DIR_MODE) == 0)
+		fchmodat(_queueLogDir, log->dir, QUEUE_LOG_DIR_MODE, 0);
+
+	snprintf(path, sizeof(path), "%s/meta", log->dir);
+
+	if((fd = openat(_queueLogDir, path, O_RDWR | O_CREAT | O_CLOEXEC, QUEUE_LOG_FILE_MODE)) == -1) {
+		freeQueueLog(log);
+		setErrType(ERR_QUEUE_LOG);
+		return NULL;
+	}
+
+	fchmod(fd, QUEUE_LOG_FILE_MODE);
+
+	// Only one process at a time sets up or recovers a log
+	if(flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0
+		|| (st.st_size < (off_t)sizeof(Queue_Log_Meta) && ftruncate(fd, sizeof(Queue_Log_Meta)) != 0)) {
+
+		close(fd);
+		freeQueueLog(log);
+		setErrType(ERR_QUEUE_LOG);
+		return NULL;
+	}
+
+	if((meta = (Queue_Log_Meta *)mmap(NULL, sizeof(Queue_Log_Meta), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		freeQueueLog(log);
+		setErrType(ERR_QUEUE_LOG);
+		return NULL;
+	}
+
+	log->meta = meta;
+
+	if(meta->magic != QUEUE_LOG_MAGIC) {
+
+		// New log, magic goes in last so a half setup log is setup again
+		memset(meta, 0, sizeof(Queue_Log_Meta));
+
+		meta->version = QUEUE_LOG_VERSION;
+		meta->nextId = 1;
+		strcpy(meta->bootId, _queueLogBootId);
+
+		if((ok = initQueueLogLock(meta)) == true) {
+			meta->magic = QUEUE_LOG_MAGIC;
+			msync(meta, sizeof(Queue_Log_Meta), MS_SYNC);
+		}
+
+	} else if(meta->version != QUEUE_LOG_VERSION) {
+		ok = false;
+
+	} else if(strcmp(meta->bootId, _queueLogBootId) != 0) {
+
+		// First open since the host rebooted, whoever held the lock is gone
+		if((ok = initQueueLogLock(meta)) == true && (ok = recoverQueueLog(log)) == true) {
+			strcpy(meta->bootId, _queueLogBootId);
+			msync(meta, sizeof(Queue_Log_Meta), MS_SYNC);
+		}
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	if(ok == false) {
+		freeQueueLog(log);
+		setErrType(ERR_QUEUE_LOG);
+		return NULL;
+	}
+
+	_queueLogs[messageType] = log;
+
+	return log;
+}
+
+
+/*
+ * Purpose: Creates a process's view of a log, with an empty index
+ *
+ * Entry:
+ * 	1st - Type of message queue the log is for
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated Queue_Log
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Log *createQueueLog(int messageType) {
+	Queue_Log *log;
+
+	if((log = (Queue_Log *)malloc(sizeof(Queue_Log))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	if((log->items = (Queue_Log_Item **)calloc(QUEUE_LOG_HASH_SIZE, sizeof(Queue_Log_Item *))) == NULL) {
+		free(log);
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	if((log->voids = (Queue_Log_Void **)calloc(QUEUE_LOG_VOID_HASH_SIZE, sizeof(Queue_Log_Void *))) == NULL) {
+		free(log->items);
+		free(log);
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	log->messageType = messageType;
+	snprintf(log->dir, sizeof(log->dir), "%d", messageType);
+
+	log->meta = NULL;
+
+	log->readMap = NULL;
+	log->readSegment = QUEUE_LOG_UNMAPPED;
+	log->appendMap = NULL;
+	log->appendSegment = QUEUE_LOG_UNMAPPED;
+
+	log->heldSegment = QUEUE_LOG_UNMAPPED;
+
+	log->position = 0;
+
+	log->liveHead = NULL;
+	log->liveTail = NULL;
+	log->numLive = 0;
+
+	log->numTracks = 0;
+	log->numLeases = 0;
+
+	return log;
+}
+
+
+/*
+ * Purpose: Free up a process's view of a log, and its index
+ *
+ * Entry:
+ * 	1st - Queue_Log to free
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeQueueLog(Queue_Log *log) {
+	Queue_Log_Item *item, *nextItem;
+	Queue_Log_Void *v, *nextVoid;
+	int i;
+
+	if(log == NULL)
+		return;
+
+	for(item = log->liveHead; item != NULL; item = nextItem) {
+		nextItem = item->liveNext;
+		free(item);
+	}
+
+	for(i = 0; i < QUEUE_LOG_VOID_HASH_SIZE; i++) {
+		for(v = log->voids[i]; v != NULL; v = nextVoid) {
+			nextVoid = v->hashNext;
+			free(v);
+		}
+	}
+
+	if(log->readMap != NULL)
+		munmap(log->readMap, QUEUE_LOG_SEGMENT_BYTES);
+
+	if(log->appendMap != NULL)
+		munmap(log->appendMap, QUEUE_LOG_SEGMENT_BYTES);
+
+	if(log->heldSegment != QUEUE_LOG_UNMAPPED) {
+		for(i = 0; i <= QUEUE_LOG_SPARE_SEGMENTS; i++)
+			close(log->held[i]);
+	}
+
+	if(log->meta != NULL)
+		munmap(log->meta, sizeof(Queue_Log_Meta));
+
+	free(log->items);
+	free(log->voids);
+	free(log);
+}
+
+
+/*
+ * Purpose: Setup the lock in a log's meta file, shared by every process
+ * 	using the log
+ *
+ * Entry:
+ * 	1st - Meta of the log
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false
+ *
+ * Note: The lock is robust, a worker killed by its sandbox while holding
+ * 	it doesn't leave it held forever. Nothing it half wrote counts as
+ * 	the log's position only moves once a record is whole.
+*/
+bool initQueueLogLock(Queue_Log_Meta *meta) {
+	pthread_mutexattr_t attr;
+	bool ok;
+
+	if(pthread_mutexattr_init(&attr) != 0)
+		return false;
+
+	ok = (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == 0
+		&& pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) == 0
+		&& pthread_mutex_init(&meta->lock, &attr) == 0);
+
+	pthread_mutexattr_destroy(&attr);
+
+	return ok;
+}
+
+
+/*
+ * Purpose: Find out which boot of the host this is, a log last opened in
+ * 	a different boot may not have got everything onto disk
+ *
+ * Entry:
+ * 	1st - Buffer of QUEUE_LOG_LENGTH_BOOT_ID to put the boot id in
+ *
+ * Exit:
+ * 	NONE, the boot id is empty if it can't be read
+*/
+void getQueueLogBootId(char *bootId) {
+	FILE *file;
+	size_t length = 0;
+
+	if((file = fopen(QUEUE_LOG_PATH_BOOT_ID, "r")) != NULL) {
+		length = fread(bootId, 1, QUEUE_LOG_LENGTH_BOOT_ID - 1, file);
+		fclose(file);
+	}
+
+	bootId[length] = '\0';
+}
+
+
+/*
+ * Purpose: Work out the path of a segment file, relative to queue_log_dir
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Number of the segment
+ * 	3rd - Buffer of MAX_LENGTH_FILEPATH + 1 to put the path in
+ *
+ * Exit:
+ * 	NONE
+*/
+void getQueueLogSegmentPath(Queue_Log *log, long segment, char *path) {
+
+	snprintf(path, MAX_LENGTH_FILEPATH + 1, "%s/%010ld.seg", log->dir, segment);
+}
+
+
+/*
+ * Purpose: Open a segment file, from queue_log_dir or from the segments a
+ * 	sandboxed worker holds open
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Number of the segment
+ * 	3rd - open() flags, O_CREAT creates it with QUEUE_LOG_FILE_MODE
+ *
+ * Exit:
+ * 	SUCCESS = File descriptor, to be closed by the caller
+ * 	FAILURE = -1, not held or couldn't be opened
+*/
+int openQueueLogSegment(Queue_Log *log, long segment, int flags) {
+	char path[MAX_LENGTH_FILEPATH + 1];
+	int fd;
+
+	if(_queueLogDir == QUEUE_LOG_DIR_UNSET) {
+		if(log->heldSegment == QUEUE_LOG_UNMAPPED || segment < log->heldSegment
+			|| segment > log->heldSegment + QUEUE_LOG_SPARE_SEGMENTS)
+			return -1;
+
+		return fcntl(log->held[segment - log->heldSegment], F_DUPFD_CLOEXEC, 0);
+	}
+
+	getQueueLogSegmentPath(log, segment, path);
+
+	if((fd = openat(_queueLogDir, path, flags | O_CLOEXEC, QUEUE_LOG_FILE_MODE)) != -1 && (flags & O_CREAT) != 0)
+		fchmod(fd, QUEUE_LOG_FILE_MODE);
+
+	return fd;
+}
+
+
+/*
+ * Purpose: Create a segment file at its full size, if it isn't already
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Number of the segment
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+ *
+ * Note: Processes whose sandbox won't let them grow a file (see
+ * 	setupLimits()) fail here rather than being sent SIGXFSZ.
+*/
+bool createQueueLogSegment(Queue_Log *log, long segment) {
+	struct rlimit limit;
+	struct stat st;
+	int fd;
+
+	if((fd = openQueueLogSegment(log, segment, O_RDWR | O_CREAT)) == -1) {
+		setErrType(ERR_QUEUE_LOG);
+		return false;
+	}
+
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		setErrType(ERR_QUEUE_LOG);
+		return false;
+	}
+
+	if(st.st_size < QUEUE_LOG_SEGMENT_BYTES) {
+		if(getrlimit(RLIMIT_FSIZE, &limit) != 0
+			|| (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < (rlim_t)QUEUE_LOG_SEGMENT_BYTES)
+			|| ftruncate(fd, QUEUE_LOG_SEGMENT_BYTES) != 0) {
+
+			close(fd);
+			setErrType(ERR_QUEUE_LOG);
+			return false;
+		}
+	}
+
+	close(fd);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Memory map a segment, in place of the one mapped before
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Where the map goes, log->readMap or log->appendMap
+ * 	3rd - Segment currently in the map, log->readSegment or log->appendSegment
+ * 	4th - Number of the segment to map
+ * 	5th - true = create the segment if it doesn't exist
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool mapQueueLogSegment(Queue_Log *log, Queue_Log_Record **map, long *mapped, long segment, bool create) {
+	void *addr;
+	int fd;
+
+	if(*map != NULL && *mapped == segment)
+		return true;
+
+	if(*map != NULL) {
+		munmap(*map, QUEUE_LOG_SEGMENT_BYTES);
+		*map = NULL;
+	}
+
+	if(create == true && createQueueLogSegment(log, segment) == false)
+		return false;
+
+	if((fd = openQueueLogSegment(log, segment, O_RDWR)) == -1) {
+		setErrType(ERR_QUEUE_LOG);
+		return false;
+	}
+
+	addr = mmap(NULL, QUEUE_LOG_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(addr == MAP_FAILED) {
+		setErrType(ERR_QUEUE_LOG);
+		return false;
+	}
+
+	*map = (Queue_Log_Record *)addr;
+	*mapped = segment;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Checksum a record, everything but the checksum itself
+ *
+ * Entry:
+ * 	1st - Record to checksum
+ *
+ * Exit:
+ * 	CRC-32 of the record, never 0 so an unwritten record never matches
+*/
+uint32_t getQueueLogCrc(Queue_Log_Record *rec) {
+	unsigned char *data;
+	uint32_t crc = 0xffffffff;
+	size_t i;
+	int bit;
+
+	data = (unsigned char *)rec + sizeof(rec->crc);
+
+	for(i = 0; i < sizeof(Queue_Log_Record) - sizeof(rec->crc); i++) {
+		crc ^= data[i];
+
+		for(bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+	}
+
+	crc = ~crc;
+
+	return (crc == 0) ? 1 : crc;
+}
+
+
+/*
+ * Purpose: Take the lock for appending to a log
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool lockQueueLog(Queue_Log *log) {
+	int rc;
+
+	rc = pthread_mutex_lock(&log->meta->lock);
+
+	// Whoever held it died, nothing they half appended counts so carry on
+	if(rc == EOWNERDEAD)
+		rc = pthread_mutex_consistent(&log->meta->lock);
+
+	if(rc != 0) {
+		setErrType(ERR_QUEUE_LOG);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Release the lock taken by lockQueueLog()
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ *
+ * Exit:
+ * 	NONE
+*/
+void unlockQueueLog(Queue_Log *log) {
+
+	pthread_mutex_unlock(&log->meta->lock);
+}
+
+
+/*
+ * Purpose: Add a record to the end of a log, lock must be held
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Record to add, its checksum is filled in
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set, the log is as it was
+*/
+bool appendQueueLog(Queue_Log *log, Queue_Log_Record *rec) {
+	long position;
+	ERRTYPE err;
+
+	position = log->meta->position;
+
+	if(mapQueueLogSegment(log, &log->appendMap, &log->appendSegment, position / QUEUE_LOG_SEGMENT_RECORDS, true) == false)
+		return false;
+
+	rec->crc = getQueueLogCrc(rec);
+
+	memcpy(&log->appendMap[position % QUEUE_LOG_SEGMENT_RECORDS], rec, sizeof(Queue_Log_Record));
+
+	// Record must be whole before anyone can read it
+	__atomic_store_n(&log->meta->position, position + 1, __ATOMIC_RELEASE);
+
+	// Starting a segment, keep the spares topped up for sandboxed workers. They can't
+	//  grow files so it fails quietly for them, bosses and mailinject get it done
+	if(position % QUEUE_LOG_SEGMENT_RECORDS == 0) {
+		err = getErrType();
+		createQueueLogSegment(log, (position / QUEUE_LOG_SEGMENT_RECORDS) + QUEUE_LOG_SPARE_SEGMENTS);
+		setErrType(err);
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Cut a log back to its last whole record, after the host went
+ * 	down before everything appended got onto disk
+ *
+ * Entry:
+ * 	1st - Queue_Log, meta flocked by openQueueLog()
+ *
+ * Exit:
+ * 	SUCCESS = true, index holds every entry still live
+ * 	FAILURE = false
+ *
+ * Note: Records after the first that isn't whole are dropped even if they
+ * 	are whole, so the log is always what was appended up to some point.
+ * 	The rest of that segment is zeroed and later segments removed, so
+ * 	nothing left over can be mistaken for a record.
+*/
+bool recoverQueueLog(Queue_Log *log) {
+	Queue_Log_Meta *meta;
+	Queue_Log_Record *rec;
+	char path[MAX_LENGTH_FILEPATH + 1];
+	long segment, maxId = 0;
+	int fd;
+
+	meta = log->meta;
+	log->position = meta->firstSegment * QUEUE_LOG_SEGMENT_RECORDS;
+
+	while(true) {
+		segment = log->position / QUEUE_LOG_SEGMENT_RECORDS;
+
+		getQueueLogSegmentPath(log, segment, path);
+
+		if(faccessat(_queueLogDir, path, F_OK, 0) != 0)
+			break;
+
+		if(mapQueueLogSegment(log, &log->readMap, &log->readSegment, segment, false) == false)
+			return false;
+
+		rec = &log->readMap[log->position % QUEUE_LOG_SEGMENT_RECORDS];
+
+		if(rec->crc != getQueueLogCrc(rec) || applyQueueLogRecord(log, rec, segment) == false)
+			break;
+
+		if(rec->id > maxId)
+			maxId = rec->id;
+
+		log->position++;
+	}
+
+	if(log->readMap != NULL && log->readSegment == log->position / QUEUE_LOG_SEGMENT_RECORDS) {
+		memset(&log->readMap[log->position % QUEUE_LOG_SEGMENT_RECORDS], 0,
+			(QUEUE_LOG_SEGMENT_RECORDS - (log->position % QUEUE_LOG_SEGMENT_RECORDS)) * sizeof(Queue_Log_Record));
+
+		msync(log->readMap, QUEUE_LOG_SEGMENT_BYTES, MS_SYNC);
+	}
+
+	for(segment = (log->position / QUEUE_LOG_SEGMENT_RECORDS) + 1; ; segment++) {
+		getQueueLogSegmentPath(log, segment, path);
+
+		if(unlinkat(_queueLogDir, path, 0) != 0)
+			break;
+	}
+
+	printf("Recovered queue log %d, %ld records from %ld (was %ld), %ld entries live\n", log->messageType, log->position, meta->firstSegment * QUEUE_LOG_SEGMENT_RECORDS, meta->position, log->numLive);
+
+	meta->position = log->position;
+	meta->synced = log->position;
+
+	if(meta->nextId <= maxId)
+		meta->nextId = maxId + 1;
+
+	if((fd = openat(_queueLogDir, log->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+		fsync(fd);
+		close(fd);
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Get everything appended to a log so far onto disk
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+ *
+ * Note: Whoever syncs gets everything appended by every process onto
+ * 	disk, so one sync covers a whole batch of appends.
+*/
+bool syncQueueLog(Queue_Log *log) {
+	long synced, end, segment;
+	int fd;
+
+	end = __atomic_load_n(&log->meta->position, __ATOMIC_ACQUIRE);
+	synced = __atomic_load_n(&log->meta->synced, __ATOMIC_ACQUIRE);
+
+	if(synced >= end)
+		return true;
+
+	if(synced < log->meta->firstSegment * QUEUE_LOG_SEGMENT_RECORDS)
+		synced = log->meta->firstSegment * QUEUE_LOG_SEGMENT_RECORDS;
+
+	for(segment = synced / QUEUE_LOG_SEGMENT_RECORDS; segment <= (end - 1) / QUEUE_LOG_SEGMENT_RECORDS; segment++) {
+		if((fd = openQueueLogSegment(log, segment, O_RDWR)) == -1 || fdatasync(fd) != 0) {
+			if(fd != -1)
+				close(fd);
+
+			setErrType(ERR_QUEUE_LOG);
+			return false;
+		}
+
+		close(fd);
+	}
+
+	msync(log->meta, sizeof(Queue_Log_Meta), MS_SYNC);
+
+	// Only ever moves forward, another process may have synced further
+	synced = __atomic_load_n(&log->meta->synced, __ATOMIC_ACQUIRE);
+
+	while(synced < end && __atomic_compare_exchange_n(&log->meta->synced, &synced, end, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == false);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Find a live entry in a process's index of a log
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Id of the entry
+ *
+ * Exit:
+ * 	SUCCESS = Queue_Log_Item
+ * 	FAILURE = NULL, no such live entry
+*/
+Queue_Log_Item *getQueueLogItem(Queue_Log *log, long id) {
+	Queue_Log_Item *item;
+
+	for(item = log->items[id & (QUEUE_LOG_HASH_SIZE - 1)]; item != NULL && item->qentry.id != id; item = item->hashNext);
+
+	return item;
+}
+
+
+/*
+ * Purpose: Find a void in a process's index of a log
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Id of the void
+ * 	3rd - true = add the void if it isn't there
+ *
+ * Exit:
+ * 	SUCCESS = Queue_Log_Void
+ * 	FAILURE = NULL, void has nothing live (or no mem to add it, err type set)
+*/
+Queue_Log_Void *getQueueLogVoid(Queue_Log *log, long voidId, bool add) {
+	Queue_Log_Void *v;
+	int bucket;
+
+	bucket = voidId & (QUEUE_LOG_VOID_HASH_SIZE - 1);
+
+	for(v = log->voids[bucket]; v != NULL && v->voidId != voidId; v = v->hashNext);
+
+	if(v != NULL || add == false)
+		return v;
+
+	if((v = (Queue_Log_Void *)malloc(sizeof(Queue_Log_Void))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	v->voidId = voidId;
+	v->pending = 0;
+	v->running = 0;
+
+	v->hashNext = log->voids[bucket];
+	log->voids[bucket] = v;
+
+	return v;
+}
+
+
+/*
+ * Purpose: Find the list of JUSTIN entries of a track
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Queue track
+ *
+ * Exit:
+ * 	SUCCESS = Queue_Log_Track, added if the track is new
+ * 	FAILURE = NULL, more than QUEUE_LOG_MAX_TRACKS tracks
+*/
+Queue_Log_Track *getQueueLogTrack(Queue_Log *log, int track) {
+	int t;
+
+	for(t = 0; t < log->numTracks; t++) {
+		if(log->tracks[t].track == track)
+			return &log->tracks[t];
+	}
+
+	if(log->numTracks >= QUEUE_LOG_MAX_TRACKS)
+		return NULL;
+
+	log->tracks[t].track = track;
+	log->tracks[t].head = NULL;
+	log->tracks[t].tail = NULL;
+
+	log->numTracks++;
+
+	return &log->tracks[t];
+}
+
+
+/*
+ * Purpose: Move an entry in the index to a new state, keeping the lists of
+ * 	JUSTIN entries and the counts of its void right
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Entry in the index
+ * 	3rd - State it's now in
+ *
+ * Exit:
+ * 	NONE, entries that are finished are dropped from the index
+*/
+void setQueueLogItemState(Queue_Log *log, Queue_Log_Item *item, int state) {
+	Queue_Log_Track *track;
+	Queue_Log_Void *v;
+	int old;
+
+	old = item->qentry.queueState;
+	item->qentry.queueState = state;
+
+	if(old == state)
+		return;
+
+	track = getQueueLogTrack(log, item->qentry.track);
+
+	// Off the JUSTIN list
+	if(old == DBVAL_message_queue_queueState_JUSTIN && track != NULL) {
+		if(item->justinPrev == NULL)
+			track->head = item->justinNext;
+		else
+			item->justinPrev->justinNext = item->justinNext;
+
+		if(item->justinNext == NULL)
+			track->tail = item->justinPrev;
+		else
+			item->justinNext->justinPrev = item->justinPrev;
+	}
+
+	// Onto the end of it
+	if(state == DBVAL_message_queue_queueState_JUSTIN && track != NULL) {
+		item->justinPrev = track->tail;
+		item->justinNext = NULL;
+
+		if(track->tail == NULL)
+			track->head = item;
+		else
+			track->tail->justinNext = item;
+
+		track->tail = item;
+	}
+
+	if((v = getQueueLogVoid(log, item->qentry.voidId, true)) != NULL) {
+		if(old == DBVAL_message_queue_queueState_JUSTIN || old == DBVAL_message_queue_queueState_PROCESSING)
+			v->pending--;
+
+		if(state == DBVAL_message_queue_queueState_JUSTIN || state == DBVAL_message_queue_queueState_PROCESSING)
+			v->pending++;
+
+		if(old == DBVAL_message_queue_queueState_PROCESSING)
+			v->running--;
+
+		if(state == DBVAL_message_queue_queueState_PROCESSING)
+			v->running++;
+	}
+
+	if(state != DBVAL_message_queue_queueState_JUSTIN && state != DBVAL_message_queue_queueState_PROCESSING)
+		dropQueueLogItem(log, item);
+}
+
+
+/*
+ * Purpose: Take an entry out of the index and free it, it must already be
+ * 	off its track's JUSTIN list
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Entry in the index
+ *
+ * Exit:
+ * 	NONE
+*/
+void dropQueueLogItem(Queue_Log *log, Queue_Log_Item *item) {
+	Queue_Log_Item **prev;
+
+	for(prev = &log->items[item->qentry.id & (QUEUE_LOG_HASH_SIZE - 1)]; *prev != NULL && *prev != item; prev = &(*prev)->hashNext);
+
+	if(*prev != NULL)
+		*prev = item->hashNext;
+
+	if(item->livePrev == NULL)
+		log->liveHead = item->liveNext;
+	else
+		item->livePrev->liveNext = item->liveNext;
+
+	if(item->liveNext == NULL)
+		log->liveTail = item->livePrev;
+	else
+		item->liveNext->livePrev = item->livePrev;
+
+	log->numLive--;
+
+	free(item);
+}
+
+
+/*
+ * Purpose: Bring a process's index up to date with a record
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Record read from the log
+ * 	3rd - Segment the record is in
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool applyQueueLogRecord(Queue_Log *log, Queue_Log_Record *rec, long segment) {
+	Queue_Log_Item *item;
+	int i, oldest;
+
+	switch(rec->type) {
+		case QUEUE_LOG_REC_INSERT:
+			if(getQueueLogItem(log, rec->id) != NULL)
+				return true;
+
+			if((item = (Queue_Log_Item *)malloc(sizeof(Queue_Log_Item))) == NULL) {
+				setErrType(ERR_MEM_ALLOC);
+				return false;
+			}
+
+			item->qentry.id = rec->id;
+			item->qentry.messageId = rec->messageId;
+			item->qentry.messageType = log->messageType;
+			item->qentry.queueState = UNSET;
+			item->qentry.userId = rec->userId;
+			item->qentry.voidId = rec->voidId;
+			item->qentry.track = rec->track;
+			item->qentry.notBefore = rec->notBefore;
+			item->qentry.failures = rec->failures;
+
+			item->owner = rec->owner;
+			item->attempts = rec->attempts;
+			item->leaseExpiry = rec->leaseExpiry;
+			item->segment = segment;
+
+			item->hashNext = log->items[rec->id & (QUEUE_LOG_HASH_SIZE - 1)];
+			log->items[rec->id & (QUEUE_LOG_HASH_SIZE - 1)] = item;
+
+			item->liveNext = NULL;
+			item->livePrev = log->liveTail;
+
+			if(log->liveTail == NULL)
+				log->liveHead = item;
+			else
+				log->liveTail->liveNext = item;
+
+			log->liveTail = item;
+			log->numLive++;
+
+			setQueueLogItemState(log, item, rec->queueState);
+		break;
+
+		case QUEUE_LOG_REC_STATE:
+			if((item = getQueueLogItem(log, rec->id)) == NULL)
+				return true;
+
+			item->qentry.notBefore = rec->notBefore;
+			item->qentry.failures = rec->failures;
+
+			item->owner = rec->owner;
+			item->attempts = rec->attempts;
+			item->leaseExpiry = rec->leaseExpiry;
+
+			setQueueLogItemState(log, item, rec->queueState);
+		break;
+
+		case QUEUE_LOG_REC_LEASE:
+			for(i = 0, oldest = 0; i < log->numLeases && log->leases[i].owner != rec->owner; i++) {
+				if(log->leases[i].expiry < log->leases[oldest].expiry)
+					oldest = i;
+			}
+
+			// Forget the longest expired boss to make room
+			if(i == log->numLeases) {
+				if(log->numLeases < QUEUE_LOG_MAX_OWNERS)
+					log->numLeases++;
+				else
+					i = oldest;
+
+				log->leases[i].owner = rec->owner;
+				log->leases[i].expiry = 0;
+			}
+
+			if(rec->leaseExpiry > log->leases[i].expiry)
+				log->leases[i].expiry = rec->leaseExpiry;
+		break;
+
+		default:
+			setErrType(ERR_QUEUE_LOG);
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Bring a process's index up to date with everything appended to
+ * 	the log since it last looked
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+ *
+ * Note: If segments were removed since it last looked, every entry added
+ * 	in them is finished (see compactQueueLog()) and is dropped.
+*/
+bool readQueueLog(Queue_Log *log) {
+	Queue_Log_Item *item, *next;
+	Queue_Log_Record *rec;
+	long end, first, segment;
+
+	end = __atomic_load_n(&log->meta->position, __ATOMIC_ACQUIRE);
+	first = log->meta->firstSegment;
+
+	if(log->position < first * QUEUE_LOG_SEGMENT_RECORDS) {
+		for(item = log->liveHead; item != NULL && item->segment < first; item = next) {
+			next = item->liveNext;
+			setQueueLogItemState(log, item, DBVAL_message_queue_queueState_DONE);
+		}
+
+		log->position = first * QUEUE_LOG_SEGMENT_RECORDS;
+	}
+
+	while(log->position < end) {
+		segment = log->position / QUEUE_LOG_SEGMENT_RECORDS;
+
+		if(mapQueueLogSegment(log, &log->readMap, &log->readSegment, segment, false) == false)
+			return false;
+
+		rec = &log->readMap[log->position % QUEUE_LOG_SEGMENT_RECORDS];
+
+		if(rec->crc != getQueueLogCrc(rec)) {
+			setErrType(ERR_QUEUE_LOG);
+			return false;
+		}
+
+		if(applyQueueLogRecord(log, rec, segment) == false)
+			return false;
+
+		log->position++;
+	}
+
+	return true;
+}
+
+
+/*
+ * Purpose: Fill in a state record holding the whole of an entry
+ *
+ * Entry:
+ * 	1st - Record to fill in
+ * 	2nd - Entry in the index
+ * 	3rd - State the entry is moving to
+ *
+ * Exit:
+ * 	NONE
+*/
+void fillQueueLogRecord(Queue_Log_Record *rec, Queue_Log_Item *item, int state) {
+
+	memset(rec, 0, sizeof(Queue_Log_Record));
+
+	rec->type = QUEUE_LOG_REC_STATE;
+	rec->queueState = state;
+
+	rec->id = item->qentry.id;
+	rec->messageId = item->qentry.messageId;
+	rec->userId = item->qentry.userId;
+	rec->voidId = item->qentry.voidId;
+	rec->notBefore = item->qentry.notBefore;
+	rec->leaseExpiry = item->leaseExpiry;
+
+	rec->owner = item->owner;
+	rec->track = item->qentry.track;
+	rec->failures = item->qentry.failures;
+	rec->attempts = item->attempts;
+}
+
+
+/*
+ * Purpose: Work out when the lease on a PROCESSING entry runs out, the
+ * 	later of its own and its boss's last renewal
+ *
+ * Entry:
+ * 	1st - Queue_Log
+ * 	2nd - Entry in the index
+ *
+ * Exit:
+ * 	When the lease runs out
+*/
+time_t getQueueLogLease(Queue_Log *log, Queue_Log_Item *item) {
+	int i;
+
+	for(i = 0; i < log->numLeases; i++) {
+		if(log->leases[i].owner == item->owner)
+			return (log->leases[i].expiry > item->leaseExpiry) ? log->leases[i].expiry : item->leaseExpiry;
+	}
+
+	return item->leaseExpiry;
+}
+
+
+/*
+ * Purpose: Turn a comma separated list of voids into a sorted array
+ *
+ * Entry:
+ * 	1st - Comma separated list of void ids, may be NULL
+ * 	2nd - Set to the array, caller must free() it
+ *
+ * Exit:
+ * 	SUCCESS = Number of voids in the array
+ * 	FAILURE = FAILURE and err type set
+*/
+int getQueueLogVoidList(char *list, long **voids) {
+	char *pos, *end;
+	long voidId;
+	int n, i, max;
+
+	*voids = NULL;
+
+	if(list == NULL)
+		return 0;
+
+	for(max = 1, pos = list; *pos != '\0'; pos++) {
+		if(*pos == ',')
+			max++;
+	}
+
+	if((*voids = (long *)malloc(sizeof(long) * max)) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return FAILURE;
+	}
+
+	// Insertion sort, lists are short
+	for(n = 0, pos = list; n < max && *pos != '\0'; pos = (*end == ',') ? end + 1 : end) {
+		voidId = strtol(pos, &end, 10);
+
+		if(end == pos)
+			break;
+
+		for(i = n; i > 0 && (*voids)[i - 1] > voidId; i--)
+			(*voids)[i] = (*voids)[i - 1];
+
+		(*voids)[i] = voidId;
+		n++;
+	}
+
+	return n;
+}
+
+
+/*
+ * Purpose: Check whether a void is in an array from getQueueLogVoidList()
+ *
+ * Entry:
+ * 	1st - Sorted array of void ids
+ * 	2nd - Number in the array
+ * 	3rd - Void to look for
+ *
+ * Exit:
+ * 	true = listed
+ * 	false = not listed
+*/
+bool isQueueLogVoidListed(long *voids, int n, long voidId) {
+	int low = 0, high = n - 1, mid;
+
+	while(low <= high) {
+		mid = (low + high) / 2;
+
+		if(voids[mid] == voidId)
+			return true;
+
+		if(voids[mid] < voidId)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return false;
+}
+
+
+/*
+ * Purpose: Copy an entry out of the index for the caller to keep
+ *
+ * Entry:
+ * 	1st - Entry in the index
+ *
+ * Exit:
+ * 	SUCCESS = Queue_Entry, caller must free
+ * 	FAILURE = NULL and err type set
+*/
+Queue_Entry *copyQueueLogEntry(Queue_Log_Item *item) {
+	Queue_Entry *qentry;
+
+	if((qentry = createQueueEntry()) == NULL)
+		return NULL;
+
+	memcpy(qentry, &item->qentry, sizeof(Queue_Entry));
+	qentry->batchNext = NULL;
+
+	return qentry;
+}
+
+
+/*
+ * Purpose: Start changing an entry, locks its log and finds it in the
+ * 	index, so long as it's still in the state the caller thinks
+ *
+ * Entry:
+ * 	1st - Queue_Entry to change
+ * 	2nd - Set to the entry in the index
+ *
+ * Exit:
+ * 	SUCCESS = Queue_Log, locked, pass to endQueueLogChange()
+ * 	FAILURE = NULL, log not locked
+*/
+Queue_Log *beginQueueLogChange(Queue_Entry *qentry, Queue_Log_Item **item) {
+	Queue_Log *log;
+
+	if((log = openQueueLog(qentry->messageType)) == NULL)
+		return NULL;
+
+	if(lockQueueLog(log) == false)
+		return NULL;
+
+	if(readQueueLog(log) == false || (*item = getQueueLogItem(log, qentry->id)) == NULL
+		|| (*item)->qentry.queueState != qentry->queueState) {
+
+		unlockQueueLog(log);
+		return NULL;
+	}
+
+	return log;
+}
+
+
+/*
+ * Purpose: Finish changing an entry, appends the change and unlocks the log
+ *
+ * Entry:
+ * 	1st - Queue_Log from beginQueueLogChange()
+ * 	2nd - Record of the change
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool endQueueLogChange(Queue_Log *log, Queue_Log_Record *rec) {
+	bool ok;
+
+	ok = (appendQueueLog(log, rec) == true && readQueueLog(log) == true);
+
+	unlockQueueLog(log);
+
+	return ok;
+}
+
+
+/*
+ * Purpose: Add an entry to its message type's log
+ *
+ * Entry:
+ * 	1st - Queue_Entry with struct values filled in, id is set
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+ *
+ * Note: Doesn't read the log, processes that only add entries (mailinject,
+ * 	rules sending mail) never build an index.
+*/
+bool insertQueueEntryLog(Queue_Entry *qentry) {
+	Queue_Log *log;
+	Queue_Log_Record rec;
+	time_t now;
+	bool ok;
+
+	if((log = openQueueLog(qentry->messageType)) == NULL)
+		return false;
+
+	now = time(NULL);
+
+	memset(&rec, 0, sizeof(rec));
+
+	rec.type = QUEUE_LOG_REC_INSERT;
+	rec.queueState = qentry->queueState;
+
+	rec.messageId = qentry->messageId;
+	rec.userId = qentry->userId;
+	rec.voidId = qentry->voidId;
+	rec.notBefore = (qentry->notBefore > now) ? qentry->notBefore : now;
+
+	rec.track = qentry->track;
+
+	if(lockQueueLog(log) == false)
+		return false;
+
+	rec.id = log->meta->nextId;
+
+	if((ok = appendQueueLog(log, &rec)) == true)
+		log->meta->nextId++;
+
+	unlockQueueLog(log);
+
+	if(ok == true)
+		qentry->id = rec.id;
+
+	return ok;
+}
+
+
+/*
+ * Purpose: Gets the oldest entry of a log in a specific state and on a
+ * 	specific queue track
+ *
+ * Entry:
+ * 	1st - Queue item state to get
+ * 	2nd - Queue track to get item on
+ * 	3rd - Type of message queue entry to get, e.g. email
+ *
+ * Exit:
+ * 	SUCCESS = Pointer to Queue_Entry or NULL if not found
+ * 	FAILURE = NULL and err type set
+*/
+Queue_Entry *getQueueEntryOldestLog(int queueState, int track, int messageType) {
+	Queue_Log *log;
+	Queue_Log_Item *item;
+
+	if((log = openQueueLog(messageType)) == NULL || readQueueLog(log) == false)
+		return NULL;
+
+	for(item = log->liveHead; item != NULL; item = item->liveNext) {
+		if(item->qentry.queueState == queueState && item->qentry.track == track)
+			return copyQueueLogEntry(item);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Purpose: Gets the oldest JUSTIN entry of a log on a track, for incoming
+ * 	messages only from voids without a rule running
+ *
+ * Entry:
+ * 	1st - Queue track to get item on
+ * 	2nd - Type of message queue entry to get, e.g. email
+ *
+ * Exit:
+ * 	SUCCESS = Pointer to Queue_Entry or NULL if not found
+ * 	FAILURE = NULL and err type set
+*/
+Queue_Entry *getQueueEntryJustinNotRunningLog(int track, int messageType) {
+	Queue_Log *log;
+	Queue_Log_Track *t;
+	Queue_Log_Item *item;
+	Queue_Log_Void *v;
+
+	if((log = openQueueLog(messageType)) == NULL || readQueueLog(log) == false)
+		return NULL;
+
+	if((t = getQueueLogTrack(log, track)) == NULL)
+		return NULL;
+
+	for(item = t->head; item != NULL; item = item->justinNext) {
+		if(messageType != DBVAL_message_queue_messageType_EMAILIN
+			|| (v = getQueueLogVoid(log, item->qentry.voidId, false)) == NULL || v->running == 0)
+			return copyQueueLogEntry(item);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Purpose: Set the state of an entry in its log
+ *
+ * Entry:
+ * 	1st - Queue_Entry to set state of
+ * 	2nd - Queue state to set it to
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false, entry wasn't in the state qentry says
+*/
+bool setQueueEntryStateLog(Queue_Entry *qentry, int state) {
+	Queue_Log *log;
+	Queue_Log_Item *item;
+	Queue_Log_Record rec;
+
+	if((log = beginQueueLogChange(qentry, &item)) == NULL)
+		return false;
+
+	fillQueueLogRecord(&rec, item, state);
+
+	return endQueueLogChange(log, &rec);
+}
+
+
+/*
+ * Purpose: Set the state of every entry of a batch in its log
+ *
+ * Entry:
+ * 	1st - First Queue_Entry of the batch
+ * 	2nd - Number of entries in the batch, not needed
+ * 	3rd - Queue state to set them to
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false, an entry wasn't in the state it says, the rest are
+ * 		still set
+ *
+ * Note: Appending to a log is local, so there's nothing to gain from
+ * 	doing a batch in one go
+*/
+bool setQueueEntriesStateLog(Queue_Entry *qentry, int numEntries, int state) {
+	bool ok = true;
+
+	for(; qentry != NULL; qentry = qentry->batchNext) {
+		if(setQueueEntryStateLog(qentry, state) == false)
+			ok = false;
+	}
+
+	return ok;
+}
+
+
+/*
+ * Purpose: Claim a batch of JUSTIN entries of a log for a boss
+ *
+ * Entry:
+ * 	1st - Array to fill with the claimed Queue_Entry's
+ * 	2nd - Max number of entries to claim (size of the array)
+ * 	3rd - Queue track to claim items on
+ * 	4th - Type of message queue entry to claim, e.g. email
+ * 	5th - Claim token, not needed, the log reads to the end under lock
+ * 	6th - Id of the boss, its pid is what the log knows it by
+ * 	7th - Comma separated list of voids not to claim for, NULL = none
+ * 	8th - Comma separated list of voids held back, NULL = none
+ * 	9th - Shard of the boss, not used, logs aren't shared
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries claimed (0 if nothing to do)
+ * 	FAILURE = FAILURE and err type set
+ *
+ * Note: Entries are claimed in the order they went on the queue, not by
+ * 	notBefore. Ones due past QUEUE_TIMER_HORIZON_SEC are passed over.
+*/
+int claimQueueEntriesLog(Queue_Entry **qentries, int max, int track, int messageType, char *claimToken, char *owner, char *skipVoids, char *heldVoids, Queue_Shard *shard) {
+	Queue_Log *log;
+	Queue_Log_Track *t;
+	Queue_Log_Item *item, *next;
+	Queue_Log_Record rec;
+	long *skip = NULL, *held = NULL;
+	int numSkip, numHeld, n = 0;
+	time_t now;
+
+	if(max <= 0)
+		return 0;
+
+	if((log = openQueueLog(messageType)) == NULL)
+		return FAILURE;
+
+	numSkip = getQueueLogVoidList(skipVoids, &skip);
+	numHeld = getQueueLogVoidList(heldVoids, &held);
+
+	if(numSkip == FAILURE || numHeld == FAILURE || lockQueueLog(log) == false) {
+		free(skip);
+		free(held);
+		return FAILURE;
+	}
+
+	now = time(NULL);
+
+	if(readQueueLog(log) == true && (t = getQueueLogTrack(log, track)) != NULL) {
+
+		for(item = t->head; item != NULL && n < max; item = next) {
+			next = item->justinNext;
+
+			if(item->qentry.notBefore > now + QUEUE_TIMER_HORIZON_SEC
+				|| isQueueLogVoidListed(skip, numSkip, item->qentry.voidId) == true
+				|| isQueueLogVoidListed(held, numHeld, item->qentry.voidId) == true)
+				continue;
+
+			fillQueueLogRecord(&rec, item, DBVAL_message_queue_queueState_PROCESSING);
+
+			rec.owner = getpid();
+			rec.attempts = item->attempts + 1;
+			rec.leaseExpiry = ((item->qentry.notBefore > now) ? item->qentry.notBefore : now) + QUEUE_LEASE_SEC;
+
+			if(appendQueueLog(log, &rec) == false || (qentries[n] = copyQueueLogEntry(item)) == NULL)
+				break;
+
+			qentries[n]->queueState = DBVAL_message_queue_queueState_PROCESSING;
+			n++;
+		}
+
+		readQueueLog(log);
+	}
+
+	unlockQueueLog(log);
+
+	free(skip);
+	free(held);
+
+	return n;
+}
+
+
+/*
+ * Purpose: Put a claimed entry that was never started back on its log,
+ * 	without it counting as an attempt
+ *
+ * Entry:
+ * 	1st - Queue_Entry to put back
+ *
+ * Exit:
+ * 	SUCCESS = true, and qentry queueState set to JUSTIN
+ * 	FAILURE = false
+*/
+bool releaseQueueEntryLog(Queue_Entry *qentry) {
+	Queue_Log *log;
+	Queue_Log_Item *item;
+	Queue_Log_Record rec;
+
+	if((log = beginQueueLogChange(qentry, &item)) == NULL)
+		return false;
+
+	fillQueueLogRecord(&rec, item, DBVAL_message_queue_queueState_JUSTIN);
+
+	rec.owner = 0;
+	rec.leaseExpiry = 0;
+	rec.attempts = (item->attempts > 0) ? item->attempts - 1 : 0;
+
+	if(endQueueLogChange(log, &rec) == false)
+		return false;
+
+	qentry->queueState = DBVAL_message_queue_queueState_JUSTIN;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Heartbeat from a boss, pushes back the lease on everything it
+ * 	holds in a log with a single record
+ *
+ * Entry:
+ * 	1st - Id of the boss, its pid is what the log knows it by
+ * 	2nd - Type of message queue the boss processes
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool renewQueueLeasesLog(char *owner, int messageType) {
+	Queue_Log *log;
+	Queue_Log_Record rec;
+	bool ok;
+
+	if((log = openQueueLog(messageType)) == NULL)
+		return false;
+
+	memset(&rec, 0, sizeof(rec));
+
+	rec.type = QUEUE_LOG_REC_LEASE;
+	rec.owner = getpid();
+	rec.leaseExpiry = time(NULL) + QUEUE_LEASE_SEC;
+
+	if(lockQueueLog(log) == false)
+		return false;
+
+	ok = appendQueueLog(log, &rec);
+
+	unlockQueueLog(log);
+
+	return ok;
+}
+
+
+/*
+ * Purpose: Put entries of a log whose lease has run out back on the queue,
+ * 	their boss has died
+ *
+ * Entry:
+ * 	1st - Type of message queue to sweep
+ *
+ * Exit:
+ * 	SUCCESS = Number of entries put back or set aside
+ * 	FAILURE = FAILURE and err type set
+ *
+ * Note: As with the database an entry already claimed
+ * 	QUEUE_LEASE_MAX_ATTEMPTS times is set to POISON instead.
+*/
+int sweepQueueLeasesLog(int messageType) {
+	Queue_Log *log;
+	Queue_Log_Item *item, *next;
+	Queue_Log_Record rec;
+	time_t now;
+	int n = 0;
+
+	if((log = openQueueLog(messageType)) == NULL)
+		return FAILURE;
+
+	if(lockQueueLog(log) == false)
+		return FAILURE;
+
+	if(readQueueLog(log) == false) {
+		unlockQueueLog(log);
+		return FAILURE;
+	}
+
+	now = time(NULL);
+
+	for(item = log->liveHead; item != NULL; item = next) {
+		next = item->liveNext;
+
+		if(item->qentry.queueState != DBVAL_message_queue_queueState_PROCESSING || getQueueLogLease(log, item) >= now)
+			continue;
+
+		fillQueueLogRecord(&rec, item, (item->attempts >= QUEUE_LEASE_MAX_ATTEMPTS) ? DBVAL_message_queue_queueState_POISON : DBVAL_message_queue_queueState_JUSTIN);
+
+		rec.owner = 0;
+		rec.leaseExpiry = 0;
+
+		if(appendQueueLog(log, &rec) == false)
+			break;
+
+		n++;
+	}
+
+	readQueueLog(log);
+	unlockQueueLog(log);
+
+	return n;
+}
+
+
+/*
+ * Purpose: Record a failed entry in its log, either back on the queue to
+ * 	retry later or DEAD
+ *
+ * Entry:
+ * 	1st - Queue_Entry that failed, must be PROCESSING
+ * 	2nd - State to put it in, JUSTIN or DEAD
+ * 	3rd - Secs before a retry
+ * 	4th - Why it failed, only printed as the log doesn't keep it
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool failQueueEntryLog(Queue_Entry *qentry, int state, int delay, char *reason) {
+	Queue_Log *log;
+	Queue_Log_Item *item;
+	Queue_Log_Record rec;
+
+	if((log = beginQueueLogChange(qentry, &item)) == NULL)
+		return false;
+
+	fillQueueLogRecord(&rec, item, state);
+
+	rec.failures = item->qentry.failures + 1;
+
+	if(state == DBVAL_message_queue_queueState_JUSTIN) {
+		rec.owner = 0;
+		rec.leaseExpiry = 0;
+		rec.attempts = 0;
+		rec.notBefore = time(NULL) + delay;
+	}
+
+	printf("Queue entry %ld failed (%s), %s\n", qentry->id, reason, (state == DBVAL_message_queue_queueState_JUSTIN) ? "retrying later" : "giving up");
+
+	return endQueueLogChange(log, &rec);
+}
+
+
+/*
+ * Purpose: Remove segments of a log that only hold finished entries, and
+ * 	create the next few segments ahead of them being needed
+ *
+ * Entry:
+ * 	1st - Type of message queue
+ * 	2nd - Not used, segments are removed whole
+ *
+ * Exit:
+ * 	SUCCESS = 0, nothing is moved anywhere
+ * 	FAILURE = FAILURE and err type set
+*/
+int compactQueueLog(int messageType, int batch) {
+	Queue_Log *log;
+	char path[MAX_LENGTH_FILEPATH + 1];
+	long segment, oldest, current;
+
+	if((log = openQueueLog(messageType)) == NULL)
+		return FAILURE;
+
+	if(lockQueueLog(log) == false)
+		return FAILURE;
+
+	if(readQueueLog(log) == false) {
+		unlockQueueLog(log);
+		return FAILURE;
+	}
+
+	current = log->meta->position / QUEUE_LOG_SEGMENT_RECORDS;
+	oldest = (log->liveHead != NULL) ? log->liveHead->segment : current;
+
+	// Everyone reading the log drops what was in them once firstSegment moves
+	for(segment = log->meta->firstSegment; segment < oldest; segment++) {
+		getQueueLogSegmentPath(log, segment, path);
+		unlinkat(_queueLogDir, path, 0);
+	}
+
+	if(oldest > log->meta->firstSegment)
+		log->meta->firstSegment = oldest;
+
+	for(segment = current; segment <= current + QUEUE_LOG_SPARE_SEGMENTS; segment++)
+		createQueueLogSegment(log, segment);
+
+	unlockQueueLog(log);
+
+	return 0;
+}
+
+
+/*
+ * Purpose: Count the pending outgoing entries of a void or of the whole
+ * 	log, stopping at a limit
+ *
+ * Entry:
+ * 	1st - Void to count for, UNSET = all voids
+ * 	2nd - Stop counting once this many are found
+ *
+ * Exit:
+ * 	SUCCESS = Number of pending entries, at most the limit
+ * 	FAILURE = FAILURE and err type set
+*/
+long countQueueOutPendingLog(long voidId, long limit) {
+	Queue_Log *log;
+	Queue_Log_Void *v;
+	long count;
+
+	if((log = openQueueLog(DBVAL_message_queue_messageType_EMAILOUT)) == NULL || readQueueLog(log) == false)
+		return FAILURE;
+
+	if(voidId == UNSET)
+		count = log->numLive;
+	else
+		count = ((v = getQueueLogVoid(log, voidId, false)) == NULL) ? 0 : v->pending;
+
+	return (count > limit) ? limit : count;
+}
+
+
+/*
+ * Purpose: List the voids with at least so many pending outgoing entries
+ *
+ * Entry:
+ * 	1st - Pending entries a void must have
+ * 	2nd - Buffer to put the comma separated void ids in
+ * 	3rd - Length of the buffer
+ *
+ * Exit:
+ * 	SUCCESS = Number of voids listed, those that don't fit are left off
+ * 	FAILURE = FAILURE and err type set
+ *
+ * Note: Unlike the database the voids aren't in id order, but the index
+ * 	doesn't reorder voids so an unchanged list still compares equal.
+*/
+int getQueueOutFullVoidsLog(long mark, char *list, size_t length) {
+	Queue_Log *log;
+	Queue_Log_Void *v;
+	size_t used = 0;
+	int i, n = 0;
+
+	if((log = openQueueLog(DBVAL_message_queue_messageType_EMAILOUT)) == NULL || readQueueLog(log) == false)
+		return FAILURE;
+
+	list[0] = '\0';
+
+	for(i = 0; i < QUEUE_LOG_VOID_HASH_SIZE; i++) {
+		for(v = log->voids[i]; v != NULL; v = v->hashNext) {
+			if(v->pending < mark || used + 22 > length)
+				continue;
+
+			used += snprintf(list + used, length - used, (n == 0) ? "%ld" : ",%ld", v->voidId);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+
+/*
+ * Purpose: Get every log this process has open onto disk
+ *
+ * Entry:
+ * 	NONE
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool syncQueueEntriesLog() {
+	bool ok = true;
+	int t;
+
+	for(t = 0; t < QUEUE_LOG_MAX_TYPES; t++) {
+		if(_queueLogs[t] != NULL && syncQueueLog(_queueLogs[t]) == false)
+			ok = false;
+	}
+
+	return ok;
+}
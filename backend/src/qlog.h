@@ -0,0 +1,195 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Queue backend keeping a queue in a local append only log of
+ *  memory mapped segment files, for single node installs
+*/
+
+#ifndef __QLOG_H__
+#define __QLOG_H__
+
+#include<time.h>
+#include<stdint.h>
+#include<pthread.h>
+#include<sys/types.h>
+#include "codewide.h"
+#include "msgqueue.h"
+
+#define QUEUE_LOG_MAGIC			0x54514c47	// Marks an initialised meta file
+#define QUEUE_LOG_VERSION		1
+
+#define QUEUE_LOG_SEGMENT_RECORDS	65536L	// Records per segment file
+#define QUEUE_LOG_SEGMENT_BYTES		(QUEUE_LOG_SEGMENT_RECORDS * (long)sizeof(Queue_Log_Record))
+#define QUEUE_LOG_SPARE_SEGMENTS	4	// Segments created ahead of the one being appended to, so
+						//  sandboxed workers never have to grow a file
+#define QUEUE_LOG_MAX_TYPES		8	// Message types that can have a log
+#define QUEUE_LOG_MAX_TRACKS		4	// Tracks a log keeps lists of JUSTIN entries for
+#define QUEUE_LOG_MAX_OWNERS		64	// Bosses whose leases a log keeps track of
+#define QUEUE_LOG_HASH_SIZE		65536	// Buckets in the index of entries by id (power of 2)
+#define QUEUE_LOG_VOID_HASH_SIZE	4096	// Buckets in the index of voids (power of 2)
+#define QUEUE_LOG_UNMAPPED		-1	// No segment memory mapped
+#define QUEUE_LOG_DIR_UNSET		-1	// queue_log_dir not opened (see openQueueLogDir())
+#define QUEUE_LOG_DIR_MODE		02770	// Directories of logs, setgid so everything in them is in the
+						//  group the jailed daemons run as
+#define QUEUE_LOG_FILE_MODE		0660	// Meta and segment files, shared by the daemons through that group
+#define QUEUE_LOG_LENGTH_BOOT_ID	40
+#define QUEUE_LOG_PATH_BOOT_ID		"/proc/sys/kernel/random/boot_id"
+
+/* Kinds of record in the log */
+#define QUEUE_LOG_REC_INSERT		1	// An entry was added
+#define QUEUE_LOG_REC_STATE		2	// An entry changed, the record holds all of it
+#define QUEUE_LOG_REC_LEASE		3	// A boss renewed the lease on everything it holds
+
+/* A record in a segment, fixed size so a segment is an array of them */
+typedef struct {
+	uint32_t crc;		// CRC-32 of the rest of the record, a record that doesn't match was
+				//  never fully written
+	uint16_t type;		// QUEUE_LOG_REC_*
+	uint16_t queueState;
+
+	int64_t id;
+	int64_t messageId;
+	int64_t userId;
+	int64_t voidId;
+	int64_t notBefore;
+	int64_t leaseExpiry;	// When the boss holding a PROCESSING entry loses it, or for
+				//  QUEUE_LOG_REC_LEASE everything it holds
+
+	int32_t owner;		// pid of the boss holding the entry, 0 = none
+	int16_t track;
+	uint8_t failures;
+	uint8_t attempts;
+} Queue_Log_Record;
+
+/* Shared by every process using a log, memory mapped from the log's meta file */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+
+	char bootId[QUEUE_LOG_LENGTH_BOOT_ID];	// Boot of the host the log was last opened in
+
+	pthread_mutex_t lock;	// Held while checking and appending, process shared and robust
+
+	long position;		// Records ever appended, the next goes in segment
+				//  position / QUEUE_LOG_SEGMENT_RECORDS
+	long synced;		// Records known to be on disk
+	long firstSegment;	// Oldest segment not yet removed
+	long nextId;		// Id of the next entry added
+} Queue_Log_Meta;
+
+/* A live entry in a process's index of a log */
+typedef struct Queue_Log_Item {
+	Queue_Entry qentry;
+
+	pid_t owner;		// Boss holding it while PROCESSING
+	int attempts;		// Times it's been claimed (see QUEUE_LEASE_MAX_ATTEMPTS)
+	time_t leaseExpiry;
+	long segment;		// Segment it was added in
+
+	struct Queue_Log_Item *hashNext;
+	struct Queue_Log_Item *livePrev, *liveNext;	// All live entries, oldest first
+	struct Queue_Log_Item *justinPrev, *justinNext;	// JUSTIN entries of its track
+} Queue_Log_Item;
+
+/* Pending entries of a void */
+typedef struct Queue_Log_Void {
+	long voidId;
+	int pending;		// JUSTIN or PROCESSING
+	int running;		// PROCESSING
+
+	struct Queue_Log_Void *hashNext;
+} Queue_Log_Void;
+
+/* Lease of a boss on everything it holds */
+typedef struct {
+	pid_t owner;
+	time_t expiry;
+} Queue_Log_Lease;
+
+/* JUSTIN entries of a track, in the order they went on the queue */
+typedef struct {
+	int track;
+	Queue_Log_Item *head, *tail;
+} Queue_Log_Track;
+
+/* A process's view of a log */
+typedef struct {
+	int messageType;
+	char dir[MAX_LENGTH_FILEPATH + 1];	// Directory of the log, relative to queue_log_dir
+
+	Queue_Log_Meta *meta;
+
+	Queue_Log_Record *readMap;	// Segment being read into the index
+	long readSegment;
+	Queue_Log_Record *appendMap;	// Segment being appended to
+	long appendSegment;
+
+	int held[QUEUE_LOG_SPARE_SEGMENTS + 1];	// Segment files a sandboxed worker holds open (see holdQueueLogSegments())
+	long heldSegment;		// First of them, QUEUE_LOG_UNMAPPED = none held
+
+	long position;			// Records read into the index
+
+	Queue_Log_Item **items;		// Index of live entries by id
+	Queue_Log_Void **voids;		// Index of voids with live entries
+	Queue_Log_Item *liveHead, *liveTail;
+	long numLive;
+
+	Queue_Log_Track tracks[QUEUE_LOG_MAX_TRACKS];
+	int numTracks;
+
+	Queue_Log_Lease leases[QUEUE_LOG_MAX_OWNERS];
+	int numLeases;
+} Queue_Log;
+
+/* Function prototypes */
+bool openQueueLogDir();				// Open the directory logs are kept in, before the chroot
+Queue_Log *openQueueLog(int);			// Open the log of a message type, once per process
+Queue_Log *createQueueLog(int);			// Allocate mem and setup a Queue_Log
+void freeQueueLog(Queue_Log *);			// Release mem associated with a Queue_Log
+bool initQueueLogLock(Queue_Log_Meta *);	// Setup the lock shared by processes using a log
+bool holdQueueLogSegments();			// Open what a worker needs of the logs, then let go of queue_log_dir
+void getQueueLogBootId(char *);			// Which boot of the host this is
+void getQueueLogSegmentPath(Queue_Log *, long, char *);	// Path of a segment file
+int openQueueLogSegment(Queue_Log *, long, int);	// Open a segment file, from queue_log_dir or held open
+bool createQueueLogSegment(Queue_Log *, long);	// Create a segment file at full size
+bool mapQueueLogSegment(Queue_Log *, Queue_Log_Record **, long *, long, bool);	// Memory map a segment
+uint32_t getQueueLogCrc(Queue_Log_Record *);	// Checksum a record
+bool lockQueueLog(Queue_Log *);			// Take the lock for appending
+void unlockQueueLog(Queue_Log *);		// Release the lock for appending
+bool appendQueueLog(Queue_Log *, Queue_Log_Record *);	// Add a record to the end of the log
+bool recoverQueueLog(Queue_Log *);		// Cut the log back after the host crashed
+bool syncQueueLog(Queue_Log *);			// Get everything appended onto disk
+
+Queue_Log_Item *getQueueLogItem(Queue_Log *, long);	// Find a live entry in the index
+Queue_Log_Void *getQueueLogVoid(Queue_Log *, long, bool);	// Find a void in the index
+Queue_Log_Track *getQueueLogTrack(Queue_Log *, int);	// Find a track's JUSTIN list
+void setQueueLogItemState(Queue_Log *, Queue_Log_Item *, int);	// Move an entry to a new state in the index
+void dropQueueLogItem(Queue_Log *, Queue_Log_Item *);	// Take an entry out of the index
+bool applyQueueLogRecord(Queue_Log *, Queue_Log_Record *, long);	// Update the index from a record
+bool readQueueLog(Queue_Log *);			// Bring the index up to date with the log
+void fillQueueLogRecord(Queue_Log_Record *, Queue_Log_Item *, int);	// Record the whole of an entry
+time_t getQueueLogLease(Queue_Log *, Queue_Log_Item *);	// When a PROCESSING entry's lease runs out
+int getQueueLogVoidList(char *, long **);	// Turn a comma separated list of voids into an array
+bool isQueueLogVoidListed(long *, int, long);	// Is a void in an array from getQueueLogVoidList()
+Queue_Entry *copyQueueLogEntry(Queue_Log_Item *);	// Copy an entry out of the index
+Queue_Log *beginQueueLogChange(Queue_Entry *, Queue_Log_Item **);	// Lock a log and find an entry to change
+bool endQueueLogChange(Queue_Log *, Queue_Log_Record *);	// Append the change and unlock the log
+
+/* Queue backend functions (see Queue_Backend) */
+bool insertQueueEntryLog(Queue_Entry *);	// Add a queue entry to a log
+Queue_Entry *getQueueEntryOldestLog(int, int, int);	// Get oldest entry of a log
+Queue_Entry *getQueueEntryJustinNotRunningLog(int, int);	// Get oldest entry of a log to each void
+bool setQueueEntryStateLog(Queue_Entry *, int);	// Set the state of an entry in a log
+bool setQueueEntriesStateLog(Queue_Entry *, int, int);	// Set the state of a batch of entries in a log
+int claimQueueEntriesLog(Queue_Entry **, int, int, int, char *, char *, char *, char *, Queue_Shard *);
+						// Claim a batch of entries of a log for a boss
+bool releaseQueueEntryLog(Queue_Entry *);	// Put a claimed entry back on a log
+bool renewQueueLeasesLog(char *, int);		// Push back the lease of a boss on a log
+int sweepQueueLeasesLog(int);			// Put entries with an expired lease back on a log
+bool failQueueEntryLog(Queue_Entry *, int, int, char *);	// Retry a failed entry of a log later or set it DEAD
+int compactQueueLog(int, int);			// Remove segments only holding finished entries
+long countQueueOutPendingLog(long, long);	// Count pending outgoing entries in the log
+int getQueueOutFullVoidsLog(long, char *, size_t);	// List voids over their outgoing mark
+bool syncQueueEntriesLog();			// Get every open log onto disk
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Backpressure from the outgoing message queue onto the rules
+ *  that fill it, per void and across all voids
+ *
+ * Note: A rule that mails every member of a big void in a loop can queue
+ *  tens of thousands of outgoing entries in one run, and every other
+ *  void's mail then waits behind them. Pending (JUSTIN or PROCESSING)
+ *  outgoing entries have a high water mark per void and one for the whole
+ *  queue. Past either mark rule runner bosses stop claiming incoming mail
+ *  for the voids over their mark (or for every void when over the global
+ *  mark) until the message deliverers have drained them back under it.
+ *
+ * Note 2: A rule already running is let finish, its mail is never held
+ *  back at the mark as rules don't look at what sending returns. Only a
+ *  void far over its mark, at its hard cap, has mail refused with
+ *  addMailToOutQueue() telling the rule to try again later.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "qpressure.h"
+#include "msgqueue.h"
+#include "setupthang.h"
+#include "logerror.h"
+#include "dbchatter.h"
+
+
+/* Pending outgoing mail of the void this worker last sent for, see isQueueOutFull() */
+static long _outVoidId = UNSET;
+static long _outPending = 0;
+static time_t _outCounted = 0;
+
+
+/*
+ * Purpose: Creates the backpressure state of a rule runner boss, holding
+ * 	nothing back until the first update
+ *
+ * Entry:
+ * 	1st - Pending outgoing entries a void may have, 0 = no mark
+ * 	2nd - Pending outgoing entries all voids may have, 0 = no mark
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated Queue_Pressure
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Pressure *createQueuePressure(long voidMark, long globalMark) {
+	Queue_Pressure *pressure;
+
+	if((pressure = (Queue_Pressure *)malloc(sizeof(Queue_Pressure))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	pressure->voidMark = voidMark;
+	pressure->globalMark = globalMark;
+
+	pressure->globalFull = false;
+	pressure->fullVoids = NULL;
+	pressure->numFullVoids = 0;
+
+	return pressure;
+}
+
+
+/*
+ * Purpose: Free up the backpressure state of a boss
+ *
+ * Entry:
+ * 	1st - Queue_Pressure to free
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeQueuePressure(Queue_Pressure *pressure) {
+
+	if(pressure == NULL)
+		return;
+
+	if(pressure->fullVoids != NULL)
+		free(pressure->fullVoids);
+
+	free(pressure);
+}
+
+
+/*
+ * Purpose: Count the pending outgoing entries of a void or of the whole
+ * 	database queue, stopping at a limit
+ *
+ * Entry:
+ * 	1st - Void to count for, UNSET = all voids
+ * 	2nd - Stop counting once this many are found
+ *
+ * Exit:
+ * 	SUCCESS = Number of pending entries, at most the limit
+ * 	FAILURE = FAILURE and err type set
+ *
+ * Note: Stopping at the limit means a flooded queue costs no more to
+ * 	check than one at its mark.
+*/
+long countQueueOutPendingDb(long voidId, long limit) {
+	DBRESULT *result;
+	DBROW row;
+	long count = 0;
+	char byVoid[32];
+
+	byVoid[0] = '\0';
+
+	if(voidId != UNSET)
+		snprintf(byVoid, sizeof(byVoid), " AND voidId = %ld", voidId);
+
+	result = dbQuery("SELECT COUNT(*) FROM (SELECT id FROM message_queue WHERE messageType = %d AND queueState IN (%d, %d)%s LIMIT %ld) AS pending", DBVAL_message_queue_messageType_EMAILOUT, DBVAL_message_queue_queueState_JUSTIN, DBVAL_message_queue_queueState_PROCESSING, byVoid, limit);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	if((row = dbQueryGetRow(result)) != NULL && row[0] != NULL)
+		count = atol(row[0]);
+
+	dbQueryFreeResult(result);
+
+	return count;
+}
+
+
+/*
+ * Purpose: List the voids with at least a mark's worth of pending outgoing
+ * 	entries in the database queue
+ *
+ * Entry:
+ * 	1st - Pending outgoing entries a void may have
+ * 	2nd - String to fill with the comma separated void ids, in id order
+ * 	3rd - Size of the string
+ *
+ * Exit:
+ * 	SUCCESS = Number of voids listed, at most QUEUE_PRESSURE_MAX_VOIDS
+ * 	FAILURE = FAILURE and err type set
+*/
+int getQueueOutFullVoidsDb(long mark, char *list, size_t length) {
+	DBRESULT *result;
+	DBROW row;
+	size_t used;
+	int n;
+
+	result = dbQuery("SELECT voidId FROM message_queue WHERE messageType = %d AND queueState IN (%d, %d) GROUP BY voidId HAVING COUNT(*) >= %ld ORDER BY voidId ASC LIMIT %d", DBVAL_message_queue_messageType_EMAILOUT, DBVAL_message_queue_queueState_JUSTIN, DBVAL_message_queue_queueState_PROCESSING, mark, QUEUE_PRESSURE_MAX_VOIDS);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	list[0] = '\0';
+
+	for(n = 0, used = 0; (row = dbQueryGetRow(result)) != NULL && used < length; n++)
+		used += snprintf(list + used, length - used, (n == 0) ? "%s" : ",%s", row[0]);
+
+	dbQueryFreeResult(result);
+
+	return n;
+}
+
+
+/*
+ * Purpose: Check whether a void may add more mail to the outgoing queue,
+ * 	counting the mail as added if so
+ *
+ * Entry:
+ * 	1st - Void wanting to add mail
+ *
+ * Exit:
+ * 	true = Void is at its hard cap, err type set to ERR_QUEUE_OUT_FULL
+ * 	false = Room for more, or couldn't tell
+ *
+ * Note: The database is only asked once every QUEUE_OUT_RECOUNT_SEC or
+ * 	when the void changes, in between the worker counts what it sends
+ * 	itself, so sending mail in a loop doesn't cost a count each time.
+ * 	Mail that then fails to be added is still counted until the next
+ * 	recount.
+ *
+ * Note 2: If the database can't say the mail is let through, the cap is
+ * 	there to bound the queue not to stop mail going out.
+*/
+bool isQueueOutFull(long voidId) {
+	long count;
+	time_t now;
+
+	if(_config->outqueue_void_hard_cap <= 0)
+		return false;
+
+	now = time(NULL);
+
+	if(voidId != _outVoidId || now - _outCounted >= QUEUE_OUT_RECOUNT_SEC) {
+
+		if((count = getQueueBackend()->countOutPending(voidId, _config->outqueue_void_hard_cap)) == FAILURE) {
+			_outVoidId = UNSET;
+			return false;
+		}
+
+		_outVoidId = voidId;
+		_outPending = count;
+		_outCounted = now;
+	}
+
+	if(_outPending >= _config->outqueue_void_hard_cap) {
+		setErrType(ERR_QUEUE_OUT_FULL);
+		return true;
+	}
+
+	_outPending++;
+
+	return false;
+}
+
+
+/*
+ * Purpose: Work out which voids a rule runner boss should stop claiming
+ * 	incoming mail for, because of how much outgoing mail they have pending
+ *
+ * Entry:
+ * 	1st - Queue_Pressure to update
+ *
+ * Exit:
+ * 	SUCCESS = QUEUE_PRESSURE_CHANGED if the voids held back changed,
+ * 		otherwise QUEUE_PRESSURE_SAME
+ * 	FAILURE = FAILURE and err type set, what was held back stays so
+ *
+ * Note: Voids come back in id order so an unchanged list compares equal.
+ * 	At most QUEUE_PRESSURE_MAX_VOIDS are held back, past that the global
+ * 	mark is there to catch the rest.
+*/
+int updateQueuePressure(Queue_Pressure *pressure) {
+	char *list;
+	size_t length;
+	long count;
+	int n = 0;
+	bool globalFull = false, changed;
+
+	if(pressure->globalMark > 0) {
+		if((count = getQueueBackend()->countOutPending(UNSET, pressure->globalMark)) == FAILURE)
+			return FAILURE;
+
+		globalFull = (count >= pressure->globalMark);
+	}
+
+	length = (QUEUE_PRESSURE_MAX_VOIDS * 21) + 1;		// Max digits in a long plus a comma
+
+	if((list = (char *)malloc(length)) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return FAILURE;
+	}
+
+	list[0] = '\0';
+
+	if(pressure->voidMark > 0) {
+		if((n = getQueueBackend()->getOutFullVoids(pressure->voidMark, list, length)) == FAILURE) {
+			free(list);
+			return FAILURE;
+		}
+	}
+
+	if(n == 0) {
+		free(list);
+		list = NULL;
+	}
+
+	changed = (globalFull != pressure->globalFull || n != pressure->numFullVoids
+		|| (list != NULL && strcmp(list, pressure->fullVoids) != 0));
+
+	if(pressure->fullVoids != NULL)
+		free(pressure->fullVoids);
+
+	pressure->globalFull = globalFull;
+	pressure->fullVoids = list;
+	pressure->numFullVoids = n;
+
+	return (changed == true) ? QUEUE_PRESSURE_CHANGED : QUEUE_PRESSURE_SAME;
+}
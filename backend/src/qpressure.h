@@ -0,0 +1,38 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Backpressure from the outgoing message queue onto the rules
+ *  that fill it, per void and across all voids
+*/
+
+#ifndef __QPRESSURE_H__
+#define __QPRESSURE_H__
+
+#include<time.h>
+#include "codewide.h"
+
+#define QUEUE_PRESSURE_MAX_VOIDS	2000	// Max voids held back at once, keeps the claim filter
+						//  within MAX_LENGTH_DB_QUERY
+
+#define QUEUE_PRESSURE_SAME		0
+#define QUEUE_PRESSURE_CHANGED		1
+
+/* Which voids a rule runner boss is holding back */
+typedef struct {
+	long voidMark;		// Pending outgoing entries a void may have, 0 = no mark
+	long globalMark;	// Pending outgoing entries all voids may have, 0 = no mark
+
+	bool globalFull;	// Over the global mark, hold back every void
+	char *fullVoids;	// Comma separated ids of voids over their mark, NULL = none
+	int numFullVoids;
+} Queue_Pressure;
+
+/* Function prototypes */
+Queue_Pressure *createQueuePressure(long, long);	// Allocate mem and setup a Queue_Pressure
+void freeQueuePressure(Queue_Pressure *);	// Release mem associated with a Queue_Pressure
+long countQueueOutPendingDb(long, long);	// Count pending outgoing entries in the database, up to a limit
+int getQueueOutFullVoidsDb(long, char *, size_t);	// List voids over their outgoing mark in the database
+bool isQueueOutFull(long);			// Is a void at its hard cap of outgoing mail?
+int updateQueuePressure(Queue_Pressure *);	// Work out which voids to hold back
+
+#endif
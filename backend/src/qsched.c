@@ -0,0 +1,803 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: In memory scheduler used by a queue boss to decide which
+ *  claimed queue entry runs next. Worker thread slots are shared between
+ *  the queue tracks by weight, and within a track voids take turns by
+ *  deficit round robin.
+ *
+ * Note: This is what stops two rules running for the same void at once,
+ *  the database only hands out entries, it doesn't check what's running.
+ *  Entries of a void are kept in a FIFO per track (a flow) and a void
+ *  takes QUEUE_VOID_QUANTUM entries per turn before going to the back of
+ *  its track's ready list, so a void with a big backlog gets no more
+ *  turns than any other. Every operation is O(1) in the number of voids
+ *  and entries apart from getQueueSchedFullVoids().
+ *
+ * Note 2: A track below its reserved slots always gets the next free slot.
+ *  Otherwise the slot goes to the track with the fewest running for its
+ *  weight, so long as that leaves enough free slots for the reservations
+ *  of other tracks with entries waiting.
+ *
+ * Note 3: How many entries of a void may run at once is the scheduler's
+ *  maxRunning unless the boss gave it a way to look up each void's own
+ *  limit (e.g. the concurrency set on a void's logic). A void's limit is
+ *  looked up when entries of it are first added and again every
+ *  QUEUE_SCHED_LIMIT_SEC while it has entries, a void with a higher limit
+ *  is let hold a bigger backlog to match.
+ *
+ * Note 4: The same look up gives how many of a void's entries may be
+ *  handed to a worker at once (see takeQueueSchedBatch()). A batch counts
+ *  as one running and one entry of the void's turn.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "qsched.h"
+#include "logerror.h"
+#include "dbchatter.h"
+
+
+/*
+ * Purpose: Create a scheduler
+ *
+ * Entry:
+ * 	1st - Max entries of one void processed at once, QUEUE_SCHED_NO_LIMIT
+ * 		for no limit
+ * 	2nd - Function to look up a void's own max entries processed at once,
+ * 		returning FAILURE to use the 1st, and filling in its batch size,
+ * 		NULL = every void uses the 1st and batches of 1
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated Queue_Sched
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Sched *createQueueSched(int maxRunning, int (*voidLimit)(long, int *)) {
+	Queue_Sched *sched;
+	int t;
+
+	if((sched = (Queue_Sched *)malloc(sizeof(Queue_Sched))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	if((sched->buckets = (Queue_Sched_Void **)calloc(QUEUE_SCHED_HASH_SIZE, sizeof(Queue_Sched_Void *))) == NULL) {
+		free(sched);
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	// Tracks in order of who goes first when slots are shared out
+	sched->tracks[0].track = DBVAL_message_queue_track_SYSTEM;
+	sched->tracks[0].weight = QUEUE_TRACK_SYSTEM_WEIGHT;
+	sched->tracks[0].reserved = QUEUE_TRACK_SYSTEM_RESERVED;
+
+	sched->tracks[1].track = DBVAL_message_queue_track_NORMAL;
+	sched->tracks[1].weight = QUEUE_TRACK_NORMAL_WEIGHT;
+	sched->tracks[1].reserved = QUEUE_TRACK_NORMAL_RESERVED;
+
+	sched->tracks[2].track = DBVAL_message_queue_track_BULK;
+	sched->tracks[2].weight = QUEUE_TRACK_BULK_WEIGHT;
+	sched->tracks[2].reserved = QUEUE_TRACK_BULK_RESERVED;
+
+	for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+		sched->tracks[t].pending = 0;
+		sched->tracks[t].running = 0;
+		sched->tracks[t].timed = 0;
+		sched->tracks[t].readyHead = NULL;
+		sched->tracks[t].readyTail = NULL;
+	}
+
+	sched->maxRunning = maxRunning;
+	sched->voidLimit = voidLimit;
+	sched->pending = 0;
+	sched->running = 0;
+
+	return sched;
+}
+
+
+/*
+ * Purpose: Free a scheduler along with any entries still waiting in it
+ *
+ * Entry:
+ * 	1st - Pointer to a Queue_Sched
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeQueueSched(Queue_Sched *sched) {
+	Queue_Sched_Void *v, *vNext;
+	Queue_Sched_Item *item, *itemNext;
+	int i, t;
+
+	if(sched == NULL)
+		return;
+
+	for(i = 0; i < QUEUE_SCHED_HASH_SIZE; i++) {
+		for(v = sched->buckets[i]; v != NULL; v = vNext) {
+			vNext = v->hashNext;
+
+			for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+				for(item = v->flows[t].head; item != NULL; item = itemNext) {
+					itemNext = item->next;
+					freeQueueEntry(item->qentry);
+					free(item);
+				}
+			}
+
+			free(v);
+		}
+	}
+
+	free(sched->buckets);
+	free(sched);
+}
+
+
+/*
+ * Purpose: Find which of the scheduler's tracks a track value is
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Track value, i.e. DBVAL_message_queue_track_NORMAL
+ *
+ * Exit:
+ * 	Index in tracks[], QUEUE_SCHED_DEFAULT_TRACK if not a known track
+*/
+int getQueueSchedTrack(Queue_Sched *sched, int track) {
+	int t;
+
+	for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+		if(sched->tracks[t].track == track)
+			return t;
+	}
+
+	return QUEUE_SCHED_DEFAULT_TRACK;
+}
+
+
+/*
+ * Purpose: Find the details the scheduler holds for a void
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Void id
+ * 	3rd - true = create the void's details if not already there
+ *
+ * Exit:
+ * 	SUCCESS = pointer to void's details, or NULL if not found and not
+ * 		asked to create
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Sched_Void *getQueueSchedVoid(Queue_Sched *sched, long voidId, bool create) {
+	Queue_Sched_Void *v;
+	int bucket, t;
+
+	bucket = (int)((unsigned long)voidId % QUEUE_SCHED_HASH_SIZE);
+
+	for(v = sched->buckets[bucket]; v != NULL; v = v->hashNext) {
+		if(v->voidId == voidId)
+			return v;
+	}
+
+	if(create == false)
+		return NULL;
+
+	if((v = (Queue_Sched_Void *)malloc(sizeof(Queue_Sched_Void))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	v->voidId = voidId;
+	v->running = 0;
+	v->maxRunning = sched->maxRunning;
+	v->maxBatch = 1;
+	v->limitChecked = 0;
+
+	for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+		v->flows[t].owner = v;
+		v->flows[t].pending = 0;
+		v->flows[t].deficit = 0;
+		v->flows[t].head = NULL;
+		v->flows[t].tail = NULL;
+		v->flows[t].ready = false;
+		v->flows[t].readyNext = NULL;
+	}
+
+	v->hashNext = sched->buckets[bucket];
+	sched->buckets[bucket] = v;
+
+	return v;
+}
+
+
+/*
+ * Purpose: Check whether a flow has entries that are allowed to run now
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Flow of a void
+ *
+ * Exit:
+ * 	true = has entries waiting and its void isn't already running as
+ * 		many as it's allowed
+ * 	false = otherwise
+*/
+bool isQueueSchedFlowRunnable(Queue_Sched *sched, Queue_Sched_Flow *flow) {
+
+	if(flow->pending == 0)
+		return false;
+
+	if(flow->owner->maxRunning != QUEUE_SCHED_NO_LIMIT && flow->owner->running >= flow->owner->maxRunning)
+		return false;
+
+	return true;
+}
+
+
+/*
+ * Purpose: Put a flow on its track's ready list if it has entries that
+ * 	are allowed to run
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Flow of a void
+ * 	3rd - true = put at the front of the ready list rather than the end
+ *
+ * Exit:
+ * 	NONE
+*/
+void updateQueueSchedReady(Queue_Sched *sched, Queue_Sched_Flow *flow, bool front) {
+	Queue_Sched_Track *track;
+
+	if(flow->ready == true || isQueueSchedFlowRunnable(sched, flow) == false)
+		return;
+
+	track = &sched->tracks[flow - flow->owner->flows];
+
+	flow->ready = true;
+
+	if(front == true) {
+		flow->readyNext = track->readyHead;
+		track->readyHead = flow;
+
+		if(track->readyTail == NULL)
+			track->readyTail = flow;
+	} else {
+		flow->readyNext = NULL;
+
+		if(track->readyTail == NULL)
+			track->readyHead = flow;
+		else
+			track->readyTail->readyNext = flow;
+
+		track->readyTail = flow;
+	}
+}
+
+
+/*
+ * Purpose: Forget about a void once it has nothing waiting or running
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Void's details
+ *
+ * Exit:
+ * 	NONE (v is freed if it was dropped)
+*/
+void dropQueueSchedVoid(Queue_Sched *sched, Queue_Sched_Void *v) {
+	Queue_Sched_Void **prev;
+	int bucket, t;
+
+	if(v->running != 0)
+		return;
+
+	for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+		if(v->flows[t].pending != 0 || v->flows[t].ready == true)
+			return;
+	}
+
+	bucket = (int)((unsigned long)v->voidId % QUEUE_SCHED_HASH_SIZE);
+
+	for(prev = &sched->buckets[bucket]; *prev != NULL; prev = &(*prev)->hashNext) {
+		if(*prev == v) {
+			*prev = v->hashNext;
+			free(v);
+			return;
+		}
+	}
+}
+
+
+/*
+ * Purpose: Add a claimed queue entry to the end of its void's FIFO on
+ * 	the entry's track
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Queue entry, the scheduler takes ownership of it
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false, and err type set
+*/
+bool addQueueSchedEntry(Queue_Sched *sched, Queue_Entry *qentry) {
+	Queue_Sched_Void *v;
+	Queue_Sched_Flow *flow;
+	Queue_Sched_Item *item;
+	time_t now;
+	int t, limit, batch;
+
+	if((v = getQueueSchedVoid(sched, qentry->voidId, true)) == NULL)
+		return false;
+
+	// The void's own limit may have changed since it was last looked up
+	if(sched->voidLimit != NULL && (now = time(NULL)) - v->limitChecked >= QUEUE_SCHED_LIMIT_SEC) {
+		v->limitChecked = now;
+
+		batch = 1;
+
+		if((limit = sched->voidLimit(v->voidId, &batch)) != FAILURE) {
+			v->maxBatch = (batch > QUEUE_BATCH_MAX) ? QUEUE_BATCH_MAX : batch;
+
+			if(limit != v->maxRunning) {
+				v->maxRunning = limit;
+
+				for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++)
+					updateQueueSchedReady(sched, &v->flows[t], false);
+			}
+		}
+	}
+
+	if((item = (Queue_Sched_Item *)malloc(sizeof(Queue_Sched_Item))) == NULL) {
+		dropQueueSchedVoid(sched, v);
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	t = getQueueSchedTrack(sched, qentry->track);
+	flow = &v->flows[t];
+
+	item->qentry = qentry;
+	item->next = NULL;
+
+	if(flow->tail == NULL)
+		flow->head = item;
+	else
+		flow->tail->next = item;
+
+	flow->tail = item;
+
+	flow->pending++;
+	sched->tracks[t].pending++;
+	sched->pending++;
+
+	updateQueueSchedReady(sched, flow, false);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Get the first flow on a track's ready list that may run now
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Index of track
+ *
+ * Exit:
+ * 	SUCCESS = Flow at the front of the ready list
+ * 	FAILURE = NULL if nothing on the track may run
+ *
+ * Note: With a per void limit a void can have flows ready on two tracks
+ * 	but only one may run. The other is left on its ready list and taken
+ * 	off here when it gets to the front, doneQueueSchedEntry() puts it
+ * 	back once the void may run again.
+ *
+ * Note 2: Flows left on the list empty are taken off here too, and their
+ * 	void dropped once it has nothing else waiting or running.
+*/
+Queue_Sched_Flow *getQueueSchedTrackHead(Queue_Sched *sched, int t) {
+	Queue_Sched_Track *track;
+	Queue_Sched_Flow *flow;
+
+	track = &sched->tracks[t];
+
+	while((flow = track->readyHead) != NULL && isQueueSchedFlowRunnable(sched, flow) == false) {
+		track->readyHead = flow->readyNext;
+
+		if(track->readyHead == NULL)
+			track->readyTail = NULL;
+
+		flow->ready = false;
+		flow->readyNext = NULL;
+
+		// Drained flows are left on the list, doneQueueSchedEntry() couldn't drop their void
+		if(flow->pending == 0)
+			dropQueueSchedVoid(sched, flow->owner);
+	}
+
+	return flow;
+}
+
+
+/*
+ * Purpose: Choose which track gets the next free worker thread slot
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Number of free worker thread slots
+ *
+ * Exit:
+ * 	SUCCESS = Index of track
+ * 	FAILURE = -1 if no track has an entry that may run
+*/
+int pickQueueSchedTrack(Queue_Sched *sched, int numFree) {
+	Queue_Sched_Track *tracks;
+	int t, u, best, unmet;
+
+	tracks = sched->tracks;
+
+	// Tracks below their reserved slots go first
+	for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+		if(tracks[t].running < tracks[t].reserved && getQueueSchedTrackHead(sched, t) != NULL)
+			return t;
+	}
+
+	for(t = 0, best = -1; t < QUEUE_SCHED_NUM_TRACKS; t++) {
+
+		if(getQueueSchedTrackHead(sched, t) == NULL)
+			continue;
+
+		// Don't take slots held back for other tracks with entries waiting
+		for(u = 0, unmet = 0; u < QUEUE_SCHED_NUM_TRACKS; u++) {
+			if(u != t && tracks[u].pending > 0 && tracks[u].running < tracks[u].reserved)
+				unmet += tracks[u].reserved - tracks[u].running;
+		}
+
+		if(numFree <= unmet)
+			continue;
+
+		// Fewest running for its weight
+		if(best == -1 || tracks[t].running * tracks[best].weight < tracks[best].running * tracks[t].weight)
+			best = t;
+	}
+
+	return best;
+}
+
+
+/*
+ * Purpose: Get the next entry to process, taking the oldest entry of the
+ * 	void at the front of the chosen track's ready list
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Number of free worker thread slots, including the one this
+ * 		entry is for
+ *
+ * Exit:
+ * 	SUCCESS = Queue entry, caller takes ownership and must call
+ * 		doneQueueSchedEntry() or returnQueueSchedEntry() for it
+ * 	FAILURE = NULL if nothing may run
+*/
+Queue_Entry *nextQueueSchedEntry(Queue_Sched *sched, int numFree) {
+	Queue_Sched_Track *track;
+	Queue_Sched_Flow *flow;
+	Queue_Sched_Item *item;
+	Queue_Entry *qentry;
+	int t;
+
+	if((t = pickQueueSchedTrack(sched, numFree)) == -1)
+		return NULL;
+
+	track = &sched->tracks[t];
+	flow = track->readyHead;
+
+	// Start of the void's turn
+	if(flow->deficit <= 0)
+		flow->deficit += QUEUE_VOID_QUANTUM;
+
+	// Take oldest entry of the void
+	item = flow->head;
+	flow->head = item->next;
+
+	if(flow->head == NULL)
+		flow->tail = NULL;
+
+	qentry = item->qentry;
+	free(item);
+
+	flow->pending--;
+	flow->deficit--;
+	flow->owner->running++;
+
+	track->pending--;
+	track->running++;
+
+	sched->pending--;
+	sched->running++;
+
+	// Next void gets a go once this one has used its turn or can't run any more
+	if(flow->deficit <= 0 || isQueueSchedFlowRunnable(sched, flow) == false) {
+		track->readyHead = flow->readyNext;
+
+		if(track->readyHead == NULL)
+			track->readyTail = NULL;
+
+		flow->ready = false;
+		flow->readyNext = NULL;
+
+		if(flow->pending == 0)
+			flow->deficit = 0;
+
+		updateQueueSchedReady(sched, flow, false);
+	}
+
+	return qentry;
+}
+
+
+/*
+ * Purpose: Chain more waiting entries of a void onto an entry got from
+ * 	nextQueueSchedEntry(), up to the void's batch size, so one worker
+ * 	processes them all in one go
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Queue entry got from nextQueueSchedEntry(), the rest of the
+ * 		batch is chained on through batchNext
+ *
+ * Exit:
+ * 	Number of entries in the batch, 1 if nothing was added
+ *
+ * Note: Entries are only taken from the same track, oldest first. The
+ * 	batch is finished with one doneQueueSchedEntry() or
+ * 	returnQueueSchedEntry() for the entry it was chained onto.
+*/
+int takeQueueSchedBatch(Queue_Sched *sched, Queue_Entry *qentry) {
+	Queue_Sched_Void *v;
+	Queue_Sched_Flow *flow;
+	Queue_Sched_Item *item;
+	Queue_Entry *last;
+	int t, n;
+
+	if((v = getQueueSchedVoid(sched, qentry->voidId, false)) == NULL || v->maxBatch <= 1)
+		return 1;
+
+	t = getQueueSchedTrack(sched, qentry->track);
+	flow = &v->flows[t];
+
+	for(n = 1, last = qentry; n < v->maxBatch && (item = flow->head) != NULL; n++) {
+		flow->head = item->next;
+
+		if(flow->head == NULL)
+			flow->tail = NULL;
+
+		last->batchNext = item->qentry;
+		last = item->qentry;
+		last->batchNext = NULL;
+
+		free(item);
+
+		flow->pending--;
+		sched->tracks[t].pending--;
+		sched->pending--;
+	}
+
+	// Ready list drops a flow with nothing left when it gets to the front
+	if(flow->pending == 0)
+		flow->deficit = 0;
+
+	return n;
+}
+
+
+/*
+ * Purpose: Let the scheduler know an entry has finished being processed
+ * 	so its void's next entry may run
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Queue entry that finished, got from nextQueueSchedEntry()
+ *
+ * Exit:
+ * 	NONE
+*/
+void doneQueueSchedEntry(Queue_Sched *sched, Queue_Entry *qentry) {
+	Queue_Sched_Void *v;
+	int t;
+
+	if((v = getQueueSchedVoid(sched, qentry->voidId, false)) == NULL || v->running == 0)
+		return;
+
+	t = getQueueSchedTrack(sched, qentry->track);
+
+	v->running--;
+	sched->tracks[t].running--;
+	sched->running--;
+
+	for(t = 0; t < QUEUE_SCHED_NUM_TRACKS; t++)
+		updateQueueSchedReady(sched, &v->flows[t], false);
+
+	dropQueueSchedVoid(sched, v);
+}
+
+
+/*
+ * Purpose: Put back an entry got from nextQueueSchedEntry() that couldn't be
+ * 	started, it goes back to the front of its void's FIFO
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Queue entry, the scheduler takes ownership of it again along
+ * 		with the rest of its batch
+ *
+ * Exit:
+ * 	NONE
+*/
+void returnQueueSchedEntry(Queue_Sched *sched, Queue_Entry *qentry) {
+	Queue_Sched_Void *v;
+	Queue_Sched_Flow *flow;
+	Queue_Sched_Item *item;
+	Queue_Entry *rider;
+	int t;
+
+	if((v = getQueueSchedVoid(sched, qentry->voidId, false)) == NULL
+		|| (item = (Queue_Sched_Item *)malloc(sizeof(Queue_Sched_Item))) == NULL) {
+
+		// Can't hold on to it, let the queue have it back
+		doneQueueSchedEntry(sched, qentry);
+
+		for(rider = qentry; rider != NULL; rider = rider->batchNext)
+			releaseQueueEntry(rider);
+
+		freeQueueEntryBatch(qentry);
+
+		return;
+	}
+
+	t = getQueueSchedTrack(sched, qentry->track);
+	flow = &v->flows[t];
+
+	// Rest of the batch goes back first, so it ends up behind the entry in the same order
+	if(qentry->batchNext != NULL)
+		returnQueueSchedBatch(sched, flow, qentry->batchNext);
+
+	qentry->batchNext = NULL;
+
+	item->qentry = qentry;
+	item->next = flow->head;
+	flow->head = item;
+
+	if(flow->tail == NULL)
+		flow->tail = item;
+
+	flow->pending++;
+	flow->deficit++;
+	v->running--;
+
+	sched->tracks[t].pending++;
+	sched->tracks[t].running--;
+
+	sched->pending++;
+	sched->running--;
+
+	updateQueueSchedReady(sched, flow, true);
+}
+
+
+/*
+ * Purpose: Put the rest of a batch back on the front of its void's FIFO,
+ * 	in the order they were taken
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Flow the batch was taken from
+ * 	3rd - First of the entries chained on by takeQueueSchedBatch(), the
+ * 		scheduler takes ownership of them again
+ *
+ * Exit:
+ * 	NONE
+*/
+void returnQueueSchedBatch(Queue_Sched *sched, Queue_Sched_Flow *flow, Queue_Entry *qentry) {
+	Queue_Sched_Item *item, *first = NULL, *last = NULL;
+	Queue_Entry *next;
+	int t;
+
+	t = flow - flow->owner->flows;
+
+	for(; qentry != NULL; qentry = next) {
+		next = qentry->batchNext;
+		qentry->batchNext = NULL;
+
+		if((item = (Queue_Sched_Item *)malloc(sizeof(Queue_Sched_Item))) == NULL) {
+			releaseQueueEntry(qentry);
+			freeQueueEntry(qentry);
+			continue;
+		}
+
+		item->qentry = qentry;
+		item->next = NULL;
+
+		if(last == NULL)
+			first = item;
+		else
+			last->next = item;
+
+		last = item;
+
+		flow->pending++;
+		sched->tracks[t].pending++;
+		sched->pending++;
+	}
+
+	if(first == NULL)
+		return;
+
+	last->next = flow->head;
+	flow->head = first;
+
+	if(flow->tail == NULL)
+		flow->tail = last;
+}
+
+
+/*
+ * Purpose: List the voids that already have enough entries waiting on a
+ * 	track, so a claim can skip them and one busy void can't fill the
+ * 	whole backlog
+ *
+ * Entry:
+ * 	1st - Scheduler
+ * 	2nd - Index of track
+ * 	3rd - Number of waiting entries at which a void counts as full, times
+ * 		the void's max running when more than 1, or its batch size when
+ * 		that's bigger
+ * 	4th - Max number of voids to list
+ *
+ * Exit:
+ * 	SUCCESS = Comma separated list of void ids for use in SQL, caller
+ * 		must free()
+ * 	FAILURE = NULL if no void is full, or err type set
+*/
+char *getQueueSchedFullVoids(Queue_Sched *sched, int t, int perVoid, int maxVoids) {
+	Queue_Sched_Void *v;
+	char *list;
+	size_t length, used;
+	int i, n, full;
+
+	length = (maxVoids * 21) + 1;		// Max digits in a long plus a comma
+
+	if((list = (char *)malloc(length)) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	list[0] = '\0';
+
+	for(i = 0, n = 0, used = 0; i < QUEUE_SCHED_HASH_SIZE && n < maxVoids; i++) {
+		for(v = sched->buckets[i]; v != NULL && n < maxVoids; v = v->hashNext) {
+			full = (v->maxRunning > 1) ? perVoid * v->maxRunning : perVoid;
+
+			// Room for at least a whole batch
+			if(full < v->maxBatch)
+				full = v->maxBatch;
+
+			if(v->flows[t].pending >= full) {
+				used += snprintf(list + used, length - used, (n == 0) ? "%ld" : ",%ld", v->voidId);
+				n++;
+			}
+		}
+	}
+
+	if(n == 0) {
+		free(list);
+		return NULL;
+	}
+
+	return list;
+}
@@ -0,0 +1,113 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: In memory scheduler used by a queue boss to decide which
+ *  claimed queue entry runs next. Worker thread slots are shared between
+ *  the queue tracks by weight, and within a track voids take turns by
+ *  deficit round robin.
+*/
+
+#ifndef __QSCHED_H__
+#define __QSCHED_H__
+
+#include<time.h>
+#include "codewide.h"
+#include "msgqueue.h"
+
+#define QUEUE_SCHED_HASH_SIZE		1024	// Number of buckets in the void lookup table
+#define QUEUE_SCHED_NO_LIMIT		0	// No limit on how many entries a void runs at once
+#define QUEUE_SCHED_NUM_TRACKS		3	// Number of tracks scheduled, see createQueueSched()
+#define QUEUE_SCHED_DEFAULT_TRACK	1	// Index of track used for entries on an unknown track
+#define QUEUE_SCHED_LIMIT_SEC		60	// Secs before a void's own limit is looked up again
+
+
+struct Queue_Sched_Void;
+
+
+/* An entry waiting in a void's FIFO */
+typedef struct Queue_Sched_Item {
+	Queue_Entry *qentry;
+	struct Queue_Sched_Item *next;
+} Queue_Sched_Item;
+
+
+/* Entries of one void on one track */
+typedef struct Queue_Sched_Flow {
+	struct Queue_Sched_Void *owner;	// Void the flow belongs to
+
+	int pending;			// Entries waiting to be processed
+	int deficit;			// Entries the void may still run on its current turn
+
+	Queue_Sched_Item *head;		// FIFO of waiting entries, oldest first
+	Queue_Sched_Item *tail;
+
+	bool ready;			// On the track's ready list
+	struct Queue_Sched_Flow *readyNext;	// Next flow on the ready list
+} Queue_Sched_Flow;
+
+
+/* Everything the scheduler knows about one void */
+typedef struct Queue_Sched_Void {
+	long voidId;
+
+	int running;			// Entries of this void currently being processed, any track
+	int maxRunning;			// Max entries of this void processed at once (QUEUE_SCHED_NO_LIMIT = any)
+	int maxBatch;			// Max entries of this void handed to a worker at once
+	time_t limitChecked;		// When maxRunning was last looked up, 0 = never
+
+	Queue_Sched_Flow flows[QUEUE_SCHED_NUM_TRACKS];	// Waiting entries per track
+
+	struct Queue_Sched_Void *hashNext;	// Next void in the same hash bucket
+} Queue_Sched_Void;
+
+
+/* A queue track and its share of the worker thread slots */
+typedef struct {
+	int track;			// Track value, i.e. DBVAL_message_queue_track_NORMAL
+	int weight;			// Share of busy slots relative to other tracks
+	int reserved;			// Slots held back for this track while it has entries waiting
+
+	int pending;			// Entries waiting on this track
+	int running;			// Entries on this track being processed
+	int timed;			// Entries of this track the boss holds on its timer till they're due,
+					//  not counted in pending (see qtimer.c)
+
+	Queue_Sched_Flow *readyHead;	// Flows with waiting entries, served deficit round robin
+	Queue_Sched_Flow *readyTail;
+} Queue_Sched_Track;
+
+
+/* Scheduler for one boss */
+typedef struct {
+	Queue_Sched_Void **buckets;	// Voids by id
+
+	Queue_Sched_Track tracks[QUEUE_SCHED_NUM_TRACKS];
+
+	int maxRunning;			// Max entries of one void processed at once (QUEUE_SCHED_NO_LIMIT = any)
+	int (*voidLimit)(long, int *);	// Looks up a void's own max and batch size, NULL = every void uses
+					//  maxRunning and batches of 1
+
+	int pending;			// Total entries waiting across all tracks
+	int running;			// Total entries being processed across all tracks
+} Queue_Sched;
+
+
+/* Function prototypes */
+Queue_Sched *createQueueSched(int, int (*)(long, int *));	// Allocate mem and setup a Queue_Sched
+void freeQueueSched(Queue_Sched *);		// Release mem of a Queue_Sched and any entries it holds
+int getQueueSchedTrack(Queue_Sched *, int);	// Index in tracks[] for a track value
+Queue_Sched_Void *getQueueSchedVoid(Queue_Sched *, long, bool);	// Find (or create) a void's details
+bool isQueueSchedFlowRunnable(Queue_Sched *, Queue_Sched_Flow *);	// Has a flow entries that may run now
+void updateQueueSchedReady(Queue_Sched *, Queue_Sched_Flow *, bool);	// Put a flow on its track's ready list if it may run
+void dropQueueSchedVoid(Queue_Sched *, Queue_Sched_Void *);	// Forget a void with nothing waiting or running
+bool addQueueSchedEntry(Queue_Sched *, Queue_Entry *);		// Add a claimed entry to the end of its void's FIFO
+Queue_Sched_Flow *getQueueSchedTrackHead(Queue_Sched *, int);	// First flow on a track that may run
+int pickQueueSchedTrack(Queue_Sched *, int);			// Choose which track gets the next free slot
+Queue_Entry *nextQueueSchedEntry(Queue_Sched *, int);		// Get next entry to process
+int takeQueueSchedBatch(Queue_Sched *, Queue_Entry *);		// Chain more of a void's entries onto the next one
+void doneQueueSchedEntry(Queue_Sched *, Queue_Entry *);		// An entry has finished processing
+void returnQueueSchedEntry(Queue_Sched *, Queue_Entry *);	// Put back an entry that couldn't be started
+void returnQueueSchedBatch(Queue_Sched *, Queue_Sched_Flow *, Queue_Entry *);	// Put back the rest of a batch
+char *getQueueSchedFullVoids(Queue_Sched *, int, int, int);	// List voids with a full FIFO on a track for SQL
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Share out a message queue between several bosses (nodes), each
+ *  owning a range of hash buckets of the queue's shard key
+ *
+ * Note: Every queue entry gets a shard key when it's inserted, the hash
+ *  bucket of its void for incoming messages or of its recipient for
+ *  outgoing. Bosses register in the queue_node table and heartbeat there,
+ *  the live nodes of a queue in order of joining split the buckets into
+ *  equal ranges. A boss only claims entries in its range, so bosses don't
+ *  fight over the same rows. When a node joins or leaves the ranges move
+ *  and each node picks up its new range on its next heartbeat.
+ *
+ * Note 2: While ranges move two nodes can briefly own the same bucket. A
+ *  node joining, or dropping nodes that stopped heart beating, sets the
+ *  moved date of its queue_node row. For incoming messages, for
+ *  QUEUE_LEASE_SEC after any node of the queue moved the ranges every node
+ *  claims one at a time under a database lock and never for a void another
+ *  node has PROCESSING, so a void still never has two rules running at
+ *  once. Every claim checks the moved dates, not just heartbeats, so a
+ *  node's view of its range being stale doesn't matter. Once ranges have
+ *  settled nodes claim without the lock or the check.
+ *
+ * Note 3: A claim made without the lock only claims if the ranges still
+ *  haven't moved when it runs (see createQueueClaimFilter()). Reading
+ *  queue_node inside the UPDATE share locks its rows, so a node can't set
+ *  its moved date, and start claiming under the lock, while a claim that
+ *  didn't see it is still going.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "qshard.h"
+#include "logerror.h"
+#include "dbchatter.h"
+
+
+/*
+ * Purpose: Creates a shard struct for a boss, starting out owning all
+ * 	the buckets until updateQueueShard() says otherwise
+ *
+ * Entry:
+ * 	1st - Unique name of the boss
+ * 	2nd - Queue the boss processes, i.e. DBVAL_message_queue_messageType_EMAILIN
+ * 	3rd - true = only one entry of a void may run at once
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated Queue_Shard
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Shard *createQueueShard(char *nodeName, int messageType, bool exclusive) {
+	Queue_Shard *shard;
+
+	if((shard = (Queue_Shard *)malloc(sizeof(Queue_Shard))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	if((shard->nodeName = strdup(nodeName)) == NULL) {
+		free(shard);
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	shard->messageType = messageType;
+	shard->exclusive = exclusive;
+
+	shard->nodes = 1;
+	shard->low = 0;
+	shard->high = QUEUE_SHARD_BUCKETS;
+
+	// Till the first claim checks, being new means joining
+	shard->moving = true;
+	shard->locked = false;
+
+	return shard;
+}
+
+
+/*
+ * Purpose: Free up a shard struct
+ *
+ * Entry:
+ * 	1st - Queue_Shard to free
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeQueueShard(Queue_Shard *shard) {
+
+	if(shard == NULL)
+		return;
+
+	if(shard->nodeName != NULL)
+		free(shard->nodeName);
+
+	free(shard);
+}
+
+
+/*
+ * Purpose: Work out the hash bucket a queue entry belongs to
+ *
+ * Entry:
+ * 	1st - Type of queue entry
+ * 	2nd - Void id of the entry
+ * 	3rd - User id of the entry (recipient for outgoing messages)
+ *
+ * Exit:
+ * 	Bucket, from 0 to QUEUE_SHARD_BUCKETS - 1
+ *
+ * Note: Multiplicative hash taking the top bits of the low 32, in SQL
+ * 	((id * 2654435761) % 4294967296) DIV 4194304 for 1024 buckets (see
+ * 	upgrade_thwonk.sql)
+*/
+int getQueueShardKey(int messageType, long voidId, long userId) {
+	unsigned long long key;
+
+	key = (messageType == DBVAL_message_queue_messageType_EMAILOUT) ? (unsigned long)userId : (unsigned long)voidId;
+
+	return (int)(((key * QUEUE_SHARD_HASH) & 0xffffffffULL) / (0x100000000ULL / QUEUE_SHARD_BUCKETS));
+}
+
+
+/*
+ * Purpose: Heartbeat for a node, drop nodes that have stopped heart
+ * 	beating and work out which buckets this node now owns
+ *
+ * Entry:
+ * 	1st - Shard of the boss
+ *
+ * Exit:
+ * 	SUCCESS = QUEUE_SHARD_CHANGED if the range owned moved, otherwise
+ * 		QUEUE_SHARD_SAME
+ * 	FAILURE = FAILURE and err type set, range owned is left as it was
+ *
+ * Note: Registers the node if it isn't already, e.g. first call or it was
+ * 	dropped while it couldn't reach the database.
+ *
+ * Note 2: Joining or dropping nodes moves every node's range, so sets
+ * 	the moved date of this node's row, which starts QUEUE_LEASE_SEC of
+ * 	every node claiming carefully (see lockQueueClaims()).
+*/
+int updateQueueShard(Queue_Shard *shard) {
+	DBRESULT *result;
+	DBROW row;
+	int i, index, nodes, low, high;
+
+	// moved is only set when the row is new, i.e. the node is joining
+	dbQueryFreeResult(dbQuery("INSERT INTO queue_node (nodeName, messageType, heartbeat, moved) VALUES ('%s', %d, now(), now()) ON DUPLICATE KEY UPDATE heartbeat = now()", shard->nodeName, shard->messageType));
+
+	if(getErrType() != ERR_NONE)
+		return FAILURE;
+
+	result = dbQuery("DELETE FROM queue_node WHERE messageType = %d AND heartbeat < now() - INTERVAL %d SECOND", shard->messageType, QUEUE_NODE_TIMEOUT_SEC);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	i = dbQueryCountRows(result);
+	dbQueryFreeResult(result);
+
+	if(i > 0) {
+		dbQueryFreeResult(dbQuery("UPDATE queue_node SET moved = now() WHERE nodeName = '%s' AND messageType = %d", shard->nodeName, shard->messageType));
+
+		if(getErrType() != ERR_NONE)
+			return FAILURE;
+	}
+
+	result = dbQuery("SELECT nodeName FROM queue_node WHERE messageType = %d ORDER BY id ASC", shard->messageType);
+
+	if(getErrType() != ERR_NONE) {
+		dbQueryFreeResult(result);
+		return FAILURE;
+	}
+
+	for(i = 0, index = -1; (row = dbQueryGetRow(result)) != NULL; i++) {
+		if(strcmp(row[0], shard->nodeName) == 0)
+			index = i;
+	}
+
+	dbQueryFreeResult(result);
+
+	nodes = i;
+
+	// Was just registered so should be there
+	if(index == -1) {
+		setErrType(ERR_DB_QUERY);
+		return FAILURE;
+	}
+
+	low = (index * QUEUE_SHARD_BUCKETS) / nodes;
+	high = ((index + 1) * QUEUE_SHARD_BUCKETS) / nodes;
+
+	if(low == shard->low && high == shard->high) {
+		shard->nodes = nodes;
+		return QUEUE_SHARD_SAME;
+	}
+
+	shard->nodes = nodes;
+	shard->low = low;
+	shard->high = high;
+
+	return QUEUE_SHARD_CHANGED;
+}
+
+
+/*
+ * Purpose: Work out whether another node may still be running voids in
+ * 	this node's range, i.e. ranges have moved lately
+ *
+ * Entry:
+ * 	1st - Shard of the boss, or NULL if not sharding
+ *
+ * Exit:
+ * 	true = claim under the lock, skipping voids other nodes are running
+ * 	false = not sharding, a void may run on several nodes at once, or
+ * 		ranges had settled when lockQueueClaims() last checked
+*/
+bool isQueueShardMoving(Queue_Shard *shard) {
+
+	if(shard == NULL || shard->exclusive == false)
+		return false;
+
+	return shard->moving;
+}
+
+
+/*
+ * Purpose: Check whether any node of the queue has moved the ranges
+ * 	lately, and if so take the claim lock for it, so only one node
+ * 	claims at a time while ranges may overlap
+ *
+ * Entry:
+ * 	1st - Shard of the boss, or NULL if not sharding
+ *
+ * Exit:
+ * 	SUCCESS = true, lock held if needed (always true if not needed)
+ * 	FAILURE = false, couldn't check or lock not got in QUEUE_CLAIM_LOCK_SEC
+ *
+ * Note: Done before every claim, so a node starts claiming carefully as
+ * 	soon as another joins rather than on its own next heartbeat.
+*/
+bool lockQueueClaims(Queue_Shard *shard) {
+	DBRESULT *result;
+	DBROW row;
+	bool got = false;
+
+	if(shard == NULL || shard->exclusive == false)
+		return true;
+
+	result = dbQuery("SELECT MAX(moved) > now() - INTERVAL %d SECOND FROM queue_node WHERE messageType = %d", QUEUE_LEASE_SEC, shard->messageType);
+
+	if(getErrType() != ERR_NONE || (row = dbQueryGetRow(result)) == NULL) {
+		dbQueryFreeResult(result);
+		return false;
+	}
+
+	// No rows means this node was dropped, it may be joining again
+	shard->moving = (row[0] == NULL || atoi(row[0]) == 1);
+	dbQueryFreeResult(result);
+
+	if(shard->moving == false)
+		return true;
+
+	result = dbQuery("SELECT GET_LOCK('%s.%d', %d)", SET_CLAIM_LOCK_NAME, shard->messageType, QUEUE_CLAIM_LOCK_SEC);
+
+	if(getErrType() == ERR_NONE && (row = dbQueryGetRow(result)) != NULL && row[0] != NULL)
+		got = (atoi(row[0]) == 1);
+
+	dbQueryFreeResult(result);
+
+	shard->locked = got;
+
+	return got;
+}
+
+
+/*
+ * Purpose: Release the claim lock taken by lockQueueClaims()
+ *
+ * Entry:
+ * 	1st - Shard of the boss, or NULL if not sharding
+ *
+ * Exit:
+ * 	NONE
+*/
+void unlockQueueClaims(Queue_Shard *shard) {
+
+	// Ranges may have settled since it was taken
+	if(shard == NULL || shard->locked == false)
+		return;
+
+	dbQueryFreeResult(dbQuery("SELECT RELEASE_LOCK('%s.%d')", SET_CLAIM_LOCK_NAME, shard->messageType));
+
+	shard->locked = false;
+}
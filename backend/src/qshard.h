@@ -0,0 +1,44 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Share out a message queue between several bosses (nodes), each
+ *  owning a range of hash buckets of the queue's shard key
+*/
+
+#ifndef __QSHARD_H__
+#define __QSHARD_H__
+
+#include "codewide.h"
+
+#define QUEUE_SHARD_BUCKETS		1024		// Number of hash buckets shard keys are split into
+#define QUEUE_SHARD_HASH		2654435761ULL	// Multiplier for hashing ids into buckets (see getQueueShardKey())
+#define QUEUE_NODE_TIMEOUT_SEC		QUEUE_LEASE_SEC	// Secs without a heartbeat before a node is dropped
+#define QUEUE_CLAIM_LOCK_SEC		5		// Max secs to wait for the claim lock
+
+#define QUEUE_SHARD_SAME		0
+#define QUEUE_SHARD_CHANGED		1
+
+/* A boss's place among the nodes processing a queue */
+typedef struct {
+	char *nodeName;		// Unique name of the boss (host.pid)
+	int messageType;	// Queue the boss processes
+
+	bool exclusive;		// Only one entry of a void may run at once across all nodes
+	bool moving;		// Ranges may overlap another node's, as of the last claim (see lockQueueClaims())
+	bool locked;		// Claim lock is held (see lockQueueClaims())
+
+	int nodes;		// Number of live nodes on the queue
+	int low;		// First bucket this node owns
+	int high;		// One past the last bucket this node owns
+} Queue_Shard;
+
+/* Function prototypes */
+Queue_Shard *createQueueShard(char *, int, bool);	// Allocate mem and setup a Queue_Shard
+void freeQueueShard(Queue_Shard *);		// Release mem associated with a Queue_Shard
+int getQueueShardKey(int, long, long);		// Bucket a queue entry belongs to
+int updateQueueShard(Queue_Shard *);		// Heartbeat and work out which buckets this node owns
+bool isQueueShardMoving(Queue_Shard *);	// May another node still be running voids in this node's range
+bool lockQueueClaims(Queue_Shard *);		// Stop other nodes claiming while this one does
+void unlockQueueClaims(Queue_Shard *);		// Let other nodes claim again
+
+#endif
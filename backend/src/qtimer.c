@@ -0,0 +1,273 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Hierarchical timing wheel a boss holds claimed queue entries in
+ *  until their not before time comes round
+ *
+ * Note: The first wheel has a slot per sec, each wheel above it a slot per
+ *  full turn of the one below. An entry goes in the lowest wheel that
+ *  reaches its time. Each time the first wheel comes round to slot 0 the
+ *  next slot of the wheel above is emptied back down (cascaded), so an
+ *  entry is only touched a few times however far off it is. Adding,
+ *  advancing a sec and taking an entry off don't depend on how many
+ *  entries are waiting.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "qtimer.h"
+#include "logerror.h"
+
+
+/*
+ * Purpose: Creates an empty timing wheel
+ *
+ * Entry:
+ * 	1st - Time to start the wheel at, normally time(NULL)
+ *
+ * Exit:
+ * 	SUCCESS = pointer to allocated Queue_Timer
+ * 	FAILURE = NULL, and err type set
+*/
+Queue_Timer *createQueueTimer(time_t now) {
+	Queue_Timer *timer;
+
+	if((timer = (Queue_Timer *)malloc(sizeof(Queue_Timer))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return NULL;
+	}
+
+	memset(timer->slots, 0, sizeof(timer->slots));
+
+	timer->due = NULL;
+	timer->dueTail = NULL;
+
+	timer->now = now;
+	timer->waiting = 0;
+
+	return timer;
+}
+
+
+/*
+ * Purpose: Free up a timing wheel and the entries still on it
+ *
+ * Entry:
+ * 	1st - Queue_Timer to free
+ *
+ * Exit:
+ * 	NONE
+*/
+void freeQueueTimer(Queue_Timer *timer) {
+	Queue_Timer_Item *item, *next;
+	int level, slot;
+
+	if(timer == NULL)
+		return;
+
+	for(level = 0; level < QUEUE_TIMER_LEVELS; level++) {
+		for(slot = 0; slot < QUEUE_TIMER_SLOTS; slot++) {
+			for(item = timer->slots[level][slot]; item != NULL; item = next) {
+				next = item->next;
+				freeQueueEntry(item->qentry);
+				free(item);
+			}
+		}
+	}
+
+	for(item = timer->due; item != NULL; item = next) {
+		next = item->next;
+		freeQueueEntry(item->qentry);
+		free(item);
+	}
+
+	free(timer);
+}
+
+
+/*
+ * Purpose: Put an item in the wheel that reaches its time, or on the due
+ * 	list if its time has already come
+ *
+ * Entry:
+ * 	1st - Queue_Timer
+ * 	2nd - Item to place
+ *
+ * Exit:
+ * 	NONE
+*/
+void placeQueueTimerItem(Queue_Timer *timer, Queue_Timer_Item *item) {
+	time_t when, delta;
+	int level, slot;
+
+	when = item->qentry->notBefore;
+	delta = when - timer->now;
+
+	if(delta <= 0) {
+		item->next = NULL;
+
+		if(timer->dueTail == NULL)
+			timer->due = item;
+		else
+			timer->dueTail->next = item;
+
+		timer->dueTail = item;
+		return;
+	}
+
+	for(level = 0; level < QUEUE_TIMER_LEVELS - 1 && delta >= ((time_t)1 << (QUEUE_TIMER_BITS * (level + 1))); level++);
+
+	// Further off than the top wheel reaches, park it in the furthest slot and place it again when it cascades
+	if(delta >= ((time_t)1 << (QUEUE_TIMER_BITS * QUEUE_TIMER_LEVELS)))
+		when = timer->now + ((time_t)1 << (QUEUE_TIMER_BITS * QUEUE_TIMER_LEVELS)) - 1;
+
+	slot = (int)((when >> (QUEUE_TIMER_BITS * level)) & QUEUE_TIMER_MASK);
+
+	item->next = timer->slots[level][slot];
+	timer->slots[level][slot] = item;
+
+	timer->waiting++;
+}
+
+
+/*
+ * Purpose: Hold a claimed queue entry until its not before time
+ *
+ * Entry:
+ * 	1st - Queue_Timer
+ * 	2nd - Queue_Entry to hold, the timer owns it until it's popped
+ *
+ * Exit:
+ * 	SUCCESS = true
+ * 	FAILURE = false and err type set
+*/
+bool addQueueTimerEntry(Queue_Timer *timer, Queue_Entry *qentry) {
+	Queue_Timer_Item *item;
+
+	if((item = (Queue_Timer_Item *)malloc(sizeof(Queue_Timer_Item))) == NULL) {
+		setErrType(ERR_MEM_ALLOC);
+		return false;
+	}
+
+	item->qentry = qentry;
+
+	placeQueueTimerItem(timer, item);
+
+	return true;
+}
+
+
+/*
+ * Purpose: Move the wheel on to a time, entries whose time has come are
+ * 	put on the due list
+ *
+ * Entry:
+ * 	1st - Queue_Timer
+ * 	2nd - Time to advance to, normally time(NULL)
+ *
+ * Exit:
+ * 	NONE
+ *
+ * Note: The wheel never goes backwards, if the clock does entries just
+ * 	wait until it catches up
+*/
+void advanceQueueTimer(Queue_Timer *timer, time_t now) {
+	Queue_Timer_Item *item, *next;
+	int level, slot;
+
+	while(timer->now < now) {
+
+		// Skip ahead when nothing is waiting, rather than a sec at a time
+		if(timer->waiting == 0) {
+			timer->now = now;
+			break;
+		}
+
+		timer->now++;
+
+		// Wheels below came round, cascade the next slot of the wheel above
+		for(level = 1; level < QUEUE_TIMER_LEVELS && ((timer->now >> (QUEUE_TIMER_BITS * (level - 1))) & QUEUE_TIMER_MASK) == 0; level++) {
+			slot = (int)((timer->now >> (QUEUE_TIMER_BITS * level)) & QUEUE_TIMER_MASK);
+
+			item = timer->slots[level][slot];
+			timer->slots[level][slot] = NULL;
+
+			for(; item != NULL; item = next) {
+				next = item->next;
+				timer->waiting--;
+				placeQueueTimerItem(timer, item);
+			}
+		}
+
+		slot = (int)(timer->now & QUEUE_TIMER_MASK);
+
+		item = timer->slots[0][slot];
+		timer->slots[0][slot] = NULL;
+
+		for(; item != NULL; item = next) {
+			next = item->next;
+			timer->waiting--;
+			placeQueueTimerItem(timer, item);
+		}
+	}
+}
+
+
+/*
+ * Purpose: Take the next entry whose time has come off the timer
+ *
+ * Entry:
+ * 	1st - Queue_Timer
+ *
+ * Exit:
+ * 	SUCCESS = Queue_Entry, now owned by the caller
+ * 	FAILURE = NULL, nothing due
+*/
+Queue_Entry *popQueueTimerEntry(Queue_Timer *timer) {
+	Queue_Timer_Item *item;
+	Queue_Entry *qentry;
+
+	if((item = timer->due) == NULL)
+		return NULL;
+
+	if((timer->due = item->next) == NULL)
+		timer->dueTail = NULL;
+
+	qentry = item->qentry;
+	free(item);
+
+	return qentry;
+}
+
+
+/*
+ * Purpose: Work out how long the boss can sleep before the timer needs
+ * 	advancing, either for an entry coming due or for a cascade
+ *
+ * Entry:
+ * 	1st - Queue_Timer
+ *
+ * Exit:
+ * 	Secs from the wheel's time, 0 if entries are already due, or
+ * 	QUEUE_TIMER_IDLE if nothing is waiting
+*/
+int getQueueTimerWait(Queue_Timer *timer) {
+	time_t when;
+	int secs;
+
+	if(timer->due != NULL)
+		return 0;
+
+	if(timer->waiting == 0)
+		return QUEUE_TIMER_IDLE;
+
+	for(secs = 1; secs <= QUEUE_TIMER_SLOTS; secs++) {
+		when = timer->now + secs;
+
+		if((when & QUEUE_TIMER_MASK) == 0 || timer->slots[0][when & QUEUE_TIMER_MASK] != NULL)
+			break;
+	}
+
+	return secs;
+}
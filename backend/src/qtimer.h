@@ -0,0 +1,48 @@
+/*
+ * Author: Mike Bennett (mike@thwonk.com)
+ *
+ * Purpose: Hierarchical timing wheel a boss holds claimed queue entries in
+ *  until their not before time comes round
+*/
+
+#ifndef __QTIMER_H__
+#define __QTIMER_H__
+
+#include<time.h>
+#include "codewide.h"
+#include "msgqueue.h"
+
+#define QUEUE_TIMER_LEVELS	4	// Levels of wheels, each a QUEUE_TIMER_SLOTS times coarser than the last
+#define QUEUE_TIMER_BITS	6
+#define QUEUE_TIMER_SLOTS	(1 << QUEUE_TIMER_BITS)	// Slots per wheel, the first wheel's are a sec each
+#define QUEUE_TIMER_MASK	(QUEUE_TIMER_SLOTS - 1)
+
+#define QUEUE_TIMER_IDLE	-1	// Nothing waiting on the timer
+
+/* An entry waiting on the timer */
+typedef struct Queue_Timer_Item {
+	Queue_Entry *qentry;
+	struct Queue_Timer_Item *next;
+} Queue_Timer_Item;
+
+/* Timing wheel of a boss */
+typedef struct {
+	Queue_Timer_Item *slots[QUEUE_TIMER_LEVELS][QUEUE_TIMER_SLOTS];
+
+	Queue_Timer_Item *due;		// Entries whose time has come, oldest first
+	Queue_Timer_Item *dueTail;
+
+	time_t now;			// Time the wheel has been advanced to
+	int waiting;			// Number of entries in the wheel, not counting due
+} Queue_Timer;
+
+/* Function prototypes */
+Queue_Timer *createQueueTimer(time_t);		// Allocate mem and setup a Queue_Timer
+void freeQueueTimer(Queue_Timer *);		// Release mem associated with a Queue_Timer, and its entries
+void placeQueueTimerItem(Queue_Timer *, Queue_Timer_Item *);	// Put an item in the right wheel, or on the due list
+bool addQueueTimerEntry(Queue_Timer *, Queue_Entry *);	// Hold an entry till its not before time
+void advanceQueueTimer(Queue_Timer *, time_t);	// Move the wheel on, entries whose time has come become due
+Queue_Entry *popQueueTimerEntry(Queue_Timer *);	// Take the next due entry off the timer
+int getQueueTimerWait(Queue_Timer *);		// Secs till the timer next needs advancing
+
+#endif
@@ -20,6 +20,9 @@
 #include "jsrunner.h"
 #include "sandbox.h"
 #include "msgqueue.h"
+#include "qlog.h"
+#include "mnglogic.h"
+#include "jsprofile.h"
 
 
 /*
@@ -43,6 +46,13 @@ bool setup(int argc, char **argv) {
 	if(dbConnect() == false)
 		return false;
 
+	// Log queue backend reaches its segments through this from inside the jail, so
+	//  every daemon shares the one log rather than each its own copy in the jail
+	if(openQueueLogDir() == false) {
+		printf("rulerunner: FAILED TO OPEN QUEUE LOG DIR\n");
+		exit(FAILURE);
+	}
+
 	// Security wise it might make more sense to have this happening first and
 	// put the config file along with database socket in the chroot folder
 #ifndef DEBUG
@@ -117,11 +127,25 @@ int main(int argc, char **argv) {
 		failureExit(getErrType());
 	}
 
-	// Process incoming message queue with spawnRuleRunner() doing the work in each child
+	// Roll up rule profiles and exit
+	if(_config->profile_top > 0) {
+		if(printJSProfileTop(_config->profile_top, JS_PROFILE_TOP_HOURS) == false) {
+			printf("ERROR reading rule profiles\n");
+			failureExit(getErrType());
+		}
+
+		tidy();
+
+		return SUCCESS;
+	}
+
+	// Process incoming message queue with spawnRuleRunner() doing the work in each child,
+	//  as many at once for a void as its logic allows, workers write out their rule
+	//  profiles before they exit
 	runQueueThreads(&spawnRuleRunner, _config->maxnum_rulerunner_threads,
-		DBVAL_message_queue_messageType_EMAILIN, DBVAL_message_queue_track_NORMAL,
+		DBVAL_message_queue_messageType_EMAILIN,
 		MAX_RULERUNNER_SLEEP_SEC, MAX_RULERUNNER_SLEEP_NSEC,
-		&failureExit, SANDBOX_RULERUNNER);
+		&failureExit, SANDBOX_RULERUNNER, &getLogicLimitsForVoid, &flushJSProfile);
 
 	tidy();
 
@@ -50,6 +50,7 @@ SCONFIG *initSConfig() {
  *	FAILURE = NULL pointer and _errno set (see getErrType())
 */
 SCONFIG *parseCmd(int argc, char **argv) {
+	int i;
 
 	if(_config == NULL) {
 		if(initSConfig() == NULL) {
@@ -57,6 +58,21 @@ SCONFIG *parseCmd(int argc, char **argv) {
 		}
 	}
 
+	_config->archive_backfill = 0;
+	_config->profile_top = 0;
+
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], SET_ARG_BACKFILL_ARCHIVE) == 0)
+			_config->archive_backfill = 1;
+
+		if(strcmp(argv[i], SET_ARG_PROFILE_TOP) == 0) {
+			_config->profile_top = JS_PROFILE_TOP;
+
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0)
+				_config->profile_top = atoi(argv[++i]);
+		}
+	}
+
 	return _config;
 }
 
@@ -101,6 +117,34 @@ SCONFIG *parseConfig(char *configFile) {
 
 	_config->maxnum_rulerunner_threads = MAX_NUM_RULERUNNER_THREADS;
 	_config->maxnum_outqueue_threads = MAX_NUM_OUTQUEUE_THREADS;
+	_config->minnum_rulerunner_threads = MIN_NUM_RULERUNNER_THREADS;
+	_config->minnum_outqueue_threads = MIN_NUM_OUTQUEUE_THREADS;
+
+	_config->pooljobs_rulerunner = MAX_RULERUNNER_POOL_JOBS;
+	_config->pooljobs_outqueue = MAX_OUTQUEUE_POOL_JOBS;
+
+	_config->mail_dedup_sec = MAIL_DEDUP_SEC;
+
+	_config->queue_backend = QUEUE_BACKEND;
+	_config->queue_log_dir = (char *)strdup(SET_QUEUE_LOG_DIR);
+
+	_config->reuse_js_runtime = SPIDERMONKEY_REUSE_RUNTIME;
+	_config->js_max_cpu_msec = JS_MAX_CPU_MSEC;
+	_config->js_max_wall_msec = JS_MAX_WALL_MSEC;
+	_config->js_max_heap_bytes = JS_MAX_HEAP_BYTES;
+	_config->js_engine_options = JS_ENGINE_OPTIONS;
+	_config->js_profile_sample = JS_PROFILE_SAMPLE;
+	_config->js_profile_keep_days = JS_PROFILE_KEEP_DAYS;
+
+	_config->shard_rulerunner = QUEUE_SHARD_RULERUNNER;
+	_config->shard_outqueue = QUEUE_SHARD_OUTQUEUE;
+
+	_config->outqueue_void_high_water = QUEUE_OUT_VOID_HIGH_WATER;
+	_config->outqueue_global_high_water = QUEUE_OUT_GLOBAL_HIGH_WATER;
+	_config->outqueue_void_hard_cap = QUEUE_OUT_VOID_HARD_CAP;
+
+	_config->archive_batch = QUEUE_ARCHIVE_BATCH;
+	_config->archive_sec = QUEUE_ARCHIVE_SEC;
 
 	return _config;
 }
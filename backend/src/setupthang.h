@@ -25,6 +25,38 @@ typedef struct {
 
 	size_t maxnum_rulerunner_threads;	// Max num of rule runner threads
 	size_t maxnum_outqueue_threads;		// Max num of outgoing message queue threads
+	size_t minnum_rulerunner_threads;	// Min num of rule runner threads the boss cuts back to
+	size_t minnum_outqueue_threads;		// Min num of outgoing message queue threads the boss cuts back to
+
+	long pooljobs_rulerunner;		// Jobs per pooled rule runner worker (0 = no pool)
+	long pooljobs_outqueue;			// Jobs per pooled outgoing message queue worker (0 = no pool)
+
+	long mail_dedup_sec;			// Secs incoming mail is remembered per void to drop repeats (0 = off)
+
+	int queue_backend;			// Where queues are kept, QUEUE_BACKEND_* (see msgqueue.h)
+	char *queue_log_dir;			// Where the log queue backend keeps its files (see qlog.c)
+
+	int reuse_js_runtime;			// 1 = rule runner workers keep their SpiderMonkey runtime between rules
+	long js_max_cpu_msec;			// Most CPU millisecs a rule may use (see jsbudget.c)
+	long js_max_wall_msec;			// Most millisecs a rule may take
+	long js_max_heap_bytes;			// Most GC heap a rule may grow by
+	int js_engine_options;			// Engine options of logic that doesn't set its own (see jsoptions.h)
+	long js_profile_sample;			// 1 in this many rule runs is profiled, 0 = off (see jsprofile.c)
+	long js_profile_keep_days;		// Days rule profiles are kept, 0 = for ever
+
+	int shard_rulerunner;			// 1 = rule runners share the incoming queue by void (see qshard.c)
+	int shard_outqueue;			// 1 = message deliverers share the outgoing queue by recipient
+
+	long outqueue_void_high_water;		// Pending outgoing entries a void may have (0 = no mark, see qpressure.c)
+	long outqueue_global_high_water;	// Pending outgoing entries all voids may have (0 = no mark)
+	long outqueue_void_hard_cap;		// Pending outgoing entries a void may have before its rules' mail
+						//  is refused (0 = no cap)
+
+	long archive_batch;			// Max DONE queue entries archived in one go (0 = no archiving)
+	long archive_sec;			// Secs between archive runs
+	int archive_backfill;			// 1 = archive all DONE queue entries then exit (cmd line --backfill-archive)
+	int profile_top;			// > 0 = print this many of the most expensive voids and natives then
+						//  exit (cmd line --profile-top)
 } SCONFIG;
 
 /* Globals */